@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -25,6 +26,7 @@
 #include "cache.pb.h"
 #include "hash.h"
 #include "logging.h"
+#include "platform.h"
 #ifdef __APPLE__
 #include "smalloc.h"
 #endif
@@ -66,6 +68,19 @@ int Ack2Errno(cvmfs::EnumStatus status_code) {
   }
 }
 
+
+/**
+ * The shared memory data path requires passing a file descriptor, which only
+ * works on unix domain sockets.
+ */
+bool IsUnixSocket(int fd) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  int retval =
+    getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len);
+  return (retval == 0) && (addr.ss_family == AF_UNIX);
+}
+
 }  // anonymous namespace
 
 const shash::Any ExternalCacheManager::kInvalidHandle;
@@ -88,6 +103,44 @@ bool ExternalCacheManager::AcquireQuotaManager(QuotaManager *quota_mgr) {
 }
 
 
+/**
+ * Blocks until a slot in the shared memory region is available.  Returns the
+ * offset of the slot in the region.
+ */
+uint64_t ExternalCacheManager::AcquireShmSlot() {
+  MutexLockGuard guard(lock_shm_slots_);
+  while (shm_free_slots_.empty())
+    pthread_cond_wait(&cond_shm_slots_, &lock_shm_slots_);
+  uint64_t offset = shm_free_slots_.back();
+  shm_free_slots_.pop_back();
+  return offset;
+}
+
+
+/**
+ * Maps the shared memory region that the plugin accepted during the handshake.
+ * Without the mapping, data is transferred as attachments.
+ */
+bool ExternalCacheManager::AttachShm(int fd_shm) {
+  void *region = mmap(NULL, kShmRegionSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd_shm, 0);
+  if (region == MAP_FAILED) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+             "failed to map shared memory region for cache plugin (%d)",
+             errno);
+    return false;
+  }
+  shm_region_ = reinterpret_cast<unsigned char *>(region);
+  shm_size_ = kShmRegionSize;
+  const unsigned num_slots = shm_size_ / max_object_size_;
+  for (unsigned i = 0; i < num_slots; ++i)
+    shm_free_slots_.push_back(static_cast<uint64_t>(i) * max_object_size_);
+  LogCvmfs(kLogCache, kLogDebug,
+           "using shared memory data path with %u slots", num_slots);
+  return true;
+}
+
+
 void ExternalCacheManager::CallRemotely(ExternalCacheManager::RpcJob *rpc_job) {
   if (!spawned_) {
     transport_.SendFrame(rpc_job->frame_send());
@@ -108,19 +161,36 @@ void ExternalCacheManager::CallRemotely(ExternalCacheManager::RpcJob *rpc_job) {
     } while (again);
   } else {
     Signal signal;
-    {
-      MutexLockGuard guard(lock_inflight_rpcs_);
-      inflight_rpcs_.push_back(RpcInFlight(rpc_job, &signal));
-    }
-    {
-      MutexLockGuard guard(lock_send_fd_);
-      transport_.SendFrame(rpc_job->frame_send());
-    }
+    CallRemotelyAsync(rpc_job, &signal);
     signal.Wait();
   }
 }
 
 
+/**
+ * Sends the request and returns without waiting for the reply.  The signal
+ * fires once the reply arrived.  Before the reader thread is spawned, the call
+ * is synchronous and the signal fires immediately.
+ */
+void ExternalCacheManager::CallRemotelyAsync(
+  ExternalCacheManager::RpcJob *rpc_job,
+  Signal *signal)
+{
+  if (!spawned_) {
+    CallRemotely(rpc_job);
+    signal->Wakeup();
+    return;
+  }
+
+  {
+    MutexLockGuard guard(lock_inflight_rpcs_);
+    inflight_rpcs_.push_back(RpcInFlight(rpc_job, signal));
+  }
+  MutexLockGuard guard(lock_send_fd_);
+  transport_.SendFrame(rpc_job->frame_send());
+}
+
+
 int ExternalCacheManager::ChangeRefcount(const shash::Any &id, int change_by) {
   cvmfs::MsgHash object_id;
   transport_.FillMsgHash(id, &object_id);
@@ -201,19 +271,32 @@ ExternalCacheManager *ExternalCacheManager::Create(
     new ExternalCacheManager(fd_connection, max_open_fds));
   assert(cache_mgr.IsValid());
 
+  int fd_shm = -1;
+  if (IsUnixSocket(fd_connection))
+    fd_shm = platform_memfd("cvmfs-cache-shm", kShmRegionSize);
+
   cvmfs::MsgHandshake msg_handshake;
   msg_handshake.set_protocol_version(kPbProtocolVersion);
   msg_handshake.set_name(ident);
   CacheTransport::Frame frame_send(&msg_handshake);
+  if (fd_shm >= 0) {
+    msg_handshake.set_flags(cvmfs::SESSION_FLAG_SHM);
+    msg_handshake.set_shm_size(kShmRegionSize);
+    frame_send.set_passed_fd(fd_shm);
+  }
   cache_mgr->transport_.SendFrame(&frame_send);
 
   CacheTransport::Frame frame_recv;
   bool retval = cache_mgr->transport_.RecvFrame(&frame_recv);
-  if (!retval)
+  if (!retval) {
+    if (fd_shm >= 0) close(fd_shm);
     return NULL;
+  }
   google::protobuf::MessageLite *msg_typed = frame_recv.GetMsgTyped();
-  if (msg_typed->GetTypeName() != "cvmfs.MsgHandshakeAck")
+  if (msg_typed->GetTypeName() != "cvmfs.MsgHandshakeAck") {
+    if (fd_shm >= 0) close(fd_shm);
     return NULL;
+  }
   cvmfs::MsgHandshakeAck *msg_ack =
     reinterpret_cast<cvmfs::MsgHandshakeAck *>(msg_typed);
   cache_mgr->session_id_ = msg_ack->session_id();
@@ -224,14 +307,21 @@ ExternalCacheManager *ExternalCacheManager::Create(
     LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
              "external cache manager object size too large (%u)",
              cache_mgr->max_object_size_);
+    if (fd_shm >= 0) close(fd_shm);
     return NULL;
   }
   if (cache_mgr->max_object_size_ < kMinSupportedObjectSize) {
     LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
              "external cache manager object size too small (%u)",
              cache_mgr->max_object_size_);
+    if (fd_shm >= 0) close(fd_shm);
     return NULL;
   }
+  if (fd_shm >= 0) {
+    if (msg_ack->has_flags() && (msg_ack->flags() & cvmfs::SESSION_FLAG_SHM))
+      cache_mgr->AttachShm(fd_shm);
+    close(fd_shm);
+  }
   return cache_mgr.Release();
 }
 
@@ -359,6 +449,9 @@ ExternalCacheManager::ExternalCacheManager(
   , spawned_(false)
   , terminated_(false)
   , capabilities_(cvmfs::CAP_NONE)
+  , shm_region_(NULL)
+  , shm_size_(0)
+  , readahead_clock_(0)
 {
   int retval = pthread_rwlock_init(&rwlock_fd_table_, NULL);
   assert(retval == 0);
@@ -366,6 +459,12 @@ ExternalCacheManager::ExternalCacheManager(
   assert(retval == 0);
   retval = pthread_mutex_init(&lock_inflight_rpcs_, NULL);
   assert(retval == 0);
+  retval = pthread_mutex_init(&lock_shm_slots_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_shm_slots_, NULL);
+  assert(retval == 0);
+  retval = pthread_mutex_init(&lock_readahead_, NULL);
+  assert(retval == 0);
   atomic_init64(&next_request_id_);
 }
 
@@ -383,47 +482,96 @@ ExternalCacheManager::~ExternalCacheManager() {
   if (spawned_)
     pthread_join(thread_read_, NULL);
   close(transport_.fd_connection());
+  for (unsigned i = 0; i < readahead_buffers_.size(); ++i) {
+    delete readahead_buffers_[i].pending;
+    free(readahead_buffers_[i].data);
+  }
+  if (shm_region_ != NULL)
+    munmap(shm_region_, shm_size_);
   pthread_rwlock_destroy(&rwlock_fd_table_);
   pthread_mutex_destroy(&lock_send_fd_);
   pthread_mutex_destroy(&lock_inflight_rpcs_);
+  pthread_mutex_destroy(&lock_shm_slots_);
+  pthread_cond_destroy(&cond_shm_slots_);
+  pthread_mutex_destroy(&lock_readahead_);
 }
 
 
+/**
+ * Sends the buffered data of the transaction as a store part.  Parts that do
+ * not commit the object are sent without waiting for the reply; the replies
+ * are collected when kMaxPendingParts parts are outstanding or before the
+ * last part is sent.  Errors of pending parts are reported by a later call.
+ */
 int ExternalCacheManager::Flush(bool do_commit, Transaction *transaction) {
   if (transaction->committed)
     return 0;
   LogCvmfs(kLogCache, kLogDebug, "flushing %u bytes for %s",
            transaction->buf_pos, transaction->id.ToString().c_str());
-  cvmfs::MsgHash object_id;
-  transport_.FillMsgHash(transaction->id, &object_id);
-  cvmfs::MsgStoreReq msg_store;
-  msg_store.set_session_id(session_id_);
-  msg_store.set_req_id(transaction->transaction_id);
-  msg_store.set_allocated_object_id(&object_id);
-  msg_store.set_part_nr((transaction->size / max_object_size_) + 1);
-  msg_store.set_expected_size(transaction->expected_size);
-  msg_store.set_last_part(do_commit);
+
+  const bool is_async = spawned_ && !do_commit;
+  int retval = 0;
+  if (!is_async) {
+    retval = WaitForPendingParts(transaction);
+  } else if (transaction->num_pending_parts == kMaxPendingParts) {
+    PendingStore *oldest = transaction->pending_parts[0];
+    for (unsigned i = 1; i < kMaxPendingParts; ++i)
+      transaction->pending_parts[i - 1] = transaction->pending_parts[i];
+    transaction->num_pending_parts--;
+    retval = WaitForPart(oldest, transaction);
+  }
+  if (retval != 0)
+    return retval;
+
+  PendingStore *pending_store = new PendingStore();
+  cvmfs::MsgStoreReq *msg_store = &pending_store->msg_store;
+  msg_store->set_session_id(session_id_);
+  msg_store->set_req_id(transaction->transaction_id);
+  transport_.FillMsgHash(transaction->id, msg_store->mutable_object_id());
+  msg_store->set_part_nr((transaction->size / max_object_size_) + 1);
+  msg_store->set_expected_size(transaction->expected_size);
+  msg_store->set_last_part(do_commit);
 
   if (transaction->object_info_modified) {
     cvmfs::EnumObjectType object_type;
     transport_.FillObjectType(transaction->object_info.type, &object_type);
-    msg_store.set_object_type(object_type);
-    msg_store.set_description(transaction->object_info.description);
+    msg_store->set_object_type(object_type);
+    msg_store->set_description(transaction->object_info.description);
   }
 
-  RpcJob rpc_job(&msg_store);
-  rpc_job.set_attachment_send(transaction->buffer, transaction->buf_pos);
+  pending_store->rpc_job = new RpcJob(msg_store);
+  // Pending parts must not wait for a shared memory slot, see DoPread()
+  if ((shm_region_ != NULL) && (transaction->buf_pos > 0)) {
+    if (is_async) {
+      pending_store->uses_shm = TryAcquireShmSlot(&pending_store->shm_offset);
+    } else {
+      pending_store->shm_offset = AcquireShmSlot();
+      pending_store->uses_shm = true;
+    }
+  }
+  if (pending_store->uses_shm) {
+    memcpy(shm_region_ + pending_store->shm_offset, transaction->buffer,
+           transaction->buf_pos);
+    msg_store->set_shm_offset(pending_store->shm_offset);
+    msg_store->set_shm_size(transaction->buf_pos);
+  } else {
+    // The attachment is written to the socket before the call returns, so
+    // the transaction buffer can be reused right away
+    pending_store->rpc_job->set_attachment_send(transaction->buffer,
+                                                transaction->buf_pos);
+  }
   // TODO(jblomer): allow for out of order chunk upload
-  CallRemotely(&rpc_job);
-  msg_store.release_object_id();
+  CallRemotelyAsync(pending_store->rpc_job, &pending_store->signal);
 
-  cvmfs::MsgStoreReply *msg_reply = rpc_job.msg_store_reply();
-  if (msg_reply->status() == cvmfs::STATUS_OK) {
-    transaction->flushed = true;
-    if (do_commit)
-      transaction->committed = true;
+  if (is_async) {
+    transaction->pending_parts[transaction->num_pending_parts++] =
+      pending_store;
+    return 0;
   }
-  return Ack2Errno(msg_reply->status());
+  retval = WaitForPart(pending_store, transaction);
+  if ((retval == 0) && do_commit)
+    transaction->committed = true;
+  return retval;
 }
 
 
@@ -569,35 +717,119 @@ int64_t ExternalCacheManager::Pread(
   if (id == kInvalidHandle)
     return -EBADF;
 
+  int64_t result = ReadFromReadahead(id, buf, size, offset);
+  if (result >= 0) {
+    if (static_cast<uint64_t>(result) == size)
+      StartReadahead(id, offset + size);
+    return result;
+  }
+
+  result = DoPread(id, buf, size, offset);
+  // Reading from the beginning indicates a sequential reader
+  if ((offset == 0) && (result > 0) && (static_cast<uint64_t>(result) == size))
+    StartReadahead(id, size);
+  return result;
+}
+
+
+/**
+ * Reads from the object in batches of max_object_size_.  Up to
+ * kMaxPipelinedReads batches are in flight at the same time.
+ */
+int64_t ExternalCacheManager::DoPread(
+  const shash::Any &id,
+  void *buf,
+  uint64_t size,
+  uint64_t offset)
+{
+  if (size == 0)
+    return 0;
   cvmfs::MsgHash object_id;
   transport_.FillMsgHash(id, &object_id);
+
+  const uint64_t num_batches = (size + max_object_size_ - 1) / max_object_size_;
+  unsigned window = spawned_
+    ? std::min(num_batches, static_cast<uint64_t>(kMaxPipelinedReads))
+    : 1;
+  // Only the first shared memory slot is waited for, further slots are used
+  // if available.  Otherwise concurrent readers could deadlock.
+  vector<uint64_t> shm_slots;
+  if (shm_region_ != NULL) {
+    shm_slots.push_back(AcquireShmSlot());
+    uint64_t shm_offset;
+    while ((shm_slots.size() < window) && TryAcquireShmSlot(&shm_offset))
+      shm_slots.push_back(shm_offset);
+    window = shm_slots.size();
+  }
+  vector<uint64_t> free_shm_slots(shm_slots);
+
+  int64_t result = size;
+  // After an error or a short read, no further batches are requested but the
+  // replies to the batches in flight are still collected
+  bool done = false;
   uint64_t nbytes = 0;
-  while (nbytes < size) {
-    uint64_t batch_size =
-      std::min(size - nbytes, static_cast<uint64_t>(max_object_size_));
-    cvmfs::MsgReadReq msg_read;
-    msg_read.set_session_id(session_id_);
-    msg_read.set_req_id(NextRequestId());
-    msg_read.set_allocated_object_id(&object_id);
-    msg_read.set_offset(offset + nbytes);
-    msg_read.set_size(batch_size);
-    RpcJob rpc_job(&msg_read);
-    rpc_job.set_attachment_recv(reinterpret_cast<char *>(buf) + nbytes,
-                                batch_size);
-    CallRemotely(&rpc_job);
-    msg_read.release_object_id();
-
-    cvmfs::MsgReadReply *msg_reply = rpc_job.msg_read_reply();
-    if (msg_reply->status() == cvmfs::STATUS_OK) {
-      nbytes += rpc_job.frame_recv()->att_size();
-      // Fuse sends in rounded up buffers, so short reads are expected
-      if (rpc_job.frame_recv()->att_size() < batch_size)
-        return nbytes;
-    } else {
-      return Ack2Errno(msg_reply->status());
+  uint64_t next_batch = 0;
+  vector<PendingRead *> reads_inflight;
+  while (true) {
+    while (!done && (next_batch < num_batches) &&
+           (reads_inflight.size() < window))
+    {
+      const uint64_t pos = next_batch * max_object_size_;
+      PendingRead *pending_read = new PendingRead(
+        session_id_, NextRequestId(), object_id, offset + pos,
+        std::min(size - pos, static_cast<uint64_t>(max_object_size_)));
+      if (!free_shm_slots.empty()) {
+        pending_read->uses_shm = true;
+        pending_read->shm_offset = free_shm_slots.back();
+        free_shm_slots.pop_back();
+        pending_read->msg_read.set_shm_offset(pending_read->shm_offset);
+      } else {
+        pending_read->rpc_job->set_attachment_recv(
+          reinterpret_cast<char *>(buf) + pos, pending_read->size);
+      }
+      CallRemotelyAsync(pending_read->rpc_job, &pending_read->signal);
+      reads_inflight.push_back(pending_read);
+      next_batch++;
+    }
+    if (reads_inflight.empty())
+      break;
+
+    PendingRead *pending_read = reads_inflight[0];
+    reads_inflight.erase(reads_inflight.begin());
+    pending_read->signal.Wait();
+    if (!done) {
+      cvmfs::MsgReadReply *msg_reply = pending_read->rpc_job->msg_read_reply();
+      uint32_t batch_received = pending_read->rpc_job->frame_recv()->att_size();
+      if (msg_reply->status() != cvmfs::STATUS_OK) {
+        result = Ack2Errno(msg_reply->status());
+        done = true;
+      } else if (pending_read->uses_shm) {
+        batch_received = msg_reply->has_shm_size() ? msg_reply->shm_size() : 0;
+        if (batch_received > pending_read->size) {
+          result = -EIO;
+          done = true;
+        } else {
+          memcpy(reinterpret_cast<char *>(buf) + nbytes,
+                 shm_region_ + pending_read->shm_offset, batch_received);
+        }
+      }
+      if (!done) {
+        nbytes += batch_received;
+        // Fuse sends in rounded up buffers, so short reads are expected
+        if (batch_received < pending_read->size) {
+          result = nbytes;
+          done = true;
+        }
+      }
     }
+    if (pending_read->uses_shm)
+      free_shm_slots.push_back(pending_read->shm_offset);
+    delete pending_read;
   }
-  return size;
+
+  for (unsigned i = 0; i < shm_slots.size(); ++i)
+    ReleaseShmSlot(shm_slots[i]);
+  return result;
 }
 
 
@@ -605,13 +837,100 @@ int ExternalCacheManager::Readahead(int fd) {
   shash::Any id = GetHandle(fd);
   if (id == kInvalidHandle)
     return -EBADF;
-  // No-op
+  StartReadahead(id, 0);
   return 0;
 }
 
 
+/**
+ * Serves the read from a read-ahead buffer if the buffer covers the requested
+ * range or the end of the object.  Returns -1 if there is no such buffer.
+ */
+int64_t ExternalCacheManager::ReadFromReadahead(
+  const shash::Any &id,
+  void *buf,
+  uint64_t size,
+  uint64_t offset)
+{
+  if (readahead_buffers_.empty())
+    return -1;
+
+  ReadaheadBuffer *readahead = NULL;
+  {
+    MutexLockGuard guard(lock_readahead_);
+    for (unsigned i = 0; i < readahead_buffers_.size(); ++i) {
+      ReadaheadBuffer *candidate = &readahead_buffers_[i];
+      if ((candidate->pending != NULL) && (candidate->id == id) &&
+          (offset >= candidate->offset) &&
+          (offset < candidate->offset + candidate->pending->size))
+      {
+        readahead = candidate;
+        readahead->num_readers++;
+        break;
+      }
+    }
+  }
+  if (readahead == NULL)
+    return -1;
+
+  readahead->pending->signal.Wait();
+
+  MutexLockGuard guard(lock_readahead_);
+  FinishReadahead(readahead);
+  readahead->num_readers--;
+  readahead->last_used = ++readahead_clock_;
+  if (readahead->status != 0)
+    return -1;
+  const uint64_t end = readahead->offset + readahead->size;
+  if (offset > end)
+    return -1;
+  const bool is_eof = readahead->size < readahead->pending->size;
+  uint64_t nbytes = std::min(size, end - offset);
+  if ((nbytes < size) && !is_eof)
+    return -1;
+  memcpy(buf, readahead->data + (offset - readahead->offset), nbytes);
+  return nbytes;
+}
+
+
+/**
+ * Collects the reply of a read-ahead request once it arrived, whether or not
+ * anybody reads the buffer.  Ranges at or beyond the end of the object and
+ * failed requests hold no data, their buffers are released right away unless
+ * they are being read.  Must be called with lock_readahead_ held.
+ */
+void ExternalCacheManager::FinishReadahead(ReadaheadBuffer *readahead) {
+  if ((readahead->pending == NULL) || readahead->completed ||
+      readahead->pending->signal.IsSleeping())
+  {
+    return;
+  }
+  cvmfs::MsgReadReply *msg_reply =
+    readahead->pending->rpc_job->msg_read_reply();
+  readahead->status = Ack2Errno(msg_reply->status());
+  readahead->size = readahead->pending->rpc_job->frame_recv()->att_size();
+  readahead->completed = true;
+  if ((readahead->num_readers == 0) &&
+      ((readahead->status != 0) || (readahead->size == 0)))
+  {
+    delete readahead->pending;
+    readahead->pending = NULL;
+    readahead->last_used = 0;
+  }
+}
+
+
+void ExternalCacheManager::ReleaseShmSlot(uint64_t offset) {
+  MutexLockGuard guard(lock_shm_slots_);
+  shm_free_slots_.push_back(offset);
+  pthread_cond_signal(&cond_shm_slots_);
+}
+
+
 int ExternalCacheManager::Reset(void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
+  // Errors of pending parts don't matter, the transaction is aborted anyway
+  WaitForPendingParts(transaction);
   transaction->buf_pos = 0;
   transaction->size = 0;
   transaction->open_fds = 0;
@@ -638,6 +957,11 @@ int ExternalCacheManager::Reset(void *txn) {
 
 
 void ExternalCacheManager::Spawn() {
+  readahead_buffers_.resize(kNumReadaheadBuffers);
+  for (unsigned i = 0; i < kNumReadaheadBuffers; ++i) {
+    readahead_buffers_[i].data =
+      reinterpret_cast<unsigned char *>(smalloc(max_object_size_));
+  }
   int retval = pthread_create(&thread_read_, NULL, MainRead, this);
   assert(retval == 0);
   spawned_ = true;
@@ -707,6 +1031,73 @@ bool ExternalCacheManager::SpawnPlugin(const vector<string> &cmd_line) {
 }
 
 
+/**
+ * Requests the kReadaheadDepth ranges following offset into read-ahead buffers
+ * unless they are already buffered or known to be beyond the end of the
+ * object.  Buffers that are in flight or being read are not recycled.
+ */
+void ExternalCacheManager::StartReadahead(
+  const shash::Any &id,
+  uint64_t offset)
+{
+  if (readahead_buffers_.empty())
+    return;
+
+  for (unsigned d = 0; d < kReadaheadDepth; ++d) {
+    const uint64_t pos = offset + static_cast<uint64_t>(d) * max_object_size_;
+    PendingRead *pending_read = NULL;
+    {
+      MutexLockGuard guard(lock_readahead_);
+      ReadaheadBuffer *victim = NULL;
+      bool is_buffered = false;
+      for (unsigned i = 0; i < readahead_buffers_.size(); ++i) {
+        ReadaheadBuffer *candidate = &readahead_buffers_[i];
+        FinishReadahead(candidate);
+        if ((candidate->pending != NULL) && (candidate->id == id)) {
+          const bool is_eof = candidate->completed &&
+            (candidate->size < candidate->pending->size);
+          if ((pos >= candidate->offset) &&
+              ((pos < candidate->offset + candidate->pending->size) ||
+               is_eof))
+          {
+            is_buffered = true;
+            break;
+          }
+        }
+        const bool is_idle = (candidate->num_readers == 0) &&
+          ((candidate->pending == NULL) || candidate->completed);
+        if (is_idle &&
+            ((victim == NULL) || (candidate->last_used < victim->last_used)))
+        {
+          victim = candidate;
+        }
+      }
+      if (is_buffered)
+        continue;
+      if (victim == NULL)
+        return;
+
+      cvmfs::MsgHash object_id;
+      transport_.FillMsgHash(id, &object_id);
+      delete victim->pending;
+      pending_read = new PendingRead(session_id_, NextRequestId(), object_id,
+                                     pos, max_object_size_);
+      pending_read->rpc_job->set_attachment_recv(victim->data,
+                                                 max_object_size_);
+      victim->id = id;
+      victim->offset = pos;
+      victim->pending = pending_read;
+      victim->completed = false;
+      victim->status = 0;
+      victim->size = 0;
+      victim->last_used = ++readahead_clock_;
+    }
+    // The buffer is not recycled before the request completed
+    CallRemotelyAsync(pending_read->rpc_job, &pending_read->signal);
+  }
+}
+
+
 int ExternalCacheManager::StartTxn(
   const shash::Any &id,
   uint64_t size,
@@ -726,6 +1117,51 @@ int ExternalCacheManager::StartTxn(
 }
 
 
+bool ExternalCacheManager::TryAcquireShmSlot(uint64_t *offset) {
+  MutexLockGuard guard(lock_shm_slots_);
+  if (shm_free_slots_.empty())
+    return false;
+  *offset = shm_free_slots_.back();
+  shm_free_slots_.pop_back();
+  return true;
+}
+
+
+/**
+ * Collects the reply of a store part and releases its resources.
+ */
+int ExternalCacheManager::WaitForPart(
+  PendingStore *pending_store,
+  Transaction *transaction)
+{
+  pending_store->signal.Wait();
+  cvmfs::MsgStoreReply *msg_reply = pending_store->rpc_job->msg_store_reply();
+  if (msg_reply->status() == cvmfs::STATUS_OK)
+    transaction->flushed = true;
+  int result = Ack2Errno(msg_reply->status());
+  if (pending_store->uses_shm)
+    ReleaseShmSlot(pending_store->shm_offset);
+  delete pending_store;
+  return result;
+}
+
+
+/**
+ * Collects the replies of all pending parts of the transaction.  Returns the
+ * first error, if any.
+ */
+int ExternalCacheManager::WaitForPendingParts(Transaction *transaction) {
+  int result = 0;
+  for (unsigned i = 0; i < transaction->num_pending_parts; ++i) {
+    int retval = WaitForPart(transaction->pending_parts[i], transaction);
+    if (result == 0)
+      result = retval;
+  }
+  transaction->num_pending_parts = 0;
+  return result;
+}
+
+
 int64_t ExternalCacheManager::Write(const void *buf, uint64_t size, void *txn) {
   Transaction *transaction = reinterpret_cast<Transaction *>(txn);
   assert(!transaction->committed);
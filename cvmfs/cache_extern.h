@@ -17,6 +17,7 @@
 #include "cache.h"
 #include "cache_transport.h"
 #include "fd_table.h"
+#include "gtest/gtest_prod.h"
 #include "hash.h"
 #include "quota.h"
 #include "util/single_copy.h"
@@ -25,9 +26,10 @@
 
 class ExternalCacheManager : public CacheManager {
   friend class ExternalQuotaManager;
+  FRIEND_TEST(T_ExternalCacheManager, ReadaheadRecycling);
 
  public:
-  static const unsigned kPbProtocolVersion = 1;
+  static const unsigned kPbProtocolVersion = 2;
   /**
    * Used for race-free startup of an external cache plugin.
    */
@@ -90,6 +92,7 @@ class ExternalCacheManager : public CacheManager {
   int64_t session_id() const { return session_id_; }
   uint32_t max_object_size() const { return max_object_size_; }
   uint64_t capabilities() const { return capabilities_; }
+  bool has_shm() const { return shm_region_ != NULL; }
 
  protected:
   virtual void *DoSaveState();
@@ -111,6 +114,33 @@ class ExternalCacheManager : public CacheManager {
    * Statistically, at least half of our objects should not be further chunked.
    */
   static const unsigned kMinSupportedObjectSize = 4 * 1024;
+  /**
+   * Size of the shared memory region offered to plugins connected through a
+   * unix domain socket.  It is divided into slots of max_object_size_ bytes,
+   * i.e. there are at least 16 slots.
+   */
+  static const unsigned kShmRegionSize = 8 * 1024 * 1024;
+  /**
+   * Maximum number of read requests that a single Pread() keeps in flight
+   */
+  static const unsigned kMaxPipelinedReads = 8;
+  /**
+   * Maximum number of store parts of a transaction that are sent before the
+   * reply to the oldest part is collected
+   */
+  static const unsigned kMaxPendingParts = 4;
+  /**
+   * Number of buffers for ranges that are read ahead, shared by all open
+   * objects.  Every buffer has max_object_size_ bytes.
+   */
+  static const unsigned kNumReadaheadBuffers = 8;
+  /**
+   * Number of subsequent ranges of max_object_size_ bytes that are requested
+   * ahead of a sequential reader
+   */
+  static const unsigned kReadaheadDepth = 2;
+
+  struct PendingStore;
 
   struct Transaction {
     explicit Transaction(const shash::Any &id)
@@ -123,6 +153,7 @@ class ExternalCacheManager : public CacheManager {
       , flushed(false)
       , committed(false)
       , object_info_modified(false)
+      , num_pending_parts(0)
       , id(id)
     { }
 
@@ -139,6 +170,12 @@ class ExternalCacheManager : public CacheManager {
     bool flushed;
     bool committed;
     bool object_info_modified;
+    /**
+     * Parts that have been sent but whose reply has not yet been collected,
+     * oldest first
+     */
+    PendingStore *pending_parts[kMaxPendingParts];
+    unsigned num_pending_parts;
     uint64_t transaction_id;
     shash::Any id;
   };  // class Transaction
@@ -244,6 +281,76 @@ class ExternalCacheManager : public CacheManager {
     CacheTransport::Frame frame_recv_;
   };  // class RpcJob
 
+  /**
+   * A read request that is sent without waiting for the reply, so that several
+   * requests can be in flight on the connection.  The reply can be inspected
+   * once the signal fired.
+   */
+  struct PendingRead : ::SingleCopy {
+    PendingRead(int64_t session_id,
+                uint64_t req_id,
+                const cvmfs::MsgHash &object_id,
+                uint64_t offset,
+                uint32_t size)
+      : rpc_job(NULL), size(size), shm_offset(0), uses_shm(false)
+    {
+      msg_read.set_session_id(session_id);
+      msg_read.set_req_id(req_id);
+      msg_read.mutable_object_id()->CopyFrom(object_id);
+      msg_read.set_offset(offset);
+      msg_read.set_size(size);
+      rpc_job = new RpcJob(&msg_read);
+    }
+    ~PendingRead() { delete rpc_job; }
+
+    cvmfs::MsgReadReq msg_read;
+    RpcJob *rpc_job;
+    Signal signal;
+    uint32_t size;
+    uint64_t shm_offset;
+    bool uses_shm;
+  };
+
+  /**
+   * A part of a transaction that is sent without waiting for the reply.
+   */
+  struct PendingStore : ::SingleCopy {
+    PendingStore() : rpc_job(NULL), shm_offset(0), uses_shm(false) { }
+    ~PendingStore() { delete rpc_job; }
+
+    cvmfs::MsgStoreReq msg_store;
+    RpcJob *rpc_job;
+    Signal signal;
+    uint64_t shm_offset;
+    bool uses_shm;
+  };
+
+  /**
+   * Holds the reply to a read request for a range that follows a sequentially
+   * read range.  Buffers are recycled in LRU order.
+   */
+  struct ReadaheadBuffer {
+    ReadaheadBuffer()
+      : id(kInvalidHandle), offset(0), pending(NULL), completed(false)
+      , status(0), size(0), data(NULL), num_readers(0), last_used(0) { }
+
+    shash::Any id;
+    uint64_t offset;
+    /**
+     * The request in flight or the completed request, NULL if unused
+     */
+    PendingRead *pending;
+    bool completed;
+    int status;
+    /**
+     * Number of valid bytes once the request completed
+     */
+    uint32_t size;
+    unsigned char *data;
+    unsigned num_readers;
+    uint64_t last_used;
+  };
+
   struct RpcInFlight {
     RpcInFlight() : rpc_job(NULL), signal(NULL) { }
     RpcInFlight(RpcJob *r, Signal *s) : rpc_job(r), signal(s) { }
@@ -258,7 +365,24 @@ class ExternalCacheManager : public CacheManager {
 
   explicit ExternalCacheManager(int fd_connection, unsigned max_open_fds);
   int64_t NextRequestId() { return atomic_xadd64(&next_request_id_, 1); }
+  bool AttachShm(int fd_shm);
+  uint64_t AcquireShmSlot();
+  bool TryAcquireShmSlot(uint64_t *offset);
+  void ReleaseShmSlot(uint64_t offset);
+  int64_t DoPread(const shash::Any &id,
+                  void *buf,
+                  uint64_t size,
+                  uint64_t offset);
+  int64_t ReadFromReadahead(const shash::Any &id,
+                            void *buf,
+                            uint64_t size,
+                            uint64_t offset);
+  void StartReadahead(const shash::Any &id, uint64_t offset);
+  void FinishReadahead(ReadaheadBuffer *readahead);
+  int WaitForPart(PendingStore *pending_store, Transaction *transaction);
+  int WaitForPendingParts(Transaction *transaction);
   void CallRemotely(RpcJob *rpc_job);
+  void CallRemotelyAsync(RpcJob *rpc_job, Signal *signal);
   int ChangeRefcount(const shash::Any &id, int change_by);
   int DoOpen(const shash::Any &id);
   shash::Any GetHandle(int fd);
@@ -281,6 +405,28 @@ class ExternalCacheManager : public CacheManager {
   pthread_mutex_t lock_inflight_rpcs_;
   pthread_t thread_read_;
   uint64_t capabilities_;
+
+  /**
+   * Mapped shared memory region if the plugin agreed on the shared memory data
+   * path, NULL otherwise.
+   */
+  unsigned char *shm_region_;
+  uint64_t shm_size_;
+  /**
+   * Offsets of the slots in the shared memory region that are not used by an
+   * ongoing read or store request.
+   */
+  std::vector<uint64_t> shm_free_slots_;
+  pthread_mutex_t lock_shm_slots_;
+  pthread_cond_t cond_shm_slots_;
+
+  /**
+   * Allocated when the reader thread is spawned.  Read-ahead requires
+   * asynchronous replies.
+   */
+  std::vector<ReadaheadBuffer> readahead_buffers_;
+  uint64_t readahead_clock_;
+  pthread_mutex_t lock_readahead_;
 };  // class ExternalCacheManager
 
 
@@ -5,8 +5,8 @@
 #include "channel.h"
 
 #include <errno.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -22,6 +22,7 @@
 #include "util/pointer.h"
 #include "util/posix.h"
 #include "util/string.h"
+#include "util_concurrency.h"
 
 using namespace std;  // NOLINT
 
@@ -34,6 +35,42 @@ void CachePlugin::AskToDetach() {
 }
 
 
+/**
+ * Maps the shared memory region passed by a client.  The region must not be
+ * able to shrink underneath the mapping, otherwise accessing it can result in
+ * SIGBUS.  The file descriptor is closed by the caller.
+ */
+bool CachePlugin::AttachShm(int fd_con, int fd_shm, uint64_t size) {
+  if ((size == 0) || (size > kMaxShmSize))
+    return false;
+  platform_stat64 info;
+  if ((platform_fstat(fd_shm, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) < size))
+  {
+    LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
+             "shared memory region of client too small");
+    return false;
+  }
+  if (!platform_memfd_sealed(fd_shm)) {
+    LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
+             "shared memory region of client not sealed");
+    return false;
+  }
+  void *region =
+    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
+  if (region == MAP_FAILED) {
+    LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
+             "failed to map shared memory region of client (%d)", errno);
+    return false;
+  }
+  DetachShm(fd_con);
+  MutexLockGuard guard(lock_);
+  shm_regions_[fd_con] =
+    SharedMemory(reinterpret_cast<unsigned char *>(region), size);
+  return true;
+}
+
+
 CachePlugin::CachePlugin(uint64_t capabilities)
   : capabilities_(capabilities)
   , fd_socket_(-1)
@@ -42,7 +79,11 @@ CachePlugin::CachePlugin(uint64_t capabilities)
   , num_workers_(0)
   , max_object_size_(kDefaultMaxObjectSize)
   , num_inlimbo_clients_(0)
+  , fd_eventqueue_(-1)
+  , queue_ready_(kMaxQueuedConnections, kMaxQueuedConnections)
 {
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
   atomic_init64(&next_session_id_);
   atomic_init64(&next_txn_id_);
   atomic_init64(&next_lst_id_);
@@ -60,19 +101,144 @@ CachePlugin::~CachePlugin() {
     close(fd_socket_);
   if (fd_socket_lock_ >= 0)
     UnlockFile(fd_socket_lock_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Cleans up after connections that were closed by the client.  Runs in the I/O
+ * thread.  Returns true if the plugin should stop because all clients are
+ * gone.
+ */
+bool CachePlugin::CloseConnections() {
+  vector<int> closed_connections;
+  {
+    MutexLockGuard guard(lock_);
+    closed_connections.swap(closed_connections_);
+  }
+  for (unsigned i = 0; i < closed_connections.size(); ++i) {
+    int fd_con = closed_connections[i];
+    platform_eventqueue_del(fd_eventqueue_, fd_con);
+    DetachShm(fd_con);
+    close(fd_con);
+    connections_.erase(fd_con);
+  }
+
+  if ((getenv(CacheTransport::kEnvReadyNotifyFd) == NULL) ||
+      !connections_.empty())
+  {
+    return false;
+  }
+  MutexLockGuard guard(lock_);
+  if (num_inlimbo_clients_ > 0)
+    return false;
+  LogCvmfs(kLogCache, kLogSyslog,
+           "stopping cache plugin, no more active clients");
+  return true;
+}
+
+
+void CachePlugin::DetachShm(int fd_con) {
+  MutexLockGuard guard(lock_);
+  map<int, SharedMemory>::iterator iter = shm_regions_.find(fd_con);
+  if (iter == shm_regions_.end())
+    return;
+  munmap(iter->second.region, iter->second.size);
+  shm_regions_.erase(iter);
 }
 
 
+/**
+ * Hands over a connection with a pending request to the worker threads or
+ * processes the request right away if there are no worker threads.  Runs in
+ * the I/O thread.
+ */
+void CachePlugin::DispatchRequest(int fd_con) {
+  if (num_workers_ == 0) {
+    FinishRequest(fd_con, HandleRequest(fd_con));
+    return;
+  }
+  {
+    MutexLockGuard guard(lock_);
+    busy_connections_.insert(fd_con);
+  }
+  queue_ready_.Enqueue(fd_con);
+}
+
+
+/**
+ * Called after a request has been handled.  Re-enables the connection in the
+ * event queue or, if the connection was closed, leaves the cleanup to the I/O
+ * thread.
+ */
+void CachePlugin::FinishRequest(int fd_con, bool proceed) {
+  {
+    MutexLockGuard guard(lock_);
+    busy_connections_.erase(fd_con);
+    if ((detach_pending_.erase(fd_con) > 0) && proceed)
+      SendDetachRequest(fd_con);
+    if (!proceed)
+      closed_connections_.push_back(fd_con);
+  }
+
+  if (proceed) {
+    int retval = platform_eventqueue_rearm(fd_eventqueue_, fd_con);
+    assert(retval == 0);
+  } else {
+    char closed = kSignalClosed;
+    WritePipe(pipe_ctrl_[1], &closed, 1);
+  }
+}
+
+
+/**
+ * Returns NULL if the client has no shared memory region or if the requested
+ * range is outside the region.
+ */
+unsigned char *CachePlugin::GetShmBuffer(
+  int fd_con,
+  uint64_t offset,
+  uint32_t size)
+{
+  MutexLockGuard guard(lock_);
+  map<int, SharedMemory>::const_iterator iter = shm_regions_.find(fd_con);
+  if (iter == shm_regions_.end())
+    return NULL;
+  if ((offset > iter->second.size) || (size > iter->second.size - offset))
+    return NULL;
+  return iter->second.region + offset;
+}
+
+
+/**
+ * Takes ownership of fd_shm, which is -1 if the client did not pass a shared
+ * memory region.
+ */
 void CachePlugin::HandleHandshake(
   cvmfs::MsgHandshake *msg_req,
+  int fd_shm,
   CacheTransport *transport)
 {
+  uint32_t flags = cvmfs::SESSION_FLAG_NONE;
+  if (fd_shm >= 0) {
+    if (msg_req->has_flags() && (msg_req->flags() & cvmfs::SESSION_FLAG_SHM) &&
+        msg_req->has_shm_size() &&
+        AttachShm(transport->fd_connection(), fd_shm, msg_req->shm_size()))
+    {
+      flags |= cvmfs::SESSION_FLAG_SHM;
+    }
+    close(fd_shm);
+  }
+
   uint64_t session_id = NextSessionId();
-  if (msg_req->has_name()) {
-    sessions_[session_id] = msg_req->name();
-  } else {
-    sessions_[session_id] =
-      "anonymous client (" + StringifyInt(session_id) + ")";
+  {
+    MutexLockGuard guard(lock_);
+    if (msg_req->has_name()) {
+      sessions_[session_id] = msg_req->name();
+    } else {
+      sessions_[session_id] =
+        "anonymous client (" + StringifyInt(session_id) + ")";
+    }
   }
   cvmfs::MsgHandshakeAck msg_ack;
   CacheTransport::Frame frame_send(&msg_ack);
@@ -83,6 +249,8 @@ void CachePlugin::HandleHandshake(
   msg_ack.set_max_object_size(max_object_size_);
   msg_ack.set_session_id(session_id);
   msg_ack.set_capabilities(capabilities_);
+  if (flags != cvmfs::SESSION_FLAG_NONE)
+    msg_ack.set_flags(flags);
   transport->SendFrame(&frame_send);
 }
 
@@ -114,7 +282,14 @@ void CachePlugin::HandleIoctl(cvmfs::MsgIoctl *msg_req) {
   if (!msg_req->has_conncnt_change_by())
     return;
   int32_t conncnt_change_by = msg_req->conncnt_change_by();
-  if ((num_inlimbo_clients_ + conncnt_change_by) < 0) {
+  {
+    MutexLockGuard guard(lock_);
+    if ((num_inlimbo_clients_ + conncnt_change_by) >= 0)
+      num_inlimbo_clients_ += conncnt_change_by;
+    else
+      conncnt_change_by = 0;
+  }
+  if (conncnt_change_by == 0) {
     LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                     "invalid request to drop connection counter below zero");
     return;
@@ -124,7 +299,6 @@ void CachePlugin::HandleIoctl(cvmfs::MsgIoctl *msg_req) {
   } else {
     LogSessionInfo(msg_req->session_id(), "release session lock");
   }
-  num_inlimbo_clients_ += conncnt_change_by;
 }
 
 
@@ -231,6 +405,30 @@ void CachePlugin::HandleRead(
     return;
   }
   unsigned size = msg_req->size();
+
+  if (msg_req->has_shm_offset()) {
+    unsigned char *shm_buffer =
+      GetShmBuffer(transport->fd_connection(), msg_req->shm_offset(), size);
+    if (shm_buffer == NULL) {
+      LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
+                      "invalid shared memory reference received from client");
+      msg_reply.set_status(cvmfs::STATUS_MALFORMED);
+      transport->SendFrame(&frame_send);
+      return;
+    }
+    cvmfs::EnumStatus status =
+      Pread(object_id, msg_req->offset(), &size, shm_buffer);
+    msg_reply.set_status(status);
+    if (status == cvmfs::STATUS_OK) {
+      msg_reply.set_shm_size(size);
+    } else {
+      LogSessionError(msg_req->session_id(), status,
+                      "failed to read from object");
+    }
+    transport->SendFrame(&frame_send);
+    return;
+  }
+
 #ifdef __APPLE__
   unsigned char *buffer = reinterpret_cast<unsigned char *>(smalloc(size));
 #else
@@ -291,12 +489,15 @@ bool CachePlugin::HandleRequest(int fd_con) {
 
   google::protobuf::MessageLite *msg_typed = frame_recv.GetMsgTyped();
 
+  // File descriptors are only expected along with the handshake, others are
+  // closed together with the frame
   if (msg_typed->GetTypeName() == "cvmfs.MsgHandshake") {
     cvmfs::MsgHandshake *msg_req =
       reinterpret_cast<cvmfs::MsgHandshake *>(msg_typed);
-    HandleHandshake(msg_req, &transport);
+    HandleHandshake(msg_req, frame_recv.ReleasePassedFd(), &transport);
   } else if (msg_typed->GetTypeName() == "cvmfs.MsgQuit") {
     cvmfs::MsgQuit *msg_req = reinterpret_cast<cvmfs::MsgQuit *>(msg_typed);
+    MutexLockGuard guard(lock_);
     sessions_.erase(msg_req->session_id());
     return false;
   } else if (msg_typed->GetTypeName() == "cvmfs.MsgIoctl") {
@@ -373,7 +574,11 @@ void CachePlugin::HandleStoreAbort(
   msg_reply.set_part_nr(0);
   uint64_t txn_id;
   UniqueRequest uniq_req(msg_req->session_id(), msg_req->req_id());
-  bool retval = txn_ids_.Lookup(uniq_req, &txn_id);
+  bool retval;
+  {
+    MutexLockGuard guard(lock_);
+    retval = txn_ids_.Lookup(uniq_req, &txn_id);
+  }
   if (!retval) {
     LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                     "malformed transaction id received from client");
@@ -385,6 +590,7 @@ void CachePlugin::HandleStoreAbort(
       LogSessionError(msg_req->session_id(), status,
                       "failed to abort transaction");
     }
+    MutexLockGuard guard(lock_);
     txn_ids_.Erase(uniq_req);
   }
   transport->SendFrame(&frame_send);
@@ -400,11 +606,22 @@ void CachePlugin::HandleStore(
   CacheTransport::Frame frame_send(&msg_reply);
   msg_reply.set_req_id(msg_req->req_id());
   msg_reply.set_part_nr(msg_req->part_nr());
+
+  // The payload is either attached or in the shared memory region
+  unsigned char *data = reinterpret_cast<unsigned char *>(frame->attachment());
+  uint32_t data_size = frame->att_size();
+  if (msg_req->has_shm_offset()) {
+    data_size = msg_req->has_shm_size() ? msg_req->shm_size() : 0;
+    data = GetShmBuffer(transport->fd_connection(), msg_req->shm_offset(),
+                        data_size);
+  }
+
   shash::Any object_id;
   bool retval = transport->ParseMsgHash(msg_req->object_id(), &object_id);
   if ( !retval ||
-       (frame->att_size() > max_object_size_) ||
-       ((frame->att_size() < max_object_size_) && !msg_req->last_part()) )
+       (msg_req->has_shm_offset() && (data == NULL)) ||
+       (data_size > max_object_size_) ||
+       ((data_size < max_object_size_) && !msg_req->last_part()) )
   {
     LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                     "malformed hash or bad object size received from client");
@@ -417,7 +634,11 @@ void CachePlugin::HandleStore(
   uint64_t txn_id;
   cvmfs::EnumStatus status = cvmfs::STATUS_OK;
   if (msg_req->part_nr() == 1) {
-    if (txn_ids_.Contains(uniq_req)) {
+    {
+      MutexLockGuard guard(lock_);
+      retval = txn_ids_.Contains(uniq_req);
+    }
+    if (retval) {
       LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                       "invalid attempt to restart running transaction");
       msg_reply.set_status(cvmfs::STATUS_MALFORMED);
@@ -438,9 +659,13 @@ void CachePlugin::HandleStore(
       transport->SendFrame(&frame_send);
       return;
     }
+    MutexLockGuard guard(lock_);
     txn_ids_.Insert(uniq_req, txn_id);
   } else {
-    retval = txn_ids_.Lookup(uniq_req, &txn_id);
+    {
+      MutexLockGuard guard(lock_);
+      retval = txn_ids_.Lookup(uniq_req, &txn_id);
+    }
     if (!retval) {
       LogSessionError(msg_req->session_id(), cvmfs::STATUS_MALFORMED,
                       "invalid transaction received from client");
@@ -451,10 +676,8 @@ void CachePlugin::HandleStore(
   }
 
   // TODO(jblomer): check part number and send objects up in order
-  if (frame->att_size() > 0) {
-    status = WriteTxn(txn_id,
-                      reinterpret_cast<unsigned char *>(frame->attachment()),
-                      frame->att_size());
+  if (data_size > 0) {
+    status = WriteTxn(txn_id, data, data_size);
     if (status != cvmfs::STATUS_OK) {
       LogSessionError(msg_req->session_id(), status, "failure writing object");
       msg_reply.set_status(status);
@@ -469,6 +692,7 @@ void CachePlugin::HandleStore(
       LogSessionError(msg_req->session_id(), status,
                       "failure committing object");
     }
+    MutexLockGuard guard(lock_);
     txn_ids_.Erase(uniq_req);
   }
   msg_reply.set_status(status);
@@ -538,9 +762,12 @@ bool CachePlugin::Listen(const string &locator) {
 
 void CachePlugin::LogSessionInfo(uint64_t session_id, const string &msg) {
   string session_str("unidentified client (" + StringifyInt(session_id) + ")");
-  map<uint64_t, string>::const_iterator iter = sessions_.find(session_id);
-  if (iter != sessions_.end()) {
-    session_str = iter->second;
+  {
+    MutexLockGuard guard(lock_);
+    map<uint64_t, string>::const_iterator iter = sessions_.find(session_id);
+    if (iter != sessions_.end()) {
+      session_str = iter->second;
+    }
   }
   LogCvmfs(kLogCache, kLogDebug | kLogSyslog,
            "session '%s': %s", session_str.c_str(), msg.c_str());
@@ -553,9 +780,12 @@ void CachePlugin::LogSessionError(
   const std::string &msg)
 {
   string session_str("unidentified client (" + StringifyInt(session_id) + ")");
-  map<uint64_t, string>::const_iterator iter = sessions_.find(session_id);
-  if (iter != sessions_.end()) {
-    session_str = iter->second;
+  {
+    MutexLockGuard guard(lock_);
+    map<uint64_t, string>::const_iterator iter = sessions_.find(session_id);
+    if (iter != sessions_.end()) {
+      session_str = iter->second;
+    }
   }
   LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
            "session '%s': %s (%d - %s)",
@@ -569,23 +799,22 @@ void *CachePlugin::MainProcessRequests(void *data) {
 
   platform_sighandler_t save_sigpipe = signal(SIGPIPE, SIG_IGN);
 
-  vector<struct pollfd> watch_fds;
-  // Elements 0, 1: control pipe, socket fd
-  struct pollfd watch_ctrl;
-  watch_ctrl.fd = cache_plugin->pipe_ctrl_[0];
-  watch_ctrl.events = POLLIN | POLLPRI;
-  watch_fds.push_back(watch_ctrl);
-  struct pollfd watch_socket;
-  watch_socket.fd = cache_plugin->fd_socket_;
-  watch_socket.events = POLLIN | POLLPRI;
-  watch_fds.push_back(watch_socket);
+  // The control pipe and the socket stay armed, connections are armed for a
+  // single request at a time
+  int fd_eventqueue = cache_plugin->fd_eventqueue_;
+  int fd_ctrl = cache_plugin->pipe_ctrl_[0];
+  int fd_socket = cache_plugin->fd_socket_;
+  int retval = platform_eventqueue_add(fd_eventqueue, fd_ctrl, false);
+  assert(retval == 0);
+  retval = platform_eventqueue_add(fd_eventqueue, fd_socket, false);
+  assert(retval == 0);
 
+  int ready_fds[kMaxEvents];
   bool terminated = false;
   while (!terminated) {
-    for (unsigned i = 0; i < watch_fds.size(); ++i)
-      watch_fds[i].revents = 0;
-    int retval = poll(&watch_fds[0], watch_fds.size(), -1);
-    if (retval < 0) {
+    int num_ready =
+      platform_eventqueue_wait(fd_eventqueue, ready_fds, kMaxEvents);
+    if (num_ready < 0) {
       if (errno == EINTR)
         continue;
       LogCvmfs(kLogCache, kLogSyslogErr | kLogDebug,
@@ -593,77 +822,97 @@ void *CachePlugin::MainProcessRequests(void *data) {
       abort();
     }
 
-    // Termination or detach
-    if (watch_fds[0].revents) {
-      char signal;
-      ReadPipe(watch_fds[0].fd, &signal, 1);
-      if (signal == kSignalDetach) {
-        cache_plugin->SendDetachRequests();
-        continue;
-      }
-
-      // termination
-      if (watch_fds.size() > 2) {
-        LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
-                 "terminating external cache manager with pending connections");
-      }
-      break;
-    }
+    for (int i = 0; (i < num_ready) && !terminated; ++i) {
+      // Termination, detach, or closed connections
+      if (ready_fds[i] == fd_ctrl) {
+        char signal;
+        ReadPipe(fd_ctrl, &signal, 1);
+        if (signal == kSignalDetach) {
+          cache_plugin->SendDetachRequests();
+          continue;
+        }
+        if (signal == kSignalClosed) {
+          terminated = cache_plugin->CloseConnections();
+          continue;
+        }
 
-    // New connection
-    if (watch_fds[1].revents) {
-      struct sockaddr_un remote;
-      socklen_t socket_size = sizeof(remote);
-      int fd_con =
-        accept(watch_fds[1].fd, (struct sockaddr *)&remote, &socket_size);
-      if (fd_con < 0) {
-        LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
-                 "failed to establish connection (%d)", errno);
+        // termination
+        if (!cache_plugin->connections_.empty()) {
+          LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
+                   "terminating external cache manager with pending "
+                   "connections");
+        }
+        terminated = true;
         continue;
       }
-      struct pollfd watch_con;
-      watch_con.fd = fd_con;
-      watch_con.events = POLLIN | POLLPRI;
-      watch_fds.push_back(watch_con);
-      cache_plugin->connections_.insert(fd_con);
-    }
 
-    // New request
-    for (unsigned i = 2; i < watch_fds.size(); ) {
-      if (watch_fds[i].revents) {
-        bool proceed = cache_plugin->HandleRequest(watch_fds[i].fd);
-        if (!proceed) {
-          close(watch_fds[i].fd);
-          cache_plugin->connections_.erase(watch_fds[i].fd);
-          watch_fds.erase(watch_fds.begin() + i);
-          if ( (getenv(CacheTransport::kEnvReadyNotifyFd) != NULL) &&
-               (cache_plugin->connections_.empty()) &&
-               (cache_plugin->num_inlimbo_clients_ == 0) )
-          {
-            LogCvmfs(kLogCache, kLogSyslog,
-                     "stopping cache plugin, no more active clients");
-            terminated = true;
-            break;
-          }
-        } else {
-          i++;
+      // New connection
+      if (ready_fds[i] == fd_socket) {
+        struct sockaddr_un remote;
+        socklen_t socket_size = sizeof(remote);
+        int fd_con =
+          accept(fd_socket, (struct sockaddr *)&remote, &socket_size);
+        if (fd_con < 0) {
+          LogCvmfs(kLogCache, kLogSyslogWarn | kLogDebug,
+                   "failed to establish connection (%d)", errno);
+          continue;
         }
-      } else {
-        i++;
+        retval = platform_eventqueue_add(fd_eventqueue, fd_con, true);
+        assert(retval == 0);
+        cache_plugin->connections_.insert(fd_con);
+        continue;
       }
+
+      // New request
+      cache_plugin->DispatchRequest(ready_fds[i]);
     }
   }
 
-  // 0, 1 being closed by destructor
-  for (unsigned i = 2; i < watch_fds.size(); ++i)
-    close(watch_fds[i].fd);
+  // Let the workers finish their current request
+  for (unsigned i = 0; i < cache_plugin->threads_workers_.size(); ++i)
+    cache_plugin->queue_ready_.Enqueue(-1);
+  for (unsigned i = 0; i < cache_plugin->threads_workers_.size(); ++i)
+    pthread_join(cache_plugin->threads_workers_[i], NULL);
+  cache_plugin->threads_workers_.clear();
+
+  // control pipe and socket being closed by destructor
+  set<int>::const_iterator iter = cache_plugin->connections_.begin();
+  set<int>::const_iterator iter_end = cache_plugin->connections_.end();
+  for (; iter != iter_end; ++iter) {
+    cache_plugin->DetachShm(*iter);
+    close(*iter);
+  }
+  cache_plugin->connections_.clear();
+  cache_plugin->busy_connections_.clear();
+  cache_plugin->detach_pending_.clear();
+  cache_plugin->closed_connections_.clear();
   cache_plugin->txn_ids_.Clear();
+  close(fd_eventqueue);
+  cache_plugin->fd_eventqueue_ = -1;
 
   signal(SIGPIPE, save_sigpipe);
   return NULL;
 }
 
 
+/**
+ * Worker threads handle one request at a time of the connections passed by
+ * the I/O thread.  A negative file descriptor stops the worker.
+ */
+void *CachePlugin::MainWorker(void *data) {
+  CachePlugin *cache_plugin = reinterpret_cast<CachePlugin *>(data);
+
+  while (true) {
+    int fd_con = cache_plugin->queue_ready_.Dequeue();
+    if (fd_con < 0)
+      break;
+    bool proceed = cache_plugin->HandleRequest(fd_con);
+    cache_plugin->FinishRequest(fd_con, proceed);
+  }
+  return NULL;
+}
+
+
 /**
  * Used during startup to synchronize with the cvmfs client.
  */
@@ -678,6 +927,14 @@ void CachePlugin::NotifySupervisor(char signal) {
 
 void CachePlugin::ProcessRequests(unsigned num_workers) {
   num_workers_ = num_workers;
+  fd_eventqueue_ = platform_eventqueue_create();
+  assert(fd_eventqueue_ >= 0);
+  for (unsigned i = 0; i < num_workers_; ++i) {
+    pthread_t thread_worker;
+    int retval = pthread_create(&thread_worker, NULL, MainWorker, this);
+    assert(retval == 0);
+    threads_workers_.push_back(thread_worker);
+  }
   int retval = pthread_create(&thread_io_, NULL, MainProcessRequests, this);
   assert(retval == 0);
   NotifySupervisor(CacheTransport::kReadyNotification);
@@ -685,16 +942,29 @@ void CachePlugin::ProcessRequests(unsigned num_workers) {
 }
 
 
+void CachePlugin::SendDetachRequest(int fd_con) {
+  CacheTransport transport(fd_con,
+    CacheTransport::kFlagSendIgnoreFailure |
+    CacheTransport::kFlagSendNonBlocking);
+  cvmfs::MsgDetach msg_detach;
+  CacheTransport::Frame frame_send(&msg_detach);
+  transport.SendFrame(&frame_send);
+}
+
+
+/**
+ * Connections that are handled by a worker thread receive the detach request
+ * once their current request is finished, so that frames do not interleave.
+ */
 void CachePlugin::SendDetachRequests() {
+  MutexLockGuard guard(lock_);
   set<int>::const_iterator iter = connections_.begin();
   set<int>::const_iterator iter_end = connections_.end();
   for (; iter != iter_end; ++iter) {
-    CacheTransport transport(*iter,
-      CacheTransport::kFlagSendIgnoreFailure |
-      CacheTransport::kFlagSendNonBlocking);
-    cvmfs::MsgDetach msg_detach;
-    CacheTransport::Frame frame_send(&msg_detach);
-    transport.SendFrame(&frame_send);
+    if (busy_connections_.count(*iter) > 0)
+      detach_pending_.insert(*iter);
+    else
+      SendDetachRequest(*iter);
   }
 }
 
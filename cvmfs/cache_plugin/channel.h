@@ -10,6 +10,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "cache.pb.h"
@@ -17,10 +18,11 @@
 #include "hash.h"
 #include "murmur.h"
 #include "smallhash.h"
+#include "util_concurrency.h"
 
 class CachePlugin {
  public:
-  static const unsigned kPbProtocolVersion = 1;
+  static const unsigned kPbProtocolVersion = 2;
   static const uint64_t kSizeUnknown;
 
   struct ObjectInfo {
@@ -89,6 +91,29 @@ class CachePlugin {
   static const unsigned kListingSize = 4 * 1024 * 1024;  // 4MB
   static const char kSignalTerminate = 'q';
   static const char kSignalDetach = 'd';
+  static const char kSignalClosed = 'c';
+  /**
+   * Upper limit for the number of events handled in one round of the I/O loop
+   */
+  static const unsigned kMaxEvents = 64;
+  /**
+   * Connections with a pending request waiting for a worker thread
+   */
+  static const unsigned kMaxQueuedConnections = 1024;
+  /**
+   * Upper limit for the shared memory region a client can attach
+   */
+  static const uint64_t kMaxShmSize = 64 * 1024 * 1024;  // 64MB
+
+  /**
+   * Shared memory region that a client passed along with the handshake
+   */
+  struct SharedMemory {
+    SharedMemory() : region(NULL), size(0) { }
+    SharedMemory(unsigned char *r, uint64_t s) : region(r), size(s) { }
+    unsigned char *region;
+    uint64_t size;
+  };
 
   struct UniqueRequest {
     UniqueRequest() : session_id(-1), req_id(-1) { }
@@ -106,6 +131,7 @@ class CachePlugin {
   };
 
   static void *MainProcessRequests(void *data);
+  static void *MainWorker(void *data);
 
   inline uint64_t NextSessionId() {
     return atomic_xadd64(&next_session_id_, 1);
@@ -120,8 +146,12 @@ class CachePlugin {
     return MurmurHash2(&req, sizeof(req), 0x07387a4f);
   }
 
+  void DispatchRequest(int fd_con);
+  void FinishRequest(int fd_con, bool proceed);
+  bool CloseConnections();
   bool HandleRequest(int fd_con);
   void HandleHandshake(cvmfs::MsgHandshake *msg_req,
+                       int fd_shm,
                        CacheTransport *transport);
   void HandleRefcount(cvmfs::MsgRefcountReq *msg_req,
                       CacheTransport *transport);
@@ -138,8 +168,13 @@ class CachePlugin {
   void HandleShrink(cvmfs::MsgShrinkReq *msg_req, CacheTransport *transport);
   void HandleList(cvmfs::MsgListReq *msg_req, CacheTransport *transport);
   void HandleIoctl(cvmfs::MsgIoctl *msg_req);
+  void SendDetachRequest(int fd_con);
   void SendDetachRequests();
 
+  bool AttachShm(int fd_con, int fd_shm, uint64_t size);
+  void DetachShm(int fd_con);
+  unsigned char *GetShmBuffer(int fd_con, uint64_t offset, uint32_t size);
+
   void NotifySupervisor(char signal);
 
   void LogSessionError(uint64_t session_id,
@@ -165,6 +200,40 @@ class CachePlugin {
   SmallHashDynamic<UniqueRequest, uint64_t> txn_ids_;
   std::set<int> connections_;
   std::map<uint64_t, std::string> sessions_;
+  /**
+   * Maps connection file descriptors to the shared memory region of the
+   * connected client, if the shared memory data path is used.
+   */
+  std::map<int, SharedMemory> shm_regions_;
+  /**
+   * Connections that are currently handled by a worker thread.  Only the
+   * worker thread sends on such a connection.
+   */
+  std::set<int> busy_connections_;
+  /**
+   * Busy connections that get the detach request once the worker is done
+   */
+  std::set<int> detach_pending_;
+  /**
+   * Connections that were closed by the client, to be cleaned up by the I/O
+   * thread
+   */
+  std::vector<int> closed_connections_;
+  /**
+   * Protects the session state that is shared between the I/O thread and the
+   * worker threads: sessions, transaction ids, shared memory regions, and the
+   * connection bookkeeping above.
+   */
+  pthread_mutex_t lock_;
+  /**
+   * The I/O thread waits for new connections and requests.  Connections with
+   * a request are handed over to the worker threads.  A connection is disabled
+   * in the event queue until its request is handled, so that the requests of a
+   * single connection are processed in order.
+   */
+  int fd_eventqueue_;
+  FifoChannel<int> queue_ready_;
+  std::vector<pthread_t> threads_workers_;
   pthread_t thread_io_;
   int pipe_ctrl_[2];
 };  // class CachePlugin
@@ -0,0 +1,127 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * A cache plugin that stores objects in large, preallocated extent files on a
+ * local disk.  Space in the extents is handed out by a slab allocator and the
+ * object index is an mmapped file, so that a cleanly stopped cache survives a
+ * restart of the plugin.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "cache_plugin/disk_cache.h"
+#include "cache_plugin/libcvmfs_cache.h"
+#include "logging.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+
+static void Usage(const char *progname) {
+  printf("%s <config file>\n", progname);
+}
+
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  cvmcache_init_global();
+
+  cvmcache_option_map *options = cvmcache_options_init();
+  if (cvmcache_options_parse(options, argv[1]) != 0) {
+    printf("cannot parse options file %s\n", argv[1]);
+    return 1;
+  }
+  char *locator = cvmcache_options_get(options, "CVMFS_CACHE_PLUGIN_LOCATOR");
+  if (locator == NULL) {
+    printf("CVMFS_CACHE_PLUGIN_LOCATOR missing\n");
+    cvmcache_options_fini(options);
+    return 1;
+  }
+  char *cache_dir = cvmcache_options_get(options, "CVMFS_CACHE_PLUGIN_DIR");
+  if (cache_dir == NULL) {
+    printf("CVMFS_CACHE_PLUGIN_DIR missing\n");
+    cvmcache_options_fini(options);
+    return 1;
+  }
+  char *disk_size = cvmcache_options_get(options, "CVMFS_CACHE_PLUGIN_SIZE");
+  if (disk_size == NULL) {
+    printf("CVMFS_CACHE_PLUGIN_SIZE missing\n");
+    cvmcache_options_fini(options);
+    return 1;
+  }
+  unsigned num_workers = 4;
+  char *workers = cvmcache_options_get(options, "CVMFS_CACHE_PLUGIN_WORKERS");
+  if (workers != NULL) {
+    num_workers = String2Uint64(workers);
+    cvmcache_options_free(workers);
+  }
+
+  cvmcache_spawn_watchdog(NULL);
+  PluginDiskCache *plugin = PluginDiskCache::Create(cache_dir, disk_size);
+  if (plugin == NULL) {
+    fprintf(stderr, "failed to initialize cache in %s\n", cache_dir);
+    return 1;
+  }
+
+  struct cvmcache_callbacks callbacks;
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.cvmcache_chrefcnt = plugin->disk_chrefcnt;
+  callbacks.cvmcache_obj_info = plugin->disk_obj_info;
+  callbacks.cvmcache_pread = plugin->disk_pread;
+  callbacks.cvmcache_start_txn = plugin->disk_start_txn;
+  callbacks.cvmcache_write_txn = plugin->disk_write_txn;
+  callbacks.cvmcache_commit_txn = plugin->disk_commit_txn;
+  callbacks.cvmcache_abort_txn = plugin->disk_abort_txn;
+  callbacks.cvmcache_info = plugin->disk_info;
+  callbacks.cvmcache_shrink = plugin->disk_shrink;
+  callbacks.cvmcache_listing_begin = plugin->disk_listing_begin;
+  callbacks.cvmcache_listing_next = plugin->disk_listing_next;
+  callbacks.cvmcache_listing_end = plugin->disk_listing_end;
+  callbacks.capabilities = CVMCACHE_CAP_ALL_V1;
+
+  struct cvmcache_context *ctx = cvmcache_init(&callbacks);
+  plugin->set_context(ctx);
+  int retval = cvmcache_listen(ctx, locator);
+  if (!retval) {
+    fprintf(stderr, "failed to listen on %s\n", locator);
+    return 1;
+  }
+  printf("Listening for cvmfs clients on %s\n", locator);
+  printf("NOTE: this process needs to run as user cvmfs\n\n");
+
+
+  cvmcache_process_requests(ctx, num_workers);
+  if (!cvmcache_is_supervised()) {
+    printf("Press <Ctrl+D> to quit\n");
+    while (true) {
+      char buf;
+      retval = read(fileno(stdin), &buf, 1);
+      if (retval != 1)
+        break;
+    }
+    cvmcache_terminate(ctx);
+  } else {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslog,
+             "CernVM-FS disk cache plugin started in supervised mode");
+  }
+
+  cvmcache_wait_for(ctx);
+  // Marks the index as clean
+  delete plugin;
+  printf("  ... good bye\n");
+  cvmcache_options_free(disk_size);
+  cvmcache_options_free(cache_dir);
+  cvmcache_options_free(locator);
+  cvmcache_options_fini(options);
+  cvmcache_terminate_watchdog();
+  cvmcache_cleanup_global();
+  return 0;
+}
@@ -0,0 +1,769 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "disk_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cache_plugin/libcvmfs_cache.h"
+#include "cache_plugin/slab_allocator.h"
+#include "logging.h"
+#include "lru.h"
+#include "murmur.h"
+#include "platform.h"
+#include "smallhash.h"
+#include "smalloc.h"
+#include "util/posix.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Open transactions.  If the object size is known upfront, the data are
+ * written directly to their final place in the extents.  Otherwise the data
+ * are collected in memory and written on commit.
+ */
+struct Transaction {
+  Transaction()
+    : type(CVMCACHE_OBJECT_REGULAR)
+    , allocated(false)
+    , offset(0)
+    , alloc_size(0)
+    , size_class(0)
+    , nbytes_written(0)
+    , buffer(NULL)
+    , buffer_size(0)
+  {
+    memset(&id, 0, sizeof(id));
+  }
+
+  struct cvmcache_hash id;
+  cvmcache_object_type type;
+  string description;
+  bool allocated;
+  uint64_t offset;
+  uint64_t alloc_size;
+  uint8_t size_class;
+  uint64_t nbytes_written;
+  unsigned char *buffer;
+  uint64_t buffer_size;
+};
+
+
+/**
+ * Listings are generated and cached during the entire life time of a listing
+ * id.  Not very memory efficient but we don't optimize for listings.
+ */
+struct Listing {
+  Listing() : pos(0) { }
+  uint64_t pos;
+  vector<struct cvmcache_object_info> elems;
+};
+
+
+/**
+ * Allows us to use a cvmcache_hash in (hash) maps.
+ */
+struct ComparableHash {
+  ComparableHash() { }
+  explicit ComparableHash(const struct cvmcache_hash &h) : hash(h) { }
+  bool operator ==(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) == 0;
+  }
+  bool operator !=(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) != 0;
+  }
+  bool operator <(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) < 0;
+  }
+  bool operator >(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) > 0;
+  }
+
+  struct cvmcache_hash hash;
+};
+
+
+namespace {
+
+static inline uint32_t hasher_uint64(const uint64_t &key) {
+  return MurmurHash2(&key, sizeof(key), 0x07387a4f);
+}
+
+static inline uint32_t hasher_any(const ComparableHash &key) {
+  return (uint32_t) *(reinterpret_cast<const uint32_t *>(&key.hash));
+}
+
+}  // anonymous namespace
+
+
+PluginDiskCache *PluginDiskCache::instance_ = NULL;
+const uint64_t PluginDiskCache::kMinSize = 64 * 1024 * 1024;
+const uint64_t PluginDiskCache::kSlabSize = 4 * 1024 * 1024;
+const uint64_t PluginDiskCache::kMinChunkSize = 4096;
+const uint8_t PluginDiskCache::kNumSizeClasses = 10;
+const uint64_t PluginDiskCache::kExtentSize = 1024 * 1024 * 1024;
+const uint64_t PluginDiskCache::kAvgObjectSize = 32 * 1024;
+const double PluginDiskCache::kShrinkFactor = 0.75;
+const double PluginDiskCache::kDangerZoneThreshold = 0.7;
+const uint32_t PluginDiskCache::kIndexMagic = 0x43564443;
+const uint32_t PluginDiskCache::kIndexVersion = 1;
+
+
+PluginDiskCache *PluginDiskCache::Create(const string &cache_dir,
+                                         const string &size_str)
+{
+  assert(instance_ == NULL);
+
+  uint64_t size_bytes = String2Uint64(size_str) * 1024 * 1024;
+  instance_ = new PluginDiskCache(cache_dir, size_bytes);
+  if (!instance_->Open()) {
+    delete instance_;
+    return NULL;
+  }
+  return instance_;
+}
+
+
+PluginDiskCache::~PluginDiskCache() {
+  if (index_header_ != NULL) {
+    for (unsigned i = 0; i < fd_extents_.size(); ++i)
+      fsync(fd_extents_[i]);
+    msync(index_header_, index_size_, MS_SYNC);
+    index_header_->clean = 1;
+    msync(index_header_, sizeof(IndexHeader), MS_SYNC);
+    munmap(index_header_, index_size_);
+  }
+  if (fd_index_ >= 0)
+    close(fd_index_);
+  for (unsigned i = 0; i < fd_extents_.size(); ++i)
+    close(fd_extents_[i]);
+  if (fd_lock_ >= 0)
+    UnlockFile(fd_lock_);
+  delete allocator_;
+  delete objects_;
+  pthread_mutex_destroy(&lock_);
+  instance_ = NULL;
+}
+
+
+int PluginDiskCache::disk_chrefcnt(
+  struct cvmcache_hash *id,
+  int32_t change_by)
+{
+  ComparableHash h(*id);
+  MutexLockGuard guard(Me()->lock_);
+  uint32_t slot;
+  if (!Me()->objects_->Lookup(h, &slot))
+    return CVMCACHE_STATUS_NOENTRY;
+
+  if (change_by == 0)
+    return CVMCACHE_STATUS_OK;
+  int32_t *refcnt = &Me()->refcnts_[slot];
+  if ((*refcnt + change_by) < 0)
+    return CVMCACHE_STATUS_BADCOUNT;
+
+  if (*refcnt == 0) {
+    Me()->cache_info_.pinned_bytes += Me()->index_[slot].size;
+    if (!Me()->in_danger_zone_ && Me()->IsInDangerZone()) {
+      Me()->in_danger_zone_ = true;
+      if (Me()->ctx_ != NULL)
+        cvmcache_ask_detach(Me()->ctx_);
+    }
+  }
+  *refcnt += change_by;
+  if (*refcnt == 0) {
+    Me()->cache_info_.pinned_bytes -= Me()->index_[slot].size;
+    Me()->in_danger_zone_ = Me()->IsInDangerZone();
+  }
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_obj_info(
+  struct cvmcache_hash *id,
+  struct cvmcache_object_info *info)
+{
+  ComparableHash h(*id);
+  MutexLockGuard guard(Me()->lock_);
+  uint32_t slot;
+  if (!Me()->objects_->Lookup(h, &slot, false))
+    return CVMCACHE_STATUS_NOENTRY;
+
+  info->size = Me()->index_[slot].size;
+  info->type = static_cast<cvmcache_object_type>(Me()->index_[slot].type);
+  info->pinned = Me()->refcnts_[slot] > 0;
+  info->description = Me()->descriptions_[slot].empty()
+                      ? NULL
+                      : strdup(Me()->descriptions_[slot].c_str());
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_pread(struct cvmcache_hash *id,
+                                uint64_t offset,
+                                uint32_t *size,
+                                unsigned char *buffer)
+{
+  ComparableHash h(*id);
+  uint64_t position;
+  uint64_t object_size;
+  {
+    MutexLockGuard guard(Me()->lock_);
+    uint32_t slot;
+    if (!Me()->objects_->Lookup(h, &slot, false))
+      return CVMCACHE_STATUS_NOENTRY;
+    position = Me()->index_[slot].offset;
+    object_size = Me()->index_[slot].size;
+  }
+  if (offset > object_size)
+    return CVMCACHE_STATUS_OUTOFBOUNDS;
+  uint32_t nbytes =
+    std::min(uint64_t(*size), object_size - offset);
+  // Open objects are pinned, so the extent region cannot be recycled
+  // while we read from it
+  if (!Me()->ReadExtent(position + offset, nbytes, buffer))
+    return CVMCACHE_STATUS_IOERR;
+  *size = nbytes;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_start_txn(
+  struct cvmcache_hash *id,
+  uint64_t txn_id,
+  struct cvmcache_object_info *info)
+{
+  Transaction *txn = new Transaction();
+  txn->id = *id;
+  txn->type = info->type;
+  if (info->description != NULL)
+    txn->description = info->description;
+
+  MutexLockGuard guard(Me()->lock_);
+  if (info->size != CVMCACHE_SIZE_UNKNOWN) {
+    txn->alloc_size = info->size;
+    if (!Me()->AllocateSpace(txn->alloc_size,
+                             &txn->size_class, &txn->offset))
+    {
+      delete txn;
+      return CVMCACHE_STATUS_NOSPACE;
+    }
+    txn->allocated = true;
+  }
+  Me()->transactions_.Insert(txn_id, txn);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_write_txn(
+  uint64_t txn_id,
+  unsigned char *buffer,
+  uint32_t size)
+{
+  Transaction *txn;
+  {
+    MutexLockGuard guard(Me()->lock_);
+    bool retval = Me()->transactions_.Lookup(txn_id, &txn);
+    assert(retval);
+  }
+  assert(size > 0);
+
+  if (txn->allocated &&
+      (txn->nbytes_written + size >
+       Me()->allocator_->GetCapacity(txn->alloc_size, txn->size_class)))
+  {
+    // Object is larger than announced, continue in memory
+    if (!Me()->MoveToBuffer(txn))
+      return CVMCACHE_STATUS_IOERR;
+  }
+
+  if (txn->allocated) {
+    if (!Me()->WriteExtent(txn->offset + txn->nbytes_written, size, buffer))
+      return CVMCACHE_STATUS_IOERR;
+  } else {
+    if (txn->nbytes_written + size > txn->buffer_size) {
+      txn->buffer_size =
+        std::max(txn->nbytes_written + size, 2 * txn->buffer_size);
+      txn->buffer = reinterpret_cast<unsigned char *>(
+        srealloc(txn->buffer, txn->buffer_size));
+    }
+    memcpy(txn->buffer + txn->nbytes_written, buffer, size);
+  }
+  txn->nbytes_written += size;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_commit_txn(uint64_t txn_id) {
+  Transaction *txn;
+  {
+    MutexLockGuard guard(Me()->lock_);
+    bool retval = Me()->transactions_.Lookup(txn_id, &txn);
+    assert(retval);
+    if (!txn->allocated) {
+      txn->alloc_size = txn->nbytes_written;
+      if (!Me()->AllocateSpace(txn->alloc_size,
+                               &txn->size_class, &txn->offset))
+      {
+        return CVMCACHE_STATUS_NOSPACE;
+      }
+      txn->allocated = true;
+    }
+  }
+
+  if (txn->buffer != NULL) {
+    if (!Me()->WriteExtent(txn->offset, txn->nbytes_written, txn->buffer))
+      return CVMCACHE_STATUS_IOERR;
+  }
+
+  MutexLockGuard guard(Me()->lock_);
+  ComparableHash h(txn->id);
+  uint32_t slot;
+  if (Me()->objects_->Lookup(h, &slot)) {
+    // Concurrent addition of same objects, drop the one at hand and
+    // increase ref count of existing copy
+    Me()->allocator_->Free(txn->offset, txn->alloc_size, txn->size_class);
+    if (Me()->refcnts_[slot] == 0)
+      Me()->cache_info_.pinned_bytes += Me()->index_[slot].size;
+    Me()->refcnts_[slot]++;
+  } else {
+    if (Me()->free_slots_.empty())
+      Me()->DoShrink(uint64_t(Me()->cache_info_.used_bytes * kShrinkFactor));
+    if (Me()->free_slots_.empty())
+      return CVMCACHE_STATUS_NOSPACE;
+
+    slot = Me()->free_slots_.back();
+    Me()->free_slots_.pop_back();
+    IndexEntry *entry = &Me()->index_[slot];
+    entry->offset = txn->offset;
+    entry->size = txn->nbytes_written;
+    entry->alloc_size = txn->alloc_size;
+    entry->id = txn->id;
+    entry->type = txn->type;
+    entry->size_class = txn->size_class;
+    entry->in_use = 1;
+    Me()->refcnts_[slot] = 1;
+    Me()->descriptions_[slot] = txn->description;
+    Me()->cache_info_.used_bytes += entry->size;
+    Me()->cache_info_.pinned_bytes += entry->size;
+    Me()->objects_->Insert(h, slot);
+  }
+
+  Me()->transactions_.Erase(txn_id);
+  free(txn->buffer);
+  delete txn;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_abort_txn(uint64_t txn_id) {
+  MutexLockGuard guard(Me()->lock_);
+  Transaction *txn;
+  bool retval = Me()->transactions_.Lookup(txn_id, &txn);
+  assert(retval);
+  Me()->transactions_.Erase(txn_id);
+  if (txn->allocated)
+    Me()->allocator_->Free(txn->offset, txn->alloc_size, txn->size_class);
+  free(txn->buffer);
+  delete txn;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_info(struct cvmcache_info *info) {
+  MutexLockGuard guard(Me()->lock_);
+  *info = Me()->cache_info_;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_shrink(uint64_t shrink_to, uint64_t *used) {
+  MutexLockGuard guard(Me()->lock_);
+  *used = Me()->cache_info_.used_bytes;
+  if (*used <= shrink_to)
+    return CVMCACHE_STATUS_OK;
+
+  Me()->DoShrink(shrink_to);
+  *used = Me()->cache_info_.used_bytes;
+  return (*used <= shrink_to) ? CVMCACHE_STATUS_OK : CVMCACHE_STATUS_PARTIAL;
+}
+
+
+int PluginDiskCache::disk_listing_begin(
+  uint64_t lst_id,
+  enum cvmcache_object_type type)
+{
+  Listing *lst = new Listing();
+  MutexLockGuard guard(Me()->lock_);
+  Me()->objects_->FilterBegin();
+  while (Me()->objects_->FilterNext()) {
+    ComparableHash h;
+    uint32_t slot;
+    Me()->objects_->FilterGet(&h, &slot);
+    IndexEntry *entry = &Me()->index_[slot];
+    if (entry->type != type)
+      continue;
+
+    struct cvmcache_object_info item;
+    item.id = entry->id;
+    item.size = entry->size;
+    item.type = type;
+    item.pinned = Me()->refcnts_[slot] != 0;
+    item.description = Me()->descriptions_[slot].empty()
+                       ? NULL
+                       : strdup(Me()->descriptions_[slot].c_str());
+    lst->elems.push_back(item);
+  }
+  Me()->objects_->FilterEnd();
+
+  Me()->listings_.Insert(lst_id, lst);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_listing_next(
+  int64_t listing_id,
+  struct cvmcache_object_info *item)
+{
+  MutexLockGuard guard(Me()->lock_);
+  Listing *lst;
+  bool retval = Me()->listings_.Lookup(listing_id, &lst);
+  assert(retval);
+  if (lst->pos >= lst->elems.size())
+    return CVMCACHE_STATUS_OUTOFBOUNDS;
+  *item = lst->elems[lst->pos];
+  lst->pos++;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginDiskCache::disk_listing_end(int64_t listing_id) {
+  MutexLockGuard guard(Me()->lock_);
+  Listing *lst;
+  bool retval = Me()->listings_.Lookup(listing_id, &lst);
+  assert(retval);
+
+  // Don't free description strings, done by the library
+  delete lst;
+  Me()->listings_.Erase(listing_id);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+PluginDiskCache::PluginDiskCache(const string &cache_dir, uint64_t size)
+  : cache_dir_(cache_dir)
+  , fd_lock_(-1)
+  , fd_index_(-1)
+  , index_size_(0)
+  , index_header_(NULL)
+  , index_(NULL)
+  , allocator_(NULL)
+  , objects_(NULL)
+  , in_danger_zone_(false)
+  , ctx_(NULL)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  num_slabs_ = std::max(kMinSize, size) / kSlabSize;
+  slabs_per_extent_ = kExtentSize / kSlabSize;
+  const uint64_t mask_64 = ~((1 << 6) - 1);
+  num_entries_ = std::max(uint64_t(1024),
+    (num_slabs_ * kSlabSize) / kAvgObjectSize) & mask_64;
+
+  memset(&cache_info_, 0, sizeof(cache_info_));
+  cache_info_.size_bytes = num_slabs_ * kSlabSize;
+  transactions_.Init(64, uint64_t(-1), hasher_uint64);
+  listings_.Init(8, uint64_t(-1), hasher_uint64);
+}
+
+
+bool PluginDiskCache::Open() {
+  if (!MkdirDeep(cache_dir_, 0700)) {
+    fprintf(stderr, "cannot create cache directory %s\n",
+            cache_dir_.c_str());
+    return false;
+  }
+  fd_lock_ = TryLockFile(cache_dir_ + "/lock");
+  if (fd_lock_ < 0) {
+    fprintf(stderr, "cache directory %s is in use\n", cache_dir_.c_str());
+    return false;
+  }
+
+  uint64_t num_extents =
+    (num_slabs_ + slabs_per_extent_ - 1) / slabs_per_extent_;
+  for (unsigned i = 0; i < num_extents; ++i) {
+    string path = cache_dir_ + "/extent." + StringifyInt(i);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      fprintf(stderr, "cannot open %s (%d)\n", path.c_str(), errno);
+      return false;
+    }
+    fd_extents_.push_back(fd);
+    uint64_t extent_size = std::min(slabs_per_extent_,
+      num_slabs_ - i * slabs_per_extent_) * kSlabSize;
+    if (ftruncate(fd, extent_size) != 0) {
+      fprintf(stderr, "cannot resize %s (%d)\n", path.c_str(), errno);
+      return false;
+    }
+    // On file systems without preallocation we stay with a sparse file
+    int retval = platform_fallocate(fd, extent_size);
+    if (retval != 0) {
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+               "failed to preallocate %s (%d)", path.c_str(), retval);
+    }
+  }
+
+  string path_index = cache_dir_ + "/index";
+  fd_index_ = open(path_index.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd_index_ < 0) {
+    fprintf(stderr, "cannot open %s (%d)\n", path_index.c_str(), errno);
+    return false;
+  }
+  index_size_ = sizeof(IndexHeader) + num_entries_ * sizeof(IndexEntry);
+  if (ftruncate(fd_index_, index_size_) != 0) {
+    fprintf(stderr, "cannot resize %s (%d)\n", path_index.c_str(), errno);
+    return false;
+  }
+  void *mapping = mmap(NULL, index_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_index_, 0);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "cannot map %s (%d)\n", path_index.c_str(), errno);
+    return false;
+  }
+  index_header_ = reinterpret_cast<IndexHeader *>(mapping);
+  index_ = reinterpret_cast<IndexEntry *>(
+    reinterpret_cast<char *>(mapping) + sizeof(IndexHeader));
+
+  struct cvmcache_hash hash_empty;
+  memset(&hash_empty, 0, sizeof(hash_empty));
+  objects_ = new lru::LruCache<ComparableHash, uint32_t>(
+    num_entries_,
+    ComparableHash(hash_empty),
+    hasher_any,
+    perf::StatisticsTemplate("objects", &statistics_));
+  allocator_ = new SlabAllocator(num_slabs_, slabs_per_extent_, kSlabSize,
+                                 kMinChunkSize, kNumSizeClasses);
+  refcnts_.resize(num_entries_, 0);
+  descriptions_.resize(num_entries_);
+
+  if (!LoadIndex())
+    ResetIndex();
+  // Mark the index as dirty until we shut down properly
+  index_header_->clean = 0;
+  msync(index_header_, sizeof(IndexHeader), MS_SYNC);
+
+  LogCvmfs(kLogCvmfs, kLogStdout, "Using %" PRIu64 "MB of disk space in %s "
+           "for up to %" PRIu64 " objects (%" PRIu64 " objects loaded)",
+           cache_info_.size_bytes / (1024 * 1024), cache_dir_.c_str(),
+           num_entries_, num_entries_ - free_slots_.size());
+  return true;
+}
+
+
+/**
+ * Rebuilds the allocator and the LRU list from the index file.  Returns
+ * false if the index cannot be trusted.
+ */
+bool PluginDiskCache::LoadIndex() {
+  if ((index_header_->magic != kIndexMagic) ||
+      (index_header_->version != kIndexVersion) ||
+      (index_header_->num_slabs != num_slabs_) ||
+      (index_header_->num_entries != num_entries_) ||
+      (index_header_->clean != 1))
+  {
+    return false;
+  }
+
+  for (uint64_t i = num_entries_; i > 0; --i) {
+    IndexEntry *entry = &index_[i - 1];
+    if (!entry->in_use) {
+      free_slots_.push_back(i - 1);
+      continue;
+    }
+    if ((entry->size > entry->alloc_size) ||
+        (entry->size_class != allocator_->GetSizeClass(entry->alloc_size))
+        || !allocator_->Claim(entry->offset, entry->alloc_size,
+                              entry->size_class))
+    {
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+               "corrupted cache index in %s, starting empty",
+               cache_dir_.c_str());
+      return false;
+    }
+    objects_->Insert(ComparableHash(entry->id), i - 1);
+    cache_info_.used_bytes += entry->size;
+  }
+  return true;
+}
+
+
+void PluginDiskCache::ResetIndex() {
+  memset(index_header_, 0, index_size_);
+  index_header_->magic = kIndexMagic;
+  index_header_->version = kIndexVersion;
+  index_header_->num_slabs = num_slabs_;
+  index_header_->num_entries = num_entries_;
+
+  delete allocator_;
+  allocator_ = new SlabAllocator(num_slabs_, slabs_per_extent_, kSlabSize,
+                                 kMinChunkSize, kNumSizeClasses);
+  objects_->Drop();
+  cache_info_.used_bytes = 0;
+  free_slots_.clear();
+  for (uint64_t i = num_entries_; i > 0; --i)
+    free_slots_.push_back(i - 1);
+}
+
+
+/**
+ * Evicts objects if necessary to make room for the allocation.
+ */
+bool PluginDiskCache::AllocateSpace(
+  uint64_t size,
+  uint8_t *size_class,
+  uint64_t *offset)
+{
+  if (size > kExtentSize)
+    return false;
+  *size_class = allocator_->GetSizeClass(size);
+  while (!allocator_->Allocate(size, *size_class, offset)) {
+    uint64_t used_before = cache_info_.used_bytes;
+    DoShrink(uint64_t(used_before * kShrinkFactor));
+    if (cache_info_.used_bytes == used_before)
+      return false;
+  }
+  return true;
+}
+
+
+/**
+ * Takes back already written data of a transaction from the extent into
+ * memory and releases the extent space.
+ */
+bool PluginDiskCache::MoveToBuffer(Transaction *txn) {
+  assert(txn->allocated && (txn->buffer == NULL));
+  txn->buffer_size = 2 * std::max(txn->nbytes_written, uint64_t(4096));
+  txn->buffer = reinterpret_cast<unsigned char *>(smalloc(txn->buffer_size));
+  if (!ReadExtent(txn->offset, txn->nbytes_written, txn->buffer))
+    return false;
+  MutexLockGuard guard(lock_);
+  allocator_->Free(txn->offset, txn->alloc_size, txn->size_class);
+  txn->allocated = false;
+  return true;
+}
+
+
+void PluginDiskCache::FreeSlot(uint32_t slot) {
+  IndexEntry *entry = &index_[slot];
+  entry->in_use = 0;
+  allocator_->Free(entry->offset, entry->alloc_size, entry->size_class);
+  cache_info_.used_bytes -= entry->size;
+  descriptions_[slot].clear();
+  free_slots_.push_back(slot);
+}
+
+
+void PluginDiskCache::DoShrink(uint64_t shrink_to) {
+  ComparableHash h;
+  uint32_t slot;
+
+  objects_->FilterBegin();
+  while ((cache_info_.used_bytes > shrink_to) && objects_->FilterNext()) {
+    objects_->FilterGet(&h, &slot);
+    if ((refcnts_[slot] != 0) ||
+        (index_[slot].type != CVMCACHE_OBJECT_VOLATILE))
+    {
+      continue;
+    }
+    FreeSlot(slot);
+    objects_->FilterDelete();
+  }
+  objects_->FilterEnd();
+
+  objects_->FilterBegin();
+  while ((cache_info_.used_bytes > shrink_to) && objects_->FilterNext()) {
+    objects_->FilterGet(&h, &slot);
+    if (refcnts_[slot] != 0)
+      continue;
+    FreeSlot(slot);
+    objects_->FilterDelete();
+  }
+  objects_->FilterEnd();
+
+  cache_info_.no_shrink++;
+}
+
+
+bool PluginDiskCache::ReadExtent(
+  uint64_t position,
+  uint64_t size,
+  unsigned char *buffer)
+{
+  int fd = fd_extents_[position / kExtentSize];
+  off_t offset = position % kExtentSize;
+  uint64_t nbytes = 0;
+  while (nbytes < size) {
+    ssize_t retval = pread(fd, buffer + nbytes, size - nbytes,
+                           offset + nbytes);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (retval == 0)
+      return false;
+    nbytes += retval;
+  }
+  return true;
+}
+
+
+bool PluginDiskCache::WriteExtent(
+  uint64_t position,
+  uint64_t size,
+  const unsigned char *buffer)
+{
+  int fd = fd_extents_[position / kExtentSize];
+  off_t offset = position % kExtentSize;
+  uint64_t nbytes = 0;
+  while (nbytes < size) {
+    ssize_t retval = pwrite(fd, buffer + nbytes, size - nbytes,
+                            offset + nbytes);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    nbytes += retval;
+  }
+  return true;
+}
+
+
+bool PluginDiskCache::IsInDangerZone() {
+  return (static_cast<double>(cache_info_.pinned_bytes) /
+          static_cast<double>(cache_info_.size_bytes)) >
+         kDangerZoneThreshold;
+}
@@ -0,0 +1,164 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CACHE_PLUGIN_DISK_CACHE_H_
+#define CVMFS_CACHE_PLUGIN_DISK_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cache_plugin/libcvmfs_cache.h"
+#include "smallhash.h"
+#include "statistics.h"
+
+class SlabAllocator;
+struct ComparableHash;
+struct Listing;
+struct Transaction;
+
+namespace lru {
+template<class Key, class Value> class LruCache;
+}
+
+/**
+ * Start of the mmapped index file.  The index is only trusted if the plugin
+ * was stopped cleanly and the geometry of the extent files did not change.
+ */
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_slabs;
+  uint64_t num_entries;
+  uint32_t clean;
+  uint32_t padding;
+};
+
+
+/**
+ * An index slot.  The slots follow the header in the index file.  The
+ * description of an object is kept in memory only and lost on restart.
+ */
+struct IndexEntry {
+  /**
+   * Byte position in the concatenation of all the extent files.
+   */
+  uint64_t offset;
+  uint64_t size;
+  /**
+   * The size that was passed to the slab allocator, can be larger than size.
+   */
+  uint64_t alloc_size;
+  struct cvmcache_hash id;
+  uint8_t in_use;
+  uint8_t type;
+  uint8_t size_class;
+};
+
+
+/**
+ * Implements all the cache plugin callbacks.  Singelton.  The callbacks can be
+ * called concurrently from several worker threads.  Metadata are protected by
+ * a single mutex; the disk I/O takes place outside the lock.
+ */
+class PluginDiskCache {
+ public:
+  static PluginDiskCache *Create(const std::string &cache_dir,
+                                 const std::string &size_str);
+  ~PluginDiskCache();
+
+  /**
+   * Used when detaching nested catalogs.  Without a context, the plugin does
+   * not ask clients to release pinned objects.
+   */
+  void set_context(struct cvmcache_context *ctx) { ctx_ = ctx; }
+
+  static int disk_chrefcnt(struct cvmcache_hash *id, int32_t change_by);
+  static int disk_obj_info(struct cvmcache_hash *id,
+                           struct cvmcache_object_info *info);
+  static int disk_pread(struct cvmcache_hash *id,
+                        uint64_t offset,
+                        uint32_t *size,
+                        unsigned char *buffer);
+  static int disk_start_txn(struct cvmcache_hash *id,
+                            uint64_t txn_id,
+                            struct cvmcache_object_info *info);
+  static int disk_write_txn(uint64_t txn_id,
+                            unsigned char *buffer,
+                            uint32_t size);
+  static int disk_commit_txn(uint64_t txn_id);
+  static int disk_abort_txn(uint64_t txn_id);
+  static int disk_info(struct cvmcache_info *info);
+  static int disk_shrink(uint64_t shrink_to, uint64_t *used);
+  static int disk_listing_begin(uint64_t lst_id,
+                                enum cvmcache_object_type type);
+  static int disk_listing_next(int64_t listing_id,
+                               struct cvmcache_object_info *item);
+  static int disk_listing_end(int64_t listing_id);
+
+ private:
+  static const uint64_t kMinSize;  // 64 * 1024 * 1024
+  static const uint64_t kSlabSize;  // 4 * 1024 * 1024
+  static const uint64_t kMinChunkSize;  // 4096
+  static const uint8_t kNumSizeClasses;  // 10: 4kB to 2MB
+  static const uint64_t kExtentSize;  // 1024 * 1024 * 1024
+  static const uint64_t kAvgObjectSize;  // 32 * 1024
+  static const double kShrinkFactor;  //  = 0.75;
+  static const double kDangerZoneThreshold;  // = 0.7
+  static const uint32_t kIndexMagic;  // = 'CVDC'
+  static const uint32_t kIndexVersion;  // = 1
+
+  static PluginDiskCache *instance_;
+  static PluginDiskCache *Me() {
+    return instance_;
+  }
+  PluginDiskCache(const std::string &cache_dir, uint64_t size);
+
+  bool Open();
+  bool LoadIndex();
+  void ResetIndex();
+  bool AllocateSpace(uint64_t size, uint8_t *size_class, uint64_t *offset);
+  bool MoveToBuffer(Transaction *txn);
+  void FreeSlot(uint32_t slot);
+  void DoShrink(uint64_t shrink_to);
+  bool ReadExtent(uint64_t position, uint64_t size, unsigned char *buffer);
+  bool WriteExtent(uint64_t position, uint64_t size,
+                   const unsigned char *buffer);
+  bool IsInDangerZone();
+
+  std::string cache_dir_;
+  int fd_lock_;
+  std::vector<int> fd_extents_;
+  uint64_t num_slabs_;
+  uint64_t slabs_per_extent_;
+  int fd_index_;
+  uint64_t index_size_;
+  uint64_t num_entries_;
+  IndexHeader *index_header_;
+  IndexEntry *index_;
+  /**
+   * Unused index slots
+   */
+  std::vector<uint32_t> free_slots_;
+  /**
+   * Reference counters and descriptions are not persistent and kept separately
+   * from the mmapped index
+   */
+  std::vector<int32_t> refcnts_;
+  std::vector<std::string> descriptions_;
+  SlabAllocator *allocator_;
+
+  pthread_mutex_t lock_;
+  struct cvmcache_info cache_info_;
+  perf::Statistics statistics_;
+  SmallHashDynamic<uint64_t, Transaction *> transactions_;
+  SmallHashDynamic<uint64_t, Listing *> listings_;
+  lru::LruCache<ComparableHash, uint32_t> *objects_;
+  bool in_danger_zone_;
+  struct cvmcache_context *ctx_;
+};  // class PluginDiskCache
+
+#endif  // CVMFS_CACHE_PLUGIN_DISK_CACHE_H_
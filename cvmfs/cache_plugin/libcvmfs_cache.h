@@ -181,7 +181,10 @@ struct cvmcache_context *cvmcache_init(struct cvmcache_callbacks *callbacks);
 int cvmcache_listen(struct cvmcache_context *ctx, char *locator);
 /**
  * Spawns a separate I/O thread that can be stopped with cvmcache_terminate.
- * The nworkers parameter is currently unused.
+ * If nworkers is larger than zero, requests are processed by a pool of
+ * nworkers threads.  Requests of the same client are processed in order but
+ * requests of different clients run concurrently, so the callbacks need to be
+ * thread-safe.  With nworkers = 0, the I/O thread processes all requests.
  */
 void cvmcache_process_requests(struct cvmcache_context *ctx, unsigned nworkers);
 /**
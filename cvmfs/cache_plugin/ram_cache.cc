@@ -0,0 +1,751 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "ram_cache.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "cache_plugin/libcvmfs_cache.h"
+#include "cache_plugin/slab_allocator.h"
+#include "logging.h"
+#include "murmur.h"
+#include "platform.h"
+#include "smallhash.h"
+#include "smalloc.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Header of the data pieces in the cache.  After the object header, the
+ * zero-terminated description and the object data follows.
+ */
+struct ObjectHeader {
+  ObjectHeader() {
+    txn_id = uint64_t(-1);
+    size_data = 0;
+    size_desc = 0;
+    refcnt = 0;
+    nbytes_written = 0;
+    type = CVMCACHE_OBJECT_REGULAR;
+    memset(&id, 0, sizeof(id));
+    size_class = 0;
+    alloc_size = 0;
+    last_access = 0;
+    lru_prev = NULL;
+    lru_next = NULL;
+    in_lru = false;
+  }
+
+  char *GetDescription() {
+    if (size_desc == 0)
+      return NULL;
+    return reinterpret_cast<char *>(this) + sizeof(ObjectHeader);
+  }
+
+  void SetDescription(char *description) {
+    if (description == NULL)
+      return;
+    memcpy(reinterpret_cast<char *>(this) + sizeof(ObjectHeader),
+           description, strlen(description) + 1);
+  }
+
+  unsigned char *GetData() {
+    return reinterpret_cast<unsigned char *>(this) +
+           sizeof(ObjectHeader) + size_desc;
+  }
+
+  /**
+   * Set during a running transaction.  Once committed, this is uint64_t(-1).
+   */
+  uint64_t txn_id;
+  /**
+   * Can be zero.  During a transaction, this is the available space for data.
+   */
+  uint64_t size_data;
+  /**
+   * String length + 1 (null terminated) or null if the description is NULL.
+   */
+  uint32_t size_desc;
+  /**
+   * Protected by the lock of the index stripe.  On commit, refcnt is set to 1.
+   */
+  int32_t refcnt;
+  /**
+   * Only used during a transaction
+   */
+  uint64_t nbytes_written;
+  cvmcache_object_type type;
+  struct cvmcache_hash id;
+  /**
+   * Required to return the memory to the slab allocator
+   */
+  uint8_t size_class;
+  uint64_t alloc_size;
+  /**
+   * The LRU fields are protected by the lock of the size class' LRU list.
+   */
+  uint64_t last_access;
+  ObjectHeader *lru_prev;
+  ObjectHeader *lru_next;
+  bool in_lru;
+};
+
+
+/**
+ * Listings are generated and cached during the entire life time of a listing
+ * id.  Not very memory efficient but we don't optimize for listings.
+ */
+struct Listing {
+  Listing() : pos(0) { }
+  uint64_t pos;
+  vector<struct cvmcache_object_info> elems;
+};
+
+
+/**
+ * Allows us to use a cvmcache_hash in (hash) maps.
+ */
+struct ComparableHash {
+  ComparableHash() { }
+  explicit ComparableHash(const struct cvmcache_hash &h) : hash(h) { }
+  bool operator ==(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) == 0;
+  }
+  bool operator !=(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) != 0;
+  }
+  bool operator <(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) < 0;
+  }
+  bool operator >(const ComparableHash &other) const {
+    return cvmcache_hash_cmp(const_cast<cvmcache_hash *>(&(this->hash)),
+                             const_cast<cvmcache_hash *>(&(other.hash))) > 0;
+  }
+
+  struct cvmcache_hash hash;
+};
+
+
+/**
+ * Part of the object index with its own lock.  The stripe of an object is
+ * determined by its content hash.
+ */
+struct IndexStripe {
+  IndexStripe() {
+    int retval = pthread_mutex_init(&lock, NULL);
+    assert(retval == 0);
+  }
+  ~IndexStripe() {
+    pthread_mutex_destroy(&lock);
+  }
+
+  pthread_mutex_t lock;
+  SmallHashDynamic<ComparableHash, ObjectHeader *> objects;
+};
+
+
+/**
+ * Intrusive list of the committed objects of a size class, most recently used
+ * object first.
+ */
+struct LruList {
+  LruList() : head(NULL), tail(NULL) {
+    int retval = pthread_mutex_init(&lock, NULL);
+    assert(retval == 0);
+  }
+  ~LruList() {
+    pthread_mutex_destroy(&lock);
+  }
+
+  void PushFront(ObjectHeader *object) {
+    object->lru_prev = NULL;
+    object->lru_next = head;
+    if (head != NULL)
+      head->lru_prev = object;
+    head = object;
+    if (tail == NULL)
+      tail = object;
+    object->in_lru = true;
+  }
+
+  void Remove(ObjectHeader *object) {
+    if (object->lru_prev != NULL)
+      object->lru_prev->lru_next = object->lru_next;
+    else
+      head = object->lru_next;
+    if (object->lru_next != NULL)
+      object->lru_next->lru_prev = object->lru_prev;
+    else
+      tail = object->lru_prev;
+    object->lru_prev = NULL;
+    object->lru_next = NULL;
+    object->in_lru = false;
+  }
+
+  pthread_mutex_t lock;
+  ObjectHeader *head;
+  ObjectHeader *tail;
+};
+
+
+namespace {
+
+static inline uint32_t hasher_uint64(const uint64_t &key) {
+  return MurmurHash2(&key, sizeof(key), 0x07387a4f);
+}
+
+static inline uint32_t hasher_any(const ComparableHash &key) {
+  return (uint32_t) *(reinterpret_cast<const uint32_t *>(&key.hash));
+}
+
+}  // anonymous namespace
+
+
+PluginRamCache *PluginRamCache::instance_ = NULL;
+const uint64_t PluginRamCache::kMinSize = 100 * 1024 * 1024;
+const double PluginRamCache::kShrinkFactor = 0.75;
+const double PluginRamCache::kObjectExpandFactor = 1.5;
+const double PluginRamCache::kIndexFraction = 0.04;
+const double PluginRamCache::kDangerZoneThreshold = 0.7;
+const uint64_t PluginRamCache::kSlabSize = 1024 * 1024;
+const uint64_t PluginRamCache::kMinChunkSize = 256;
+const uint8_t PluginRamCache::kNumSizeClasses = 12;
+
+
+PluginRamCache *PluginRamCache::Create(const string &mem_size_str) {
+  assert(instance_ == NULL);
+
+  uint64_t mem_size_bytes;
+  if (HasSuffix(mem_size_str, "%", false)) {
+    mem_size_bytes = platform_memsize() * String2Uint64(mem_size_str) / 100;
+  } else {
+    mem_size_bytes = String2Uint64(mem_size_str) * 1024 * 1024;
+  }
+  instance_ = new PluginRamCache(mem_size_bytes);
+  return instance_;
+}
+
+
+PluginRamCache::~PluginRamCache() {
+  delete[] lru_lists_;
+  delete[] stripes_;
+  delete allocator_;
+  smunmap(arena_);
+  pthread_mutex_destroy(&lock_);
+  instance_ = NULL;
+}
+
+
+int PluginRamCache::ram_chrefcnt(struct cvmcache_hash *id, int32_t change_by) {
+  ComparableHash h(*id);
+  IndexStripe *stripe = Me()->GetStripe(h);
+  ObjectHeader *object;
+  {
+    MutexLockGuard guard(stripe->lock);
+    if (!stripe->objects.Lookup(h, &object))
+      return CVMCACHE_STATUS_NOENTRY;
+    if ((object->refcnt + change_by) < 0)
+      return CVMCACHE_STATUS_BADCOUNT;
+
+    if ((object->refcnt == 0) && (change_by > 0))
+      atomic_xadd64(&Me()->pinned_bytes_, object->size_data);
+    object->refcnt += change_by;
+    if ((object->refcnt == 0) && (change_by < 0))
+      atomic_xadd64(&Me()->pinned_bytes_, -int64_t(object->size_data));
+  }
+
+  // Only the reference taken by the caller keeps the object from being
+  // evicted once the stripe lock is released.  The remaining references
+  // after a decrease belong to other clients and can vanish any time.
+  if (change_by > 0)
+    Me()->TouchObject(object);
+  Me()->UpdateDangerZone();
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_obj_info(
+  struct cvmcache_hash *id,
+  struct cvmcache_object_info *info)
+{
+  ComparableHash h(*id);
+  IndexStripe *stripe = Me()->GetStripe(h);
+  MutexLockGuard guard(stripe->lock);
+  ObjectHeader *object;
+  if (!stripe->objects.Lookup(h, &object))
+    return CVMCACHE_STATUS_NOENTRY;
+
+  info->size = object->size_data;
+  info->type = object->type;
+  info->pinned = object->refcnt > 0;
+  info->description = (object->GetDescription() == NULL)
+                      ? NULL
+                      : strdup(object->GetDescription());
+  return CVMCACHE_STATUS_OK;
+}
+
+
+/**
+ * Clients read from open, i.e. pinned, objects so that the copy can happen
+ * outside the stripe lock.
+ */
+int PluginRamCache::ram_pread(
+  struct cvmcache_hash *id,
+  uint64_t offset,
+  uint32_t *size,
+  unsigned char *buffer)
+{
+  ComparableHash h(*id);
+  IndexStripe *stripe = Me()->GetStripe(h);
+  ObjectHeader *object;
+  pthread_mutex_lock(&stripe->lock);
+  if (!stripe->objects.Lookup(h, &object)) {
+    pthread_mutex_unlock(&stripe->lock);
+    return CVMCACHE_STATUS_NOENTRY;
+  }
+  if (offset > object->size_data) {
+    pthread_mutex_unlock(&stripe->lock);
+    return CVMCACHE_STATUS_OUTOFBOUNDS;
+  }
+  bool is_pinned = object->refcnt > 0;
+  if (is_pinned)
+    pthread_mutex_unlock(&stripe->lock);
+
+  unsigned nbytes =
+    std::min(*size, static_cast<uint32_t>(object->size_data - offset));
+  memcpy(buffer, object->GetData() + offset, nbytes);
+  *size = nbytes;
+
+  if (!is_pinned)
+    pthread_mutex_unlock(&stripe->lock);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_start_txn(
+  struct cvmcache_hash *id,
+  uint64_t txn_id,
+  struct cvmcache_object_info *info)
+{
+  ObjectHeader object_header;
+  object_header.txn_id = txn_id;
+  if (info->size != CVMCACHE_SIZE_UNKNOWN)
+    object_header.size_data = info->size;
+  else
+    object_header.size_data = 4096;
+  if (info->description != NULL)
+    object_header.size_desc = strlen(info->description) + 1;
+  object_header.type = info->type;
+  object_header.id = *id;
+
+  uint64_t total_size = sizeof(object_header) +
+                        object_header.size_desc + object_header.size_data;
+  MutexLockGuard guard(Me()->lock_);
+  ObjectHeader *allocd_object =
+    Me()->AllocateObject(total_size, object_header);
+  if (allocd_object == NULL)
+    return CVMCACHE_STATUS_NOSPACE;
+
+  allocd_object->SetDescription(info->description);
+  Me()->transactions_.Insert(txn_id, allocd_object);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+/**
+ * The transaction object is private to the calling client, so that the data
+ * is copied without holding the global lock.
+ */
+int PluginRamCache::ram_write_txn(
+  uint64_t txn_id,
+  unsigned char *buffer,
+  uint32_t size)
+{
+  ObjectHeader *txn_object;
+  {
+    MutexLockGuard guard(Me()->lock_);
+    int retval = Me()->transactions_.Lookup(txn_id, &txn_object);
+    assert(retval);
+    assert(size > 0);
+
+    if ((txn_object->nbytes_written + size) > txn_object->size_data) {
+      uint64_t header_size = sizeof(ObjectHeader) + txn_object->size_desc;
+      uint64_t new_size = std::max(
+        header_size + txn_object->nbytes_written + size,
+        uint64_t((header_size + txn_object->size_data) *
+                 kObjectExpandFactor));
+      ObjectHeader *new_object =
+        Me()->AllocateObject(new_size, *txn_object);
+      if (new_object == NULL)
+        return CVMCACHE_STATUS_NOSPACE;
+      memcpy(reinterpret_cast<char *>(new_object) + sizeof(ObjectHeader),
+             reinterpret_cast<char *>(txn_object) + sizeof(ObjectHeader),
+             txn_object->size_desc + txn_object->nbytes_written);
+      Me()->FreeObject(txn_object);
+      txn_object = new_object;
+      Me()->transactions_.Insert(txn_id, txn_object);
+    }
+  }
+
+  memcpy(txn_object->GetData() + txn_object->nbytes_written, buffer, size);
+  txn_object->nbytes_written += size;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_commit_txn(uint64_t txn_id) {
+  MutexLockGuard guard(Me()->lock_);
+  ObjectHeader *txn_object;
+  int retval = Me()->transactions_.Lookup(txn_id, &txn_object);
+  assert(retval);
+  Me()->transactions_.Erase(txn_id);
+
+  ComparableHash h(txn_object->id);
+  IndexStripe *stripe = Me()->GetStripe(h);
+  ObjectHeader *existing_object = NULL;
+  {
+    MutexLockGuard guard_stripe(stripe->lock);
+    if (stripe->objects.Lookup(h, &existing_object)) {
+      // Concurrent addition of same objects, drop the one at hand and
+      // increase ref count of existing copy
+      if (existing_object->refcnt == 0)
+        atomic_xadd64(&Me()->pinned_bytes_, existing_object->size_data);
+      existing_object->refcnt++;
+    } else {
+      txn_object->txn_id = uint64_t(-1);
+      txn_object->size_data = txn_object->nbytes_written;
+      txn_object->refcnt = 1;
+      atomic_xadd64(&Me()->pinned_bytes_, txn_object->size_data);
+      stripe->objects.Insert(h, txn_object);
+    }
+  }
+
+  if (existing_object != NULL) {
+    Me()->FreeObject(txn_object);
+  } else {
+    Me()->cache_info_.used_bytes += txn_object->size_data;
+    LruList *lru = Me()->GetLruList(txn_object->size_class);
+    MutexLockGuard guard_lru(lru->lock);
+    txn_object->last_access = atomic_xadd64(&Me()->access_clock_, 1);
+    lru->PushFront(txn_object);
+  }
+  Me()->UpdateDangerZone();
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_abort_txn(uint64_t txn_id) {
+  MutexLockGuard guard(Me()->lock_);
+  ObjectHeader *txn_object;
+  int retval = Me()->transactions_.Lookup(txn_id, &txn_object);
+  assert(retval);
+  Me()->transactions_.Erase(txn_id);
+  Me()->FreeObject(txn_object);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_info(struct cvmcache_info *info) {
+  MutexLockGuard guard(Me()->lock_);
+  *info = Me()->cache_info_;
+  info->pinned_bytes = atomic_read64(&Me()->pinned_bytes_);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_shrink(uint64_t shrink_to, uint64_t *used) {
+  MutexLockGuard guard(Me()->lock_);
+  *used = Me()->cache_info_.used_bytes;
+  if (*used <= shrink_to)
+    return CVMCACHE_STATUS_OK;
+
+  Me()->DoShrink(shrink_to);
+  *used = Me()->cache_info_.used_bytes;
+  return (*used <= shrink_to) ? CVMCACHE_STATUS_OK : CVMCACHE_STATUS_PARTIAL;
+}
+
+
+int PluginRamCache::ram_listing_begin(
+  uint64_t lst_id,
+  enum cvmcache_object_type type)
+{
+  Listing *lst = new Listing();
+  // Objects cannot be evicted while we hold the global lock
+  MutexLockGuard guard(Me()->lock_);
+  for (unsigned i = 0; i <= Me()->allocator_->num_size_classes(); ++i) {
+    LruList *lru = &Me()->lru_lists_[i];
+    MutexLockGuard guard_lru(lru->lock);
+    for (ObjectHeader *object = lru->head; object != NULL;
+         object = object->lru_next)
+    {
+      if (object->type != type)
+        continue;
+
+      struct cvmcache_object_info item;
+      item.id = object->id;
+      item.size = object->size_data;
+      item.type = type;
+      item.pinned = object->refcnt != 0;
+      item.description = (object->size_desc > 0)
+                         ? strdup(object->GetDescription())
+                         : NULL;
+      lst->elems.push_back(item);
+    }
+  }
+
+  Me()->listings_.Insert(lst_id, lst);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_listing_next(
+  int64_t listing_id,
+  struct cvmcache_object_info *item)
+{
+  MutexLockGuard guard(Me()->lock_);
+  Listing *lst;
+  bool retval = Me()->listings_.Lookup(listing_id, &lst);
+  assert(retval);
+  if (lst->pos >= lst->elems.size())
+    return CVMCACHE_STATUS_OUTOFBOUNDS;
+  *item = lst->elems[lst->pos];
+  lst->pos++;
+  return CVMCACHE_STATUS_OK;
+}
+
+
+int PluginRamCache::ram_listing_end(int64_t listing_id) {
+  MutexLockGuard guard(Me()->lock_);
+  Listing *lst;
+  bool retval = Me()->listings_.Lookup(listing_id, &lst);
+  assert(retval);
+
+  // Don't free description strings, done by the library
+  delete lst;
+  Me()->listings_.Erase(listing_id);
+  return CVMCACHE_STATUS_OK;
+}
+
+
+PluginRamCache::PluginRamCache(uint64_t mem_size)
+  : ctx_(NULL)
+{
+  atomic_init64(&pinned_bytes_);
+  atomic_init64(&access_clock_);
+  atomic_init32(&in_danger_zone_);
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+
+  uint64_t num_slabs =
+    std::max(kMinSize, uint64_t(mem_size * (1.0 - kIndexFraction))) /
+    kSlabSize;
+  uint64_t arena_size = num_slabs * kSlabSize;
+  arena_ = reinterpret_cast<unsigned char *>(smmap(arena_size));
+  allocator_ = new SlabAllocator(num_slabs, num_slabs, kSlabSize,
+                                 kMinChunkSize, kNumSizeClasses);
+  lru_lists_ = new LruList[kNumSizeClasses + 1];
+  memset(&cache_info_, 0, sizeof(cache_info_));
+  cache_info_.size_bytes = arena_size;
+
+  struct cvmcache_hash hash_empty;
+  memset(&hash_empty, 0, sizeof(hash_empty));
+  stripes_ = new IndexStripe[kNumStripes];
+  for (unsigned i = 0; i < kNumStripes; ++i)
+    stripes_[i].objects.Init(64, ComparableHash(hash_empty), hasher_any);
+  transactions_.Init(64, uint64_t(-1), hasher_uint64);
+  listings_.Init(8, uint64_t(-1), hasher_uint64);
+
+  LogCvmfs(kLogCvmfs, kLogStdout, "Allocating %" PRIu64 "MB of memory "
+           "in %" PRIu64 " slabs", arena_size / (1024 * 1024), num_slabs);
+}
+
+
+/**
+ * Allocates memory for an object and copies the template header into it.
+ * Evicts unpinned objects if necessary.  Returns NULL if there is not enough
+ * space.  Called with the global lock held.
+ */
+ObjectHeader *PluginRamCache::AllocateObject(
+  uint64_t total_size,
+  const ObjectHeader &object_header)
+{
+  if (total_size > cache_info_.size_bytes)
+    return NULL;
+
+  uint8_t size_class = allocator_->GetSizeClass(total_size);
+  uint64_t offset;
+  while (!allocator_->Allocate(total_size, size_class, &offset)) {
+    // Preferably recycle a chunk of the same size class
+    if ((size_class != SlabAllocator::kClassRun) &&
+        EvictFromList(GetLruList(size_class), false))
+    {
+      continue;
+    }
+    uint64_t used_bytes = cache_info_.used_bytes;
+    DoShrink(uint64_t(used_bytes * kShrinkFactor));
+    if (cache_info_.used_bytes == used_bytes)
+      return NULL;
+  }
+
+  ObjectHeader *object = reinterpret_cast<ObjectHeader *>(arena_ + offset);
+  *object = object_header;
+  object->size_class = size_class;
+  object->alloc_size = total_size;
+  object->lru_prev = NULL;
+  object->lru_next = NULL;
+  object->in_lru = false;
+  if (object->txn_id != uint64_t(-1)) {
+    // Use the chunk's slack as room for the transaction to grow
+    object->size_data =
+      allocator_->GetCapacity(total_size, size_class) -
+      sizeof(ObjectHeader) - object->size_desc;
+  }
+  return object;
+}
+
+
+/**
+ * Evicts volatile objects first, then the least recently used objects
+ * across all size classes.  Called with the global lock held.
+ */
+void PluginRamCache::DoShrink(uint64_t shrink_to) {
+  unsigned num_lists = allocator_->num_size_classes() + 1;
+  for (unsigned i = 0; i < num_lists; ++i) {
+    while ((cache_info_.used_bytes > shrink_to) &&
+           EvictFromList(&lru_lists_[i], true))
+    { }
+  }
+
+  vector<bool> exhausted(num_lists, false);
+  while (cache_info_.used_bytes > shrink_to) {
+    LruList *oldest_list = NULL;
+    unsigned oldest_idx = 0;
+    uint64_t oldest_access = 0;
+    for (unsigned i = 0; i < num_lists; ++i) {
+      if (exhausted[i])
+        continue;
+      MutexLockGuard guard_lru(lru_lists_[i].lock);
+      ObjectHeader *tail = lru_lists_[i].tail;
+      if (tail == NULL) {
+        exhausted[i] = true;
+        continue;
+      }
+      if ((oldest_list == NULL) || (tail->last_access < oldest_access)) {
+        oldest_list = &lru_lists_[i];
+        oldest_idx = i;
+        oldest_access = tail->last_access;
+      }
+    }
+    if (oldest_list == NULL)
+      break;
+    if (!EvictFromList(oldest_list, false))
+      exhausted[oldest_idx] = true;
+  }
+
+  cache_info_.no_shrink++;
+}
+
+
+/**
+ * Removes the least recently used unpinned (volatile) object of an LRU list.
+ * Returns false if there is no such object.  Called with the global lock
+ * held.
+ */
+bool PluginRamCache::EvictFromList(LruList *lru, bool volatile_only) {
+  MutexLockGuard guard_lru(lru->lock);
+  for (ObjectHeader *object = lru->tail; object != NULL;
+       object = object->lru_prev)
+  {
+    if (volatile_only && (object->type != CVMCACHE_OBJECT_VOLATILE))
+      continue;
+    ComparableHash h(object->id);
+    IndexStripe *stripe = GetStripe(h);
+    {
+      MutexLockGuard guard_stripe(stripe->lock);
+      if (object->refcnt != 0)
+        continue;
+      stripe->objects.Erase(h);
+    }
+    lru->Remove(object);
+    cache_info_.used_bytes -= object->size_data;
+    FreeObject(object);
+    return true;
+  }
+  return false;
+}
+
+
+/**
+ * Called with the global lock held.
+ */
+void PluginRamCache::FreeObject(ObjectHeader *object) {
+  allocator_->Free(reinterpret_cast<unsigned char *>(object) - arena_,
+                   object->alloc_size, object->size_class);
+}
+
+
+LruList *PluginRamCache::GetLruList(uint8_t size_class) {
+  if (size_class == SlabAllocator::kClassRun)
+    return &lru_lists_[allocator_->num_size_classes()];
+  return &lru_lists_[size_class];
+}
+
+
+IndexStripe *PluginRamCache::GetStripe(const ComparableHash &h) {
+  return &stripes_[h.hash.digest[sizeof(h.hash.digest) - 1] % kNumStripes];
+}
+
+
+bool PluginRamCache::IsInDangerZone() {
+  return (static_cast<double>(atomic_read64(&pinned_bytes_)) /
+          static_cast<double>(cache_info_.size_bytes)) >
+         kDangerZoneThreshold;
+}
+
+
+/**
+ * Moves a pinned object to the front of its LRU list.
+ */
+void PluginRamCache::TouchObject(ObjectHeader *object) {
+  LruList *lru = GetLruList(object->size_class);
+  MutexLockGuard guard_lru(lru->lock);
+  if (!object->in_lru)
+    return;
+  object->last_access = atomic_xadd64(&access_clock_, 1);
+  if (lru->head == object)
+    return;
+  lru->Remove(object);
+  lru->PushFront(object);
+}
+
+
+/**
+ * Asks clients to release nested catalogs once when too much of the cache is
+ * pinned.
+ */
+void PluginRamCache::UpdateDangerZone() {
+  if (IsInDangerZone()) {
+    if (atomic_cas32(&in_danger_zone_, 0, 1) && (ctx_ != NULL))
+      cvmcache_ask_detach(ctx_);
+  } else {
+    atomic_cas32(&in_danger_zone_, 1, 0);
+  }
+}
@@ -0,0 +1,135 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CACHE_PLUGIN_RAM_CACHE_H_
+#define CVMFS_CACHE_PLUGIN_RAM_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "atomic.h"
+#include "cache_plugin/libcvmfs_cache.h"
+#include "smallhash.h"
+#include "util/single_copy.h"
+
+class SlabAllocator;
+struct ComparableHash;
+struct IndexStripe;
+struct Listing;
+struct LruList;
+struct ObjectHeader;
+
+/**
+ * Implements all the cache plugin callbacks.  Singelton.  The callbacks can be
+ * called concurrently from several worker threads.
+ *
+ * Objects are stored in a fixed-size memory arena that is managed by a slab
+ * allocator, so objects never move once they are allocated.  Committed objects
+ * are found through a lock-striped hash index and they are kept in one LRU
+ * list per size class.  Reading and reference counting only take the lock of
+ * an index stripe.
+ *
+ * The global lock protects the transactions, the listings, the slab allocator,
+ * and the used bytes.  Objects are only removed from the index under the
+ * global lock.  Locks are acquired in the order global lock, LRU list lock,
+ * index stripe lock.
+ */
+class PluginRamCache : SingleCopy {
+ public:
+  /**
+   * The size is given in megabytes or as a percentage of the physical memory,
+   * e.g. "25%".
+   */
+  static PluginRamCache *Create(const std::string &mem_size_str);
+  ~PluginRamCache();
+
+  /**
+   * Used when detaching nested catalogs.  Without a context, the plugin does
+   * not ask clients to release pinned objects.
+   */
+  void set_context(struct cvmcache_context *ctx) { ctx_ = ctx; }
+
+  static int ram_chrefcnt(struct cvmcache_hash *id, int32_t change_by);
+  static int ram_obj_info(struct cvmcache_hash *id,
+                          struct cvmcache_object_info *info);
+  static int ram_pread(struct cvmcache_hash *id,
+                       uint64_t offset,
+                       uint32_t *size,
+                       unsigned char *buffer);
+  static int ram_start_txn(struct cvmcache_hash *id,
+                           uint64_t txn_id,
+                           struct cvmcache_object_info *info);
+  static int ram_write_txn(uint64_t txn_id,
+                           unsigned char *buffer,
+                           uint32_t size);
+  static int ram_commit_txn(uint64_t txn_id);
+  static int ram_abort_txn(uint64_t txn_id);
+  static int ram_info(struct cvmcache_info *info);
+  static int ram_shrink(uint64_t shrink_to, uint64_t *used);
+  static int ram_listing_begin(uint64_t lst_id,
+                               enum cvmcache_object_type type);
+  static int ram_listing_next(int64_t listing_id,
+                              struct cvmcache_object_info *item);
+  static int ram_listing_end(int64_t listing_id);
+
+ private:
+  static const uint64_t kMinSize;  // 100 * 1024 * 1024;
+  static const double kShrinkFactor;  //  = 0.75;
+  static const double kObjectExpandFactor;  // = 1.5;
+  static const double kIndexFraction;  // = 0.04;
+  static const double kDangerZoneThreshold;  // = 0.7
+  /**
+   * Chunks of 256B, 512B, ..., 512kB, larger objects use runs of 1MB slabs.
+   */
+  static const uint64_t kSlabSize;  // = 1024 * 1024;
+  static const uint64_t kMinChunkSize;  // = 256;
+  static const uint8_t kNumSizeClasses;  // = 12;
+  static const unsigned kNumStripes = 64;
+
+  static PluginRamCache *instance_;
+  static PluginRamCache *Me() {
+    return instance_;
+  }
+  explicit PluginRamCache(uint64_t mem_size);
+
+  ObjectHeader *AllocateObject(uint64_t total_size,
+                               const ObjectHeader &object_header);
+  void DoShrink(uint64_t shrink_to);
+  bool EvictFromList(LruList *lru, bool volatile_only);
+  void FreeObject(ObjectHeader *object);
+  LruList *GetLruList(uint8_t size_class);
+  IndexStripe *GetStripe(const ComparableHash &h);
+  bool IsInDangerZone();
+  void TouchObject(ObjectHeader *object);
+  void UpdateDangerZone();
+
+  /**
+   * Only used_bytes and no_shrink are maintained, protected by lock_.
+   */
+  struct cvmcache_info cache_info_;
+  atomic_int64 pinned_bytes_;
+  /**
+   * Logical time stamp for the LRU lists
+   */
+  atomic_int64 access_clock_;
+  atomic_int32 in_danger_zone_;
+  pthread_mutex_t lock_;
+  SmallHashDynamic<uint64_t, ObjectHeader *> transactions_;
+  SmallHashDynamic<uint64_t, Listing *> listings_;
+  /**
+   * kNumStripes parts of the object index
+   */
+  IndexStripe *stripes_;
+  /**
+   * One list per size class and one for the objects stored in slab runs
+   */
+  LruList *lru_lists_;
+  unsigned char *arena_;
+  SlabAllocator *allocator_;
+  struct cvmcache_context *ctx_;
+};  // class PluginRamCache
+
+#endif  // CVMFS_CACHE_PLUGIN_RAM_CACHE_H_
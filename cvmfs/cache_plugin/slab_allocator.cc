@@ -0,0 +1,225 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include "cvmfs_config.h"
+#include "slab_allocator.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace std;  // NOLINT
+
+const uint8_t SlabAllocator::kClassRun;
+const uint8_t SlabAllocator::kClassFree;
+
+
+/**
+ * Hands out alloc_size bytes from a chunk of size_class or from a run of
+ * slabs.  Returns false if there is no free space.
+ */
+bool SlabAllocator::Allocate(
+  uint64_t alloc_size,
+  uint8_t size_class,
+  uint64_t *offset)
+{
+  if (size_class == kClassRun) {
+    uint64_t num_run_slabs = GetNumRunSlabs(alloc_size);
+    uint64_t first_slab;
+    if (!FindFreeSlabs(num_run_slabs, &first_slab))
+      return false;
+    for (uint64_t i = 0; i < num_run_slabs; ++i)
+      slab_class_[first_slab + i] = kClassRun;
+    num_free_slabs_ -= num_run_slabs;
+    *offset = first_slab * slab_size_;
+    return true;
+  }
+
+  assert(size_class < num_size_classes_);
+  if (partial_slabs_[size_class].empty()) {
+    uint64_t slab;
+    if (!FindFreeSlabs(1, &slab))
+      return false;
+    TakeSlab(slab, size_class);
+  }
+  uint64_t slab = *partial_slabs_[size_class].begin();
+  uint64_t *bitmap = &bitmaps_[slab * bitmap_words_];
+  unsigned chunk = 0;
+  while (~bitmap[chunk / 64] == 0)
+    chunk += 64;
+  while (bitmap[chunk / 64] & (uint64_t(1) << (chunk % 64)))
+    chunk++;
+  MarkChunk(slab, chunk, size_class);
+  *offset = slab * slab_size_ + chunk * GetChunkSize(size_class);
+  return true;
+}
+
+
+/**
+ * Used to rebuild the allocator state from a persistent index.  Returns false
+ * if the allocation is invalid or overlaps with a previous one.
+ */
+bool SlabAllocator::Claim(
+  uint64_t offset,
+  uint64_t alloc_size,
+  uint8_t size_class)
+{
+  uint64_t slab = offset / slab_size_;
+  if (size_class == kClassRun) {
+    uint64_t num_run_slabs = GetNumRunSlabs(alloc_size);
+    if (((offset % slab_size_) != 0) || (slab + num_run_slabs > num_slabs_))
+      return false;
+    for (uint64_t i = 0; i < num_run_slabs; ++i) {
+      if (slab_class_[slab + i] != kClassFree)
+        return false;
+    }
+    for (uint64_t i = 0; i < num_run_slabs; ++i)
+      slab_class_[slab + i] = kClassRun;
+    num_free_slabs_ -= num_run_slabs;
+    return true;
+  }
+
+  if ((size_class >= num_size_classes_) || (slab >= num_slabs_))
+    return false;
+  uint64_t chunk_size = GetChunkSize(size_class);
+  if (((offset % slab_size_) % chunk_size) != 0)
+    return false;
+  if (slab_class_[slab] == kClassFree)
+    TakeSlab(slab, size_class);
+  if (slab_class_[slab] != size_class)
+    return false;
+  unsigned chunk = (offset % slab_size_) / chunk_size;
+  if (bitmaps_[slab * bitmap_words_ + chunk / 64] &
+      (uint64_t(1) << (chunk % 64)))
+  {
+    return false;
+  }
+  MarkChunk(slab, chunk, size_class);
+  return true;
+}
+
+
+/**
+ * First fit search for num contiguous free slabs within one segment.
+ */
+bool SlabAllocator::FindFreeSlabs(uint64_t num, uint64_t *first_slab) {
+  if ((num > num_free_slabs_) || (num > slabs_per_segment_))
+    return false;
+  uint64_t run_length = 0;
+  for (uint64_t i = 0; i < num_slabs_; ++i) {
+    if ((i % slabs_per_segment_) == 0)
+      run_length = 0;
+    if (slab_class_[i] != kClassFree) {
+      run_length = 0;
+      continue;
+    }
+    run_length++;
+    if (run_length == num) {
+      *first_slab = i + 1 - num;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void SlabAllocator::Free(
+  uint64_t offset,
+  uint64_t alloc_size,
+  uint8_t size_class)
+{
+  uint64_t slab = offset / slab_size_;
+  if (size_class == kClassRun) {
+    uint64_t num_run_slabs = GetNumRunSlabs(alloc_size);
+    for (uint64_t i = 0; i < num_run_slabs; ++i) {
+      assert(slab_class_[slab + i] == kClassRun);
+      slab_class_[slab + i] = kClassFree;
+    }
+    num_free_slabs_ += num_run_slabs;
+    return;
+  }
+
+  assert(slab_class_[slab] == size_class);
+  unsigned chunk = (offset % slab_size_) / GetChunkSize(size_class);
+  uint64_t *word = &bitmaps_[slab * bitmap_words_ + chunk / 64];
+  assert(*word & (uint64_t(1) << (chunk % 64)));
+  *word &= ~(uint64_t(1) << (chunk % 64));
+  if (chunks_used_[slab] == GetNumChunks(size_class))
+    partial_slabs_[size_class].insert(slab);
+  chunks_used_[slab]--;
+  if (chunks_used_[slab] == 0) {
+    partial_slabs_[size_class].erase(slab);
+    slab_class_[slab] = kClassFree;
+    num_free_slabs_++;
+  }
+}
+
+
+/**
+ * Number of bytes that can be written to an allocation of alloc_size.
+ */
+uint64_t SlabAllocator::GetCapacity(
+  uint64_t alloc_size,
+  uint8_t size_class) const
+{
+  if (size_class == kClassRun)
+    return GetNumRunSlabs(alloc_size) * slab_size_;
+  return GetChunkSize(size_class);
+}
+
+
+uint8_t SlabAllocator::GetSizeClass(uint64_t size) const {
+  uint64_t chunk_size = min_chunk_size_;
+  for (uint8_t i = 0; i < num_size_classes_; ++i) {
+    if (size <= chunk_size)
+      return i;
+    chunk_size *= 2;
+  }
+  return kClassRun;
+}
+
+
+void SlabAllocator::MarkChunk(
+  uint64_t slab,
+  unsigned chunk,
+  uint8_t size_class)
+{
+  bitmaps_[slab * bitmap_words_ + chunk / 64] |= uint64_t(1) << (chunk % 64);
+  chunks_used_[slab]++;
+  if (chunks_used_[slab] == GetNumChunks(size_class))
+    partial_slabs_[size_class].erase(slab);
+}
+
+
+SlabAllocator::SlabAllocator(
+  uint64_t num_slabs,
+  uint64_t slabs_per_segment,
+  uint64_t slab_size,
+  uint64_t min_chunk_size,
+  uint8_t num_size_classes)
+  : num_slabs_(num_slabs)
+  , slabs_per_segment_(slabs_per_segment)
+  , slab_size_(slab_size)
+  , min_chunk_size_(min_chunk_size)
+  , num_size_classes_(num_size_classes)
+  , bitmap_words_(slab_size / min_chunk_size / 64)
+  , num_free_slabs_(num_slabs)
+  , slab_class_(num_slabs, kClassFree)
+  , chunks_used_(num_slabs, 0)
+  , bitmaps_(num_slabs * (slab_size / min_chunk_size / 64), 0)
+  , partial_slabs_(num_size_classes)
+{
+  assert(bitmap_words_ > 0);
+  assert((min_chunk_size_ << (num_size_classes_ - 1)) <= slab_size_);
+  assert(num_size_classes_ < kClassFree);
+}
+
+
+void SlabAllocator::TakeSlab(uint64_t slab, uint8_t size_class) {
+  assert(slab_class_[slab] == kClassFree);
+  slab_class_[slab] = size_class;
+  chunks_used_[slab] = 0;
+  memset(&bitmaps_[slab * bitmap_words_], 0,
+         bitmap_words_ * sizeof(bitmaps_[0]));
+  partial_slabs_[size_class].insert(slab);
+  num_free_slabs_--;
+}
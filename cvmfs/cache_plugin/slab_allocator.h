@@ -0,0 +1,85 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#ifndef CVMFS_CACHE_PLUGIN_SLAB_ALLOCATOR_H_
+#define CVMFS_CACHE_PLUGIN_SLAB_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <set>
+#include <vector>
+
+#include "util/single_copy.h"
+
+/**
+ * Manages a linear address space for the cache plugins, e.g. a memory arena or
+ * a set of extent files.  The space is cut into slabs.  Small allocations are
+ * served from slabs that are carved into equally sized chunks of a size class
+ * (powers of two starting at min_chunk_size).  Allocations larger than the
+ * largest size class occupy a run of contiguous slabs.  Neither chunks nor
+ * runs cross a segment boundary (slabs_per_segment).
+ *
+ * The allocator never moves allocations, so that pointers remain valid.
+ * Internal fragmentation is bounded by the size class granularity.  Not
+ * thread-safe.
+ */
+class SlabAllocator : SingleCopy {
+ public:
+  static const uint8_t kClassRun = 0xFF;
+
+  SlabAllocator(uint64_t num_slabs,
+                uint64_t slabs_per_segment,
+                uint64_t slab_size,
+                uint64_t min_chunk_size,
+                uint8_t num_size_classes);
+
+  uint8_t GetSizeClass(uint64_t size) const;
+  uint64_t GetCapacity(uint64_t alloc_size, uint8_t size_class) const;
+  bool Allocate(uint64_t alloc_size, uint8_t size_class, uint64_t *offset);
+  bool Claim(uint64_t offset, uint64_t alloc_size, uint8_t size_class);
+  void Free(uint64_t offset, uint64_t alloc_size, uint8_t size_class);
+
+  uint64_t num_slabs() const { return num_slabs_; }
+  uint64_t num_free_slabs() const { return num_free_slabs_; }
+  uint64_t slab_size() const { return slab_size_; }
+  uint8_t num_size_classes() const { return num_size_classes_; }
+
+ private:
+  static const uint8_t kClassFree = 0xFE;
+
+  uint64_t GetChunkSize(uint8_t size_class) const {
+    return min_chunk_size_ << size_class;
+  }
+  unsigned GetNumChunks(uint8_t size_class) const {
+    return slab_size_ / GetChunkSize(size_class);
+  }
+  uint64_t GetNumRunSlabs(uint64_t alloc_size) const {
+    return (alloc_size + slab_size_ - 1) / slab_size_;
+  }
+  bool FindFreeSlabs(uint64_t num, uint64_t *first_slab);
+  void TakeSlab(uint64_t slab, uint8_t size_class);
+  void MarkChunk(uint64_t slab, unsigned chunk, uint8_t size_class);
+
+  uint64_t num_slabs_;
+  uint64_t slabs_per_segment_;
+  uint64_t slab_size_;
+  uint64_t min_chunk_size_;
+  uint8_t num_size_classes_;
+  unsigned bitmap_words_;
+  uint64_t num_free_slabs_;
+  /**
+   * Either a size class, kClassRun, or kClassFree
+   */
+  std::vector<uint8_t> slab_class_;
+  std::vector<uint32_t> chunks_used_;
+  /**
+   * One bit per chunk of the smallest size class for every slab
+   */
+  std::vector<uint64_t> bitmaps_;
+  /**
+   * Slabs of a size class that have at least one free chunk
+   */
+  std::vector<std::set<uint64_t> > partial_slabs_;
+};  // class SlabAllocator
+
+#endif  // CVMFS_CACHE_PLUGIN_SLAB_ALLOCATOR_H_
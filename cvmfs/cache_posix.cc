@@ -421,8 +421,16 @@ int PosixCacheManager::Rename(const char *oldpath, const char *newpath) {
 /**
  * Used by the sqlite vfs in order to preload file catalogs into the file system
  * buffers.
+ *
+ * The kernel readahead does not copy the file to user space and returns
+ * quickly if the file is already in the page cache, as it is for a freshly
+ * downloaded catalog.  Reading the file is the fallback for file systems
+ * without readahead support.
  */
 int PosixCacheManager::Readahead(int fd) {
+  if (platform_readahead(fd) == 0)
+    return 0;
+
   unsigned char *buf[4096];
   int nbytes;
   uint64_t pos = 0;
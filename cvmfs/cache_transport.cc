@@ -6,7 +6,9 @@
 
 #include <alloca.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <cstdlib>
@@ -54,6 +56,8 @@ CacheTransport::Frame::Frame()
   , msg_typed_(NULL)
   , attachment_(NULL)
   , att_size_(0)
+  , passed_fd_(-1)
+  , owns_passed_fd_(false)
   , is_wrapped_(false)
   , is_msg_out_of_band_(false)
 { }
@@ -64,6 +68,8 @@ CacheTransport::Frame::Frame(google::protobuf::MessageLite *m)
   , msg_typed_(m)
   , attachment_(NULL)
   , att_size_(0)
+  , passed_fd_(-1)
+  , owns_passed_fd_(false)
   , is_wrapped_(false)
   , is_msg_out_of_band_(false)
 { }
@@ -88,8 +94,8 @@ void CacheTransport::Frame::MergeFrom(const Frame &other) {
   if (other.att_size_ > 0) {
     assert(att_size_ >= other.att_size_);
     memcpy(attachment_, other.attachment_, other.att_size_);
-    att_size_ = other.att_size_;
   }
+  att_size_ = other.att_size_;
 }
 
 
@@ -134,6 +140,10 @@ void CacheTransport::Frame::Release() {
 void CacheTransport::Frame::Reset(uint32_t original_att_size) {
   msg_typed_ = NULL;
   att_size_ = original_att_size;
+  if (owns_passed_fd_)
+    close(passed_fd_);
+  passed_fd_ = -1;
+  owns_passed_fd_ = false;
   is_wrapped_ = false;
   is_msg_out_of_band_ = false;
   Release();
@@ -368,9 +378,13 @@ bool CacheTransport::ParseObjectType(
 bool CacheTransport::RecvFrame(CacheTransport::Frame *frame) {
   uint32_t size;
   bool has_attachment;
-  bool retval = RecvHeader(&size, &has_attachment);
-  if (!retval)
+  int passed_fd = -1;
+  bool retval = RecvHeader(&size, &has_attachment, &passed_fd);
+  if (!retval) {
+    if (passed_fd >= 0) close(passed_fd);
     return false;
+  }
+  frame->AdoptPassedFd(passed_fd);
 
   void *buffer;
   if (size <= kMaxStackAlloc)
@@ -424,11 +438,57 @@ bool CacheTransport::RecvFrame(CacheTransport::Frame *frame) {
 }
 
 
-bool CacheTransport::RecvHeader(uint32_t *size, bool *has_attachment) {
+/**
+ * The header is received with recvmsg() so that a file descriptor that was
+ * sent along with the frame is picked up.  The received file descriptor is
+ * marked close-on-exec.  Truncated ancillary data is treated as an error.
+ */
+bool CacheTransport::RecvHeader(
+  uint32_t *size,
+  bool *has_attachment,
+  int *passed_fd)
+{
   unsigned char header[kHeaderSize];
-  ssize_t nbytes = SafeRead(fd_connection_, header, kHeaderSize);
-  if ((nbytes < 0) || (static_cast<unsigned>(nbytes) != kHeaderSize))
+  struct iovec iov;
+  iov.iov_base = header;
+  iov.iov_len = kHeaderSize;
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t nbytes;
+  do {
+    nbytes = recvmsg(fd_connection_, &msg, flags);
+  } while ((nbytes < 0) && (errno == EINTR));
+  if (nbytes <= 0)
+    return false;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+#ifndef MSG_CMSG_CLOEXEC
+      fcntl(*passed_fd, F_SETFD, FD_CLOEXEC);
+#endif
+      break;
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC)
     return false;
+  if (static_cast<unsigned>(nbytes) < kHeaderSize) {
+    const unsigned remaining = kHeaderSize - nbytes;
+    ssize_t nbytes_rest = SafeRead(fd_connection_, header + nbytes, remaining);
+    if ((nbytes_rest < 0) || (static_cast<unsigned>(nbytes_rest) != remaining))
+      return false;
+  }
   if ((header[0] & (~kFlagHasAttachment)) != kWireProtocolVersion)
     return false;
   *has_attachment = header[0] & kFlagHasAttachment;
@@ -441,7 +501,8 @@ void CacheTransport::SendData(
   void *message,
   uint32_t msg_size,
   void *attachment,
-  uint32_t att_size)
+  uint32_t att_size,
+  int passed_fd)
 {
   uint32_t total_size =
     msg_size + att_size + ((att_size > 0) ? kInnerHeaderSize : 0);
@@ -478,10 +539,13 @@ void CacheTransport::SendData(
     iov[1].iov_len = msg_size;
   }
   if (flags_ & kFlagSendNonBlocking) {
+    assert(passed_fd < 0);
     SendNonBlocking(iov, (att_size == 0) ? 2 : 4);
     return;
   }
-  bool retval = SafeWriteV(fd_connection_, iov, (att_size == 0) ? 2 : 4);
+  bool retval = (passed_fd < 0)
+    ? SafeWriteV(fd_connection_, iov, (att_size == 0) ? 2 : 4)
+    : SendWithFd(iov, (att_size == 0) ? 2 : 4, passed_fd);
 
   if (!retval && !(flags_ & kFlagSendIgnoreFailure)) {
     LogCvmfs(kLogCache, kLogSyslogErr | kLogDebug,
@@ -516,6 +580,41 @@ void CacheTransport::SendNonBlocking(struct iovec *iov, unsigned iovcnt) {
 }
 
 
+/**
+ * Sends the frame together with a file descriptor as ancillary data.  Only used
+ * for small control messages, so a short write is treated as a failure.
+ */
+bool CacheTransport::SendWithFd(
+  struct iovec *iov,
+  unsigned iovcnt,
+  int passed_fd)
+{
+  size_t total_size = 0;
+  for (unsigned i = 0; i < iovcnt; ++i)
+    total_size += iov[i].iov_len;
+
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  memset(cmsg_buf, 0, sizeof(cmsg_buf));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+
+  ssize_t nbytes;
+  do {
+    nbytes = sendmsg(fd_connection_, &msg, 0);
+  } while ((nbytes < 0) && (errno == EINTR));
+  return (nbytes >= 0) && (static_cast<size_t>(nbytes) == total_size);
+}
+
+
 void CacheTransport::SendFrame(CacheTransport::Frame *frame) {
   cvmfs::MsgRpc *msg_rpc = frame->GetMsgRpc();
   int32_t size = msg_rpc->ByteSize();
@@ -527,7 +626,8 @@ void CacheTransport::SendFrame(CacheTransport::Frame *frame) {
 #endif
   bool retval = msg_rpc->SerializeToArray(buffer, size);
   assert(retval);
-  SendData(buffer, size, frame->attachment(), frame->att_size());
+  SendData(buffer, size, frame->attachment(), frame->att_size(),
+           frame->passed_fd());
 #ifdef __APPLE__
   free(buffer);
 #endif
@@ -106,6 +106,22 @@ class CacheTransport {
       attachment_ = attachment;
       att_size_ = att_size;
     }
+    /**
+     * A file descriptor that is sent along with the frame as SCM_RIGHTS
+     * ancillary data (unix domain sockets only).  On the receiving end, the
+     * received file descriptor is owned by the frame and closed on Reset()
+     * unless it is taken over with ReleasePassedFd().
+     */
+    int passed_fd() const { return passed_fd_; }
+    void set_passed_fd(int fd) { passed_fd_ = fd; }
+    void AdoptPassedFd(int fd) {
+      passed_fd_ = fd;
+      owns_passed_fd_ = (fd >= 0);
+    }
+    int ReleasePassedFd() {
+      owns_passed_fd_ = false;
+      return passed_fd_;
+    }
 
     bool ParseMsgRpc(void *buffer, uint32_t size);
     cvmfs::MsgRpc *GetMsgRpc();
@@ -127,6 +143,8 @@ class CacheTransport {
     google::protobuf::MessageLite *msg_typed_;
     void *attachment_;
     uint32_t att_size_;
+    int passed_fd_;
+    bool owns_passed_fd_;
     bool is_wrapped_;
     bool is_msg_out_of_band_;
   };  // class CacheTransport::Frame
@@ -154,9 +172,11 @@ class CacheTransport {
   void SendData(void *message,
                 uint32_t msg_size,
                 void *attachment = NULL,
-                uint32_t att_size = 0);
+                uint32_t att_size = 0,
+                int passed_fd = -1);
   void SendNonBlocking(struct iovec *iov, unsigned iovcnt);
-  bool RecvHeader(uint32_t *size, bool *has_attachment);
+  bool SendWithFd(struct iovec *iov, unsigned iovcnt, int passed_fd);
+  bool RecvHeader(uint32_t *size, bool *has_attachment, int *passed_fd);
 
   int fd_connection_;
   uint32_t flags_;
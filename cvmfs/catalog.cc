@@ -2,14 +2,18 @@
  * This file is part of the CernVM File System.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "catalog.h"
 
 #include <alloca.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <algorithm>
 #include <cassert>
 
+#include "catalog_filter.h"
 #include "catalog_mgr.h"
 #include "logging.h"
 #include "platform.h"
@@ -62,6 +66,11 @@ Catalog::Catalog(const PathString &mountpoint,
   initialized_(false)
 {
   max_row_id_ = 0;
+  atomic_init64(&last_access_);
+  path_filter_ = NULL;
+  num_negative_lookups_ = 0;
+  spawned_path_filter_ = false;
+  atomic_init32(&stop_path_filter_);
   inode_annotation_ = NULL;
   lock_ = reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
   int retval = pthread_mutex_init(lock_, NULL);
@@ -82,9 +91,14 @@ Catalog::Catalog(const PathString &mountpoint,
 
 
 Catalog::~Catalog() {
+  if (spawned_path_filter_) {
+    atomic_write32(&stop_path_filter_, 1);
+    pthread_join(thread_path_filter_, NULL);
+  }
   pthread_mutex_destroy(lock_);
   free(lock_);
   FinalizePreparedStatements();
+  delete path_filter_;
   delete database_;
 }
 
@@ -289,6 +303,10 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
   assert(IsInitialized());
 
   pthread_mutex_lock(lock_);
+  if ((path_filter_ != NULL) && !path_filter_->MayContain(md5path)) {
+    pthread_mutex_unlock(lock_);
+    return false;
+  }
   sql_lookup_md5path_->BindPathHash(md5path);
   bool found = sql_lookup_md5path_->FetchRow();
   if (found && (dirent != NULL)) {
@@ -296,12 +314,80 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
     FixTransitionPoint(md5path, dirent);
   }
   sql_lookup_md5path_->Reset();
+  if (!found && (++num_negative_lookups_ == kPathFilterThreshold))
+    SpawnPathFilter();
   pthread_mutex_unlock(lock_);
 
   return found;
 }
 
 
+/**
+ * Starts a thread that fills a Bloom filter with all the path hashes of the
+ * catalog.  Writable catalogs change and thus do not get a filter.  Called
+ * with lock_ held.
+ */
+void Catalog::SpawnPathFilter() const {
+  if (spawned_path_filter_ || IsWritable() ||
+      (max_row_id_ > kPathFilterMaxEntries))
+  {
+    return;
+  }
+
+  int retval = pthread_create(&thread_path_filter_, NULL, MainPathFilter,
+                              const_cast<Catalog *>(this));
+  if (retval != 0) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to spawn path filter thread");
+    return;
+  }
+  spawned_path_filter_ = true;
+}
+
+
+/**
+ * Reads the path hashes in batches, so that lookups in the catalog can
+ * proceed while the filter is built.  The filter is only used once it
+ * contains all the rows.
+ */
+void *Catalog::MainPathFilter(void *data) {
+  Catalog *catalog = reinterpret_cast<Catalog *>(data);
+  PathHashFilter *filter = new PathHashFilter(catalog->max_row_id_);
+
+  pthread_mutex_lock(catalog->lock_);
+  SqlCatalog *sql_md5paths = new SqlCatalog(catalog->database(),
+    "SELECT md5path_1, md5path_2 FROM catalog;");
+  bool has_more = true;
+  while (has_more && (atomic_read32(&catalog->stop_path_filter_) == 0)) {
+    for (unsigned i = 0; i < kPathFilterBatchSize; ++i) {
+      has_more = sql_md5paths->FetchRow();
+      if (!has_more)
+        break;
+      filter->Add(sql_md5paths->RetrieveMd5(0, 1));
+    }
+    pthread_mutex_unlock(catalog->lock_);
+    pthread_mutex_lock(catalog->lock_);
+  }
+
+  const bool complete =
+    !has_more && (sql_md5paths->GetLastError() == SQLITE_DONE);
+  if (!has_more && !complete) {
+    LogCvmfs(kLogCatalog, kLogDebug,
+             "failed to build path filter for %s (SqliteErrorcode: %d)",
+             catalog->mountpoint_.c_str(), sql_md5paths->GetLastError());
+  }
+  delete sql_md5paths;
+  if (complete) {
+    catalog->path_filter_ = filter;
+    LogCvmfs(kLogCatalog, kLogDebug, "built path filter for %s (%" PRIu64
+             " B)", catalog->mountpoint_.c_str(), filter->GetMemoryUsage());
+  } else {
+    delete filter;
+  }
+  pthread_mutex_unlock(catalog->lock_);
+  return NULL;
+}
+
+
 /**
  * Performs a lookup on this Catalog for a given MD5 path hash.
  * @param md5path the MD5 hash of the searched path
@@ -572,6 +658,57 @@ string Catalog::PrintMemStatistics() const {
 }
 
 
+/**
+ * Approximate number of bytes used by this catalog's SQlite connection and
+ * its path filter.
+ */
+uint64_t Catalog::GetMemoryUsage() const {
+  sqlite::MemStatistics stats;
+  pthread_mutex_lock(lock_);
+  database().GetMemStatistics(&stats);
+  const uint64_t filter_size =
+    (path_filter_ != NULL) ? path_filter_->GetMemoryUsage() : 0;
+  pthread_mutex_unlock(lock_);
+  return stats.page_cache_used + stats.schema_used + stats.stmt_used +
+         filter_size;
+}
+
+
+uint64_t Catalog::GetNumPages() const {
+  pthread_mutex_lock(lock_);
+  const uint64_t result = database().GetPageCount();
+  pthread_mutex_unlock(lock_);
+  return result;
+}
+
+
+/**
+ * Limits the number of database pages this catalog keeps in the SQlite page
+ * cache.
+ */
+void Catalog::SetCachePages(const unsigned num_pages) {
+  pthread_mutex_lock(lock_);
+  const bool retval = database().SetCacheSize(num_pages);
+  pthread_mutex_unlock(lock_);
+  if (!retval) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to set cache size of %s",
+             mountpoint_.c_str());
+  }
+}
+
+
+/**
+ * True if inodes of hard link groups have been handed out.  They depend on
+ * the order of lookups and would change if the catalog was reloaded.
+ */
+bool Catalog::HasHardlinkInodes() const {
+  pthread_mutex_lock(lock_);
+  const bool result = !hardlink_groups_.empty();
+  pthread_mutex_unlock(lock_);
+  return result;
+}
+
+
 /**
  * Determine the actual inode of a DirectoryEntry.
  * The first used entry from a hardlink group deterimines the inode of the
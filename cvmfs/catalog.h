@@ -13,6 +13,7 @@
 #include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "catalog_counters.h"
 #include "catalog_sql.h"
 #include "directory_entry.h"
@@ -36,6 +37,7 @@ class AbstractCatalogManager;
 class Catalog;
 
 class Counters;
+class PathHashFilter;
 
 typedef std::vector<Catalog *> CatalogList;
 typedef IntegerMap<uint64_t> OwnerMap;  // used to map uid/gid
@@ -91,12 +93,29 @@ class InodeAnnotation {
 class Catalog : SingleCopy {
   FRIEND_TEST(T_Catalog, NormalizePath);
   FRIEND_TEST(T_Catalog, PlantPath);
+  FRIEND_TEST(T_CatalogFilter, Catalog);
   friend class swissknife::CommandMigrate;  // for catalog version migration
 
  public:
   typedef std::vector<shash::Any> HashVector;
 
   static const uint64_t kDefaultTTL = 900;  /**< 15 minutes default TTL */
+  /**
+   * After so many negative lookups, a Bloom filter of the catalog's path
+   * hashes is built in the background.  Once it is ready, lookups of
+   * non-existing paths skip SQlite.
+   */
+  static const unsigned kPathFilterThreshold = 64;
+  /**
+   * The filter thread reads so many rows at a time before it releases the
+   * catalog lock for other lookups.
+   */
+  static const unsigned kPathFilterBatchSize = 4096;
+  /**
+   * No filter for catalogs with more rows, it would take too long to build
+   * (1.25 bytes per entry)
+   */
+  static const uint64_t kPathFilterMaxEntries = 4 * 1024 * 1024;
 
   /**
    * Note: is_nested only has an effect if parent == NULL otherwise being
@@ -168,6 +187,10 @@ class Catalog : SingleCopy {
   shash::Any GetPreviousRevision() const;
   const Counters& GetCounters() const { return counters_; }
   std::string PrintMemStatistics() const;
+  uint64_t GetMemoryUsage() const;
+  uint64_t GetNumPages() const;
+  void SetCachePages(const unsigned num_pages);
+  bool HasHardlinkInodes() const;
 
   inline float schema() const { return database().schema_version(); }
   inline PathString mountpoint() const { return mountpoint_; }
@@ -180,6 +203,15 @@ class Catalog : SingleCopy {
   inline shash::Any hash() const { return catalog_hash_; }
   inline bool volatile_flag() const { return volatile_flag_; }
   inline uint64_t revision() const { return GetRevision(); }
+  inline uint64_t last_access() const { return atomic_read64(&last_access_); }
+  /**
+   * Called concurrently under the catalog manager's read lock.  Only writes
+   * if the value changes, so that hot catalogs are not constantly modified.
+   */
+  inline void set_last_access(const uint64_t value) const {
+    if (static_cast<uint64_t>(atomic_read64(&last_access_)) != value)
+      atomic_write64(&last_access_, value);
+  }
 
   inline bool IsInitialized() const {
     return inode_range_.IsInitialized() && initialized_;
@@ -280,6 +312,8 @@ class Catalog : SingleCopy {
                           StatEntryList *listing) const;
   bool LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
                    DirectoryEntry *dirent) const;
+  void SpawnPathFilter() const;
+  static void *MainPathFilter(void *data);
 
   CatalogDatabase *database_;
 
@@ -306,10 +340,28 @@ class Catalog : SingleCopy {
   mutable NestedCatalogList nested_catalog_cache_;
   mutable bool              nested_catalog_cache_dirty_;
 
+  /**
+   * NULL until enough negative lookups have been counted and the filter
+   * thread finished.  Protected by lock_.
+   */
+  mutable PathHashFilter *path_filter_;
+  mutable unsigned num_negative_lookups_;
+  mutable bool spawned_path_filter_;
+  mutable pthread_t thread_path_filter_;
+  /**
+   * Set by the destructor to abort a running filter thread
+   */
+  atomic_int32 stop_path_filter_;
+
   mutable VomsAuthzStatus voms_authz_status_;
   mutable std::string voms_authz_;
 
   bool initialized_;
+  /**
+   * Access clock of the catalog manager at the time of the last lookup in
+   * this catalog.  Used to find cold nested catalogs.
+   */
+  mutable atomic_int64 last_access_;
   InodeRange inode_range_;
   uint64_t max_row_id_;
   InodeAnnotation *inode_annotation_;
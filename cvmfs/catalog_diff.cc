@@ -0,0 +1,194 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_diff.h"
+
+#include <algorithm>
+
+#include "catalog.h"
+#include "directory_entry.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+static bool IsSmallerName(const DirectoryEntry &a, const DirectoryEntry &b) {
+  return a.name() < b.name();
+}
+
+
+bool CatalogDiff::Compare(
+  const map<PathString, shash::Any> &loaded_catalogs,
+  const shash::Any &new_root_hash)
+{
+  dentries_.clear();
+  directories_.clear();
+  map<PathString, shash::Any>::const_iterator iter_root =
+    loaded_catalogs.find(PathString("", 0));
+  if (iter_root == loaded_catalogs.end())
+    return false;
+  Catalog *old_root = OpenCatalog(PathString("", 0), iter_root->second);
+  if (old_root == NULL)
+    return false;
+
+  loaded_catalogs_ = &loaded_catalogs;
+  bool retval = DiffCatalog(old_root, new_root_hash);
+  loaded_catalogs_ = NULL;
+  CloseCatalog(old_root);
+  return retval;
+}
+
+
+void CatalogDiff::CloseCatalog(Catalog *catalog) {
+  delete catalog;
+}
+
+
+/**
+ * Compares a catalog of the old revision with its new version, which is opened
+ * and closed here.
+ */
+bool CatalogDiff::DiffCatalog(
+  const Catalog *old_catalog,
+  const shash::Any &new_hash)
+{
+  const PathString mountpoint = old_catalog->mountpoint();
+  Catalog *new_catalog = OpenCatalog(mountpoint, new_hash);
+  if (new_catalog == NULL)
+    return false;
+
+  bool retval = true;
+  if (old_catalog->IsRoot()) {
+    DirectoryEntry old_dirent;
+    DirectoryEntry new_dirent;
+    retval = old_catalog->LookupPath(mountpoint, &old_dirent) &&
+             new_catalog->LookupPath(mountpoint, &new_dirent);
+    if (retval && (old_dirent.CompareTo(new_dirent) !=
+                   DirectoryEntryBase::Difference::kIdentical))
+    {
+      directories_.push_back(mountpoint);
+    }
+  }
+  retval = retval && DiffDirectory(old_catalog, new_catalog, mountpoint);
+  CloseCatalog(new_catalog);
+  return retval;
+}
+
+
+/**
+ * Recursively compares the listings of path in both catalog versions.  Stops
+ * at nested catalog mountpoints, which are compared by their content hash.
+ */
+bool CatalogDiff::DiffDirectory(
+  const Catalog *old_catalog,
+  const Catalog *new_catalog,
+  const PathString &path)
+{
+  DirectoryEntryList old_listing;
+  DirectoryEntryList new_listing;
+  if (!old_catalog->ListingPath(path, &old_listing) ||
+      !new_catalog->ListingPath(path, &new_listing))
+  {
+    return false;
+  }
+  sort(old_listing.begin(), old_listing.end(), IsSmallerName);
+  sort(new_listing.begin(), new_listing.end(), IsSmallerName);
+
+  const DirectoryEntryBase::Differences kAttributes =
+    DirectoryEntryBase::Difference::kLinkcount |
+    DirectoryEntryBase::Difference::kSize |
+    DirectoryEntryBase::Difference::kMtime;
+  unsigned i_old = 0;
+  unsigned i_new = 0;
+  while ((i_old < old_listing.size()) || (i_new < new_listing.size())) {
+    if (dentries_.size() + directories_.size() > max_paths_)
+      return false;
+
+    PathString child_path(path);
+    child_path.Append("/", 1);
+    if ((i_new == new_listing.size()) ||
+        ((i_old < old_listing.size()) &&
+         IsSmallerName(old_listing[i_old], new_listing[i_new])))
+    {
+      // Removed
+      child_path.Append(old_listing[i_old].name().GetChars(),
+                        old_listing[i_old].name().GetLength());
+      dentries_.push_back(child_path);
+      i_old++;
+      continue;
+    }
+    if ((i_old == old_listing.size()) ||
+        IsSmallerName(new_listing[i_new], old_listing[i_old]))
+    {
+      // Added
+      child_path.Append(new_listing[i_new].name().GetChars(),
+                        new_listing[i_new].name().GetLength());
+      dentries_.push_back(child_path);
+      i_new++;
+      continue;
+    }
+
+    const DirectoryEntry &old_dirent = old_listing[i_old++];
+    const DirectoryEntry &new_dirent = new_listing[i_new++];
+    child_path.Append(old_dirent.name().GetChars(),
+                      old_dirent.name().GetLength());
+    DirectoryEntryBase::Differences diff = old_dirent.CompareTo(new_dirent);
+    if (!old_dirent.IsDirectory() || !new_dirent.IsDirectory() ||
+        ((diff & ~kAttributes) != DirectoryEntryBase::Difference::kIdentical))
+    {
+      if (diff != DirectoryEntryBase::Difference::kIdentical)
+        dentries_.push_back(child_path);
+      continue;
+    }
+    if (diff != DirectoryEntryBase::Difference::kIdentical)
+      directories_.push_back(child_path);
+
+    bool retval = old_dirent.IsNestedCatalogMountpoint() ?
+      DiffNested(old_catalog, new_catalog, child_path) :
+      DiffDirectory(old_catalog, new_catalog, child_path);
+    if (!retval)
+      return false;
+  }
+  return dentries_.size() + directories_.size() <= max_paths_;
+}
+
+
+/**
+ * Descends into a changed nested catalog if its old version is loaded.
+ */
+bool CatalogDiff::DiffNested(
+  const Catalog *old_catalog,
+  const Catalog *new_catalog,
+  const PathString &mountpoint)
+{
+  shash::Any old_nested_hash;
+  shash::Any new_nested_hash;
+  uint64_t size;
+  if (!old_catalog->FindNested(mountpoint, &old_nested_hash, &size) ||
+      !new_catalog->FindNested(mountpoint, &new_nested_hash, &size))
+  {
+    return false;
+  }
+  if (old_nested_hash == new_nested_hash)
+    return true;
+
+  map<PathString, shash::Any>::const_iterator iter_loaded =
+    loaded_catalogs_->find(mountpoint);
+  if ((iter_loaded == loaded_catalogs_->end()) ||
+      (iter_loaded->second != old_nested_hash))
+  {
+    dentries_.push_back(mountpoint);
+    return true;
+  }
+
+  Catalog *old_nested = OpenCatalog(mountpoint, old_nested_hash);
+  if (old_nested == NULL)
+    return false;
+  bool retval = DiffCatalog(old_nested, new_nested_hash);
+  CloseCatalog(old_nested);
+  return retval;
+}
+
+}  // namespace catalog
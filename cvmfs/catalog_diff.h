@@ -0,0 +1,75 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_DIFF_H_
+#define CVMFS_CATALOG_DIFF_H_
+
+#include <map>
+#include <vector>
+
+#include "hash.h"
+#include "shortstring.h"
+
+namespace catalog {
+
+class Catalog;
+
+/**
+ * Compares the loaded catalogs of a repository with a new revision, so that
+ * only the changed entries need to be evicted from the kernel caches on
+ * remount.  Entries that were added, removed, or changed are collected in
+ * dentries.  Directories that changed only in their attributes (e.g. the mtime
+ * after an entry was added) are collected in directories.
+ *
+ * Both revisions are read from catalogs that are opened by OpenCatalog(),
+ * independently of the catalogs attached to a catalog manager.  Thus no
+ * catalog manager lock needs to be held while the new catalogs are
+ * downloaded.  Changed nested catalogs that are not loaded are not opened;
+ * their mountpoints are added to dentries, i.e. the entire subtree counts as
+ * changed.
+ */
+class CatalogDiff {
+ public:
+  explicit CatalogDiff(const unsigned max_paths)
+    : max_paths_(max_paths), loaded_catalogs_(NULL) { }
+  virtual ~CatalogDiff() { }
+
+  /**
+   * The loaded catalogs map mountpoints to catalog hashes and need to contain
+   * the root catalog.  Returns false if a catalog cannot be opened or if more
+   * than max_paths paths changed.
+   */
+  bool Compare(const std::map<PathString, shash::Any> &loaded_catalogs,
+               const shash::Any &new_root_hash);
+
+  const std::vector<PathString> &dentries() const { return dentries_; }
+  const std::vector<PathString> &directories() const { return directories_; }
+
+ protected:
+  /**
+   * Returns a catalog that is not attached to a catalog tree or NULL on
+   * failure.  The empty mountpoint denotes the root catalog.
+   */
+  virtual Catalog *OpenCatalog(const PathString &mountpoint,
+                               const shash::Any &hash) = 0;
+  virtual void CloseCatalog(Catalog *catalog);
+
+ private:
+  bool DiffCatalog(const Catalog *old_catalog, const shash::Any &new_hash);
+  bool DiffDirectory(const Catalog *old_catalog,
+                     const Catalog *new_catalog,
+                     const PathString &path);
+  bool DiffNested(const Catalog *old_catalog,
+                  const Catalog *new_catalog,
+                  const PathString &mountpoint);
+
+  unsigned max_paths_;
+  const std::map<PathString, shash::Any> *loaded_catalogs_;
+  std::vector<PathString> dentries_;
+  std::vector<PathString> directories_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_DIFF_H_
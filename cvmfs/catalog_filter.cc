@@ -0,0 +1,43 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_filter.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+PathHashFilter::PathHashFilter(const uint64_t num_entries) {
+  const uint64_t num_words = (num_entries * kBitsPerEntry + 63) / 64;
+  bitmap_.resize((num_words > 0) ? num_words : 1, 0);
+  num_bits_ = bitmap_.size() * 64;
+}
+
+
+/**
+ * Probes are derived from the two halves of the digest by double hashing.
+ */
+void PathHashFilter::Add(const shash::Md5 &md5path) {
+  uint64_t h1, h2;
+  md5path.ToIntPair(&h1, &h2);
+  for (unsigned i = 0; i < kNumProbes; ++i) {
+    const uint64_t bit = (h1 + i * h2) % num_bits_;
+    bitmap_[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+}
+
+
+bool PathHashFilter::MayContain(const shash::Md5 &md5path) const {
+  uint64_t h1, h2;
+  md5path.ToIntPair(&h1, &h2);
+  for (unsigned i = 0; i < kNumProbes; ++i) {
+    const uint64_t bit = (h1 + i * h2) % num_bits_;
+    if ((bitmap_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace catalog
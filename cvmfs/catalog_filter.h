@@ -0,0 +1,44 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_FILTER_H_
+#define CVMFS_CATALOG_FILTER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "hash.h"
+#include "util/single_copy.h"
+
+namespace catalog {
+
+/**
+ * A Bloom filter over the path hashes of a catalog.  If MayContain() returns
+ * false, the path is certainly not in the catalog and the SQL lookup can be
+ * skipped.  Path hashes are MD5 digests, so their bits are used directly
+ * instead of applying further hash functions.
+ */
+class PathHashFilter : SingleCopy {
+ public:
+  /**
+   * 10 bits per entry and 7 probes give a false positive rate of ~1%.
+   */
+  static const unsigned kBitsPerEntry = 10;
+  static const unsigned kNumProbes = 7;
+
+  explicit PathHashFilter(const uint64_t num_entries);
+  void Add(const shash::Md5 &md5path);
+  bool MayContain(const shash::Md5 &md5path) const;
+
+  uint64_t GetMemoryUsage() const { return bitmap_.size() * sizeof(uint64_t); }
+
+ private:
+  uint64_t num_bits_;
+  std::vector<uint64_t> bitmap_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_FILTER_H_
@@ -30,6 +30,11 @@ class XattrList;
 namespace catalog {
 
 const unsigned kSqliteMemPerThread = 1*1024*1024;
+/**
+ * Lower bound of the page cache size of a single catalog, unless the catalog
+ * has less pages.
+ */
+const unsigned kMinSqliteCachePages = 64;
 
 /**
  * Lookup a directory entry including its parent entry or not.
@@ -71,6 +76,7 @@ struct Statistics {
   perf::Counter *n_lookup_xattrs;
   perf::Counter *n_listing;
   perf::Counter *n_nested_listing;
+  perf::Counter *n_evicted;
 
   explicit Statistics(perf::Statistics *statistics) {
     n_lookup_inode = statistics->Register("catalog_mgr.n_lookup_inode",
@@ -86,6 +92,8 @@ struct Statistics {
         "Number of listings");
     n_nested_listing = statistics->Register("catalog_mgr.n_nested_listing",
         "Number of listings of nested catalogs");
+    n_evicted = statistics->Register("catalog_mgr.n_evicted",
+        "Number of nested catalogs detached due to the memory limit");
   }
 };
 
@@ -172,6 +180,11 @@ class AbstractCatalogManager : public SingleCopy {
                       const shash::Algorithms interpret_hashes_as,
                       FileChunkList *chunks);
   void SetOwnerMaps(const OwnerMap &uid_map, const OwnerMap &gid_map);
+  void SetDiffRemount(const bool value) { diff_remount_ = value; }
+  void SetMemoryLimit(const uint64_t value) { memory_limit_ = value; }
+  void SetSqliteCacheBudget(const uint64_t num_pages) {
+    sqlite_cache_budget_ = num_pages;
+  }
 
   shash::Any GetNestedCatalogHash(const PathString &mountpoint);
 
@@ -180,6 +193,7 @@ class AbstractCatalogManager : public SingleCopy {
     ReadLock(); uint64_t r = inode_gauge_; Unlock(); return r;
   }
   bool volatile_flag() const { return volatile_flag_; }
+  bool diff_remount() const { return diff_remount_; }
   uint64_t GetRevision() const;
   uint64_t GetTTL() const;
   bool GetVOMSAuthz(std::string *authz) const;
@@ -194,7 +208,8 @@ class AbstractCatalogManager : public SingleCopy {
    */
   inline inode_t GetRootInode() const {
     return inode_annotation_ ?
-      inode_annotation_->Annotate(kInodeOffset + 1) : kInodeOffset + 1;
+      inode_annotation_->Annotate(root_inode_offset_ + 1) :
+      root_inode_offset_ + 1;
   }
   inline CatalogT* GetRootCatalog() const { return catalogs_.front(); }
   /**
@@ -264,6 +279,21 @@ class AbstractCatalogManager : public SingleCopy {
 
  private:
   void CheckInodeWatermark();
+  void RemountDiff(const std::string &catalog_path,
+                   const shash::Any &catalog_hash);
+  unsigned KeepUnchangedSubtrees(CatalogT *old_parent, CatalogT *new_parent);
+  void EvictColdCatalogs(const PathString &path);
+  void UpdateSqliteCache(CatalogT *catalog, const bool attach);
+  unsigned GetSqliteCacheShare(const uint64_t num_pages) const;
+
+  /**
+   * Remembers the inodes of a detached cold catalog
+   */
+  struct EvictedCatalog {
+    shash::Any hash;
+    InodeRange inode_range;
+  };
+  typedef std::map<PathString, EvictedCatalog> EvictedCatalogMap;
 
   /**
    * This list is only needed to find a catalog given an inode.
@@ -273,6 +303,47 @@ class AbstractCatalogManager : public SingleCopy {
   CatalogList catalogs_;
   int inode_watermark_status_;  /**< 0: OK, 1: > 32bit */
   uint64_t inode_gauge_;  /**< highest issued inode */
+  /**
+   * Inode offset of the root catalog.  Only differs from kInodeOffset after a
+   * diff remount.
+   */
+  uint64_t root_inode_offset_;
+  /**
+   * On remount, keep the nested catalogs that did not change attached
+   */
+  bool diff_remount_;
+  /**
+   * Soft limit for the SQlite memory of all attached catalogs.  Once
+   * exceeded, the least recently used leaf nested catalogs are detached.
+   * Zero means no limit.
+   */
+  uint64_t memory_limit_;
+  /**
+   * Number of SQlite pages that are distributed among the attached catalogs in
+   * proportion to their size.  Zero leaves the SQlite default cache size.
+   */
+  uint64_t sqlite_cache_budget_;
+  /**
+   * Total number of database pages of the attached catalogs.
+   */
+  uint64_t attached_pages_;
+  /**
+   * Value of attached_pages_ when the cache shares were last recalculated for
+   * all catalogs.  Shares are recalculated when the attached size doubles or
+   * halves, so that attaching a catalog does not touch every other catalog.
+   */
+  uint64_t balanced_pages_;
+  /**
+   * Advanced under the write lock before nested catalogs are mounted.  Catalogs
+   * are stamped with the current value when they are used for a lookup.
+   */
+  uint64_t access_clock_;
+  /**
+   * Inode ranges of detached cold catalogs.  If the same catalog is mounted
+   * again, it gets its old inodes back.  Cleared when all inodes are
+   * invalidated.
+   */
+  EvictedCatalogMap evicted_catalogs_;
   uint64_t revision_cache_;
   /**
    * Not protected by a read lock because it can only change when the root
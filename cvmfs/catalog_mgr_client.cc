@@ -2,10 +2,18 @@
  * This file is part of the CernVM file system.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "cvmfs_config.h"
 #include "catalog_mgr_client.h"
 
+#include <inttypes.h>
+
+#include <cassert>
+
 #include "cache_posix.h"
+#include "catalog_diff.h"
+#include "catalog_prefetch.h"
 #include "download.h"
 #include "fetch.h"
 #include "manifest.h"
@@ -13,11 +21,39 @@
 #include "signature.h"
 #include "statistics.h"
 #include "util/posix.h"
+#include "util/string.h"
+#include "util_concurrency.h"
 
 using namespace std;  // NOLINT
 
 namespace catalog {
 
+/**
+ * True if the whitelist was verified no longer than kReverifyIntervalS ago,
+ * is still valid, and the certificate is not on the blacklist.
+ */
+bool ManifestValidators::IsVerified(
+  const time_t now,
+  const vector<string> &blacklist) const
+{
+  if ((timestamp_verified == 0) || (now < timestamp_verified) ||
+      (now - timestamp_verified >= static_cast<time_t>(kReverifyIntervalS)))
+  {
+    return false;
+  }
+  if (now >= whitelist_expires)
+    return false;
+  for (unsigned i = 0; i < blacklist.size(); ++i) {
+    if (signature::SignatureManager::MkFromFingerprint(blacklist[i]) ==
+        certificate_fingerprint)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
 /**
  * Triggered when the catalog is attached (db file opened)
  */
@@ -27,6 +63,8 @@ void ClientCatalogManager::ActivateCatalog(Catalog *catalog) {
     all_inodes_ = counters.GetAllEntries();
   }
   loaded_inodes_ += counters.GetSelfEntries();
+  if (prefetcher_ != NULL)
+    prefetcher_->Schedule(catalog);
 }
 
 
@@ -43,8 +81,11 @@ ClientCatalogManager::ClientCatalogManager(
   , all_inodes_(0)
   , loaded_inodes_(0)
   , fixed_alt_root_catalog_(false)
+  , prefetcher_(NULL)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "constructing client catalog manager");
+  int retval = pthread_mutex_init(&lock_loaded_, NULL);
+  assert(retval == 0);
   n_certificate_hits_ = statistics->Register("cache.n_certificate_hits",
     "Number of certificate hits");
   n_certificate_misses_ = statistics->Register("cache.n_certificate_misses",
@@ -54,12 +95,19 @@ ClientCatalogManager::ClientCatalogManager(
 
 ClientCatalogManager::~ClientCatalogManager() {
   LogCvmfs(kLogCache, kLogDebug, "unpinning / unloading all catalogs");
+  delete prefetcher_;
 
   for (map<PathString, shash::Any>::iterator i = mounted_catalogs_.begin(),
        iend = mounted_catalogs_.end(); i != iend; ++i)
   {
     fetcher_->cache_mgr()->quota_mgr()->Unpin(i->second);
   }
+  for (map<PathString, shash::Any>::iterator i = staged_catalogs_.begin(),
+       iend = staged_catalogs_.end(); i != iend; ++i)
+  {
+    fetcher_->cache_mgr()->quota_mgr()->Unpin(i->second);
+  }
+  pthread_mutex_destroy(&lock_loaded_);
 }
 
 
@@ -68,12 +116,147 @@ Catalog *ClientCatalogManager::CreateCatalog(
   const shash::Any  &catalog_hash,
   catalog::Catalog  *parent_catalog
 ) {
-  mounted_catalogs_[mountpoint] = loaded_catalogs_[mountpoint];
-  loaded_catalogs_.erase(mountpoint);
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    mounted_catalogs_[mountpoint] = loaded_catalogs_[mountpoint];
+    loaded_catalogs_.erase(mountpoint);
+  }
   return new Catalog(mountpoint, catalog_hash, parent_catalog);
 }
 
 
+/**
+ * Opens the catalogs from the cache.  Catalogs that are not mounted (anymore)
+ * are unpinned when they are closed; new catalogs are pinned again when they
+ * get mounted.
+ */
+class ClientCatalogManager::CachedCatalogDiff : public CatalogDiff {
+ public:
+  CachedCatalogDiff(ClientCatalogManager *catalog_mgr,
+                    const unsigned max_paths)
+    : CatalogDiff(max_paths), catalog_mgr_(catalog_mgr) { }
+
+ protected:
+  virtual Catalog *OpenCatalog(const PathString &mountpoint,
+                               const shash::Any &hash)
+  {
+    string cvmfs_path = "file catalog at " + catalog_mgr_->repo_name_ + ":" +
+      (mountpoint.IsEmpty() ?
+        "/" : string(mountpoint.GetChars(), mountpoint.GetLength())) +
+      " (" + hash.ToString() + ")";
+    string catalog_path;
+    LoadError retval =
+      catalog_mgr_->LoadCatalogCas(hash, cvmfs_path, "", &catalog_path);
+    if (retval != kLoadNew)
+      return NULL;
+    Catalog *catalog = Catalog::AttachFreely(
+      mountpoint.ToString(), catalog_path, hash, NULL, !mountpoint.IsEmpty());
+    if (catalog == NULL)
+      catalog_mgr_->UnpinUnmounted(mountpoint, hash);
+    return catalog;
+  }
+
+  virtual void CloseCatalog(Catalog *catalog) {
+    const PathString mountpoint = catalog->mountpoint();
+    const shash::Any hash = catalog->hash();
+    delete catalog;
+    catalog_mgr_->UnpinUnmounted(mountpoint, hash);
+  }
+
+ private:
+  ClientCatalogManager *catalog_mgr_;
+};
+
+
+/**
+ * Nested catalogs can get mounted while they are prefetched.  Fetching them
+ * concurrently, the catalog manager shares the download and the pin with the
+ * prefetcher.  Such a pin must stay.
+ */
+class ClientCatalogManager::ClientCatalogPrefetcher : public CatalogPrefetcher {
+ public:
+  ClientCatalogPrefetcher(ClientCatalogManager *catalog_mgr,
+                          const unsigned max_depth,
+                          const uint64_t budget)
+    : CatalogPrefetcher(catalog_mgr->fetcher_, catalog_mgr->repo_name_,
+                        max_depth, budget)
+    , catalog_mgr_(catalog_mgr)
+  { }
+
+ protected:
+  virtual void UnpinCatalog(const PathString &mountpoint,
+                            const shash::Any &hash)
+  {
+    catalog_mgr_->UnpinUnmounted(mountpoint, hash);
+  }
+
+ private:
+  ClientCatalogManager *catalog_mgr_;
+};
+
+
+/**
+ * Compares the loaded catalogs with the newest revision announced by the
+ * manifest, see CatalogDiff.  The catalog manager is only locked to copy the
+ * list of mounted catalogs, the catalogs of both revisions are opened
+ * separately.  Returns false if the new revision cannot be loaded or if more
+ * than max_paths paths changed.  The new catalogs remain in the cache for the
+ * following Remount().
+ */
+bool ClientCatalogManager::DiffRevision(
+  const unsigned max_paths,
+  vector<PathString> *dentries,
+  vector<PathString> *directories)
+{
+  dentries->clear();
+  directories->clear();
+  shash::Any new_root_hash;
+  LoadError load_error =
+    LoadCatalog(PathString("", 0), shash::Any(), NULL, &new_root_hash);
+  if ((load_error != kLoadNew) || new_root_hash.IsNull())
+    return false;
+
+  ReadLock();
+  map<PathString, shash::Any> mounted_catalogs(mounted_catalogs_);
+  Unlock();
+
+  CachedCatalogDiff catalog_diff(this, max_paths);
+  bool retval = catalog_diff.Compare(mounted_catalogs, new_root_hash);
+  *dentries = catalog_diff.dentries();
+  *directories = catalog_diff.directories();
+  LogCvmfs(kLogCatalog, kLogDebug,
+           "revision diff to %s: %u changed entries, %u changed directories%s",
+           new_root_hash.ToString().c_str(),
+           static_cast<unsigned>(dentries->size()),
+           static_cast<unsigned>(directories->size()),
+           retval ? "" : " (incomplete)");
+  return retval;
+}
+
+
+/**
+ * Releases the pin of a catalog that was opened outside the catalog tree
+ * unless the catalog is mounted or staged for the next remount.
+ */
+void ClientCatalogManager::UnpinUnmounted(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  ReadLock();
+  map<PathString, shash::Any>::const_iterator iter =
+    mounted_catalogs_.find(mountpoint);
+  bool is_mounted = (iter != mounted_catalogs_.end()) && (iter->second == hash);
+  Unlock();
+  if (!is_mounted) {
+    MutexLockGuard guard(&lock_loaded_);
+    iter = staged_catalogs_.find(mountpoint);
+    is_mounted = (iter != staged_catalogs_.end()) && (iter->second == hash);
+  }
+  if (!is_mounted)
+    fetcher_->cache_mgr()->quota_mgr()->Unpin(hash);
+}
+
+
 shash::Any ClientCatalogManager::GetRootHash() {
   ReadLock();
   shash::Any result = mounted_catalogs_[PathString("", 0)];
@@ -82,6 +265,147 @@ shash::Any ClientCatalogManager::GetRootHash() {
 }
 
 
+/**
+ * Prepares a remount without blocking file system callers.  Fetches the
+ * manifest, downloads the new root catalog and the new versions of the
+ * attached nested catalogs that changed.  The following Remount() then finds
+ * everything in the cache and does not need to go to the network.  No locks
+ * are held during the downloads.
+ *
+ * Returns kLoadNew if a new revision is staged (or was staged before).
+ */
+LoadError ClientCatalogManager::StageRemount() {
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    if (!staged_root_hash_.IsNull())
+      return kLoadNew;
+  }
+
+  string catalog_path;
+  shash::Any new_root_hash;
+  LoadError load_error =
+    LoadCatalog(PathString("", 0), shash::Any(), &catalog_path, &new_root_hash);
+  if ((load_error != kLoadNew) && (load_error != kLoadUp2Date))
+    return load_error;
+  // The catalog file stays in the cache; it is opened again on Remount()
+  fetcher_->cache_mgr()->Close(String2Int64(catalog_path.substr(1)));
+
+  // The manifest checksum is stored on download, so the cached copy is
+  // reported as up to date even if the previous staged revision never got
+  // mounted
+  map<PathString, shash::Any> attached;
+  ReadLock();
+  const vector<Catalog *> &catalogs = GetCatalogs();
+  for (unsigned i = 0; i < catalogs.size(); ++i)
+    attached[catalogs[i]->mountpoint()] = catalogs[i]->hash();
+  Unlock();
+  if (attached[PathString("", 0)] == new_root_hash)
+    return kLoadUp2Date;
+
+  WarmCatalog(PathString("", 0), new_root_hash, attached);
+  LogCvmfs(kLogCatalog, kLogDebug, "staged remount to root catalog %s",
+           new_root_hash.ToString().c_str());
+  MutexLockGuard guard(&lock_loaded_);
+  staged_root_hash_ = new_root_hash;
+  return kLoadNew;
+}
+
+
+/**
+ * Downloads the nested catalogs of the given new catalog version whose
+ * mountpoints are attached with a different hash.  Unchanged and not attached
+ * nested catalogs are skipped.
+ */
+void ClientCatalogManager::WarmCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash,
+  const map<PathString, shash::Any> &attached)
+{
+  string cvmfs_path = "file catalog at " + repo_name_ + ":" +
+    (mountpoint.IsEmpty() ? "/" : mountpoint.ToString()) +
+    " (" + hash.ToString() + ")";
+  string catalog_path;
+  if (LoadCatalogCas(hash, cvmfs_path, "", &catalog_path) != kLoadNew)
+    return;
+  if (!mountpoint.IsEmpty()) {
+    MutexLockGuard guard(&lock_loaded_);
+    staged_catalogs_[mountpoint] = hash;
+  }
+
+  Catalog *catalog = Catalog::AttachFreely(
+    mountpoint.ToString(), catalog_path, hash, NULL, !mountpoint.IsEmpty());
+  if (catalog == NULL)
+    return;
+  const Catalog::NestedCatalogList nested = catalog->ListOwnNestedCatalogs();
+  delete catalog;
+
+  for (unsigned i = 0; i < nested.size(); ++i) {
+    map<PathString, shash::Any>::const_iterator iter =
+      attached.find(nested[i].mountpoint);
+    if ((iter == attached.end()) || (iter->second == nested[i].hash))
+      continue;
+    WarmCatalog(nested[i].mountpoint, nested[i].hash, attached);
+  }
+}
+
+
+/**
+ * Called after the staged revision got mounted.  Releases the pins of the
+ * catalogs downloaded by StageRemount() that did not get mounted.
+ */
+void ClientCatalogManager::UnpinStaged() {
+  map<PathString, shash::Any> staged;
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    staged.swap(staged_catalogs_);
+  }
+  for (map<PathString, shash::Any>::const_iterator i = staged.begin(),
+       iend = staged.end(); i != iend; ++i)
+  {
+    UnpinUnmounted(i->first, i->second);
+  }
+}
+
+
+void ClientCatalogManager::SetLoadedCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  MutexLockGuard guard(&lock_loaded_);
+  loaded_catalogs_[mountpoint] = hash;
+}
+
+
+/**
+ * Has to be called before the root catalog is attached.  Nested catalogs of
+ * attached catalogs are then downloaded in the background once Spawn() is
+ * called.
+ */
+bool ClientCatalogManager::EnablePrefetch(
+  const unsigned max_depth,
+  const uint64_t budget,
+  const string &hints_path)
+{
+  assert(prefetcher_ == NULL);
+  prefetcher_ = new ClientCatalogPrefetcher(this, max_depth, budget);
+  if (!hints_path.empty() && !prefetcher_->LoadHints(hints_path)) {
+    delete prefetcher_;
+    prefetcher_ = NULL;
+    return false;
+  }
+  LogCvmfs(kLogCatalog, kLogDebug,
+           "prefetching nested catalogs up to depth %u, budget %" PRIu64 "B",
+           max_depth, budget);
+  return true;
+}
+
+
+void ClientCatalogManager::Spawn() {
+  if (prefetcher_ != NULL)
+    prefetcher_->Spawn();
+}
+
+
 /**
  * Specialized initialization that uses a fixed root hash.
  */
@@ -130,11 +454,32 @@ LoadError ClientCatalogManager::LoadCatalog(
     LoadError load_error =
       LoadCatalogCas(hash, cvmfs_path, alt_catalog_path, catalog_path);
     if (load_error == catalog::kLoadNew)
-      loaded_catalogs_[mountpoint] = hash;
+      SetLoadedCatalog(mountpoint, hash);
     *catalog_hash = hash;
     return load_error;
   }
 
+  // A revision downloaded by StageRemount() is applied without asking the
+  // network again
+  shash::Any staged_hash;
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    staged_hash = staged_root_hash_;
+  }
+  if (!staged_hash.IsNull()) {
+    *catalog_hash = staged_hash;
+    if (!catalog_path)
+      return catalog::kLoadNew;
+    cvmfs_path += " (" + staged_hash.ToString() + ")";
+    LoadError load_error =
+      LoadCatalogCas(staged_hash, cvmfs_path, "", catalog_path);
+    MutexLockGuard guard(&lock_loaded_);
+    staged_root_hash_ = shash::Any();
+    if (load_error == catalog::kLoadNew)
+      loaded_catalogs_[mountpoint] = staged_hash;
+    return load_error;
+  }
+
   // Happens only on init/remount, i.e. quota won't delete a cached catalog
   string checksum_dir = ".";
   // TODO(jblomer): find a way to remove this hack
@@ -160,14 +505,48 @@ LoadError ClientCatalogManager::LoadCatalog(
 
   // Load and verify remote checksum
   manifest::Failures manifest_failure;
-  CachedManifestEnsemble ensemble(fetcher_->cache_mgr(), this);
+  CachedManifestEnsemble ensemble(fetcher_->cache_mgr(), this,
+                                  catalog_path != NULL);
+  // If the whitelist verification is stale, the manifest is fetched
+  // unconditionally and verified even if it announces the cached catalog
+  bool reverify = false;
+  const vector<string> blacklist = signature_mgr_->GetBlacklistedCertificates();
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    if (manifest_validators_.catalog_hash == cache_hash) {
+      if (manifest_validators_.IsVerified(time(NULL), blacklist)) {
+        ensemble.etag = manifest_validators_.etag;
+        ensemble.last_modified = manifest_validators_.last_modified;
+      } else {
+        reverify = !manifest_validators_.etag.empty() ||
+                   !manifest_validators_.last_modified.empty();
+      }
+    }
+  }
+  if (reverify)
+    LogCvmfs(kLogCache, kLogDebug, "verifying manifest and whitelist again");
   manifest_failure = manifest::Fetch("", repo_name_, cache_last_modified,
-                                     &cache_hash, signature_mgr_,
+                                     reverify ? NULL : &cache_hash,
+                                     signature_mgr_,
                                      fetcher_->download_mgr(),
                                      &ensemble);
+  if (manifest_failure == manifest::kFailNotModified) {
+    LogCvmfs(kLogCache, kLogDebug, "manifest not modified, using cached copy");
+    offline_mode_ = false;
+    if (catalog_path) {
+      LoadError error =
+        LoadCatalogCas(cache_hash, cvmfs_path, "", catalog_path);
+      if (error != catalog::kLoadNew)
+        return error;
+    }
+    SetLoadedCatalog(mountpoint, cache_hash);
+    *catalog_hash = cache_hash;
+    return catalog::kLoadUp2Date;
+  }
   if (manifest_failure != manifest::kFailOk) {
     LogCvmfs(kLogCache, kLogDebug, "failed to fetch manifest (%d - %s)",
              manifest_failure, manifest::Code2Ascii(manifest_failure));
+    ensemble.AbortPrefetch();
 
     if (catalog_path) {
       LoadError error =
@@ -175,13 +554,27 @@ LoadError ClientCatalogManager::LoadCatalog(
       if (error != catalog::kLoadNew)
         return error;
     }
-    loaded_catalogs_[mountpoint] = cache_hash;
+    SetLoadedCatalog(mountpoint, cache_hash);
     *catalog_hash = cache_hash;
     offline_mode_ = true;
     return catalog::kLoadUp2Date;
   }
 
   offline_mode_ = false;
+  {
+    MutexLockGuard guard(&lock_loaded_);
+    manifest_validators_.etag = ensemble.etag;
+    manifest_validators_.last_modified = ensemble.last_modified;
+    manifest_validators_.catalog_hash = ensemble.manifest->catalog_hash();
+    if (ensemble.whitelist_expires > 0) {
+      manifest_validators_.timestamp_verified = time(NULL);
+      manifest_validators_.whitelist_expires = ensemble.whitelist_expires;
+      manifest_validators_.certificate_fingerprint =
+        ensemble.certificate_fingerprint;
+    } else {
+      manifest_validators_.timestamp_verified = 0;
+    }
+  }
   cvmfs_path += " (" + ensemble.manifest->catalog_hash().ToString() + ")";
   LogCvmfs(kLogCache, kLogDebug, "remote checksum is %s",
            ensemble.manifest->catalog_hash().ToString().c_str());
@@ -192,20 +585,22 @@ LoadError ClientCatalogManager::LoadCatalog(
       LoadError error =
         LoadCatalogCas(cache_hash, cvmfs_path, "", catalog_path);
       if (error == catalog::kLoadNew) {
-        loaded_catalogs_[mountpoint] = cache_hash;
+        SetLoadedCatalog(mountpoint, cache_hash);
         *catalog_hash = cache_hash;
         return catalog::kLoadUp2Date;
       }
       LogCvmfs(kLogCache, kLogDebug,
                "unable to open catalog from local checksum, downloading");
     } else {
-      loaded_catalogs_[mountpoint] = cache_hash;
+      SetLoadedCatalog(mountpoint, cache_hash);
       *catalog_hash = cache_hash;
       return catalog::kLoadUp2Date;
     }
   }
-  if (!catalog_path)
+  if (!catalog_path) {
+    *catalog_hash = ensemble.manifest->catalog_hash();
     return catalog::kLoadNew;
+  }
 
   // Load new catalog
   catalog::LoadError load_retval =
@@ -216,7 +611,7 @@ LoadError ClientCatalogManager::LoadCatalog(
                    catalog_path);
   if (load_retval != catalog::kLoadNew)
     return load_retval;
-  loaded_catalogs_[mountpoint] = ensemble.manifest->catalog_hash();
+  SetLoadedCatalog(mountpoint, ensemble.manifest->catalog_hash());
   *catalog_hash = ensemble.manifest->catalog_hash();
 
   // Store new manifest and certificate
@@ -236,7 +631,8 @@ LoadError ClientCatalogManager::LoadCatalogCas(
 {
   assert(hash.suffix == shash::kSuffixCatalog);
   int fd = fetcher_->Fetch(hash, CacheManager::kSizeUnknown, name,
-    zlib::kZlibDefault, CacheManager::kTypeCatalog, alt_catalog_path);
+    zlib::kZlibDefault, CacheManager::kTypeCatalog, alt_catalog_path, -1,
+    download::kPriorityCatalog);
   if (fd >= 0) {
     *catalog_path = "@" + StringifyInt(fd);
     return kLoadNew;
@@ -256,8 +652,10 @@ void ClientCatalogManager::UnloadCatalog(const Catalog *catalog) {
   map<PathString, shash::Any>::iterator iter =
     mounted_catalogs_.find(catalog->mountpoint());
   assert(iter != mounted_catalogs_.end());
-  fetcher_->cache_mgr()->quota_mgr()->Unpin(iter->second);
-  mounted_catalogs_.erase(iter);
+  fetcher_->cache_mgr()->quota_mgr()->Unpin(catalog->hash());
+  // On a diff remount, the new version of the catalog is already mounted
+  if (iter->second == catalog->hash())
+    mounted_catalogs_.erase(iter);
   const catalog::Counters &counters = catalog->GetCounters();
   loaded_inodes_ -= counters.GetSelfEntries();
 }
@@ -266,6 +664,75 @@ void ClientCatalogManager::UnloadCatalog(const Catalog *catalog) {
 //------------------------------------------------------------------------------
 
 
+CachedManifestEnsemble::~CachedManifestEnsemble() {
+  JoinPrefetch();
+}
+
+
+/**
+ * Unpins the prefetched root catalog if the manifest turns out to be unusable.
+ * A catalog that was already in the cache keeps its pin, it can belong to a
+ * mounted or loaded catalog.
+ */
+void CachedManifestEnsemble::AbortPrefetch() {
+  if (!prefetch_spawned_)
+    return;
+  JoinPrefetch();
+  if (prefetch_pinned_) {
+    cache_mgr_->quota_mgr()->Unpin(prefetch_hash_);
+    prefetch_pinned_ = false;
+  }
+}
+
+
+void CachedManifestEnsemble::JoinPrefetch() {
+  if (prefetch_spawned_) {
+    pthread_join(thread_prefetch_, NULL);
+    prefetch_spawned_ = false;
+  }
+}
+
+
+/**
+ * The catalog manager picks up the catalog from the cache or waits for the
+ * running download in the fetcher.  A catalog that is already in the cache is
+ * neither fetched nor pinned.
+ */
+void *CachedManifestEnsemble::MainPrefetchCatalog(void *data) {
+  CachedManifestEnsemble *ensemble =
+    reinterpret_cast<CachedManifestEnsemble *>(data);
+  cvmfs::Fetcher *fetcher = ensemble->catalog_mgr_->fetcher_;
+  int fd = fetcher->cache_mgr()->Open(CacheManager::Bless(
+    ensemble->prefetch_hash_, CacheManager::kTypeCatalog));
+  if (fd >= 0) {
+    fetcher->cache_mgr()->Close(fd);
+    return NULL;
+  }
+
+  fd = fetcher->Fetch(ensemble->prefetch_hash_, CacheManager::kSizeUnknown,
+    "file catalog at " + ensemble->catalog_mgr_->repo_name() + ":/ (" +
+      ensemble->prefetch_hash_.ToString() + ")",
+    zlib::kZlibDefault, CacheManager::kTypeCatalog, "", -1,
+    download::kPriorityCatalog);
+  if (fd >= 0) {
+    ensemble->prefetch_pinned_ = true;
+    fetcher->cache_mgr()->Close(fd);
+  }
+  return NULL;
+}
+
+
+void CachedManifestEnsemble::PrefetchObjects() {
+  if (!prefetch_catalog_ || manifest->has_alt_catalog_path())
+    return;
+  prefetch_hash_ = manifest->catalog_hash();
+  int retval =
+    pthread_create(&thread_prefetch_, NULL, MainPrefetchCatalog, this);
+  assert(retval == 0);
+  prefetch_spawned_ = true;
+}
+
+
 void CachedManifestEnsemble::FetchCertificate(const shash::Any &hash) {
   uint64_t size;
   bool retval = cache_mgr_->Open2Mem(
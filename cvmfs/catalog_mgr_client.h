@@ -8,9 +8,12 @@
 #include "catalog_mgr.h"
 
 #include <inttypes.h>
+#include <pthread.h>
 
+#include <ctime>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "backoff.h"
 #include "hash.h"
@@ -31,6 +34,36 @@ class SignatureManager;
 
 namespace catalog {
 
+class CatalogPrefetcher;
+
+/**
+ * HTTP validators of the last downloaded manifest together with the outcome
+ * of the last full verification of the whitelist.  A not-modified reply does
+ * not reveal a resigned or revoked whitelist.  Therefore, the manifest is only
+ * requested conditionally for a limited time after the whitelist was verified,
+ * as long as the whitelist is valid and the certificate is not blacklisted.
+ */
+struct ManifestValidators {
+  static const unsigned kReverifyIntervalS = 3600;
+
+  ManifestValidators() : timestamp_verified(0), whitelist_expires(0) { }
+  bool IsVerified(const time_t now,
+                  const std::vector<std::string> &blacklist) const;
+
+  std::string etag;
+  std::string last_modified;
+  /**
+   * Root catalog announced by the manifest
+   */
+  shash::Any catalog_hash;
+  /**
+   * Zero if the whitelist was not verified for this manifest
+   */
+  time_t timestamp_verified;
+  time_t whitelist_expires;
+  shash::Any certificate_fingerprint;
+};
+
 /**
  * A catalog manager that uses a Fetcher to get file catalgs in the form of
  * (virtual) file descriptors from a cache manager.  Sqlite has a path based
@@ -48,6 +81,12 @@ namespace catalog {
 class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   // Maintains certificate hit/miss counters
   friend class CachedManifestEnsemble;
+  // Opens catalogs of the loaded and of the new revision from the cache
+  class CachedCatalogDiff;
+  friend class CachedCatalogDiff;
+  // Keeps the pins of prefetched catalogs that got mounted meanwhile
+  class ClientCatalogPrefetcher;
+  friend class ClientCatalogPrefetcher;
 
  public:
   ClientCatalogManager(const std::string &repo_name,
@@ -57,8 +96,17 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   virtual ~ClientCatalogManager();
 
   bool InitFixed(const shash::Any &root_hash, bool alternative_path);
+  bool EnablePrefetch(const unsigned max_depth,
+                      const uint64_t budget,
+                      const std::string &hints_path);
+  void Spawn();
 
   shash::Any GetRootHash();
+  LoadError StageRemount();
+  void UnpinStaged();
+  bool DiffRevision(const unsigned max_paths,
+                    std::vector<PathString> *dentries,
+                    std::vector<PathString> *directories);
 
   bool offline_mode() const { return offline_mode_; }
   uint64_t all_inodes() const { return all_inodes_; }
@@ -81,6 +129,11 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
                            const std::string &name,
                            const std::string &alt_catalog_path,
                            std::string *catalog_path);
+  void UnpinUnmounted(const PathString &mountpoint, const shash::Any &hash);
+  void SetLoadedCatalog(const PathString &mountpoint, const shash::Any &hash);
+  void WarmCatalog(const PathString &mountpoint,
+                   const shash::Any &hash,
+                   const std::map<PathString, shash::Any> &attached);
 
   /**
    * Required for unpinning
@@ -95,28 +148,75 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t all_inodes_;
   uint64_t loaded_inodes_;
   bool fixed_alt_root_catalog_;  /**< fixed root hash but alternative url */
+  /**
+   * Root catalog downloaded by StageRemount() that the next Remount() applies
+   * without fetching the manifest again.  Null if no remount is staged.
+   */
+  shash::Any staged_root_hash_;
+  /**
+   * Nested catalogs downloaded by StageRemount().  They stay pinned until the
+   * staged revision is mounted, so that the cache cleanup cannot remove them
+   * while the kernel caches are drained.
+   */
+  std::map<PathString, shash::Any> staged_catalogs_;
+  /**
+   * As long as the announced root catalog is the cached root catalog and the
+   * whitelist verification is recent, the manifest is requested conditionally.
+   */
+  ManifestValidators manifest_validators_;
+  /**
+   * Protects loaded_catalogs_, staged_root_hash_, staged_catalogs_, and the
+   * manifest validators.
+   * Root catalogs are staged while other catalogs are loaded under the catalog
+   * manager's write lock.
+   */
+  pthread_mutex_t lock_loaded_;
   BackoffThrottle backoff_throttle_;
+  /**
+   * Downloads nested catalogs in the background, NULL if disabled
+   */
+  CatalogPrefetcher *prefetcher_;
   perf::Counter *n_certificate_hits_;
   perf::Counter *n_certificate_misses_;
 };
 
 
 /**
- * Tries to fetch the certificate from cache
+ * Tries to fetch the certificate from cache.  If requested, downloads the root
+ * catalog into the cache while the manifest is verified.
  */
 class CachedManifestEnsemble : public manifest::ManifestEnsemble {
  public:
   CachedManifestEnsemble(
     CacheManager *cache_mgr,
-    ClientCatalogManager *catalog_mgr)
+    ClientCatalogManager *catalog_mgr,
+    const bool prefetch_catalog = false)
     : cache_mgr_(cache_mgr)
     , catalog_mgr_(catalog_mgr)
+    , prefetch_catalog_(prefetch_catalog)
+    , prefetch_spawned_(false)
+    , prefetch_pinned_(false)
   { }
+  virtual ~CachedManifestEnsemble();
   void FetchCertificate(const shash::Any &hash);
+  void PrefetchObjects();
+  void AbortPrefetch();
 
  private:
+  static void *MainPrefetchCatalog(void *data);
+  void JoinPrefetch();
+
   CacheManager *cache_mgr_;
   ClientCatalogManager *catalog_mgr_;
+  bool prefetch_catalog_;
+  bool prefetch_spawned_;
+  /**
+   * Set if the prefetched catalog was not in the cache before, i.e. the pin
+   * was taken by the prefetch.
+   */
+  bool prefetch_pinned_;
+  shash::Any prefetch_hash_;
+  pthread_t thread_prefetch_;
 };
 
 }  // namespace catalog
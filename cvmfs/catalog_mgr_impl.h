@@ -11,6 +11,7 @@
 
 #include "cvmfs_config.h"
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 
@@ -29,6 +30,13 @@ AbstractCatalogManager<CatalogT>::AbstractCatalogManager(
   statistics_(statistics) {
   inode_watermark_status_ = 0;
   inode_gauge_ = AbstractCatalogManager<CatalogT>::kInodeOffset;
+  root_inode_offset_ = AbstractCatalogManager<CatalogT>::kInodeOffset;
+  diff_remount_ = false;
+  memory_limit_ = 0;
+  sqlite_cache_budget_ = 0;
+  attached_pages_ = 0;
+  balanced_pages_ = 0;
+  access_clock_ = 0;
   revision_cache_ = 0;
   volatile_flag_ = false;
   has_authz_cache_ = false;
@@ -104,8 +112,8 @@ bool AbstractCatalogManager<CatalogT>::Init() {
 
 /**
  * Remounts the root catalog if necessary.  If a newer root catalog exists,
- * it is mounted and replaces the currently mounted tree (all existing catalogs
- * are detached)
+ * it is mounted and replaces the currently mounted tree.  Unless diff remount
+ * is enabled, all existing catalogs are detached.
  */
 template <class CatalogT>
 LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
@@ -122,10 +130,13 @@ LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
                                            shash::Any(),
                                            &catalog_path,
                                            &catalog_hash);
-  if (load_error == kLoadNew) {
+  if ((load_error == kLoadNew) && diff_remount_ && !catalogs_.empty()) {
+    RemountDiff(catalog_path, catalog_hash);
+  } else if (load_error == kLoadNew) {
     inode_t old_inode_gauge = inode_gauge_;
     DetachAll();
     inode_gauge_ = AbstractCatalogManager<CatalogT>::kInodeOffset;
+    evicted_catalogs_.clear();
 
     CatalogT *new_root = CreateCatalog(PathString("", 0), catalog_hash, NULL);
     assert(new_root);
@@ -143,6 +154,200 @@ LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
 }
 
 
+/**
+ * Attaches a new root catalog and moves the nested catalogs whose content hash
+ * did not change from the old tree into the new one.  The kept catalogs retain
+ * their inode ranges and their open databases.  Inodes are never reused
+ * because the inode gauge is not reset, so that the inode generation stays the
+ * same.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::RemountDiff(
+  const string &catalog_path,
+  const shash::Any &catalog_hash)
+{
+  CatalogT *old_root = GetRootCatalog();
+  // The new root is attached to an empty list, so that it is recognized as
+  // root catalog
+  CatalogList old_catalogs;
+  old_catalogs.swap(catalogs_);
+  CatalogT *new_root = CreateCatalog(PathString("", 0), catalog_hash, NULL);
+  assert(new_root);
+  bool retval = AttachCatalog(catalog_path, new_root);
+  assert(retval);
+  catalogs_.insert(catalogs_.end(), old_catalogs.begin(), old_catalogs.end());
+
+  unsigned num_kept = KeepUnchangedSubtrees(old_root, new_root);
+  DetachCatalog(old_root);
+  LogCvmfs(kLogCatalog, kLogDebug,
+           "diff remount kept %u nested catalog subtrees, %u catalogs attached",
+           num_kept, static_cast<unsigned>(catalogs_.size()));
+}
+
+
+/**
+ * Moves the children of old_parent that are unchanged in new_parent
+ * underneath new_parent.  A changed child with attached children of its own
+ * is replaced by its new version so that the search continues one level
+ * deeper.  All other children of old_parent are detached.  Returns the number
+ * of kept subtrees.
+ */
+template <class CatalogT>
+unsigned AbstractCatalogManager<CatalogT>::KeepUnchangedSubtrees(
+  CatalogT *old_parent,
+  CatalogT *new_parent)
+{
+  unsigned num_kept = 0;
+  CatalogList children = old_parent->GetChildren();
+  for (typename CatalogList::const_iterator i = children.begin(),
+       iEnd = children.end(); i != iEnd; ++i)
+  {
+    CatalogT *child = *i;
+    shash::Any new_hash;
+    uint64_t size;
+    if (!new_parent->FindNested(child->mountpoint(), &new_hash, &size)) {
+      DetachSubtree(child);
+      continue;
+    }
+
+    if (new_hash == child->hash()) {
+      old_parent->RemoveChild(child);
+      new_parent->AddChild(child);
+      num_kept++;
+      continue;
+    }
+
+    if (!child->GetChildren().empty()) {
+      CatalogT *new_child =
+        MountCatalog(child->mountpoint(), new_hash, new_parent);
+      if (new_child != NULL)
+        num_kept += KeepUnchangedSubtrees(child, new_child);
+    }
+    DetachSubtree(child);
+  }
+  return num_kept;
+}
+
+
+/**
+ * Detaches the least recently used leaf catalogs until the memory used by the
+ * attached catalogs drops below the memory limit.  Catalogs on the way to path
+ * are kept, as are catalogs with hard link inodes.  The inode ranges of
+ * detached catalogs are remembered so that the inodes stay stable if a
+ * catalog gets mounted again.  Must be called with the write lock held and
+ * before catalog pointers are taken.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::EvictColdCatalogs(
+  const PathString &path)
+{
+  access_clock_++;
+  if (memory_limit_ == 0)
+    return;
+
+  uint64_t memory_usage = 0;
+  for (unsigned i = 0; i < catalogs_.size(); ++i)
+    memory_usage += catalogs_[i]->GetMemoryUsage();
+
+  while (memory_usage > memory_limit_) {
+    CatalogT *victim = NULL;
+    for (unsigned i = 0; i < catalogs_.size(); ++i) {
+      CatalogT *catalog = catalogs_[i];
+      if (!catalog->HasParent() || !catalog->GetChildren().empty())
+        continue;
+      const PathString mountpoint = catalog->mountpoint();
+      if (path.StartsWith(mountpoint) &&
+          ((path.GetLength() == mountpoint.GetLength()) ||
+           (path.GetChars()[mountpoint.GetLength()] == '/')))
+      {
+        continue;
+      }
+      if ((victim != NULL) && (victim->last_access() <= catalog->last_access()))
+        continue;
+      if (catalog->HasHardlinkInodes())
+        continue;
+      victim = catalog;
+    }
+    if (victim == NULL)
+      break;
+
+    const uint64_t victim_usage = victim->GetMemoryUsage();
+    memory_usage -= std::min(memory_usage, victim_usage);
+    LogCvmfs(kLogCatalog, kLogDebug,
+             "detaching cold catalog %s (%" PRIu64 " bytes)",
+             victim->mountpoint().c_str(), victim_usage);
+    EvictedCatalog evicted;
+    evicted.hash = victim->hash();
+    evicted.inode_range = victim->inode_range();
+    evicted_catalogs_[victim->mountpoint()] = evicted;
+    DetachCatalog(victim);
+    perf::Inc(statistics_.n_evicted);
+  }
+}
+
+
+/**
+ * Page cache share of a catalog with num_pages database pages.  Small catalogs
+ * get a minimum share, a catalog never gets more pages than it has.
+ */
+template <class CatalogT>
+unsigned AbstractCatalogManager<CatalogT>::GetSqliteCacheShare(
+  const uint64_t num_pages) const
+{
+  assert(balanced_pages_ > 0);
+  uint64_t share = sqlite_cache_budget_ * num_pages / balanced_pages_;
+  share = std::max(share, static_cast<uint64_t>(kMinSqliteCachePages));
+  return std::min(share, num_pages);
+}
+
+
+/**
+ * Keeps track of the size of the attached catalogs and divides the SQlite page
+ * cache budget among them.  Called with the write lock held when a catalog is
+ * attached (after it is added to catalogs_) or detached (before its database
+ * is closed).
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::UpdateSqliteCache(
+  CatalogT *catalog,
+  const bool attach)
+{
+  if (sqlite_cache_budget_ == 0)
+    return;
+
+  const uint64_t num_pages = catalog->GetNumPages();
+  if (attach)
+    attached_pages_ += num_pages;
+  else
+    attached_pages_ -= std::min(attached_pages_, num_pages);
+
+  if ((attached_pages_ > 2 * balanced_pages_) ||
+      (2 * attached_pages_ < balanced_pages_))
+  {
+    balanced_pages_ = attached_pages_;
+    LogCvmfs(kLogCatalog, kLogDebug,
+             "distributing %" PRIu64 " cache pages among %" PRIu64 " catalogs "
+             "(%" PRIu64 " pages)",
+             sqlite_cache_budget_, static_cast<uint64_t>(catalogs_.size()),
+             attached_pages_);
+    for (unsigned i = 0; i < catalogs_.size(); ++i) {
+      if (catalogs_[i] == catalog) {
+        if (!attach)
+          continue;
+        catalogs_[i]->SetCachePages(GetSqliteCacheShare(num_pages));
+      } else {
+        catalogs_[i]->SetCachePages(
+          GetSqliteCacheShare(catalogs_[i]->GetNumPages()));
+      }
+    }
+    return;
+  }
+
+  if (attach)
+    catalog->SetCachePages(GetSqliteCacheShare(num_pages));
+}
+
+
 /**
  * Detaches everything except the root catalog
  */
@@ -227,6 +432,7 @@ bool AbstractCatalogManager<CatalogT>::LookupPath(const PathString &path,
              path.c_str());
     Unlock();
     WriteLock();
+    EvictColdCatalogs(path);
     // Check again to avoid race
     best_fit = FindCatalog(path);
     assert(best_fit != NULL);
@@ -309,6 +515,7 @@ bool AbstractCatalogManager<CatalogT>::LookupXattrs(
   if (MountSubtree(path, best_fit, NULL)) {
     Unlock();
     WriteLock();
+    EvictColdCatalogs(path);
     // Check again to avoid race
     best_fit = FindCatalog(path);
     result = MountSubtree(path, best_fit, &catalog);
@@ -346,6 +553,7 @@ bool AbstractCatalogManager<CatalogT>::Listing(const PathString &path,
   if (MountSubtree(path, best_fit, NULL)) {
     Unlock();
     WriteLock();
+    EvictColdCatalogs(path);
     // Check again to avoid race
     best_fit = FindCatalog(path);
     result = MountSubtree(path, best_fit, &catalog);
@@ -383,6 +591,7 @@ bool AbstractCatalogManager<CatalogT>::ListingStat(const PathString &path,
   if (MountSubtree(path, best_fit, NULL)) {
     Unlock();
     WriteLock();
+    EvictColdCatalogs(path);
     // Check again to avoid race
     best_fit = FindCatalog(path);
     result = MountSubtree(path, best_fit, &catalog);
@@ -423,6 +632,7 @@ bool AbstractCatalogManager<CatalogT>::ListFileChunks(
   if (MountSubtree(path, best_fit, NULL)) {
     Unlock();
     WriteLock();
+    EvictColdCatalogs(path);
     // Check again to avoid race
     best_fit = FindCatalog(path);
     result = MountSubtree(path, best_fit, &catalog);
@@ -531,11 +741,13 @@ CatalogT* AbstractCatalogManager<CatalogT>::FindCatalog(
   // Start at the root catalog and successively go down the catalog tree
   CatalogT *best_fit = GetRootCatalog();
   CatalogT *next_fit = NULL;
+  best_fit->set_last_access(access_clock_);
   while (best_fit->mountpoint() != path) {
     next_fit = best_fit->FindSubtree(path);
     if (next_fit == NULL)
       break;
     best_fit = next_fit;
+    best_fit->set_last_access(access_clock_);
   }
 
   return best_fit;
@@ -677,9 +889,25 @@ bool AbstractCatalogManager<CatalogT>::AttachCatalog(const string &db_path,
     return false;
   }
 
-  // Determine the inode offset of this catalog
+  // Determine the inode offset of this catalog, reuse the inodes of an
+  // evicted instance of the same catalog
   uint64_t inode_chunk_size = new_catalog->max_row_id();
-  InodeRange range = AcquireInodes(inode_chunk_size);
+  InodeRange range;
+  bool reused_range = false;
+  typename EvictedCatalogMap::iterator iter_evicted =
+    evicted_catalogs_.find(new_catalog->mountpoint());
+  if (iter_evicted != evicted_catalogs_.end()) {
+    if (iter_evicted->second.inode_range.IsInitialized() &&
+        (iter_evicted->second.hash == new_catalog->hash()) &&
+        (iter_evicted->second.inode_range.size >= inode_chunk_size))
+    {
+      range = iter_evicted->second.inode_range;
+      reused_range = true;
+    }
+    evicted_catalogs_.erase(iter_evicted);
+  }
+  if (!reused_range)
+    range = AcquireInodes(inode_chunk_size);
   new_catalog->set_inode_range(range);
   new_catalog->SetInodeAnnotation(inode_annotation_);
   new_catalog->SetOwnerMaps(&uid_map_, &gid_map_);
@@ -688,19 +916,23 @@ bool AbstractCatalogManager<CatalogT>::AttachCatalog(const string &db_path,
   if (!new_catalog->IsInitialized()) {
     LogCvmfs(kLogCatalog, kLogDebug,
              "catalog initialization failed (obscure data)");
-    inode_gauge_ -= inode_chunk_size;
+    if (!reused_range)
+      inode_gauge_ -= inode_chunk_size;
     return false;
   }
   CheckInodeWatermark();
 
   // The revision of the catalog tree is given by the root catalog revision
   if (catalogs_.empty()) {
+    root_inode_offset_ = range.offset;
     revision_cache_ = new_catalog->GetRevision();
     has_authz_cache_ = new_catalog->GetVOMSAuthz(&authz_cache_);
     volatile_flag_ = new_catalog->volatile_flag();
   }
 
+  new_catalog->set_last_access(access_clock_);
   catalogs_.push_back(new_catalog);
+  UpdateSqliteCache(new_catalog, true);
   ActivateCatalog(new_catalog);
   return true;
 }
@@ -720,6 +952,7 @@ void AbstractCatalogManager<CatalogT>::DetachCatalog(CatalogT *catalog) {
     catalog->parent()->RemoveChild(catalog);
 
   ReleaseInodes(catalog->inode_range());
+  UpdateSqliteCache(catalog, false);
   UnloadCatalog(catalog);
 
   // Delete catalog from internal lists
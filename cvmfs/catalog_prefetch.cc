@@ -0,0 +1,219 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_prefetch.h"
+
+#include <cassert>
+#include <cstdio>
+
+#include "cache.h"
+#include "catalog.h"
+#include "compression.h"
+#include "fetch.h"
+#include "logging.h"
+#include "quota.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+/**
+ * True if path equals parent or is located below parent.
+ */
+static bool IsSubPath(const PathString &parent, const PathString &path) {
+  if (path.GetLength() < parent.GetLength())
+    return false;
+  if (!path.StartsWith(parent))
+    return false;
+  return (path.GetLength() == parent.GetLength()) ||
+         (path.GetChars()[parent.GetLength()] == '/');
+}
+
+
+CatalogPrefetcher::CatalogPrefetcher(
+  cvmfs::Fetcher *fetcher,
+  const string &repo_name,
+  const unsigned max_depth,
+  const uint64_t budget)
+  : fetcher_(fetcher)
+  , repo_name_(repo_name)
+  , max_depth_(max_depth)
+  , budget_(budget)
+  , jobs_(kMaxQueueLength + 1, 1)
+  , spawned_(false)
+{
+  atomic_init64(&bytes_prefetched_);
+  atomic_init32(&terminated_);
+}
+
+
+CatalogPrefetcher::~CatalogPrefetcher() {
+  atomic_cas32(&terminated_, 0, 1);
+  if (spawned_) {
+    jobs_.Enqueue(NULL);
+    pthread_join(thread_prefetch_, NULL);
+  }
+  while (!jobs_.IsEmpty())
+    delete jobs_.Dequeue();
+}
+
+
+bool CatalogPrefetcher::IsHinted(const PathString &mountpoint) const {
+  if (hints_.empty())
+    return true;
+  for (unsigned i = 0; i < hints_.size(); ++i) {
+    if (IsSubPath(hints_[i], mountpoint) || IsSubPath(mountpoint, hints_[i]))
+      return true;
+  }
+  return false;
+}
+
+
+/**
+ * Reads one path per line.  Empty lines and lines starting with '#' are
+ * ignored.
+ */
+bool CatalogPrefetcher::LoadHints(const string &path) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (f == NULL) {
+    LogCvmfs(kLogCatalog, kLogDebug | kLogSyslogWarn,
+             "failed to open catalog prefetch hints %s", path.c_str());
+    return false;
+  }
+  hints_.clear();
+  string line;
+  while (GetLineFile(f, &line)) {
+    line = Trim(line);
+    if (line.empty() || (line[0] == '#'))
+      continue;
+    while (!line.empty() && (line[line.length() - 1] == '/'))
+      line.erase(line.length() - 1);
+    hints_.push_back(PathString(line));
+  }
+  fclose(f);
+  LogCvmfs(kLogCatalog, kLogDebug, "loaded %u catalog prefetch hints",
+           static_cast<unsigned>(hints_.size()));
+  return true;
+}
+
+
+void *CatalogPrefetcher::MainPrefetch(void *data) {
+  CatalogPrefetcher *prefetcher = reinterpret_cast<CatalogPrefetcher *>(data);
+  LogCvmfs(kLogCatalog, kLogDebug, "starting catalog prefetch thread");
+
+  while (true) {
+    Job *job = prefetcher->jobs_.Dequeue();
+    if (job == NULL)
+      break;
+    prefetcher->Prefetch(*job, 1);
+    delete job;
+  }
+
+  LogCvmfs(kLogCatalog, kLogDebug, "stopping catalog prefetch thread");
+  return NULL;
+}
+
+
+/**
+ * Downloads the catalog of job and, if depth permits, its nested catalogs.
+ */
+void CatalogPrefetcher::Prefetch(const Job &job, const unsigned depth) {
+  if (atomic_read32(&terminated_) == 1)
+    return;
+
+  const string name = "file catalog at " + repo_name_ + ":" +
+    (job.mountpoint.IsEmpty() ? "/" : job.mountpoint.ToString()) +
+    " (" + job.hash.ToString() + ")";
+  bool is_downloaded = false;
+  int fd = fetcher_->cache_mgr()->Open(
+    CacheManager::Bless(job.hash, CacheManager::kTypeCatalog, name));
+  if (fd < 0) {
+    uint64_t bytes_prefetched = atomic_read64(&bytes_prefetched_);
+    if (bytes_prefetched + job.size > budget_)
+      return;
+
+    LogCvmfs(kLogCatalog, kLogDebug, "prefetching %s", name.c_str());
+    fd = fetcher_->Fetch(job.hash, CacheManager::kSizeUnknown, name,
+                         zlib::kZlibDefault, CacheManager::kTypeCatalog, "",
+                         -1, download::kPriorityPrefetch);
+    if (fd < 0) {
+      LogCvmfs(kLogCatalog, kLogDebug, "failed to prefetch %s (%d)",
+               name.c_str(), fd);
+      return;
+    }
+    is_downloaded = true;
+    int64_t size = fetcher_->cache_mgr()->GetSize(fd);
+    if (size > 0)
+      atomic_xadd64(&bytes_prefetched_, size);
+  }
+
+  Catalog::NestedCatalogList nested;
+  if (depth >= max_depth_) {
+    fetcher_->cache_mgr()->Close(fd);
+  } else {
+    // The catalog takes ownership of the file descriptor
+    Catalog *catalog = Catalog::AttachFreely(
+      job.mountpoint.ToString(), "@" + StringifyInt(fd), job.hash, NULL, true);
+    if (catalog != NULL) {
+      nested = catalog->ListOwnNestedCatalogs();
+      delete catalog;
+    }
+  }
+  if (is_downloaded)
+    UnpinCatalog(job.mountpoint, job.hash);
+
+  for (unsigned i = 0; i < nested.size(); ++i) {
+    if (!IsHinted(nested[i].mountpoint))
+      continue;
+    Job nested_job;
+    nested_job.mountpoint = nested[i].mountpoint;
+    nested_job.hash = nested[i].hash;
+    nested_job.size = nested[i].size;
+    Prefetch(nested_job, depth + 1);
+  }
+}
+
+
+/**
+ * Called when a catalog gets attached.  Queues the catalog's nested catalogs.
+ */
+void CatalogPrefetcher::Schedule(const Catalog *catalog) {
+  if (catalog->IsRoot())
+    atomic_write64(&bytes_prefetched_, 0);
+
+  const Catalog::NestedCatalogList nested = catalog->ListOwnNestedCatalogs();
+  for (unsigned i = 0; i < nested.size(); ++i) {
+    if (!IsHinted(nested[i].mountpoint))
+      continue;
+    if (jobs_.GetItemCount() >= kMaxQueueLength) {
+      LogCvmfs(kLogCatalog, kLogDebug, "catalog prefetch queue full");
+      return;
+    }
+    Job *job = new Job();
+    job->mountpoint = nested[i].mountpoint;
+    job->hash = nested[i].hash;
+    job->size = nested[i].size;
+    jobs_.Enqueue(job);
+  }
+}
+
+
+void CatalogPrefetcher::UnpinCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  fetcher_->cache_mgr()->quota_mgr()->Unpin(hash);
+}
+
+
+void CatalogPrefetcher::Spawn() {
+  int retval = pthread_create(&thread_prefetch_, NULL, MainPrefetch, this);
+  assert(retval == 0);
+  spawned_ = true;
+}
+
+}  // namespace catalog
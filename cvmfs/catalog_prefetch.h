@@ -0,0 +1,113 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_PREFETCH_H_
+#define CVMFS_CATALOG_PREFETCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "util/single_copy.h"
+#include "util_concurrency.h"
+
+namespace cvmfs {
+class Fetcher;
+}
+
+namespace catalog {
+
+class Catalog;
+
+/**
+ * Downloads the nested catalogs of newly attached catalogs into the cache in a
+ * background thread.  A cold traversal that crosses several transition points
+ * then finds the catalogs locally instead of waiting for one download per
+ * level.  The prefetched catalogs are not mounted.  They are stored as catalogs
+ * in the cache; the pin taken by the download is released once the nested
+ * catalogs are listed.  Catalogs that are already in the cache are not
+ * downloaded, do not count against the budget, and keep their pin.
+ *
+ * Starting from an attached catalog, the prefetcher descends up to max_depth
+ * levels of nested catalogs.  It stops once the byte budget is used up; the
+ * budget is reset when a new root catalog gets attached.  An optional hints
+ * file, one path per line, restricts prefetching to nested catalogs on the way
+ * to or below the listed paths.
+ */
+class CatalogPrefetcher : SingleCopy {
+  FRIEND_TEST(T_CatalogPrefetcher, Hints);
+  FRIEND_TEST(T_CatalogPrefetcher, Prefetch);
+  FRIEND_TEST(T_CatalogPrefetcher, Budget);
+  FRIEND_TEST(T_CatalogPrefetcher, Schedule);
+
+ public:
+  CatalogPrefetcher(cvmfs::Fetcher *fetcher,
+                    const std::string &repo_name,
+                    const unsigned max_depth,
+                    const uint64_t budget);
+  virtual ~CatalogPrefetcher();
+  bool LoadHints(const std::string &path);
+  void Spawn();
+  void Schedule(const Catalog *catalog);
+
+  uint64_t bytes_prefetched() { return atomic_read64(&bytes_prefetched_); }
+
+ protected:
+  /**
+   * Releases the pin of a catalog that was downloaded by the prefetcher.  The
+   * catalog manager overwrites it in order to keep the pin if the catalog got
+   * mounted in the meantime.
+   */
+  virtual void UnpinCatalog(const PathString &mountpoint,
+                            const shash::Any &hash);
+
+  cvmfs::Fetcher *fetcher_;
+
+ private:
+  /**
+   * Jobs that do not fit in the queue are dropped.  Schedule() must not block
+   * because it is called with the catalog manager's write lock held.  The
+   * channel has room for one more element, the termination signal.
+   */
+  static const unsigned kMaxQueueLength = 1024;
+
+  struct Job {
+    PathString mountpoint;
+    shash::Any hash;
+    uint64_t size;
+  };
+
+  static void *MainPrefetch(void *data);
+  void Prefetch(const Job &job, const unsigned depth);
+  bool IsHinted(const PathString &mountpoint) const;
+
+  std::string repo_name_;
+  unsigned max_depth_;
+  uint64_t budget_;
+  atomic_int64 bytes_prefetched_;
+  /**
+   * Paths without trailing slash.  Empty: prefetch everything.
+   */
+  std::vector<PathString> hints_;
+  /**
+   * A NULL job terminates the prefetch thread.
+   */
+  FifoChannel<Job *> jobs_;
+  /**
+   * Pending jobs are skipped on shutdown
+   */
+  atomic_int32 terminated_;
+  bool spawned_;
+  pthread_t thread_prefetch_;
+};  // class CatalogPrefetcher
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_PREFETCH_H_
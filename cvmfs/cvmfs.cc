@@ -75,6 +75,7 @@
 #include "compression.h"
 #include "directory_entry.h"
 #include "download.h"
+#include "external_stream.h"
 #include "fence.h"
 #include "fetch.h"
 #include "file_chunk.h"
@@ -541,6 +542,62 @@ static void cvmfs_readlink(fuse_req_t req, fuse_ino_t ino) {
 }
 
 
+/**
+ * Walks the directory tree below path and loads all directory entries into the
+ * md5path cache and, except in NFS mode, into the inode and path caches.
+ * Nested catalogs are mounted on the way.  The walk stops once it has seen as
+ * many entries as the md5path cache can hold, because further entries would
+ * evict the first ones.  Returns the number of entries that were loaded.
+ *
+ * The fence is only held while a single directory is loaded, so that a long
+ * walk does not block catalog updates.
+ */
+static uint64_t PrefetchMetadata(const PathString &path) {
+  const uint64_t max_entries = mount_point_->md5path_cache()->cache_size();
+  uint64_t num_entries = 0;
+
+  vector<PathString> directories;
+  directories.push_back(path);
+  while (!directories.empty() && (num_entries < max_entries)) {
+    const PathString directory = directories.back();
+    directories.pop_back();
+
+    fuse_remounter_->fence()->Enter();
+    catalog::StatEntryList listing;
+    if (!mount_point_->catalog_mgr()->ListingStat(directory, &listing)) {
+      fuse_remounter_->fence()->Leave();
+      LogCvmfs(kLogCvmfs, kLogDebug, "prefetch: failed to list %s",
+               directory.c_str());
+      continue;
+    }
+    for (unsigned i = 0; i < listing.size(); ++i) {
+      PathString entry_path;
+      entry_path.Assign(directory);
+      entry_path.Append("/", 1);
+      entry_path.Append(listing.AtPtr(i)->name.GetChars(),
+                        listing.AtPtr(i)->name.GetLength());
+
+      catalog::DirectoryEntry dirent;
+      if (!GetDirentForPath(entry_path, &dirent))
+        continue;
+      if (!file_system_->IsNfsSource()) {
+        mount_point_->inode_cache()->Insert(dirent.inode(), dirent);
+        mount_point_->path_cache()->Insert(dirent.inode(), entry_path);
+      }
+      if (dirent.IsDirectory())
+        directories.push_back(entry_path);
+      if (++num_entries >= max_entries)
+        break;
+    }
+    fuse_remounter_->fence()->Leave();
+  }
+
+  LogCvmfs(kLogCvmfs, kLogDebug, "prefetched %" PRIu64 " entries below %s",
+           num_entries, path.c_str());
+  return num_entries;
+}
+
+
 static void AddToDirListing(const fuse_req_t req,
                             const char *name, const struct stat *stat_info,
                             BigVector<char> *listing)
@@ -821,12 +878,18 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
 
   perf::Inc(file_system_->n_fs_open());  // Count actual open / fetch operations
 
-  if (!dirent.IsChunkedFile()) {
+  // Streamed external files are served through the chunk tables as well,
+  // unchunked files as a single chunk
+  const bool is_streamed =
+    dirent.IsExternalFile() &&
+    (dirent.compression_algorithm() == zlib::kNoCompression) &&
+    (mount_point_->external_streamer() != NULL);
+  if (!dirent.IsChunkedFile() && !is_streamed) {
     fuse_remounter_->fence()->Leave();
   } else {
     LogCvmfs(kLogCvmfs, kLogDebug,
-             "chunked file %s opened (download delayed to read() call)",
-             path.c_str());
+             "%s file %s opened (download delayed to read() call)",
+             is_streamed ? "streamed" : "chunked", path.c_str());
 
     if (perf::Xadd(file_system_->no_open_files(), 1) >=
         (static_cast<int>(max_open_files_))-kNumReservedFd)
@@ -856,9 +919,11 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
 
       // Retrieve File chunks from the catalog
       UniquePtr<FileChunkList> chunks(new FileChunkList());
-      if (!catalog_mgr->ListFileChunks(path, dirent.hash_algorithm(),
-                                       chunks.weak_ref()) ||
-          chunks->IsEmpty())
+      if (!dirent.IsChunkedFile()) {
+        chunks->PushBack(FileChunk(dirent.checksum(), 0, dirent.size()));
+      } else if (!catalog_mgr->ListFileChunks(path, dirent.hash_algorithm(),
+                                              chunks.weak_ref()) ||
+                 chunks->IsEmpty())
       {
         fuse_remounter_->fence()->Leave();
         LogCvmfs(kLogCvmfs, kLogDebug| kLogSyslogErr, "file %s is marked as "
@@ -1007,11 +1072,22 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     assert(retval);
     chunk_tables->Unlock();
 
+    const bool is_streamed =
+      chunks.external_data &&
+      (chunks.compression_alg == zlib::kNoCompression) &&
+      (mount_point_->external_streamer() != NULL);
+    const CacheManager::ObjectType object_type =
+      mount_point_->catalog_mgr()->volatile_flag()
+        ? CacheManager::kTypeVolatile
+        : CacheManager::kTypeRegular;
+
     // Fetch all needed chunks and read the requested data
     off_t offset_in_chunk = off - chunks.list->AtPtr(chunk_idx)->offset();
     do {
       // Open file descriptor to chunk
-      if ((chunk_fd.fd == -1) || (chunk_fd.chunk_idx != chunk_idx)) {
+      if (!is_streamed &&
+          ((chunk_fd.fd == -1) || (chunk_fd.chunk_idx != chunk_idx)))
+      {
         if (chunk_fd.fd != -1) file_system_->cache_mgr()->Close(chunk_fd.fd);
         string verbose_path = "Part of " + chunks.path.ToString();
         if (chunks.external_data) {
@@ -1020,9 +1096,7 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
             chunks.list->AtPtr(chunk_idx)->size(),
             verbose_path,
             chunks.compression_alg,
-            mount_point_->catalog_mgr()->volatile_flag()
-              ? CacheManager::kTypeVolatile
-              : CacheManager::kTypeRegular,
+            object_type,
             chunks.path.ToString(),
             chunks.list->AtPtr(chunk_idx)->offset());
         } else {
@@ -1031,9 +1105,7 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
             chunks.list->AtPtr(chunk_idx)->size(),
             verbose_path,
             chunks.compression_alg,
-            mount_point_->catalog_mgr()->volatile_flag()
-              ? CacheManager::kTypeVolatile
-              : CacheManager::kTypeRegular);
+            object_type);
         }
         if (chunk_fd.fd < 0) {
           chunk_fd.fd = -1;
@@ -1047,19 +1119,31 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         chunk_fd.chunk_idx = chunk_idx;
       }
 
-      LogCvmfs(kLogCvmfs, kLogDebug, "reading from chunk fd %d",
-               chunk_fd.fd);
       // Read data from chunk
       const size_t bytes_to_read = size - overall_bytes_fetched;
       const size_t remaining_bytes_in_chunk =
         chunks.list->AtPtr(chunk_idx)->size() - offset_in_chunk;
       size_t bytes_to_read_in_chunk =
         std::min(bytes_to_read, remaining_bytes_in_chunk);
-      const int64_t bytes_fetched = file_system_->cache_mgr()->Pread(
-        chunk_fd.fd,
-        data + overall_bytes_fetched,
-        bytes_to_read_in_chunk,
-        offset_in_chunk);
+      int64_t bytes_fetched;
+      if (is_streamed) {
+        bytes_fetched = mount_point_->external_streamer()->Read(
+          *chunks.list->AtPtr(chunk_idx),
+          chunks.path.ToString(),
+          offset_in_chunk,
+          bytes_to_read_in_chunk,
+          object_type,
+          data + overall_bytes_fetched,
+          chunk_handle);
+      } else {
+        LogCvmfs(kLogCvmfs, kLogDebug, "reading from chunk fd %d",
+                 chunk_fd.fd);
+        bytes_fetched = file_system_->cache_mgr()->Pread(
+          chunk_fd.fd,
+          data + overall_bytes_fetched,
+          bytes_to_read_in_chunk,
+          offset_in_chunk);
+      }
 
       if (bytes_fetched < 0) {
         LogCvmfs(kLogCvmfs, kLogSyslogErr, "read err no %" PRId64 " (%s)",
@@ -1158,6 +1242,8 @@ static void cvmfs_release(fuse_req_t req, fuse_ino_t ino,
 
     if (chunk_fd.fd != -1)
       file_system_->cache_mgr()->Close(chunk_fd.fd);
+    if (mount_point_->external_streamer() != NULL)
+      mount_point_->external_streamer()->Release(chunk_handle);
     perf::Dec(file_system_->no_open_files());
   } else {
     if (file_system_->cache_mgr()->Close(fd) == 0) {
@@ -1462,6 +1548,26 @@ static void cvmfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
       attribute_value = StringifyInt((rx/1024)/time);
   } else if (attr == "user.fqrn") {
     attribute_value = loader_exports_->repository_name;
+  } else if (attr == "user.prefetch_metadata") {
+    // Not listed by listxattr so that getfattr -d does not trigger it.  The
+    // walk can be expensive, so only root and the mount owner may start it.
+    if ((fuse_ctx->uid != 0) && (fuse_ctx->uid != geteuid())) {
+      fuse_reply_err(req, EACCES);
+      return;
+    }
+    if (!d.IsDirectory()) {
+      fuse_reply_err(req, ENOTDIR);
+      return;
+    }
+    // Size probes are answered with the maximum length of the entry count,
+    // which is bounded by the md5path cache size, instead of walking the tree
+    // twice
+    if (size == 0) {
+      fuse_reply_xattr(req, StringifyInt(
+        mount_point_->md5path_cache()->cache_size()).length());
+      return;
+    }
+    attribute_value = StringifyInt(PrefetchMetadata(path));
   } else if (attr == "user.inode_max") {
     attribute_value = StringifyInt(
       inode_generation_info_.inode_generation +
@@ -1603,14 +1709,18 @@ bool Pin(const string &path) {
           dirent.compression_algorithm(),
           CacheManager::kTypePinned,
           path,
-          chunks.AtPtr(i)->offset());
+          chunks.AtPtr(i)->offset(),
+          download::kPriorityBulk);
       } else {
         fd = mount_point_->fetcher()->Fetch(
           chunks.AtPtr(i)->content_hash(),
           chunks.AtPtr(i)->size(),
           "Part of " + path,
           dirent.compression_algorithm(),
-          CacheManager::kTypePinned);
+          CacheManager::kTypePinned,
+          "",
+          -1,
+          download::kPriorityBulk);
       }
       if (fd < 0) {
         return false;
@@ -1629,7 +1739,7 @@ bool Pin(const string &path) {
     : mount_point_->fetcher();
   int fd = this_fetcher->Fetch(
     dirent.checksum(), dirent.size(), path, dirent.compression_algorithm(),
-    CacheManager::kTypePinned);
+    CacheManager::kTypePinned, "", -1, download::kPriorityBulk);
   if (fd < 0) {
     return false;
   }
@@ -1849,6 +1959,7 @@ static void Spawn() {
 
   cvmfs::mount_point_->download_mgr()->Spawn();
   cvmfs::mount_point_->external_download_mgr()->Spawn();
+  cvmfs::mount_point_->catalog_mgr()->Spawn();
   QuotaManager *quota_mgr = cvmfs::file_system_->cache_mgr()->quota_mgr();
   quota_mgr->Spawn();
   if (quota_mgr->HasCapability(QuotaManager::kCapListeners)) {
@@ -1968,8 +2079,11 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
   if (!cvmfs::file_system_->IsNfsSource()) {
     msg_progress = "Saving inode tracker\n";
     SendMsg2Socket(fd_progress, msg_progress);
+    // Only fnFini follows, so the live tracker is handed over instead of
+    // being copied
     glue::InodeTracker *saved_inode_tracker =
-      new glue::InodeTracker(*cvmfs::mount_point_->inode_tracker());
+      cvmfs::mount_point_->inode_tracker();
+    cvmfs::mount_point_->set_inode_tracker(new glue::InodeTracker());
     loader::SavedState *state_glue_buffer = new loader::SavedState();
     state_glue_buffer->state_id = loader::kStateGlueBufferV4;
     state_glue_buffer->state = saved_inode_tracker;
@@ -1978,8 +2092,8 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
 
   msg_progress = "Saving chunk tables\n";
   SendMsg2Socket(fd_progress, msg_progress);
-  ChunkTables *saved_chunk_tables = new ChunkTables(
-    *cvmfs::mount_point_->chunk_tables());
+  ChunkTables *saved_chunk_tables = cvmfs::mount_point_->chunk_tables();
+  cvmfs::mount_point_->set_chunk_tables(new ChunkTables());
   loader::SavedState *state_chunk_tables = new loader::SavedState();
   state_chunk_tables->state_id = loader::kStateOpenChunksV4;
   state_chunk_tables->state = saved_chunk_tables;
@@ -2068,11 +2182,12 @@ static bool RestoreState(const int fd_progress,
 
     if (saved_states[i]->state_id == loader::kStateGlueBufferV4) {
       SendMsg2Socket(fd_progress, "Restoring inode tracker... ");
-      delete cvmfs::mount_point_->inode_tracker();
+      // Copied in place: the fuse invalidator already holds a pointer to the
+      // tracker.  The saved tracker cannot be adopted as is because its hash
+      // tables refer to the hash functions of the unloaded library.
       glue::InodeTracker *saved_inode_tracker =
         (glue::InodeTracker *)saved_states[i]->state;
-      cvmfs::mount_point_->set_inode_tracker(
-        new glue::InodeTracker(*saved_inode_tracker));
+      *cvmfs::mount_point_->inode_tracker() = *saved_inode_tracker;
       SendMsg2Socket(fd_progress, " done\n");
     }
 
@@ -2107,11 +2222,9 @@ static bool RestoreState(const int fd_progress,
 
     if (saved_states[i]->state_id == loader::kStateOpenChunksV4) {
       SendMsg2Socket(fd_progress, "Restoring chunk tables... ");
-      delete chunk_tables;
       ChunkTables *saved_chunk_tables = reinterpret_cast<ChunkTables *>(
         saved_states[i]->state);
-      cvmfs::mount_point_->set_chunk_tables(
-        new ChunkTables(*saved_chunk_tables));
+      *chunk_tables = *saved_chunk_tables;
       SendMsg2Socket(fd_progress, " done\n");
     }
 
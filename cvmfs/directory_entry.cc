@@ -67,4 +67,139 @@ DirectoryEntryBase::Differences DirectoryEntry::CompareTo(
   return result;
 }
 
+
+PackedDirectoryEntry::PackedDirectoryEntry()
+  : inode_(DirectoryEntryBase::kInvalidInode)
+  , size_(0)
+  , mtime_(0)
+  , mode_(0)
+  , uid_(0)
+  , gid_(0)
+  , linkcount_(1)
+  , hardlink_group_(0)
+  , hash_algorithm_(shash::kAny)
+  , hash_suffix_(shash::kSuffixNone)
+  , compression_algorithm_(zlib::kZlibDefault)
+  , flags_(0)
+  , name_length_(0)
+  , symlink_length_(0)
+  , long_names_(NULL)
+{
+  memset(digest_, 0, sizeof(digest_));
+}
+
+
+PackedDirectoryEntry::PackedDirectoryEntry(const DirectoryEntry &dirent)
+  : inode_(dirent.inode_)
+  , size_(dirent.size_)
+  , mtime_(dirent.mtime_)
+  , mode_(dirent.mode_)
+  , uid_(dirent.uid_)
+  , gid_(dirent.gid_)
+  , linkcount_(dirent.linkcount_)
+  , hardlink_group_(dirent.hardlink_group_)
+  , hash_algorithm_(dirent.checksum_.algorithm)
+  , hash_suffix_(dirent.checksum_.suffix)
+  , compression_algorithm_(dirent.compression_algorithm_)
+  , flags_(0)
+  , name_length_(0)
+  , symlink_length_(0)
+  , long_names_(NULL)
+{
+  memcpy(digest_, dirent.checksum_.digest, sizeof(digest_));
+  if (dirent.has_xattrs_) flags_ |= kFlagHasXattrs;
+  if (dirent.is_external_file_) flags_ |= kFlagExternalFile;
+  if (dirent.is_nested_catalog_root_) flags_ |= kFlagNestedCatalogRoot;
+  if (dirent.is_nested_catalog_mountpoint_)
+    flags_ |= kFlagNestedCatalogMountpoint;
+  if (dirent.is_bind_mountpoint_) flags_ |= kFlagBindMountpoint;
+  if (dirent.is_chunked_file_) flags_ |= kFlagChunkedFile;
+  if (dirent.is_hidden_) flags_ |= kFlagHidden;
+  if (dirent.is_negative_) flags_ |= kFlagNegative;
+  AssignNames(dirent.name_.GetChars(), dirent.name_.GetLength(),
+              dirent.symlink_.GetChars(), dirent.symlink_.GetLength());
+}
+
+
+PackedDirectoryEntry::PackedDirectoryEntry(const PackedDirectoryEntry &other)
+  : long_names_(NULL)
+{
+  *this = other;
+}
+
+
+PackedDirectoryEntry &PackedDirectoryEntry::operator =(
+  const PackedDirectoryEntry &other)
+{
+  if (this == &other)
+    return *this;
+  inode_ = other.inode_;
+  size_ = other.size_;
+  mtime_ = other.mtime_;
+  mode_ = other.mode_;
+  uid_ = other.uid_;
+  gid_ = other.gid_;
+  linkcount_ = other.linkcount_;
+  hardlink_group_ = other.hardlink_group_;
+  memcpy(digest_, other.digest_, sizeof(digest_));
+  hash_algorithm_ = other.hash_algorithm_;
+  hash_suffix_ = other.hash_suffix_;
+  compression_algorithm_ = other.compression_algorithm_;
+  flags_ = other.flags_;
+  AssignNames(other.names(), other.name_length_,
+              other.names() + other.name_length_, other.symlink_length_);
+  return *this;
+}
+
+
+void PackedDirectoryEntry::AssignNames(
+  const char *name,
+  const unsigned name_length,
+  const char *symlink,
+  const unsigned symlink_length)
+{
+  assert(name_length <= 0xFFFF);
+  assert(symlink_length <= 0xFFFF);
+  delete[] long_names_;
+  long_names_ = NULL;
+  name_length_ = name_length;
+  symlink_length_ = symlink_length;
+  char *buffer = names_;
+  if (name_length + symlink_length > kInlineNamesSize) {
+    long_names_ = new char[name_length + symlink_length];
+    buffer = long_names_;
+  }
+  memcpy(buffer, name, name_length);
+  memcpy(buffer + name_length, symlink, symlink_length);
+}
+
+
+void PackedDirectoryEntry::Unpack(DirectoryEntry *dirent) const {
+  dirent->inode_ = inode_;
+  dirent->name_.Assign(names(), name_length_);
+  dirent->mode_ = mode_;
+  dirent->uid_ = uid_;
+  dirent->gid_ = gid_;
+  dirent->size_ = size_;
+  dirent->mtime_ = mtime_;
+  dirent->symlink_.Assign(names() + name_length_, symlink_length_);
+  dirent->linkcount_ = linkcount_;
+  dirent->has_xattrs_ = flags_ & kFlagHasXattrs;
+  dirent->checksum_.algorithm =
+    static_cast<shash::Algorithms>(hash_algorithm_);
+  dirent->checksum_.suffix = hash_suffix_;
+  memcpy(dirent->checksum_.digest, digest_, sizeof(digest_));
+  dirent->is_external_file_ = flags_ & kFlagExternalFile;
+  dirent->compression_algorithm_ =
+    static_cast<zlib::Algorithms>(compression_algorithm_);
+  dirent->hardlink_group_ = hardlink_group_;
+  dirent->is_nested_catalog_root_ = flags_ & kFlagNestedCatalogRoot;
+  dirent->is_nested_catalog_mountpoint_ =
+    flags_ & kFlagNestedCatalogMountpoint;
+  dirent->is_bind_mountpoint_ = flags_ & kFlagBindMountpoint;
+  dirent->is_chunked_file_ = flags_ & kFlagChunkedFile;
+  dirent->is_hidden_ = flags_ & kFlagHidden;
+  dirent->is_negative_ = flags_ & kFlagNegative;
+}
+
 }  // namespace catalog
@@ -9,6 +9,7 @@
 #define CVMFS_DIRECTORY_ENTRY_H_
 
 #include <sys/types.h>
+#include <stdint.h>
 
 #include <cassert>
 #include <cstring>
@@ -36,6 +37,7 @@ class DirectoryEntryTestFactory;
 class MockCatalogManager;
 class Catalog;
 class WritableCatalogManager;
+class PackedDirectoryEntry;
 
 template <class CatalogMgrT>
 class CatalogBalancer;
@@ -63,6 +65,8 @@ class DirectoryEntryBase {
   friend class SqlDirentTouch;
   // Allow creation of virtual directories and files
   friend class VirtualCatalog;
+  // Compact copies for the meta-data caches
+  friend class PackedDirectoryEntry;
 
  public:
   static const inode_t kInvalidInode = 0;
@@ -232,6 +236,8 @@ class DirectoryEntry : public DirectoryEntryBase {
   friend class WritableCatalogManager;
   // Create DirectoryEntries for unit test purposes.
   friend class DirectoryEntryTestFactory;
+  // Compact copies for the meta-data caches
+  friend class PackedDirectoryEntry;
 
  public:
   /**
@@ -327,6 +333,70 @@ class DirectoryEntry : public DirectoryEntryBase {
 };
 
 
+/**
+ * A compact copy of a DirectoryEntry for the inode and md5path caches.  Flags
+ * are stored as a bitmap, the checksum digest is stored inline without padding
+ * and the name and the symlink share one buffer.  Only if name and symlink
+ * together exceed the inline buffer, they are moved to the heap.  The entry
+ * is converted back to a full DirectoryEntry by Unpack().
+ */
+class PackedDirectoryEntry {
+ public:
+  /**
+   * Accumulates to 120 bytes per entry on 64bit platforms.
+   */
+  static const unsigned kInlineNamesSize = 40;
+
+  PackedDirectoryEntry();
+  explicit PackedDirectoryEntry(const DirectoryEntry &dirent);
+  PackedDirectoryEntry(const PackedDirectoryEntry &other);
+  PackedDirectoryEntry &operator =(const PackedDirectoryEntry &other);
+  ~PackedDirectoryEntry() { delete[] long_names_; }
+
+  void Unpack(DirectoryEntry *dirent) const;
+  inline bool IsNegative() const { return flags_ & kFlagNegative; }
+
+ private:
+  enum Flags {
+    kFlagHasXattrs                = 0x01,
+    kFlagExternalFile             = 0x02,
+    kFlagNestedCatalogRoot        = 0x04,
+    kFlagNestedCatalogMountpoint  = 0x08,
+    kFlagBindMountpoint           = 0x10,
+    kFlagChunkedFile              = 0x20,
+    kFlagHidden                   = 0x40,
+    kFlagNegative                 = 0x80,
+  };
+
+  void AssignNames(const char *name, const unsigned name_length,
+                   const char *symlink, const unsigned symlink_length);
+  inline const char *names() const {
+    return (long_names_ != NULL) ? long_names_ : names_;
+  }
+
+  inode_t inode_;
+  uint64_t size_;
+  int64_t mtime_;
+  uint32_t mode_;
+  uint32_t uid_;
+  uint32_t gid_;
+  uint32_t linkcount_;
+  uint32_t hardlink_group_;
+  unsigned char digest_[shash::kMaxDigestSize];
+  unsigned char hash_algorithm_;
+  char hash_suffix_;
+  unsigned char compression_algorithm_;
+  unsigned char flags_;
+  uint16_t name_length_;
+  uint16_t symlink_length_;
+  /**
+   * Name followed by symlink, NULL if they fit in names_
+   */
+  char *long_names_;
+  char names_[kInlineNamesSize];
+};
+
+
 /**
  * Saves memory for large directory listings.
  */
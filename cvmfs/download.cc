@@ -45,6 +45,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <map>
 #include <set>
 
 #include "atomic.h"
@@ -165,11 +166,22 @@ static Failures PrepareDownloadDestination(JobInfo *info) {
 }
 
 
+/**
+ * Wall clock time in milliseconds, used to time the start of transfers.
+ */
+static uint64_t GetTimestampMs() {
+  struct timeval tv_now;
+  int retval = gettimeofday(&tv_now, NULL);
+  assert(retval == 0);
+  return static_cast<uint64_t>(tv_now.tv_sec) * 1000 + tv_now.tv_usec / 1000;
+}
+
+
 /**
  * Called by curl for every HTTP header. Not called for file:// transfers.
  */
-static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
-                                 void *info_link)
+size_t DownloadManager::CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
+                                           void *info_link)
 {
   const size_t num_bytes = size*nmemb;
   const string header_line(static_cast<const char *>(ptr), num_bytes);
@@ -192,6 +204,17 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     }
 
     if ((info->http_code / 100) == 2) {
+      // Validators of a previous response (e.g. a redirect) are dropped
+      if (info->etag != NULL)
+        info->etag->clear();
+      if (info->last_modified != NULL)
+        info->last_modified->clear();
+      return num_bytes;
+    } else if ((info->http_code == 304) &&
+               (!info->header_if_none_match.empty() ||
+                !info->header_if_modified_since.empty()))
+    {
+      info->not_modified = true;
       return num_bytes;
     } else if ((info->http_code == 301) ||
                (info->http_code == 302) ||
@@ -250,6 +273,14 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
   } else if (HasPrefix(header_line, "LOCATION:", true)) {
     // This comes along with redirects
     LogCvmfs(kLogDownload, kLogDebug, "%s", header_line.c_str());
+  } else if ((info->http_code / 100) != 2) {
+    // Validators are only taken from a successful response
+  } else if ((info->etag != NULL) && HasPrefix(header_line, "ETAG:", true)) {
+    *info->etag = GetHeaderValue(header_line, 5);
+  } else if ((info->last_modified != NULL) &&
+             HasPrefix(header_line, "LAST-MODIFIED:", true))
+  {
+    *info->last_modified = GetHeaderValue(header_line, 14);
   }
 
   return num_bytes;
@@ -270,6 +301,16 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
   if (num_bytes == 0)
     return 0;
 
+  // Throttled priority class; curl delivers the data again once resumed
+  if (info->bucket != NULL) {
+    if (info->bucket->tokens <= 0) {
+      info->paused = true;
+      info->bucket->num_paused++;
+      return CURL_WRITEFUNC_PAUSE;
+    }
+    info->bucket->tokens -= num_bytes;
+  }
+
   if (info->expected_hash)
     shash::Update((unsigned char *)ptr, num_bytes, info->hash_context);
 
@@ -355,6 +396,33 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
 //------------------------------------------------------------------------------
 
 
+/**
+ * Adds the tokens accumulated since the last refill.  The bucket holds at most
+ * a quarter of a second worth of tokens but at least one curl buffer.
+ */
+void TokenBucket::Refill(const uint64_t now_ms) {
+  const int64_t capacity = (rate / 4 > CURL_MAX_WRITE_SIZE) ?
+                           static_cast<int64_t>(rate / 4) : CURL_MAX_WRITE_SIZE;
+  if (timestamp_refill == 0) {
+    tokens = capacity;
+    timestamp_refill = now_ms;
+    return;
+  }
+  if (now_ms <= timestamp_refill)
+    return;
+  const uint64_t gained = rate * (now_ms - timestamp_refill) / 1000;
+  if (gained == 0)
+    return;
+  tokens += static_cast<int64_t>(gained);
+  if (tokens > capacity)
+    tokens = capacity;
+  timestamp_refill = now_ms;
+}
+
+
+//------------------------------------------------------------------------------
+
+
 const int DownloadManager::kProbeUnprobed = -1;
 const int DownloadManager::kProbeDown     = -2;
 const int DownloadManager::kProbeGeo      = -3;
@@ -377,6 +445,24 @@ int DownloadManager::ParseHttpCode(const char digits[3]) {
 }
 
 
+/**
+ * Strips the header name and the line break from a header line.
+ */
+string DownloadManager::GetHeaderValue(const string &header_line,
+                                       const unsigned name_length)
+{
+  if (header_line.length() <= name_length)
+    return "";
+  string value = header_line.substr(name_length);
+  while (!value.empty() && ((value[value.length() - 1] == '\n') ||
+                            (value[value.length() - 1] == '\r')))
+  {
+    value.erase(value.length() - 1);
+  }
+  return Trim(value);
+}
+
+
 /**
  * Called when new curl sockets arrive or existing curl sockets depart.
  */
@@ -518,14 +604,13 @@ void *DownloadManager::MainDownload(void *data) {
       ReadPipe(download_mgr->pipe_jobs_[0], &info, sizeof(info));
       if (!still_running)
         gettimeofday(&timeval_start, NULL);
-      CURL *handle = download_mgr->AcquireCurlHandle();
-      download_mgr->InitializeRequest(info, handle);
-      download_mgr->SetUrlOptions(info);
-      curl_multi_add_handle(download_mgr->curl_multi_, handle);
-      retval = curl_multi_socket_action(download_mgr->curl_multi_,
-                                        CURL_SOCKET_TIMEOUT,
-                                        0,
-                                        &still_running);
+      download_mgr->priority_classes_[info->priority].queue.push_back(info);
+      if (download_mgr->StartQueuedJobs()) {
+        retval = curl_multi_socket_action(download_mgr->curl_multi_,
+                                          CURL_SOCKET_TIMEOUT,
+                                          0,
+                                          &still_running);
+      }
     }
 
     // Activity on curl sockets
@@ -562,9 +647,25 @@ void *DownloadManager::MainDownload(void *data) {
         CURL *easy_handle = curl_msg->easy_handle;
         int curl_error = curl_msg->data.result;
         curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
+        if (info->paused) {
+          info->paused = false;
+          info->bucket->num_paused--;
+        }
 
         curl_multi_remove_handle(download_mgr->curl_multi_, easy_handle);
+        download_mgr->UpdateStatistics(easy_handle, curl_error, info);
+        if (info->is_hedge) {
+          // Unless the duplicate request won, the original one continues
+          info = download_mgr->FinalizeHedge(info, curl_error, &curl_error);
+          if (info == NULL)
+            continue;
+          easy_handle = info->curl_handle;
+        } else if (info->hedge) {
+          download_mgr->CancelHedge(info);
+        }
         if (download_mgr->VerifyAndFinalize(curl_error, info)) {
+          info->timestamp_start = GetTimestampMs();
+          info->hedged = false;
           curl_multi_add_handle(download_mgr->curl_multi_, easy_handle);
           retval = curl_multi_socket_action(download_mgr->curl_multi_,
                                             CURL_SOCKET_TIMEOUT,
@@ -573,12 +674,26 @@ void *DownloadManager::MainDownload(void *data) {
         } else {
           // Return easy handle into pool and write result back
           download_mgr->ReleaseCurlHandle(easy_handle);
+          download_mgr->priority_classes_[info->priority].num_active--;
 
           WritePipe(info->wait_at[1], &info->error_code,
                     sizeof(info->error_code));
         }
       }
     }
+
+    // Finished jobs make room for queued ones
+    if (download_mgr->StartQueuedJobs()) {
+      retval = curl_multi_socket_action(download_mgr->curl_multi_,
+                                        CURL_SOCKET_TIMEOUT,
+                                        0,
+                                        &still_running);
+    }
+
+    if (still_running) {
+      download_mgr->CheckHedges();
+      download_mgr->RefillTokenBuckets();
+    }
   }
 
   for (set<CURL *>::iterator i = download_mgr->pool_handles_inuse_->begin(),
@@ -732,15 +847,72 @@ string DownloadManager::ProxyInfo::Print() {
   } else {
     expinfo += StringifyInt(remaining) + "s";
   }
+  string scoreinfo;
+  if (num_samples > 0) {
+    scoreinfo = ", " + StringifyInt(static_cast<int64_t>(latency_ms)) + " ms";
+    if (throughput > 0.0) {
+      scoreinfo += ", " +
+        StringifyInt(static_cast<int64_t>(throughput / 1024.0)) + " kB/s";
+    }
+    scoreinfo += ", score " + StringifyInt(static_cast<int64_t>(GetScore()));
+  }
   if (host.status() == dns::kFailOk) {
-    result += " (" + host.name() + ", " + expinfo + ")";
+    result += " (" + host.name() + ", " + expinfo + scoreinfo + ")";
   } else {
-    result += " (:unresolved:, " + expinfo + ")";
+    result += " (:unresolved:, " + expinfo + scoreinfo + ")";
   }
   return result;
 }
 
 
+/**
+ * Merges the measurements of a completed transfer into the moving averages.
+ * A negative throughput indicates that the transfer was too small to measure
+ * it.  Samples that arrive after the score expired restart the averages.
+ */
+void DownloadManager::ProxyInfo::AddSample(
+  const float ttfb_ms,
+  const float bytes_per_sec,
+  const time_t now)
+{
+  if (!HasScore(now)) {
+    latency_ms = baseline_ms = ttfb_ms;
+    throughput = (bytes_per_sec > 0.0) ? bytes_per_sec : 0.0;
+    num_samples = 1;
+    timestamp_sample = now;
+    return;
+  }
+
+  latency_ms = 0.75 * latency_ms + 0.25 * ttfb_ms;
+  baseline_ms = 0.97 * baseline_ms + 0.03 * ttfb_ms;
+  if (bytes_per_sec > 0.0) {
+    throughput = (throughput > 0.0) ?
+                 0.75 * throughput + 0.25 * bytes_per_sec : bytes_per_sec;
+  }
+  num_samples++;
+  timestamp_sample = now;
+}
+
+
+bool DownloadManager::ProxyInfo::HasScore(const time_t now) const {
+  return (num_samples > 0) &&
+         (static_cast<int64_t>(now) <
+          static_cast<int64_t>(timestamp_sample + kProxyScoreTtl));
+}
+
+
+/**
+ * Expected time in milliseconds to fetch an object of the reference size.
+ * Lower is better.
+ */
+float DownloadManager::ProxyInfo::GetScore() const {
+  float score = latency_ms;
+  if (throughput > 0.0)
+    score += 1000.0 * kProxyScoreReferenceSize / throughput;
+  return score;
+}
+
+
 /**
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
@@ -795,10 +967,32 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
   info->num_used_hosts = 1;
   info->num_retries = 0;
   info->backoff_ms = 0;
+  info->hedged = false;
+  info->timestamp_start = GetTimestampMs();
+  info->bucket = NULL;
+  info->paused = false;
   info->headers = header_lists_->DuplicateList(default_headers_);
   if (info->info_header) {
     header_lists_->AppendHeader(info->headers, info->info_header);
   }
+  info->not_modified = false;
+  info->header_if_none_match.clear();
+  info->header_if_modified_since.clear();
+  // The request validators are replaced by the ones of the response, which
+  // may have none
+  if ((info->etag != NULL) && !info->etag->empty()) {
+    info->header_if_none_match = "If-None-Match: " + *info->etag;
+    header_lists_->AppendHeader(info->headers,
+                                info->header_if_none_match.c_str());
+    info->etag->clear();
+  }
+  if ((info->last_modified != NULL) && !info->last_modified->empty()) {
+    info->header_if_modified_since =
+      "If-Modified-Since: " + *info->last_modified;
+    header_lists_->AppendHeader(info->headers,
+                                info->header_if_modified_since.c_str());
+    info->last_modified->clear();
+  }
   if (info->force_nocache) {
     SetNocache(info);
   } else {
@@ -1004,6 +1198,9 @@ void DownloadManager::SetUrlOptions(JobInfo *info) {
     info->destination_mem.size = 64*1024;
     info->destination_mem.data = static_cast<char *>(smalloc(64*1024));
   }
+  // curl fails local file transfers that get paused, they are not throttled
+  if (HasPrefix(url, "file://", false))
+    info->bucket = NULL;
 
   curl_easy_setopt(curl_handle, CURLOPT_URL, EscapeUrl(url).c_str());
 }
@@ -1025,10 +1222,10 @@ void DownloadManager::ValidateProxyIpsUnlocked(
   LogCvmfs(kLogDownload, kLogDebug, "validate DNS entry for %s",
            host.name().c_str());
 
-  unsigned group_idx = opt_proxy_groups_current_;
+  pthread_mutex_lock(lock_resolver_);
   dns::Host new_host = resolver_->Resolve(host.name());
+  pthread_mutex_unlock(lock_resolver_);
 
-  bool update_only = true;  // No changes to the list of IP addresses.
   if (new_host.status() != dns::kFailOk) {
     // Try again later in case resolving fails.
     LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
@@ -1036,11 +1233,25 @@ void DownloadManager::ValidateProxyIpsUnlocked(
              host.name().c_str(), new_host.status(),
              dns::Code2Ascii(new_host.status()));
     new_host = dns::Host::ExtendDeadline(host, dns::Resolver::kMinTtl);
-  } else if (!host.IsEquivalent(new_host)) {
-    update_only = false;
   }
+  UpdateProxyIpsUnlocked(opt_proxy_groups_current_, url, host, new_host);
+}
+
 
-  if (update_only) {
+/**
+ * Replaces the proxies of host in the given load-balance group by the ones of
+ * new_host.  If only the deadline changed, the entries are updated in place.
+ * Otherwise the proxies of host are removed, the addresses of new_host are
+ * inserted, and the active group is rebalanced.
+ */
+void DownloadManager::UpdateProxyIpsUnlocked(
+  const unsigned group_idx,
+  const string &url,
+  const dns::Host &host,
+  const dns::Host &new_host)
+{
+  // No changes to the list of IP addresses.
+  if ((new_host.status() != dns::kFailOk) || host.IsEquivalent(new_host)) {
     for (unsigned i = 0; i < (*opt_proxy_groups_)[group_idx].size(); ++i) {
       if ((*opt_proxy_groups_)[group_idx][i].host.id() == host.id())
         (*opt_proxy_groups_)[group_idx][i].host = new_host;
@@ -1048,12 +1259,10 @@ void DownloadManager::ValidateProxyIpsUnlocked(
     return;
   }
 
-  assert(new_host.status() == dns::kFailOk);
-
   // Remove old host objects, insert new objects, and rebalance.
   LogCvmfs(kLogDownload, kLogDebug | kLogSyslog,
            "DNS entries for proxy %s changed, adjusting", host.name().c_str());
-  vector<ProxyInfo> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  vector<ProxyInfo> *group = &((*opt_proxy_groups_)[group_idx]);
   opt_num_proxies_ -= group->size();
   for (unsigned i = 0; i < group->size(); ) {
     if ((*group)[i].host.id() == host.id()) {
@@ -1072,14 +1281,141 @@ void DownloadManager::ValidateProxyIpsUnlocked(
   group->insert(group->end(), new_infos.begin(), new_infos.end());
   opt_num_proxies_ += new_infos.size();
 
-  RebalanceProxiesUnlocked();
+  if (group_idx == opt_proxy_groups_current_)
+    RebalanceProxiesUnlocked();
+}
+
+
+/**
+ * Called by the DNS refresh thread.  Resolves the names of all proxies whose
+ * refresh is due in one go and applies the results to the proxy groups.  The
+ * names are resolved without holding the options mutex, so that the download
+ * path does not wait for DNS.  Failed lookups leave the current addresses in
+ * place; if they expire, the download path falls back to resolving on demand.
+ */
+void DownloadManager::RefreshProxyIps(map<string, time_t> *refresh_due) {
+  vector<unsigned> group_idxs;
+  vector<string> urls;
+  vector<dns::Host> hosts;
+  vector<string> names;
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(lock_options_);
+  if (opt_proxy_groups_ == NULL) {
+    pthread_mutex_unlock(lock_options_);
+    return;
+  }
+  set<int64_t> seen_ids;
+  for (unsigned i = 0; i < opt_proxy_groups_->size(); ++i) {
+    for (unsigned j = 0; j < (*opt_proxy_groups_)[i].size(); ++j) {
+      const ProxyInfo &proxy = (*opt_proxy_groups_)[i][j];
+      if ((proxy.url == "DIRECT") || proxy.host.name().empty())
+        continue;
+      if (seen_ids.find(proxy.host.id()) != seen_ids.end())
+        continue;
+      seen_ids.insert(proxy.host.id());
+
+      time_t due = proxy.host.deadline() - kDnsRefreshMarginS;
+      map<string, time_t>::const_iterator iter =
+        refresh_due->find(proxy.host.name());
+      if ((iter != refresh_due->end()) && (iter->second < due))
+        due = iter->second;
+      if (now < due)
+        continue;
+      group_idxs.push_back(i);
+      urls.push_back(proxy.url);
+      hosts.push_back(proxy.host);
+      names.push_back(proxy.host.name());
+    }
+  }
+  pthread_mutex_unlock(lock_options_);
+  if (names.empty())
+    return;
+
+  LogCvmfs(kLogDownload, kLogDebug, "refreshing %u proxy addresses",
+           static_cast<unsigned>(names.size()));
+  vector<dns::Host> new_hosts;
+  pthread_mutex_lock(lock_resolver_);
+  resolver_->ResolveMany(names, &new_hosts);
+  pthread_mutex_unlock(lock_resolver_);
+  now = time(NULL);
+
+  pthread_mutex_lock(lock_options_);
+  for (unsigned i = 0; i < new_hosts.size(); ++i) {
+    if (new_hosts[i].status() != dns::kFailOk) {
+      LogCvmfs(kLogDownload, kLogDebug,
+               "failed to refresh IP addresses for %s (%d - %s)",
+               names[i].c_str(), new_hosts[i].status(),
+               dns::Code2Ascii(new_hosts[i].status()));
+      (*refresh_due)[names[i]] = now + kDnsRefreshMarginS;
+      continue;
+    }
+    (*refresh_due)[new_hosts[i].name()] =
+      now + (new_hosts[i].deadline() - now) * kDnsRefreshPercent / 100;
+
+    // The proxy groups might have changed while resolving
+    if ((opt_proxy_groups_ == NULL) ||
+        (group_idxs[i] >= opt_proxy_groups_->size()))
+    {
+      continue;
+    }
+    const vector<ProxyInfo> &group = (*opt_proxy_groups_)[group_idxs[i]];
+    bool found = false;
+    for (unsigned j = 0; j < group.size(); ++j) {
+      if (group[j].host.id() == hosts[i].id()) {
+        found = true;
+        break;
+      }
+    }
+    if (found)
+      UpdateProxyIpsUnlocked(group_idxs[i], urls[i], hosts[i], new_hosts[i]);
+  }
+  pthread_mutex_unlock(lock_options_);
+}
+
+
+/**
+ * Worker thread of the DNS refresh.  Wakes up periodically until Fini() writes
+ * into the pipe.
+ */
+void *DownloadManager::MainDnsRefresh(void *data) {
+  DownloadManager *download_mgr = static_cast<DownloadManager *>(data);
+  LogCvmfs(kLogDownload, kLogDebug, "DNS refresh thread started");
+
+  map<string, time_t> refresh_due;
+  struct pollfd watch_terminate;
+  watch_terminate.fd = download_mgr->pipe_dns_refresh_[0];
+  watch_terminate.events = POLLIN | POLLPRI;
+  while (true) {
+    watch_terminate.revents = 0;
+    int retval = poll(&watch_terminate, 1, kDnsRefreshCheckIntervalMs);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (retval > 0)
+      break;
+    download_mgr->RefreshProxyIps(&refresh_due);
+  }
+
+  LogCvmfs(kLogDownload, kLogDebug, "DNS refresh thread terminated");
+  return NULL;
 }
 
 
 /**
- * Adds transfer time and downloaded bytes to the global counters.
+ * Adds transfer time and downloaded bytes to the global counters.  Transfers
+ * through a proxy also update the score of the proxy.  Connection failures and
+ * HTTP errors of the proxy count as a transfer that took the full proxy
+ * timeout, so that a failing proxy is not preferred over the working ones.
  */
-void DownloadManager::UpdateStatistics(CURL *handle) {
+void DownloadManager::UpdateStatistics(
+  CURL *handle,
+  const int curl_error,
+  const JobInfo *info)
+{
+  const string &proxy = info->proxy;
   double val;
   int retval;
   int64_t sum = 0;
@@ -1091,6 +1427,427 @@ void DownloadManager::UpdateStatistics(CURL *handle) {
   assert(retval == CURLE_OK);
   sum += static_cast<int64_t>(val);*/
   perf::Xadd(counters_->sz_transferred_bytes, sum);
+
+  if (curl_error != CURLE_OK) {
+    if (proxy.empty() || (proxy == "DIRECT"))
+      return;
+    switch (curl_error) {
+      case CURLE_COULDNT_RESOLVE_PROXY:
+      case CURLE_COULDNT_CONNECT:
+      case CURLE_OPERATION_TIMEDOUT:
+      case CURLE_PARTIAL_FILE:
+      case CURLE_GOT_NOTHING:
+      case CURLE_RECV_ERROR:
+        break;
+      case CURLE_WRITE_ERROR:
+        // Error set by the header callback
+        if (info->error_code == kFailProxyHttp)
+          break;
+        return;
+      default:
+        return;
+    }
+    pthread_mutex_lock(lock_options_);
+    UpdateProxyScoreUnlocked(proxy, opt_timeout_proxy_ * 1000.0, -1.0);
+    pthread_mutex_unlock(lock_options_);
+    return;
+  }
+  double ttfb;
+  double total;
+  double size;
+  if ((curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &ttfb) !=
+       CURLE_OK) ||
+      (curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK) ||
+      (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD, &size) != CURLE_OK))
+  {
+    return;
+  }
+  float bytes_per_sec = -1.0;
+  if ((size >= kProxyThroughputMinSize) && (total > ttfb))
+    bytes_per_sec = size / (total - ttfb);
+
+  pthread_mutex_lock(lock_options_);
+  if (opt_hedge_max_size_ > 0)
+    AddHedgeSampleUnlocked(static_cast<unsigned>(ttfb * 1000.0));
+  if (!proxy.empty() && (proxy != "DIRECT"))
+    UpdateProxyScoreUnlocked(proxy, ttfb * 1000.0, bytes_per_sec);
+  pthread_mutex_unlock(lock_options_);
+}
+
+
+/**
+ * Remembers the time to first byte of a successful transfer.  Every couple of
+ * samples, the delay before a hedged request is set to the configured
+ * percentile of the recent samples.  The options mutex needs to be locked.
+ */
+void DownloadManager::AddHedgeSampleUnlocked(const unsigned ttfb_ms) {
+  if (hedge_ttfb_samples_.size() < kHedgeNumSamples)
+    hedge_ttfb_samples_.push_back(ttfb_ms);
+  else
+    hedge_ttfb_samples_[hedge_ttfb_next_] = ttfb_ms;
+  hedge_ttfb_next_ = (hedge_ttfb_next_ + 1) % kHedgeNumSamples;
+
+  if ((hedge_ttfb_samples_.size() < kHedgeNumSamples / 4) ||
+      ((hedge_ttfb_next_ % 16) != 0))
+  {
+    return;
+  }
+  vector<unsigned> samples(hedge_ttfb_samples_);
+  const unsigned idx = samples.size() * kHedgePercentile / 100;
+  nth_element(samples.begin(), samples.begin() + idx, samples.end());
+  hedge_delay_ms_ =
+    (samples[idx] > kHedgeMinDelayMs) ? samples[idx] : kHedgeMinDelayMs;
+}
+
+
+/**
+ * Called by the I/O thread.  Duplicates transfers that did not receive any
+ * data within the hedge delay and drops duplicates that became unnecessary
+ * because the original transfer started to receive data or because the object
+ * turned out to be too large.
+ */
+void DownloadManager::CheckHedges() {
+  const uint64_t now = GetTimestampMs();
+  if (now < hedge_last_check_ms_ + kHedgeCheckIntervalMs)
+    return;
+  hedge_last_check_ms_ = now;
+
+  pthread_mutex_lock(lock_options_);
+  const unsigned max_size = opt_hedge_max_size_;
+  const unsigned delay_ms = hedge_delay_ms_;
+  pthread_mutex_unlock(lock_options_);
+  if (max_size == 0)
+    return;
+
+  // Issuing and cancelling duplicates changes the set of handles in use
+  vector<JobInfo *> transfers;
+  for (set<CURL *>::const_iterator i = pool_handles_inuse_->begin(),
+       iEnd = pool_handles_inuse_->end(); i != iEnd; ++i)
+  {
+    JobInfo *info = NULL;
+    curl_easy_getinfo(*i, CURLINFO_PRIVATE, &info);
+    if ((info != NULL) && !info->is_hedge)
+      transfers.push_back(info);
+  }
+
+  for (unsigned i = 0; i < transfers.size(); ++i) {
+    JobInfo *info = transfers[i];
+    double received = 0.0;
+    double expected_size = -1.0;
+    curl_easy_getinfo(info->curl_handle, CURLINFO_SIZE_DOWNLOAD, &received);
+    curl_easy_getinfo(info->curl_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+                      &expected_size);
+    if (info->hedge) {
+      double hedge_size = -1.0;
+      curl_easy_getinfo(info->hedge->curl_handle,
+                        CURLINFO_CONTENT_LENGTH_DOWNLOAD, &hedge_size);
+      if ((received > 0.0) || (hedge_size > max_size))
+        CancelHedge(info);
+      continue;
+    }
+    if (info->hedged || (received > 0.0) || (expected_size > max_size) ||
+        (now < info->timestamp_start + delay_ms))
+    {
+      continue;
+    }
+    // Attempted at most once per try, even if there is no alternative route
+    info->hedged = true;
+    IssueHedge(info);
+  }
+}
+
+
+/**
+ * Starts a duplicate of a stalled transfer through another proxy of the
+ * load-balancing group or, without one, through the next host.  The duplicate
+ * buffers the raw response in memory.
+ *
+ * \return false if the job cannot be hedged
+ */
+bool DownloadManager::IssueHedge(JobInfo *info) {
+  if ((info->priority >= kPriorityPrefetch) ||
+      info->head_request || (info->etag != NULL) ||
+      (info->last_modified != NULL) ||
+      (info->destination == kDestinationNone) ||
+      (info->url->find("@proxy@") != string::npos))
+  {
+    return false;
+  }
+
+  string proxy;
+  string url_prefix;
+  pthread_mutex_lock(lock_options_);
+  if (opt_proxy_groups_ && (info->proxy != "DIRECT")) {
+    const vector<ProxyInfo> &group =
+      (*opt_proxy_groups_)[opt_proxy_groups_current_];
+    vector<ProxyInfo> alternatives;
+    for (unsigned i = 0; i < group.size(); ++i) {
+      if ((group[i].url != info->proxy) &&
+          (group[i].host.status() == dns::kFailOk))
+      {
+        alternatives.push_back(group[i]);
+      }
+    }
+    if (!alternatives.empty())
+      proxy = alternatives[SelectProxyUnlocked(alternatives,
+                                               alternatives.size())].url;
+  }
+  if (proxy.empty() && info->probe_hosts && opt_host_chain_ &&
+      (opt_host_chain_->size() > 1))
+  {
+    url_prefix = (*opt_host_chain_)[
+      (opt_host_chain_current_ + 1) % opt_host_chain_->size()];
+  }
+  pthread_mutex_unlock(lock_options_);
+  if (proxy.empty() && url_prefix.empty())
+    return false;
+
+  JobInfo *hedge = new JobInfo(info->url, false, info->probe_hosts,
+                               static_cast<const shash::Any *>(NULL));
+  hedge->pid = info->pid;
+  hedge->uid = info->uid;
+  hedge->gid = info->gid;
+  hedge->extra_info = info->extra_info;
+  hedge->info_header = info->info_header;
+  hedge->force_nocache = info->force_nocache;
+  hedge->range_offset = info->range_offset;
+  hedge->range_size = info->range_size;
+  hedge->is_hedge = true;
+
+  CURL *handle = AcquireCurlHandle();
+  InitializeRequest(hedge, handle);
+  SetUrlOptions(hedge);
+  if (!proxy.empty()) {
+    hedge->proxy = proxy;
+    curl_easy_setopt(handle, CURLOPT_PROXY, hedge->proxy.c_str());
+  } else {
+    curl_easy_setopt(handle, CURLOPT_URL,
+                     EscapeUrl(url_prefix + *(hedge->url)).c_str());
+  }
+  hedge->hedge = info;
+  info->hedge = hedge;
+  curl_multi_add_handle(curl_multi_, handle);
+  perf::Inc(counters_->n_hedged_requests);
+  LogCvmfs(kLogDownload, kLogDebug, "hedging stalled request for %s via %s%s",
+           info->url->c_str(), hedge->proxy.c_str(),
+           url_prefix.empty() ? "" : (" to " + url_prefix).c_str());
+  return true;
+}
+
+
+/**
+ * Called when the duplicate request completes before the original one.  If it
+ * succeeded and the original transfer did not yet receive any data, the
+ * duplicate wins: the original transfer is stopped and the buffered response
+ * is fed into its destination.
+ *
+ * \return the original job if it should be finalized with primary_curl_error,
+ * NULL if the original transfer continues
+ */
+JobInfo *DownloadManager::FinalizeHedge(
+  JobInfo *hedge,
+  const int curl_error,
+  int *primary_curl_error)
+{
+  JobInfo *info = hedge->hedge;
+  info->hedge = NULL;
+  double received = 0.0;
+  curl_easy_getinfo(info->curl_handle, CURLINFO_SIZE_DOWNLOAD, &received);
+  // Responses without status line (file://) keep the initial http_code of -1
+  if ((curl_error != CURLE_OK) || (hedge->error_code != kFailOk) ||
+      ((hedge->http_code != -1) && ((hedge->http_code / 100) != 2)) ||
+      (received > 0.0))
+  {
+    FreeHedge(hedge);
+    return NULL;
+  }
+
+  curl_multi_remove_handle(curl_multi_, info->curl_handle);
+  // The stall counts as the latency of the original proxy
+  if (info->proxy != "DIRECT") {
+    pthread_mutex_lock(lock_options_);
+    UpdateProxyScoreUnlocked(info->proxy,
+                             GetTimestampMs() - info->timestamp_start, -1.0);
+    pthread_mutex_unlock(lock_options_);
+  }
+  const size_t size = hedge->destination_mem.pos;
+  if (info->destination == kDestinationMem) {
+    free(info->destination_mem.data);
+    info->destination_mem.data =
+      (size > 0) ? static_cast<char *>(smalloc(size)) : NULL;
+    info->destination_mem.size = size;
+    info->destination_mem.pos = 0;
+  }
+  // The replay must not be paused by a bandwidth cap
+  TokenBucket *bucket = info->bucket;
+  info->bucket = NULL;
+  *primary_curl_error = CURLE_OK;
+  if ((size > 0) &&
+      (CallbackCurlData(hedge->destination_mem.data, 1, size, info) != size))
+  {
+    *primary_curl_error = CURLE_WRITE_ERROR;
+  }
+  info->bucket = bucket;
+  info->http_code = hedge->http_code;
+  info->proxy = hedge->proxy;
+
+  perf::Inc(counters_->n_hedged_won);
+  LogCvmfs(kLogDownload, kLogDebug, "hedged request for %s won via %s",
+           info->url->c_str(), hedge->proxy.c_str());
+  FreeHedge(hedge);
+  return info;
+}
+
+
+/**
+ * Acquires a curl handle for a job and adds it to the multi stack.
+ */
+void DownloadManager::StartJob(JobInfo *info) {
+  CURL *handle = AcquireCurlHandle();
+  InitializeRequest(info, handle);
+  PriorityClass *priority_class = &priority_classes_[info->priority];
+  if (priority_class->bucket.rate > 0)
+    info->bucket = &priority_class->bucket;
+  SetUrlOptions(info);
+  priority_class->num_active++;
+  curl_multi_add_handle(curl_multi_, handle);
+}
+
+
+/**
+ * Starts queued jobs in the order of priority as far as the concurrency limits
+ * of the priority classes allow.
+ *
+ * \return true if at least one job was started
+ */
+bool DownloadManager::StartQueuedJobs() {
+  bool started = false;
+  for (unsigned i = 0; i < kPriorityNumEntries; ++i) {
+    PriorityClass *priority_class = &priority_classes_[i];
+    while (!priority_class->queue.empty() &&
+           ((priority_class->max_transfers == 0) ||
+            (priority_class->num_active < priority_class->max_transfers)))
+    {
+      JobInfo *info = priority_class->queue.front();
+      priority_class->queue.pop_front();
+      StartJob(info);
+      started = true;
+    }
+  }
+  return started;
+}
+
+
+/**
+ * Called by the I/O thread.  Refills the token buckets of the priority classes
+ * with a bandwidth cap and resumes paused transfers if there are tokens again.
+ */
+void DownloadManager::RefillTokenBuckets() {
+  uint64_t now = 0;
+  bool resume = false;
+  for (unsigned i = 0; i < kPriorityNumEntries; ++i) {
+    TokenBucket *bucket = &priority_classes_[i].bucket;
+    if (bucket->rate == 0)
+      continue;
+    if (now == 0)
+      now = GetTimestampMs();
+    bucket->Refill(now);
+    if ((bucket->num_paused > 0) && (bucket->tokens > 0))
+      resume = true;
+  }
+  if (!resume)
+    return;
+
+  for (set<CURL *>::const_iterator i = pool_handles_inuse_->begin(),
+       iEnd = pool_handles_inuse_->end(); i != iEnd; ++i)
+  {
+    JobInfo *info = NULL;
+    curl_easy_getinfo(*i, CURLINFO_PRIVATE, &info);
+    if ((info == NULL) || !info->paused || (info->bucket->tokens <= 0))
+      continue;
+    info->paused = false;
+    info->bucket->num_paused--;
+    curl_easy_pause(*i, CURLPAUSE_CONT);
+  }
+}
+
+
+/**
+ * Stops the duplicate request of a job.
+ */
+void DownloadManager::CancelHedge(JobInfo *info) {
+  JobInfo *hedge = info->hedge;
+  info->hedge = NULL;
+  curl_multi_remove_handle(curl_multi_, hedge->curl_handle);
+  FreeHedge(hedge);
+}
+
+
+/**
+ * Releases the resources of a duplicate request whose handle is already
+ * removed from the multi stack.
+ */
+void DownloadManager::FreeHedge(JobInfo *hedge) {
+  if (hedge->cred_data) {
+    assert(credentials_attachment_ != NULL);
+    credentials_attachment_->ReleaseCurlHandle(hedge->curl_handle,
+                                               hedge->cred_data);
+  }
+  if (hedge->headers)
+    header_lists_->PutList(hedge->headers);
+  free(hedge->destination_mem.data);
+  ReleaseCurlHandle(hedge->curl_handle);
+  delete hedge;
+}
+
+
+/**
+ * Feeds the time to first byte and the throughput (negative if unknown) of a
+ * transfer into the score of the proxy that served it.  If the active proxy
+ * turns out to be degraded compared to its own history, the load-balancing
+ * group is rebalanced, which moves to a better scoring proxy.  The options
+ * mutex needs to be locked.
+ */
+void DownloadManager::UpdateProxyScoreUnlocked(
+  const string &proxy,
+  const float ttfb_ms,
+  const float bytes_per_sec)
+{
+  if (!opt_proxy_groups_)
+    return;
+
+  vector<ProxyInfo> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  const time_t now = time(NULL);
+  for (unsigned i = 0; i < group->size(); ++i) {
+    if ((*group)[i].url != proxy)
+      continue;
+    (*group)[i].AddSample(ttfb_ms, bytes_per_sec, now);
+
+    // Only the active proxy is replaced and not while failing over
+    if ((i != 0) || (opt_proxy_groups_current_burned_ > 1) ||
+        (group->size() < 2))
+    {
+      return;
+    }
+    const ProxyInfo &active = (*group)[0];
+    if ((active.num_samples < kProxyMinSamples) ||
+        (active.latency_ms <= kProxyDegradedFactor * active.baseline_ms) ||
+        (static_cast<int64_t>(now) <
+         static_cast<int64_t>(opt_timestamp_score_rebalance_ +
+                              kProxyRebalanceInterval)))
+    {
+      return;
+    }
+    opt_timestamp_score_rebalance_ = now;
+    const string old_proxy = active.url;
+    RebalanceProxiesUnlocked();
+    if ((*group)[0].url != old_proxy) {
+      LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+               "switching proxy from %s to %s (degraded latency)",
+               old_proxy.c_str(), (*group)[0].url.c_str());
+    }
+    return;
+  }
 }
 
 
@@ -1170,7 +1927,6 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
   LogCvmfs(kLogDownload, kLogDebug,
            "Verify downloaded url %s, proxy %s (curl error %d)",
            info->url->c_str(), info->proxy.c_str(), curl_error);
-  UpdateStatistics(info->curl_handle);
 
   if (info->cred_data) {
     assert(credentials_attachment_ != NULL);  // Someone must have set it
@@ -1182,6 +1938,11 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
   // Verification and error classification
   switch (curl_error) {
     case CURLE_OK:
+      if (info->not_modified) {
+        info->error_code = kFailOk;
+        break;
+      }
+
       // Verify content hash
       if (info->expected_hash) {
         shash::Any match_hash;
@@ -1470,6 +2231,10 @@ DownloadManager::DownloadManager() {
   reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
   retval = pthread_mutex_init(lock_synchronous_mode_, NULL);
   assert(retval == 0);
+  lock_resolver_ =
+  reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(lock_resolver_, NULL);
+  assert(retval == 0);
 
   opt_dns_server_ = NULL;
   opt_ip_preference_ = dns::kIpPreferSystem;
@@ -1492,10 +2257,17 @@ DownloadManager::DownloadManager() {
   use_system_proxy_ = false;
 
   resolver_ = NULL;
+  opt_dns_refresh_ = false;
+  pipe_dns_refresh_[0] = pipe_dns_refresh_[1] = -1;
 
   opt_timestamp_backup_proxies_ = 0;
   opt_timestamp_failover_proxies_ = 0;
   opt_proxy_groups_reset_after_ = 0;
+  opt_timestamp_score_rebalance_ = 0;
+  opt_hedge_max_size_ = 0;
+  hedge_ttfb_next_ = 0;
+  hedge_delay_ms_ = kHedgeDefaultDelayMs;
+  hedge_last_check_ms_ = 0;
   opt_timestamp_backup_host_ = 0;
   opt_host_reset_after_ = 0;
 
@@ -1508,8 +2280,10 @@ DownloadManager::DownloadManager() {
 DownloadManager::~DownloadManager() {
   pthread_mutex_destroy(lock_options_);
   pthread_mutex_destroy(lock_synchronous_mode_);
+  pthread_mutex_destroy(lock_resolver_);
   free(lock_options_);
   free(lock_synchronous_mode_);
+  free(lock_resolver_);
 }
 
 void DownloadManager::InitHeaders() {
@@ -1557,6 +2331,10 @@ void DownloadManager::Init(const unsigned max_pool_handles,
   opt_timeout_proxy_ = 5;
   opt_timeout_direct_ = 10;
   opt_low_speed_limit_ = 1024;
+  priority_classes_[kPriorityPrefetch].max_transfers =
+    kDefaultMaxBackgroundTransfers;
+  priority_classes_[kPriorityBulk].max_transfers =
+    kDefaultMaxBackgroundTransfers;
   opt_proxy_groups_current_ = 0;
   opt_proxy_groups_current_burned_ = 0;
   opt_num_proxies_ = 0;
@@ -1613,6 +2391,12 @@ void DownloadManager::Fini() {
     close(pipe_terminate_[0]);
     close(pipe_jobs_[1]);
     close(pipe_jobs_[0]);
+
+    if (opt_dns_refresh_) {
+      WritePipe(pipe_dns_refresh_[1], &buf, 1);
+      pthread_join(thread_dns_refresh_, NULL);
+      ClosePipe(pipe_dns_refresh_);
+    }
   }
 
   for (set<CURL *>::iterator i = pool_handles_idle_->begin(),
@@ -1661,6 +2445,13 @@ void DownloadManager::Spawn() {
                               static_cast<void *>(this));
   assert(retval == 0);
 
+  if (opt_dns_refresh_) {
+    MakePipe(pipe_dns_refresh_);
+    retval = pthread_create(&thread_dns_refresh_, NULL, MainDnsRefresh,
+                            static_cast<void *>(this));
+    assert(retval == 0);
+  }
+
   atomic_inc32(&multi_threaded_);
 }
 
@@ -1671,6 +2462,7 @@ void DownloadManager::Spawn() {
 Failures DownloadManager::Fetch(JobInfo *info) {
   assert(info != NULL);
   assert(info->url != NULL);
+  assert(info->priority < kPriorityNumEntries);
 
   Failures result;
   result = PrepareDownloadDestination(info);
@@ -1721,6 +2513,7 @@ Failures DownloadManager::Fetch(JobInfo *info) {
       double elapsed;
       if (curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &elapsed) == CURLE_OK)
         perf::Xadd(counters_->sz_transfer_time, (int64_t)(elapsed * 1000));
+      UpdateStatistics(handle, retval, info);
     } while (VerifyAndFinalize(retval, info));
     result = info->error_code;
     ReleaseCurlHandle(info->curl_handle);
@@ -1770,7 +2563,9 @@ void DownloadManager::SetDnsServer(const string &address) {
 
     vector<string> servers;
     servers.push_back(address);
+    pthread_mutex_lock(lock_resolver_);
     bool retval = resolver_->SetResolvers(servers);
+    pthread_mutex_unlock(lock_resolver_);
     assert(retval);
   }
   pthread_mutex_unlock(lock_options_);
@@ -1792,11 +2587,13 @@ void DownloadManager::SetDnsParameters(
     pthread_mutex_unlock(lock_options_);
     return;
   }
+  pthread_mutex_lock(lock_resolver_);
   delete resolver_;
   resolver_ = NULL;
   resolver_ =
     dns::NormalResolver::Create(opt_ipv4_only_, retries, timeout_ms);
   assert(resolver_);
+  pthread_mutex_unlock(lock_resolver_);
   pthread_mutex_unlock(lock_options_);
 }
 
@@ -1900,7 +2697,7 @@ void DownloadManager::GetHostInfo(vector<string> *host_chain, vector<int> *rtt,
 
 /**
  * Jumps to the next proxy in the ring of forward proxy servers.
- * Selects one randomly from a load-balancing group.
+ * Selects one from a load-balancing group, preferring well performing proxies.
  *
  * If info is set, switch only if the current proxy is identical to the one used
  * by info, otherwise another transfer has already done the switch.
@@ -1967,7 +2764,8 @@ void DownloadManager::SwitchProxy(JobInfo *info) {
 
   // Select new one
   if ((group_size - opt_proxy_groups_current_burned_) > 0) {
-    int select = prng_.Next(group_size - opt_proxy_groups_current_burned_ + 1);
+    unsigned select = SelectProxyUnlocked(
+      *group, group_size - opt_proxy_groups_current_burned_ + 1);
 
     // Move selected proxy to front
     const ProxyInfo swap = (*group)[select];
@@ -2454,7 +3252,9 @@ void DownloadManager::SetProxyChain(
   vector<dns::Host> hosts;
   LogCvmfs(kLogDownload, kLogDebug, "resolving %u proxy addresses",
            hostnames.size());
+  pthread_mutex_lock(lock_resolver_);
   resolver_->ResolveMany(hostnames, &hosts);
+  pthread_mutex_unlock(lock_resolver_);
 
   // Construct opt_proxy_groups_: traverse proxy list in same order and expand
   // names to resolved IP addresses.
@@ -2561,8 +3361,38 @@ string DownloadManager::GetFallbackProxyList() {
 }
 
 /**
- * Selects a new random proxy in the current load-balancing group.  Resets the
- * "burned" counter.
+ * Picks one of the first num_candidates proxies of a load-balancing group by
+ * the power of two choices: out of two random candidates, the one with the
+ * lower score wins.  Proxies without a current score count as good as the best
+ * one, so that they get probed.  Without any scores, this is a uniform random
+ * selection.
+ */
+unsigned DownloadManager::SelectProxyUnlocked(
+  const vector<ProxyInfo> &group,
+  const unsigned num_candidates)
+{
+  assert(num_candidates > 0);
+  const unsigned first = prng_.Next(num_candidates);
+  if (num_candidates == 1)
+    return first;
+  unsigned second = prng_.Next(num_candidates - 1);
+  if (second >= first)
+    second++;
+
+  const time_t now = time(NULL);
+  const bool first_scored = group[first].HasScore(now);
+  const bool second_scored = group[second].HasScore(now);
+  if (!first_scored)
+    return first;
+  if (!second_scored)
+    return second;
+  return (group[second].GetScore() < group[first].GetScore()) ? second : first;
+}
+
+
+/**
+ * Selects a new proxy in the current load-balancing group, preferring well
+ * performing ones.  Resets the "burned" counter.
  */
 void DownloadManager::RebalanceProxiesUnlocked() {
   if (!opt_proxy_groups_)
@@ -2571,7 +3401,7 @@ void DownloadManager::RebalanceProxiesUnlocked() {
   opt_timestamp_failover_proxies_ = 0;
   opt_proxy_groups_current_burned_ = 1;
   vector<ProxyInfo> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
-  int select = prng_.Next(group->size());
+  unsigned select = SelectProxyUnlocked(*group, group->size());
   swap((*group)[select], (*group)[0]);
   // LogCvmfs(kLogDownload, kLogDebug | kLogSyslog,
   //          "switching proxy from %s to %s (rebalance)",
@@ -2647,7 +3477,9 @@ void DownloadManager::SetRetryParameters(const unsigned max_retries,
 
 void DownloadManager::SetMaxIpaddrPerProxy(unsigned limit) {
   pthread_mutex_lock(lock_options_);
+  pthread_mutex_lock(lock_resolver_);
   resolver_->set_throttle(limit);
+  pthread_mutex_unlock(lock_resolver_);
   pthread_mutex_unlock(lock_options_);
 }
 
@@ -2678,6 +3510,45 @@ void DownloadManager::EnableRedirects() {
 }
 
 
+/**
+ * Resolves the proxy names in a background thread before their DNS records
+ * expire.  Must be called before Spawn().
+ */
+void DownloadManager::EnableDnsRefresh() {
+  assert(atomic_xadd32(&multi_threaded_, 0) == 0);
+  opt_dns_refresh_ = true;
+}
+
+
+/**
+ * Duplicates stalled transfers of objects up to max_size bytes.  The duplicate
+ * responses are buffered in memory, so the size is capped by kMaxMemSize.
+ */
+void DownloadManager::EnableHedging(const unsigned max_size) {
+  pthread_mutex_lock(lock_options_);
+  opt_hedge_max_size_ = (max_size < kMaxMemSize) ? max_size : kMaxMemSize;
+  pthread_mutex_unlock(lock_options_);
+}
+
+
+/**
+ * Limits the number of concurrent transfers and the bandwidth in bytes per
+ * second of a priority class, zero means unlimited.  Must be called before
+ * Spawn().  Throttled transfers should stay above the low speed limit,
+ * otherwise they time out.
+ */
+void DownloadManager::SetPriorityLimits(
+  const Priority priority,
+  const unsigned max_transfers,
+  const uint64_t max_rate)
+{
+  assert(atomic_xadd32(&multi_threaded_, 0) == 0);
+  assert(priority < kPriorityNumEntries);
+  priority_classes_[priority].max_transfers = max_transfers;
+  priority_classes_[priority].bucket.rate = max_rate;
+}
+
+
 /**
  * Creates a copy of the existing download manager.  Must only be called in
  * single-threaded stage because it calls curl_global_init().
@@ -2709,6 +3580,13 @@ DownloadManager *DownloadManager::Clone(perf::StatisticsTemplate statistics) {
   clone->proxy_template_forced_ = proxy_template_forced_;
   clone->opt_proxy_groups_reset_after_ = opt_proxy_groups_reset_after_;
   clone->opt_host_reset_after_ = opt_host_reset_after_;
+  clone->opt_hedge_max_size_ = opt_hedge_max_size_;
+  clone->opt_dns_refresh_ = opt_dns_refresh_;
+  for (unsigned i = 0; i < kPriorityNumEntries; ++i) {
+    clone->priority_classes_[i].max_transfers =
+      priority_classes_[i].max_transfers;
+    clone->priority_classes_[i].bucket.rate = priority_classes_[i].bucket.rate;
+  }
   clone->credentials_attachment_ = credentials_attachment_;
 
   return clone;
@@ -11,6 +11,8 @@
 #include <unistd.h>
 
 #include <cstdio>
+#include <deque>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -88,6 +90,36 @@ enum Destination {
 };  // Destination
 
 
+/**
+ * Jobs are scheduled by priority class.  Each class can be limited in the
+ * number of concurrent transfers and in bandwidth, so that background work
+ * does not delay interactive requests.
+ */
+enum Priority {
+  kPriorityInteractive = 0,
+  kPriorityCatalog,
+  kPriorityPrefetch,
+  kPriorityBulk,
+
+  kPriorityNumEntries
+};  // Priority
+
+
+/**
+ * Caps the download rate of a priority class.  Tokens are bytes.  Transfers of
+ * the class are paused while the bucket is empty.  Only used by the I/O thread.
+ */
+struct TokenBucket {
+  TokenBucket() : rate(0), tokens(0), timestamp_refill(0), num_paused(0) { }
+  void Refill(const uint64_t now_ms);
+
+  uint64_t rate;  ///< Bytes per second, zero means unlimited
+  int64_t tokens;
+  uint64_t timestamp_refill;  ///< In ms
+  unsigned num_paused;
+};  // TokenBucket
+
+
 struct Counters {
   perf::Counter *sz_transferred_bytes;
   perf::Counter *sz_transfer_time;  // measured in miliseconds
@@ -95,6 +127,8 @@ struct Counters {
   perf::Counter *n_retries;
   perf::Counter *n_proxy_failover;
   perf::Counter *n_host_failover;
+  perf::Counter *n_hedged_requests;
+  perf::Counter *n_hedged_won;
 
   explicit Counters(perf::StatisticsTemplate statistics) {
     sz_transferred_bytes = statistics.RegisterTemplated("sz_transferred_bytes",
@@ -108,6 +142,10 @@ struct Counters {
         "Number of proxy failovers");
     n_host_failover = statistics.RegisterTemplated("n_host_failover",
         "Number of host failovers");
+    n_hedged_requests = statistics.RegisterTemplated("n_hedged_requests",
+        "Number of duplicate requests issued for stalled transfers");
+    n_hedged_won = statistics.RegisterTemplated("n_hedged_won",
+        "Number of duplicate requests that completed first");
   }
 };  // Counters
 
@@ -137,11 +175,20 @@ struct JobInfo {
   cvmfs::Sink *destination_sink;
   const shash::Any *expected_hash;
   const std::string *extra_info;
+  Priority priority;
 
   // Allow byte ranges to be specified.
   off_t range_offset;
   off_t range_size;
 
+  // Conditional request.  Non-empty validators are sent as If-None-Match and
+  // If-Modified-Since and get replaced by the validators of the final 2XX
+  // response, or cleared if it has none.  A 304 reply to a conditional
+  // request succeeds without data and sets not_modified.
+  std::string *etag;
+  std::string *last_modified;
+  bool not_modified;
+
   // Default initialization of fields
   void Init() {
     url = NULL;
@@ -162,6 +209,7 @@ struct JobInfo {
     destination_sink = NULL;
     expected_hash = NULL;
     extra_info = NULL;
+    priority = kPriorityInteractive;
 
     curl_handle = NULL;
     headers = NULL;
@@ -175,7 +223,17 @@ struct JobInfo {
 
     range_offset = -1;
     range_size = -1;
+    etag = NULL;
+    last_modified = NULL;
+    not_modified = false;
     http_code = -1;
+
+    hedge = NULL;
+    is_hedge = false;
+    hedged = false;
+    timestamp_start = 0;
+    bucket = NULL;
+    paused = false;
   }
 
   // One constructor per destination + head request
@@ -241,6 +299,8 @@ struct JobInfo {
   CURL *curl_handle;
   curl_slist *headers;
   char *info_header;
+  std::string header_if_none_match;
+  std::string header_if_modified_since;
   z_stream zstream;
   shash::ContextPtr hash_context;
   int wait_at[2];  /**< Pipe used for the return value */
@@ -252,6 +312,13 @@ struct JobInfo {
   unsigned char num_used_hosts;
   unsigned char num_retries;
   unsigned backoff_ms;
+  // A stalled job and its duplicate request point to each other
+  JobInfo *hedge;
+  bool is_hedge;
+  bool hedged;  ///< The current attempt has already been duplicated
+  uint64_t timestamp_start;  ///< Start of the current attempt in ms
+  TokenBucket *bucket;  ///< Bandwidth cap of the priority class, if any
+  bool paused;
 };  // JobInfo
 
 
@@ -308,18 +375,62 @@ class CredentialsAttachment {
 class DownloadManager {
   FRIEND_TEST(T_Download, ValidateGeoReply);
   FRIEND_TEST(T_Download, StripDirect);
+  FRIEND_TEST(T_Download, ProxyScores);
+  FRIEND_TEST(T_Download, ProxyPenalty);
+  FRIEND_TEST(T_Download, HedgeDelay);
+  FRIEND_TEST(T_Download, PriorityLimits);
+  FRIEND_TEST(T_Download, RefreshProxyIps);
+  FRIEND_TEST(T_Download, HeaderValidators);
+  FRIEND_TEST(T_Download, IssueHedge);
+  FRIEND_TEST(T_Download, FinalizeHedge);
+  FRIEND_TEST(T_Download, CancelHedge);
 
  public:
+  /**
+   * Besides the address, a proxy carries exponentially weighted moving averages
+   * of the time to first byte and of the throughput of the transfers that
+   * completed through it.  The scores are used to prefer fast proxies within a
+   * load-balancing group.
+   */
   struct ProxyInfo {
-    ProxyInfo() { }
-    explicit ProxyInfo(const std::string &url) : url(url) { }
+    ProxyInfo()
+      : latency_ms(0.0), baseline_ms(0.0), throughput(0.0)
+      , num_samples(0), timestamp_sample(0)
+    { }
+    explicit ProxyInfo(const std::string &url)
+      : url(url)
+      , latency_ms(0.0), baseline_ms(0.0), throughput(0.0)
+      , num_samples(0), timestamp_sample(0)
+    { }
     ProxyInfo(const dns::Host &host, const std::string &url)
       : host(host)
       , url(url)
+      , latency_ms(0.0), baseline_ms(0.0), throughput(0.0)
+      , num_samples(0), timestamp_sample(0)
     { }
     std::string Print();
+    void AddSample(const float ttfb_ms, const float bytes_per_sec,
+                   const time_t now);
+    bool HasScore(const time_t now) const;
+    float GetScore() const;
     dns::Host host;
     std::string url;
+    /**
+     * Fast moving average of the time to first byte
+     */
+    float latency_ms;
+    /**
+     * Slow moving average of the time to first byte, used to detect when the
+     * proxy degrades
+     */
+    float baseline_ms;
+    /**
+     * Moving average of the throughput of large transfers in bytes per second,
+     * zero if not yet measured
+     */
+    float throughput;
+    unsigned num_samples;
+    time_t timestamp_sample;
   };
 
   enum ProxySetModes {
@@ -349,11 +460,61 @@ class DownloadManager {
 
   static const unsigned kDnsDefaultRetries = 1;
   static const unsigned kDnsDefaultTimeoutMs = 3000;
+  /**
+   * The DNS refresh thread re-resolves proxy names once this percentage of
+   * their TTL is over.  Names it did not resolve itself are refreshed
+   * kDnsRefreshMarginS seconds before they expire, failed attempts are
+   * retried after the margin.
+   */
+  static const unsigned kDnsRefreshPercent = 75;
+  static const unsigned kDnsRefreshMarginS = 15;
+  static const unsigned kDnsRefreshCheckIntervalMs = 5000;
+
+  /**
+   * Proxy scores older than this many seconds are ignored, so that a proxy
+   * that recovered gets its chance again.
+   */
+  static const unsigned kProxyScoreTtl = 600;
+  /**
+   * The active proxy is replaced if its latency grows beyond this factor of
+   * its own long-term average.  The decision requires a minimum number of
+   * samples and is taken at most once per rebalance interval (in seconds).
+   */
+  static const unsigned kProxyDegradedFactor = 3;
+  static const unsigned kProxyMinSamples = 8;
+  static const unsigned kProxyRebalanceInterval = 60;
+  /**
+   * Only transfers of at least this size contribute to the throughput.  The
+   * score of a proxy is the expected time in ms to fetch an object of the
+   * reference size.
+   */
+  static const unsigned kProxyThroughputMinSize = 64 * 1024;
+  static const unsigned kProxyScoreReferenceSize = 256 * 1024;
+
+  /**
+   * A transfer that did not receive any data after the given percentile of
+   * the recent times to first byte is duplicated through another proxy or
+   * host.  Until enough samples are collected, a fixed delay is used.
+   */
+  static const unsigned kHedgeNumSamples = 128;
+  static const unsigned kHedgePercentile = 95;
+  static const unsigned kHedgeDefaultDelayMs = 1000;
+  static const unsigned kHedgeMinDelayMs = 20;
+  static const unsigned kHedgeCheckIntervalMs = 5;
+  static const unsigned kHedgeDefaultMaxSize = 256 * 1024;
+
+  /**
+   * Unless configured otherwise, prefetch and bulk transfers are limited to
+   * this number of concurrent transfers each.
+   */
+  static const unsigned kDefaultMaxBackgroundTransfers = 4;
 
   DownloadManager();
   ~DownloadManager();
 
   static int ParseHttpCode(const char digits[3]);
+  static std::string GetHeaderValue(const std::string &header_line,
+                                    const unsigned name_length);
 
   void Init(const unsigned max_pool_handles,
             const bool use_system_proxy,
@@ -403,11 +564,19 @@ class DownloadManager {
   void EnableInfoHeader();
   void EnablePipelining();
   void EnableRedirects();
+  void EnableHedging(const unsigned max_size);
+  void EnableDnsRefresh();
+  void SetPriorityLimits(const Priority priority,
+                         const unsigned max_transfers,
+                         const uint64_t max_rate);
 
  private:
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
+  static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
+                                   void *info_link);
   static void *MainDownload(void *data);
+  static void *MainDnsRefresh(void *data);
 
   bool StripDirect(const std::string &proxy_list, std::string *cleaned_list);
   bool ValidateGeoReply(const std::string &reply_order,
@@ -416,12 +585,33 @@ class DownloadManager {
   void SwitchHost(JobInfo *info);
   void SwitchProxy(JobInfo *info);
   void RebalanceProxiesUnlocked();
+  unsigned SelectProxyUnlocked(const std::vector<ProxyInfo> &group,
+                               const unsigned num_candidates);
+  void UpdateProxyScoreUnlocked(const std::string &proxy,
+                                const float ttfb_ms,
+                                const float bytes_per_sec);
   CURL *AcquireCurlHandle();
   void ReleaseCurlHandle(CURL *handle);
   void InitializeRequest(JobInfo *info, CURL *handle);
   void SetUrlOptions(JobInfo *info);
   void ValidateProxyIpsUnlocked(const std::string &url, const dns::Host &host);
-  void UpdateStatistics(CURL *handle);
+  void UpdateProxyIpsUnlocked(const unsigned group_idx,
+                              const std::string &url,
+                              const dns::Host &host,
+                              const dns::Host &new_host);
+  void RefreshProxyIps(std::map<std::string, time_t> *refresh_due);
+  void UpdateStatistics(CURL *handle, const int curl_error,
+                        const JobInfo *info);
+  void AddHedgeSampleUnlocked(const unsigned ttfb_ms);
+  void CheckHedges();
+  bool IssueHedge(JobInfo *info);
+  JobInfo *FinalizeHedge(JobInfo *hedge, const int curl_error,
+                         int *primary_curl_error);
+  void CancelHedge(JobInfo *info);
+  void FreeHedge(JobInfo *hedge);
+  void StartJob(JobInfo *info);
+  bool StartQueuedJobs();
+  void RefillTokenBuckets();
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
   void SetNocache(JobInfo *info);
@@ -452,6 +642,11 @@ class DownloadManager {
 
   pthread_mutex_t *lock_options_;
   pthread_mutex_t *lock_synchronous_mode_;
+  /**
+   * Protects resolver_ so that names can be resolved without holding
+   * lock_options_.  Taken after lock_options_ if both are needed.
+   */
+  pthread_mutex_t *lock_resolver_;
   char *opt_dns_server_;
   unsigned opt_timeout_proxy_;
   unsigned opt_timeout_direct_;
@@ -507,6 +702,14 @@ class DownloadManager {
    */
   dns::NormalResolver *resolver_;
 
+  /**
+   * Refreshes the resolved proxy addresses ahead of their expiry so that the
+   * download path does not need to wait for DNS.
+   */
+  bool opt_dns_refresh_;
+  pthread_t thread_dns_refresh_;
+  int pipe_dns_refresh_[2];
+
   /**
    * If a proxy has IPv4 and IPv6 addresses, which one to prefer
    */
@@ -534,6 +737,40 @@ class DownloadManager {
   time_t opt_timestamp_backup_proxies_;
   time_t opt_timestamp_failover_proxies_;  // failover within the same group
   unsigned opt_proxy_groups_reset_after_;
+  /**
+   * Last time the active proxy was replaced because its score degraded
+   */
+  time_t opt_timestamp_score_rebalance_;
+
+  /**
+   * Transfers of at most this size are duplicated when they stall, zero
+   * disables hedged requests.
+   */
+  unsigned opt_hedge_max_size_;
+  /**
+   * Ring buffer of the recent times to first byte in ms, from which the delay
+   * before a hedged request is derived
+   */
+  std::vector<unsigned> hedge_ttfb_samples_;
+  unsigned hedge_ttfb_next_;
+  unsigned hedge_delay_ms_;
+  /**
+   * Only touched by the I/O thread
+   */
+  uint64_t hedge_last_check_ms_;
+
+  /**
+   * Scheduling state of a priority class.  The limits are set before the I/O
+   * thread is spawned, the rest is only touched by the I/O thread.
+   */
+  struct PriorityClass {
+    PriorityClass() : max_transfers(0), num_active(0) { }
+    unsigned max_transfers;  ///< Zero means unlimited
+    unsigned num_active;  ///< Started and not yet finished jobs
+    std::deque<JobInfo *> queue;
+    TokenBucket bucket;
+  };
+  PriorityClass priority_classes_[kPriorityNumEntries];
 
   /**
    * Similarly to proxy group reset, we'd also like to reset the host after a
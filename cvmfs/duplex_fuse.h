@@ -9,16 +9,24 @@
 // Unit tests
 #define FUSE_VERSION 29
 #define FUSE_ROOT_ID 1
+#include <sys/types.h>
 extern "C" {
 struct fuse_chan {};
 // Defined in t_fuse_evict.cc
 extern unsigned fuse_lowlevel_notify_inval_entry_cnt;
+extern unsigned fuse_lowlevel_notify_inval_inode_cnt;
 static int __attribute__((used)) fuse_lowlevel_notify_inval_entry(
   void *, unsigned long, const char *, size_t)  // NOLINT (ulong from fuse)
 {
   fuse_lowlevel_notify_inval_entry_cnt++;
   return -1;
 }
+static int __attribute__((used)) fuse_lowlevel_notify_inval_inode(
+  void *, unsigned long, off_t, off_t)  // NOLINT (ulong from fuse)
+{
+  fuse_lowlevel_notify_inval_inode_cnt++;
+  return -1;
+}
 }
 #else
 #define FUSE_USE_VERSION 26
@@ -31,6 +39,11 @@ static int __attribute__((used)) fuse_lowlevel_notify_inval_entry(
 {
   abort();
 }
+static int __attribute__((used)) fuse_lowlevel_notify_inval_inode(
+  void *, unsigned long, off_t, off_t)  // NOLINT
+{
+  abort();
+}
 }
 #endif
 #endif
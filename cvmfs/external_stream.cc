@@ -0,0 +1,370 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "external_stream.h"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "backoff.h"
+#include "clientctx.h"
+#include "download.h"
+#include "file_chunk.h"
+#include "logging.h"
+#include "smalloc.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace cvmfs {
+
+shash::Any ExternalStreamer::MakeBlockId(
+  const shash::Any &id,
+  const unsigned block_size,
+  const uint64_t block)
+{
+  shash::Any block_id(id.algorithm, shash::kSuffixPartial);
+  shash::HashString(
+    id.ToString() + "/" + StringifyInt(block_size) + "/" + StringifyInt(block),
+    &block_id);
+  return block_id;
+}
+
+
+ExternalStreamer::ExternalStreamer(
+  CacheManager *cache_mgr,
+  download::DownloadManager *download_mgr,
+  BackoffThrottle *backoff_throttle,
+  perf::StatisticsTemplate statistics,
+  const unsigned block_size)
+  : cache_mgr_(cache_mgr)
+  , download_mgr_(download_mgr)
+  , backoff_throttle_(backoff_throttle)
+  , block_size_(block_size)
+{
+  assert(block_size_ > 0);
+  lock_blocks_inflight_ = reinterpret_cast<pthread_mutex_t *>(
+    smalloc(sizeof(pthread_mutex_t)));
+  int retval = pthread_mutex_init(lock_blocks_inflight_, NULL);
+  assert(retval == 0);
+  cond_blocks_inflight_ = reinterpret_cast<pthread_cond_t *>(
+    smalloc(sizeof(pthread_cond_t)));
+  retval = pthread_cond_init(cond_blocks_inflight_, NULL);
+  assert(retval == 0);
+  lock_read_ahead_states_ = reinterpret_cast<pthread_mutex_t *>(
+    smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(lock_read_ahead_states_, NULL);
+  assert(retval == 0);
+  n_range_requests = statistics.RegisterTemplated("n_range_requests",
+    "overall number of range requests for streamed external files");
+  n_blocks = statistics.RegisterTemplated("n_blocks",
+    "overall number of downloaded blocks of streamed external files");
+}
+
+
+ExternalStreamer::~ExternalStreamer() {
+  pthread_mutex_destroy(lock_read_ahead_states_);
+  free(lock_read_ahead_states_);
+  pthread_cond_destroy(cond_blocks_inflight_);
+  free(cond_blocks_inflight_);
+  pthread_mutex_destroy(lock_blocks_inflight_);
+  free(lock_blocks_inflight_);
+}
+
+
+/**
+ * Reads size bytes at offset of the given chunk of an external file (or the
+ * entire file if it is not chunked).  Missing blocks are downloaded.  The
+ * read-ahead window is tracked per file handle.
+ *
+ * \return the number of bytes read or -errno
+ */
+int64_t ExternalStreamer::Read(
+  const FileChunk &chunk,
+  const string &url,
+  const uint64_t offset,
+  const uint64_t size,
+  const CacheManager::ObjectType object_type,
+  void *buf,
+  const uint64_t handle)
+{
+  const uint64_t chunk_size = chunk.size();
+  if ((offset >= chunk_size) || (size == 0))
+    return 0;
+  const uint64_t nbytes = min(size, chunk_size - offset);
+  const uint64_t num_blocks = (chunk_size + block_size_ - 1) / block_size_;
+  const uint64_t first_block = offset / block_size_;
+  const uint64_t last_block = (offset + nbytes - 1) / block_size_;
+
+  const unsigned read_ahead =
+    UpdateReadAhead(handle, chunk.offset() + offset, nbytes);
+
+  unsigned char *data = static_cast<unsigned char *>(buf);
+  uint64_t pos = offset;
+  for (uint64_t block = first_block; block <= last_block; ++block) {
+    const uint64_t block_offset = block * block_size_;
+    const uint64_t nbytes_block =
+      min(block_offset + block_size_, offset + nbytes) - pos;
+
+    int fd = OpenBlock(chunk.content_hash(), block);
+    if (fd < 0) {
+      // The entire object might be in the cache, e.g. if it has been pinned
+      fd = cache_mgr_->Open(CacheManager::Bless(chunk.content_hash()));
+      if (fd >= 0) {
+        const int64_t retval =
+          cache_mgr_->Pread(fd, data, offset + nbytes - pos, pos);
+        cache_mgr_->Close(fd);
+        if (retval < 0)
+          return retval;
+        return (pos - offset) + retval;
+      }
+
+      const uint64_t end_block =
+        min(num_blocks, last_block + 1 + read_ahead);
+      const int retval =
+        FetchBlocks(chunk, url, block, end_block, object_type);
+      if (retval < 0)
+        return retval;
+      fd = OpenBlock(chunk.content_hash(), block);
+      if (fd < 0)
+        return fd;
+    }
+
+    const int64_t retval =
+      cache_mgr_->Pread(fd, data, nbytes_block, pos - block_offset);
+    cache_mgr_->Close(fd);
+    if (retval < 0)
+      return retval;
+    if (static_cast<uint64_t>(retval) != nbytes_block)
+      return -EIO;
+    data += nbytes_block;
+    pos += nbytes_block;
+  }
+  return nbytes;
+}
+
+
+/**
+ * Forgets the read-ahead state of a closed file handle.
+ */
+void ExternalStreamer::Release(const uint64_t handle) {
+  MutexLockGuard guard(lock_read_ahead_states_);
+  read_ahead_states_.erase(handle);
+}
+
+
+/**
+ * Sequential reads grow the read-ahead window of the handle, other reads reset
+ * it.  Returns the new window in blocks.
+ */
+unsigned ExternalStreamer::UpdateReadAhead(
+  const uint64_t handle,
+  const uint64_t file_offset,
+  const uint64_t nbytes)
+{
+  MutexLockGuard guard(lock_read_ahead_states_);
+  ReadAheadState *state = &read_ahead_states_[handle];
+  if (file_offset == state->next_offset) {
+    const unsigned read_ahead = 2 * state->read_ahead;
+    state->read_ahead = (read_ahead == 0) ? 1 :
+      ((read_ahead > kMaxReadAheadBlocks) ? kMaxReadAheadBlocks : read_ahead);
+  } else {
+    state->read_ahead = 0;
+  }
+  state->next_offset = file_offset + nbytes;
+  return state->read_ahead;
+}
+
+
+int ExternalStreamer::OpenBlock(const shash::Any &id, const uint64_t block) {
+  return cache_mgr_->Open(
+    CacheManager::Bless(MakeBlockId(id, block_size_, block)));
+}
+
+
+bool ExternalStreamer::IsCached(const shash::Any &id, const uint64_t block) {
+  const int fd = OpenBlock(id, block);
+  if (fd < 0)
+    return false;
+  cache_mgr_->Close(fd);
+  return true;
+}
+
+
+/**
+ * Downloads the blocks starting from begin_block in a single range request.
+ * The range is extended up to max_end_block (exclusive) as long as the blocks
+ * are neither cached nor being downloaded by another thread.  If begin_block
+ * itself is being downloaded, waits for that download.
+ */
+int ExternalStreamer::FetchBlocks(
+  const FileChunk &chunk,
+  const string &url,
+  const uint64_t begin_block,
+  const uint64_t max_end_block,
+  const CacheManager::ObjectType object_type)
+{
+  const shash::Any &id = chunk.content_hash();
+  const shash::Any begin_id = MakeBlockId(id, block_size_, begin_block);
+
+  pthread_mutex_lock(lock_blocks_inflight_);
+  if (blocks_inflight_.find(begin_id) != blocks_inflight_.end()) {
+    LogCvmfs(kLogCache, kLogDebug, "waiting for block %" PRIu64 " of %s",
+             begin_block, url.c_str());
+    do {
+      pthread_cond_wait(cond_blocks_inflight_, lock_blocks_inflight_);
+    } while (blocks_inflight_.find(begin_id) != blocks_inflight_.end());
+    pthread_mutex_unlock(lock_blocks_inflight_);
+    return IsCached(id, begin_block) ? 0 : -EIO;
+  }
+  blocks_inflight_.insert(begin_id);
+  uint64_t end_block = begin_block + 1;
+  while (end_block < max_end_block) {
+    const shash::Any block_id = MakeBlockId(id, block_size_, end_block);
+    if ((blocks_inflight_.find(block_id) != blocks_inflight_.end()) ||
+        IsCached(id, end_block))
+    {
+      break;
+    }
+    blocks_inflight_.insert(block_id);
+    end_block++;
+  }
+  pthread_mutex_unlock(lock_blocks_inflight_);
+
+  const uint64_t range_begin = begin_block * block_size_;
+  const uint64_t range_end =
+    min(end_block * block_size_, static_cast<uint64_t>(chunk.size()));
+  LogCvmfs(kLogCache, kLogDebug, "streaming blocks %" PRIu64 "-%" PRIu64
+           " of %s", begin_block, end_block - 1, url.c_str());
+
+  BlockSink sink(cache_mgr_, id, block_size_, begin_block,
+                 range_end - range_begin,
+                 CacheManager::ObjectInfo(object_type, url));
+  download::JobInfo download_job(&url, false /* compressed */,
+                                 true /* probe_hosts */, &sink,
+                                 NULL /* blocks cannot be verified */);
+  download_job.extra_info = &url;
+  download_job.range_offset = chunk.offset() + range_begin;
+  download_job.range_size = range_end - range_begin;
+  ClientCtx *ctx = ClientCtx::GetInstance();
+  if (ctx->IsSet())
+    ctx->Get(&download_job.uid, &download_job.gid, &download_job.pid);
+  perf::Inc(n_range_requests);
+  perf::Xadd(n_blocks, end_block - begin_block);
+  download_mgr_->Fetch(&download_job);
+
+  int result = 0;
+  if ((download_job.error_code != download::kFailOk) || !sink.IsComplete()) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to stream blocks %" PRIu64 "-%" PRIu64 " of %s "
+             "(error %d [%s])", begin_block, end_block - 1, url.c_str(),
+             download_job.error_code,
+             download::Code2Ascii(download_job.error_code));
+    backoff_throttle_->Throttle();
+    result = -EIO;
+  }
+
+  pthread_mutex_lock(lock_blocks_inflight_);
+  for (uint64_t i = begin_block; i < end_block; ++i)
+    blocks_inflight_.erase(MakeBlockId(id, block_size_, i));
+  pthread_cond_broadcast(cond_blocks_inflight_);
+  pthread_mutex_unlock(lock_blocks_inflight_);
+  return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+BlockSink::BlockSink(
+  CacheManager *cache_mgr,
+  const shash::Any &id,
+  const unsigned block_size,
+  const uint64_t first_block,
+  const uint64_t size,
+  const CacheManager::ObjectInfo &object_info)
+  : cache_mgr_(cache_mgr)
+  , id_(id)
+  , block_size_(block_size)
+  , first_block_(first_block)
+  , size_(size)
+  , object_info_(object_info)
+  , txn_(smalloc(cache_mgr->SizeOfTxn()))
+  , in_txn_(false)
+  , pos_(0)
+  , committed_(0)
+{ }
+
+
+BlockSink::~BlockSink() {
+  if (in_txn_)
+    cache_mgr_->AbortTxn(txn_);
+  free(txn_);
+}
+
+
+int64_t BlockSink::Write(const void *buf, uint64_t sz) {
+  const unsigned char *data = static_cast<const unsigned char *>(buf);
+  uint64_t remaining = sz;
+
+  // Skip the blocks that were committed before a Reset()
+  if (pos_ < committed_) {
+    const uint64_t nbytes = min(remaining, committed_ - pos_);
+    pos_ += nbytes;
+    data += nbytes;
+    remaining -= nbytes;
+  }
+
+  while (remaining > 0) {
+    if (pos_ >= size_)
+      return -EIO;
+    const uint64_t block_begin = pos_ - (pos_ % block_size_);
+    const uint64_t block_end = min(block_begin + block_size_, size_);
+    if (!in_txn_) {
+      const shash::Any block_id = ExternalStreamer::MakeBlockId(
+        id_, block_size_, first_block_ + block_begin / block_size_);
+      const int retval =
+        cache_mgr_->StartTxn(block_id, block_end - block_begin, txn_);
+      if (retval < 0)
+        return retval;
+      cache_mgr_->CtrlTxn(object_info_, 0, txn_);
+      in_txn_ = true;
+    }
+
+    const uint64_t nbytes = min(remaining, block_end - pos_);
+    const int64_t written = cache_mgr_->Write(data, nbytes, txn_);
+    if ((written < 0) || (static_cast<uint64_t>(written) != nbytes))
+      return (written < 0) ? written : -EIO;
+    pos_ += nbytes;
+    data += nbytes;
+    remaining -= nbytes;
+
+    if (pos_ == block_end) {
+      in_txn_ = false;
+      const int retval = cache_mgr_->CommitTxn(txn_);
+      if (retval < 0)
+        return retval;
+      committed_ = pos_;
+    }
+  }
+  return sz;
+}
+
+
+int BlockSink::Reset() {
+  if (in_txn_) {
+    cache_mgr_->AbortTxn(txn_);
+    in_txn_ = false;
+  }
+  pos_ = 0;
+  return 0;
+}
+
+}  // namespace cvmfs
@@ -0,0 +1,166 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_EXTERNAL_STREAM_H_
+#define CVMFS_EXTERNAL_STREAM_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "cache.h"
+#include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "sink.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+class BackoffThrottle;
+class FileChunk;
+
+namespace download {
+class DownloadManager;
+}
+
+namespace cvmfs {
+
+/**
+ * Serves reads from external data files by HTTP range requests of aligned
+ * blocks instead of downloading entire files or chunks before the first byte
+ * can be read.  Every block is stored as a separate object in the cache
+ * manager, so that the cache becomes a sparse map of the blocks of a file.
+ * Block objects are identified by a hash derived from the content hash of the
+ * file (or chunk), the block size, and the block index.
+ *
+ * Sequential reads of a file handle grow a read-ahead window, so that a cache
+ * miss fetches several blocks in a single request.  Random access only
+ * fetches the touched blocks.  The read-ahead state is kept per chunk handle
+ * of the Fuse module.  It is not part of the saved state, after a reload the
+ * window starts over.
+ *
+ * The content hash covers the entire file, so blocks cannot be verified.  If
+ * the entire file is in the cache anyway, e.g. because it has been pinned,
+ * reads are served from there.
+ */
+class ExternalStreamer : SingleCopy {
+  FRIEND_TEST(T_ExternalStreamer, ReadAhead);
+
+ public:
+  static const unsigned kDefaultBlockSize = 1024 * 1024;
+  /**
+   * Upper bound of the read-ahead window in blocks.
+   */
+  static const unsigned kMaxReadAheadBlocks = 16;
+
+  static shash::Any MakeBlockId(const shash::Any &id,
+                                const unsigned block_size,
+                                const uint64_t block);
+
+  ExternalStreamer(CacheManager *cache_mgr,
+                   download::DownloadManager *download_mgr,
+                   BackoffThrottle *backoff_throttle,
+                   perf::StatisticsTemplate statistics,
+                   const unsigned block_size = kDefaultBlockSize);
+  ~ExternalStreamer();
+
+  int64_t Read(const FileChunk &chunk,
+               const std::string &url,
+               const uint64_t offset,
+               const uint64_t size,
+               const CacheManager::ObjectType object_type,
+               void *buf,
+               const uint64_t handle);
+  void Release(const uint64_t handle);
+
+  unsigned block_size() const { return block_size_; }
+
+ private:
+  /**
+   * The file offset following the previous read of a handle and the current
+   * read-ahead window in blocks.
+   */
+  struct ReadAheadState {
+    ReadAheadState() : next_offset(0), read_ahead(0) { }
+    uint64_t next_offset;
+    unsigned read_ahead;
+  };
+
+  unsigned UpdateReadAhead(const uint64_t handle,
+                           const uint64_t file_offset,
+                           const uint64_t nbytes);
+
+  int OpenBlock(const shash::Any &id, const uint64_t block);
+  bool IsCached(const shash::Any &id, const uint64_t block);
+  int FetchBlocks(const FileChunk &chunk,
+                  const std::string &url,
+                  const uint64_t begin_block,
+                  const uint64_t max_end_block,
+                  const CacheManager::ObjectType object_type);
+
+  CacheManager *cache_mgr_;
+  download::DownloadManager *download_mgr_;
+  BackoffThrottle *backoff_throttle_;
+  unsigned block_size_;
+
+  /**
+   * Blocks that are currently being downloaded.  Readers of such a block wait
+   * for the download instead of requesting the block again.
+   */
+  std::set<shash::Any> blocks_inflight_;
+  pthread_mutex_t *lock_blocks_inflight_;
+  pthread_cond_t *cond_blocks_inflight_;
+
+  std::map<uint64_t, ReadAheadState> read_ahead_states_;
+  pthread_mutex_t *lock_read_ahead_states_;
+
+  perf::Counter *n_range_requests;
+  perf::Counter *n_blocks;
+};
+
+
+/**
+ * Writes the response of a range request into consecutive block objects of
+ * the cache manager.  The range starts at a block boundary.  Every block is
+ * committed as soon as it is complete.  After a Reset(), the bytes of the
+ * already committed blocks are skipped.
+ */
+class BlockSink : public Sink {
+ public:
+  BlockSink(CacheManager *cache_mgr,
+            const shash::Any &id,
+            const unsigned block_size,
+            const uint64_t first_block,
+            const uint64_t size,
+            const CacheManager::ObjectInfo &object_info);
+  virtual ~BlockSink();
+  virtual int64_t Write(const void *buf, uint64_t sz);
+  virtual int Reset();
+
+  bool IsComplete() const { return committed_ == size_; }
+
+ private:
+  CacheManager *cache_mgr_;
+  shash::Any id_;
+  unsigned block_size_;
+  uint64_t first_block_;
+  uint64_t size_;
+  CacheManager::ObjectInfo object_info_;
+  void *txn_;
+  bool in_txn_;
+  /**
+   * Bytes received since the start of the range or the last Reset()
+   */
+  uint64_t pos_;
+  /**
+   * Bytes in blocks that are committed to the cache
+   */
+  uint64_t committed_;
+};
+
+}  // namespace cvmfs
+
+#endif  // CVMFS_EXTERNAL_STREAM_H_
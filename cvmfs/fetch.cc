@@ -81,7 +81,8 @@ int Fetcher::Fetch(
   const zlib::Algorithms compression_algorithm,
   const CacheManager::ObjectType object_type,
   const std::string &alt_url,
-  off_t range_offset)
+  off_t range_offset,
+  const download::Priority priority)
 {
   int fd_return;  // Read-only file descriptor that is returned
   int retval;
@@ -156,6 +157,7 @@ int Fetcher::Fetch(
   tls->download_job.compressed = (compression_algorithm == zlib::kZlibDefault);
   tls->download_job.range_offset = range_offset;
   tls->download_job.range_size = size;
+  tls->download_job.priority = priority;
   download_mgr_->Fetch(&tls->download_job);
 
   if (tls->download_job.error_code == download::kFailOk) {
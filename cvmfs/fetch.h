@@ -80,7 +80,8 @@ class Fetcher : SingleCopy {
             const zlib::Algorithms compression_algorithm,
             const CacheManager::ObjectType object_type,
             const std::string &alt_url = "",
-            off_t range_offset = -1);
+            off_t range_offset = -1,
+            const download::Priority priority = download::kPriorityInteractive);
 
   CacheManager *cache_mgr() { return cache_mgr_; }
   download::DownloadManager *download_mgr() { return download_mgr_; }
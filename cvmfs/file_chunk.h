@@ -74,7 +74,8 @@ struct FileChunkReflist {
 
 /**
  * Stores the chunk index of a file descriptor.  Needed for the Fuse module
- * and for libcvmfs.
+ * and for libcvmfs.  Part of the saved state of the chunk tables, so its
+ * layout must not change.
  */
 struct ChunkFd {
   ChunkFd() : fd(-1), chunk_idx(0) { }
@@ -94,6 +94,80 @@ void FuseInvalidator::InvalidateDentries(Handle *handle) {
 }
 
 
+/**
+ * Evicts the given dentries and the attributes of the given directories.  The
+ * dentries are paths that were added, removed, or changed.  For directories,
+ * evicting the dentry drops the cached subtree, too.  The directories are
+ * paths whose attributes changed but whose cached children stay valid.
+ */
+void FuseInvalidator::InvalidatePaths(
+  Handle *handle,
+  const vector<PathString> &dentries,
+  const vector<PathString> &directories)
+{
+  assert(handle != NULL);
+  handle->dentries_ = dentries;
+  handle->directories_ = directories;
+  char c = 'P';
+  WritePipe(pipe_ctrl_[1], &c, 1);
+  WritePipe(pipe_ctrl_[1], &handle, sizeof(handle));
+}
+
+
+/**
+ * Paths whose parent directory is not known to the inode tracker cannot be in
+ * the kernel caches and are skipped.  Returns false if the eviction was
+ * canceled.
+ */
+bool FuseInvalidator::EvictPaths(Handle *handle, uint64_t deadline) {
+  unsigned i = 0;
+  for (unsigned j = 0; j < handle->directories_.size(); ++j) {
+    const PathString &path = handle->directories_[j];
+    uint64_t inode = path.IsEmpty() ?
+                     FUSE_ROOT_ID : inode_tracker_->FindInode(path);
+    if (inode != 0) {
+      fuse_lowlevel_notify_inval_inode(*fuse_channel_, inode, 0, 0);
+      LogCvmfs(kLogCvmfs, kLogDebug, "evicting attributes of <%" PRIu64 ">",
+               inode);
+    }
+    if ((++i % kCheckTimeoutFreqOps) == 0) {
+      if ((platform_monotonic_time() >= deadline) ||
+          (atomic_read32(&terminated_) == 1))
+      {
+        return false;
+      }
+    }
+  }
+
+  for (unsigned j = 0; j < handle->dentries_.size(); ++j) {
+    const PathString &path = handle->dentries_[j];
+    if (path.IsEmpty())
+      continue;
+    PathString parent_path = GetParentPath(path);
+    uint64_t inode = parent_path.IsEmpty() ?
+                     FUSE_ROOT_ID : inode_tracker_->FindInode(parent_path);
+    if (inode != 0) {
+      NameString name = GetFileName(path);
+      // Can return non-zero value if the entry is not cached
+      fuse_lowlevel_notify_inval_entry(
+        *fuse_channel_,
+        inode,
+        name.GetChars(),
+        name.GetLength());
+      LogCvmfs(kLogCvmfs, kLogDebug, "evicting %s", path.c_str());
+    }
+    if ((++i % kCheckTimeoutFreqOps) == 0) {
+      if ((platform_monotonic_time() >= deadline) ||
+          (atomic_read32(&terminated_) == 1))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
 void *FuseInvalidator::MainInvalidator(void *data) {
   FuseInvalidator *invalidator = reinterpret_cast<FuseInvalidator *>(data);
   LogCvmfs(kLogCvmfs, kLogDebug, "starting dentry invalidator thread");
@@ -105,7 +179,7 @@ void *FuseInvalidator::MainInvalidator(void *data) {
     if (c == 'Q')
       break;
 
-    assert(c == 'I');
+    assert((c == 'I') || (c == 'P'));
     ReadPipe(invalidator->pipe_ctrl_[0], &handle, sizeof(handle));
     LogCvmfs(kLogCvmfs, kLogDebug, "invalidating kernel caches, timeout %u",
              handle->timeout_s_);
@@ -122,6 +196,23 @@ void *FuseInvalidator::MainInvalidator(void *data) {
           break;
         }
       }
+      handle->dentries_.clear();
+      handle->directories_.clear();
+      handle->SetDone();
+      continue;
+    }
+
+    if (c == 'P') {
+      LogCvmfs(kLogCvmfs, kLogDebug,
+               "evicting %u changed paths and %u changed directories",
+               static_cast<unsigned>(handle->dentries_.size()),
+               static_cast<unsigned>(handle->directories_.size()));
+      if (!invalidator->EvictPaths(handle, deadline)) {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+                 "cancel cache eviction due to timeout or termination");
+      }
+      handle->dentries_.clear();
+      handle->directories_.clear();
       handle->SetDone();
       continue;
     }
@@ -6,10 +6,14 @@
 #define CVMFS_FUSE_EVICT_H_
 
 #include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
 
 #include "atomic.h"
 #include "duplex_fuse.h"
 #include "gtest/gtest_prod.h"
+#include "shortstring.h"
 #include "util/single_copy.h"
 
 namespace glue {
@@ -24,11 +28,15 @@ class InodeTracker;
  *
  * Evicting entries from the cache must be done from a separate thread to
  * avoid a deadlock in the fuse callbacks (see Fuse documenatation).
+ *
+ * If the changed paths between two catalog revisions are known, only the
+ * affected entries can be evicted, leaving the rest of the kernel caches warm.
  */
 class FuseInvalidator : SingleCopy {
   FRIEND_TEST(T_FuseInvalidator, StartStop);
   FRIEND_TEST(T_FuseInvalidator, InvalidateTimeout);
   FRIEND_TEST(T_FuseInvalidator, InvalidateOps);
+  FRIEND_TEST(T_FuseInvalidator, InvalidatePaths);
 
  public:
   static bool HasFuseNotifyInval();
@@ -55,6 +63,11 @@ class FuseInvalidator : SingleCopy {
 
     unsigned timeout_s_;
     atomic_int32 *status_;
+    /**
+     * Set for targeted invalidation, see InvalidatePaths()
+     */
+    std::vector<PathString> dentries_;
+    std::vector<PathString> directories_;
   };
 
   FuseInvalidator(glue::InodeTracker *inode_tracker,
@@ -62,6 +75,9 @@ class FuseInvalidator : SingleCopy {
   ~FuseInvalidator();
   void Spawn();
   void InvalidateDentries(Handle *handle);
+  void InvalidatePaths(Handle *handle,
+                       const std::vector<PathString> &dentries,
+                       const std::vector<PathString> &directories);
 
  private:
   /**
@@ -79,6 +95,7 @@ class FuseInvalidator : SingleCopy {
   static const unsigned kCheckTimeoutFreqOps;  // = 256
 
   static void *MainInvalidator(void *data);
+  bool EvictPaths(Handle *handle, uint64_t deadline);
 
   glue::InodeTracker *inode_tracker_;
   struct fuse_chan **fuse_channel_;
@@ -11,6 +11,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "backoff.h"
 #include "catalog_mgr_client.h"
@@ -23,10 +24,14 @@
 
 using namespace std;  // NOLINT
 
+const unsigned FuseRemounter::kMaxDiffPaths = 10000;
+
 
 /**
  * Executed by the trigger thread, or triggered from cvmfs_talk.  Moves into
- * drainout mode if a new catalog is available online.
+ * drainout mode if a new catalog is available online.  The new catalogs are
+ * downloaded here, outside the fence, so that TryFinish() does not need to go
+ * to the network.
  */
 FuseRemounter::Status FuseRemounter::Check() {
   FenceGuard fence_guard(&fence_maintenance_);
@@ -34,7 +39,7 @@ FuseRemounter::Status FuseRemounter::Check() {
     return kStatusMaintenance;
 
   LogCvmfs(kLogCvmfs, kLogDebug, "catalog TTL expired, remount");
-  catalog::LoadError retval = mountpoint_->catalog_mgr()->Remount(true);
+  catalog::LoadError retval = mountpoint_->catalog_mgr()->StageRemount();
   switch (retval) {
     case catalog::kLoadNew:
       if (atomic_cas32(&drainout_mode_, 0, 1)) {
@@ -43,7 +48,7 @@ FuseRemounter::Status FuseRemounter::Check() {
                  "new catalog revision available, "
                  "draining out meta-data caches");
         invalidator_handle_.Reset();
-        invalidator_->InvalidateDentries(&invalidator_handle_);
+        InvalidateKernelCaches();
         atomic_inc32(&drainout_mode_);
         // drainout_mode_ == 2, IsInDrainoutMode is now 'true'
       } else {
@@ -91,6 +96,28 @@ FuseRemounter::Status FuseRemounter::CheckSynchronously() {
 }
 
 
+/**
+ * With diff remount, only the paths that differ between the mounted and the
+ * new catalog revision are evicted from the kernel caches.  Falls back to
+ * evicting everything if the diff fails or gets too large.
+ */
+void FuseRemounter::InvalidateKernelCaches() {
+  catalog::ClientCatalogManager *catalog_mgr = mountpoint_->catalog_mgr();
+  if (catalog_mgr->diff_remount()) {
+    vector<PathString> dentries;
+    vector<PathString> directories;
+    if (catalog_mgr->DiffRevision(kMaxDiffPaths, &dentries, &directories)) {
+      invalidator_->InvalidatePaths(&invalidator_handle_,
+                                    dentries, directories);
+      return;
+    }
+    LogCvmfs(kLogCvmfs, kLogDebug,
+             "no usable catalog diff, evicting all kernel cache entries");
+  }
+  invalidator_->InvalidateDentries(&invalidator_handle_);
+}
+
+
 void FuseRemounter::EnterMaintenanceMode() {
   fence_maintenance_.Drain();
   atomic_cas32(&maintenance_mode_, 0, 1);
@@ -254,6 +281,7 @@ void FuseRemounter::TryFinish() {
   }
   mountpoint_->ReEvaluateAuthz();
   fence_->Open();
+  mountpoint_->catalog_mgr()->UnpinStaged();
 
   mountpoint_->inode_cache()->Resume();
   mountpoint_->path_cache()->Resume();
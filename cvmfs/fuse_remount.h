@@ -29,6 +29,9 @@ class MountPoint;
  * root file catalog is available online and the kernel caches got flushed, the
  * actual heavy-lifting of applying the new catalog takes place in TryFinish();
  *
+ * The new root catalog and the changed nested catalogs are downloaded in
+ * Check(), so that the fence is only closed while the catalogs are swapped.
+ *
  * Remounting is inherently asynchronous because the kernel caches need to be
  * flushed.  We do this through the FuseInvalidator.  Once the FuseInvalidor
  * is ready (either by waiting or by active eviction), we flush all user-level
@@ -65,7 +68,14 @@ class FuseRemounter : SingleCopy {
   time_t catalogs_valid_until() { return catalogs_valid_until_; }
 
  private:
+  /**
+   * Upper bound for the number of changed paths that are evicted one by one
+   * from the kernel caches.  Larger diffs evict all known entries.
+   */
+  static const unsigned kMaxDiffPaths;  // = 10000
+
   static void *MainRemountTrigger(void *data);
+  void InvalidateKernelCaches();
 
   bool HasRemountTrigger() { return pipe_remount_trigger_[0] >= 0; }
   void SetAlarm(int timeout);
@@ -25,6 +25,7 @@
 #include <signal.h>
 #include <stddef.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 // If valgrind headers are present on the build system, then we can detect
@@ -46,6 +47,7 @@
 #include "options.h"
 #include "platform.h"
 #include "sanitizer.h"
+#include "smalloc.h"
 #include "util/posix.h"
 #include "util/string.h"
 
@@ -122,6 +124,7 @@ string *usyslog_path_ = NULL;
 uid_t uid_ = 0;
 gid_t gid_ = 0;
 bool single_threaded_ = false;
+unsigned fuse_clone_channels_ = 0;
 bool foreground_ = false;
 bool debug_mode_ = false;
 bool grab_mountpoint_ = false;
@@ -406,6 +409,221 @@ static void SetFuseOperations(struct fuse_lowlevel_ops *loader_operations) {
 }
 
 
+/**
+ * A clone of the /dev/fuse file descriptor with its own pool of worker
+ * threads, so that the workers do not contend for a single device queue.
+ * Like the libfuse multi-threaded loop, the pool grows when all of its
+ * workers are busy and shrinks when too many of them are idle.  All workers
+ * of a clone are pinned to the same CPU.
+ */
+struct FuseCloneChannel {
+  struct fuse_session *session;
+  struct fuse_chan *channel;
+  unsigned cpu;
+  pthread_mutex_t lock;
+  vector<pthread_t> workers;  ///< protected by lock
+  unsigned num_available;  ///< workers waiting for a request, protected by lock
+  bool stopping;  ///< no more workers are spawned, protected by lock
+};
+
+/**
+ * Same threshold as in the libfuse multi-threaded loop.
+ */
+const unsigned kMaxIdleCloneWorkers = 10;
+
+
+/**
+ * Like the receive function of the libfuse kernel channel.  The kernel channel
+ * cannot be used for clones because it requires to be the (only) channel of
+ * the session.
+ */
+static int CloneChannelReceive(struct fuse_chan **chp, char *buf, size_t size)
+{
+  struct fuse_chan *channel = *chp;
+  FuseCloneChannel *clone =
+    reinterpret_cast<FuseCloneChannel *>(fuse_chan_data(channel));
+  while (true) {
+    const ssize_t retval = read(fuse_chan_fd(channel), buf, size);
+    if (fuse_session_exited(clone->session))
+      return 0;
+    if (retval >= 0)
+      return retval;
+    // ENOENT: the request was interrupted, safe to restart
+    if ((errno == ENOENT) || (errno == EAGAIN))
+      continue;
+    if (errno == ENODEV) {
+      // Unmounted
+      fuse_session_exit(clone->session);
+      return 0;
+    }
+    return -errno;
+  }
+}
+
+
+static int CloneChannelSend(struct fuse_chan *channel,
+                            const struct iovec iov[], size_t count)
+{
+  if (iov == NULL)
+    return 0;
+  const ssize_t retval = writev(fuse_chan_fd(channel), iov, count);
+  return (retval < 0) ? -errno : 0;
+}
+
+
+static void CloneChannelDestroy(struct fuse_chan *channel) {
+  close(fuse_chan_fd(channel));
+}
+
+
+static void *MainFuseCloneWorker(void *data);
+
+/**
+ * Called with the clone's lock held.
+ */
+static void SpawnFuseCloneWorker(FuseCloneChannel *clone) {
+  pthread_t thread;
+  int retval = pthread_create(&thread, NULL, MainFuseCloneWorker, clone);
+  if (retval != 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+             "failed to start fuse worker (%d)", retval);
+    return;
+  }
+  clone->workers.push_back(thread);
+}
+
+
+/**
+ * Removes the calling worker from the pool if there are too many idle workers.
+ * Called with the clone's lock held.  A removed worker is detached because it
+ * is not joined anymore when the fuse loop stops.
+ */
+static bool RetireFuseCloneWorker(FuseCloneChannel *clone) {
+  if (clone->stopping || (clone->num_available < kMaxIdleCloneWorkers))
+    return false;
+  for (unsigned i = 0; i < clone->workers.size(); ++i) {
+    if (pthread_equal(clone->workers[i], pthread_self())) {
+      clone->workers.erase(clone->workers.begin() + i);
+      pthread_detach(pthread_self());
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static void *MainFuseCloneWorker(void *data) {
+  FuseCloneChannel *clone = reinterpret_cast<FuseCloneChannel *>(data);
+  if (!platform_pin_thread(clone->cpu)) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "failed to pin fuse worker to cpu %u",
+             clone->cpu);
+  }
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+  const size_t bufsize = fuse_chan_bufsize(clone->channel);
+  char *buf = reinterpret_cast<char *>(smalloc(bufsize));
+  pthread_cleanup_push(free, buf);
+  while (!fuse_session_exited(clone->session)) {
+    struct fuse_chan *channel = clone->channel;
+    struct fuse_buf fbuf;
+    memset(&fbuf, 0, sizeof(fbuf));
+    fbuf.mem = buf;
+    fbuf.size = bufsize;
+    pthread_mutex_lock(&clone->lock);
+    clone->num_available++;
+    pthread_mutex_unlock(&clone->lock);
+    // Only cancelable while waiting for a request, see FuseLoopCloned()
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    const int retval =
+      fuse_session_receive_buf(clone->session, &fbuf, &channel);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&clone->lock);
+    clone->num_available--;
+    if ((retval > 0) && (clone->num_available == 0) && !clone->stopping)
+      SpawnFuseCloneWorker(clone);
+    pthread_mutex_unlock(&clone->lock);
+    if (retval == -EINTR)
+      continue;
+    if (retval <= 0) {
+      if (retval < 0)
+        fuse_session_exit(clone->session);
+      break;
+    }
+    fuse_session_process_buf(clone->session, &fbuf, channel);
+
+    pthread_mutex_lock(&clone->lock);
+    const bool retired = RetireFuseCloneWorker(clone);
+    pthread_mutex_unlock(&clone->lock);
+    if (retired)
+      break;
+  }
+  pthread_cleanup_pop(1);
+  return NULL;
+}
+
+
+/**
+ * Serves the fuse session with clones of the /dev/fuse file descriptor, each
+ * with its own worker pool pinned round-robin to the CPUs the process may use.
+ * The main thread serves the original channel with the libfuse multi-threaded
+ * loop, which is also the fallback if the kernel cannot clone the file
+ * descriptor.
+ */
+static int FuseLoopCloned(struct fuse_session *session,
+                          struct fuse_chan *channel,
+                          const unsigned num_clones)
+{
+  struct fuse_chan_ops clone_operations;
+  memset(&clone_operations, 0, sizeof(clone_operations));
+  clone_operations.receive = CloneChannelReceive;
+  clone_operations.send = CloneChannelSend;
+  clone_operations.destroy = CloneChannelDestroy;
+
+  const vector<unsigned> cpus = platform_allowed_cpus();
+  vector<FuseCloneChannel *> clones;
+  for (unsigned i = 0; i < num_clones; ++i) {
+    const int fd_clone = platform_clone_fuse_fd(fuse_chan_fd(channel));
+    if (fd_clone < 0) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "failed to clone fuse channel (%d), using %u clones",
+               errno, i);
+      break;
+    }
+    FuseCloneChannel *clone = new FuseCloneChannel();
+    clone->session = session;
+    clone->cpu = cpus[(i + 1) % cpus.size()];
+    clone->num_available = 0;
+    clone->stopping = false;
+    int retval = pthread_mutex_init(&clone->lock, NULL);
+    assert(retval == 0);
+    clone->channel = fuse_chan_new(&clone_operations, fd_clone,
+                                   fuse_chan_bufsize(channel), clone);
+    assert(clone->channel != NULL);
+    pthread_mutex_lock(&clone->lock);
+    SpawnFuseCloneWorker(clone);
+    pthread_mutex_unlock(&clone->lock);
+    clones.push_back(clone);
+  }
+
+  const int result = fuse_session_loop_mt(session);
+  for (unsigned i = 0; i < clones.size(); ++i) {
+    FuseCloneChannel *clone = clones[i];
+    pthread_mutex_lock(&clone->lock);
+    clone->stopping = true;
+    const vector<pthread_t> workers = clone->workers;
+    pthread_mutex_unlock(&clone->lock);
+    for (unsigned j = 0; j < workers.size(); ++j) {
+      pthread_cancel(workers[j]);
+      pthread_join(workers[j], NULL);
+    }
+    fuse_chan_destroy(clone->channel);
+    pthread_mutex_destroy(&clone->lock);
+    delete clone;
+  }
+  return result;
+}
+
+
 static void *OpenLibrary(const string &path) {
   return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
 }
@@ -744,6 +962,10 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // Additional fuse worker threads with their own /dev/fuse descriptor
+  if (options_manager->GetValue("CVMFS_FUSE_CLONE_CHANNELS", &parameter))
+    fuse_clone_channels_ = String2Uint64(parameter);
+
   // Number of file descriptors
   if (options_manager->GetValue("CVMFS_NFILES", &parameter)) {
     int retval = SetLimitNoFile(String2Uint64(parameter));
@@ -907,6 +1129,8 @@ int main(int argc, char *argv[]) {
   fuse_session_add_chan(session, channel);
   if (single_threaded_)
     retval = fuse_session_loop(session);
+  else if (fuse_clone_channels_ > 0)
+    retval = FuseLoopCloned(session, channel, fuse_clone_channels_);
   else
     retval = fuse_session_loop_mt(session);
   SetLogMicroSyslog(*usyslog_path_);
@@ -722,6 +722,7 @@ class LruCache : SingleCopy {
 
   inline bool IsFull() const { return cache_gauge_ >= cache_size_; }
   inline bool IsEmpty() const { return cache_gauge_ == 0; }
+  inline unsigned int cache_size() const { return cache_size_; }
 
   Counters counters() {
     Lock();
@@ -39,11 +39,11 @@ static inline uint32_t hasher_inode(const fuse_ino_t &inode) {
 // uint32_t hasher_inode(const fuse_ino_t &inode);
 
 
-class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
+class InodeCache : public LruCache<fuse_ino_t, catalog::PackedDirectoryEntry>
 {
  public:
   explicit InodeCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>(
+    LruCache<fuse_ino_t, catalog::PackedDirectoryEntry>(
       cache_size, fuse_ino_t(-1), hasher_inode,
       perf::StatisticsTemplate("inode_cache", statistics))
   {
@@ -53,15 +53,20 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
     LogCvmfs(kLogLru, kLogDebug, "insert inode --> dirent: %u -> '%s'",
              inode, dirent.name().c_str());
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Insert(inode, dirent);
+      LruCache<fuse_ino_t, catalog::PackedDirectoryEntry>::Insert(
+        inode, catalog::PackedDirectoryEntry(dirent));
     return result;
   }
 
   bool Lookup(const fuse_ino_t &inode, catalog::DirectoryEntry *dirent,
               bool update_lru = true)
   {
+    catalog::PackedDirectoryEntry packed;
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Lookup(inode, dirent);
+      LruCache<fuse_ino_t, catalog::PackedDirectoryEntry>::Lookup(inode,
+                                                                  &packed);
+    if (result)
+      packed.Unpack(dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup inode --> dirent: %u (%s)",
              inode, result ? "hit" : "miss");
     return result;
@@ -69,7 +74,7 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping inode cache");
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>::Drop();
+    LruCache<fuse_ino_t, catalog::PackedDirectoryEntry>::Drop();
   }
 };  // InodeCache
 
@@ -108,27 +113,31 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
 
 
 class Md5PathCache :
-  public LruCache<shash::Md5, catalog::DirectoryEntry>
+  public LruCache<shash::Md5, catalog::PackedDirectoryEntry>
 {
  public:
   explicit Md5PathCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<shash::Md5, catalog::DirectoryEntry>(
+    LruCache<shash::Md5, catalog::PackedDirectoryEntry>(
       cache_size, shash::Md5(shash::AsciiPtr("!")), hasher_md5,
       perf::StatisticsTemplate("md5_path_cache", statistics))
   {
-    dirent_negative_ = catalog::DirectoryEntry(catalog::kDirentNegative);
+    dirent_negative_ = catalog::PackedDirectoryEntry(
+      catalog::DirectoryEntry(catalog::kDirentNegative));
   }
 
   bool Insert(const shash::Md5 &hash, const catalog::DirectoryEntry &dirent) {
     LogCvmfs(kLogLru, kLogDebug, "insert md5 --> dirent: %s -> '%s'",
              hash.ToString().c_str(), dirent.name().c_str());
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Insert(hash, dirent);
+      LruCache<shash::Md5, catalog::PackedDirectoryEntry>::Insert(
+        hash, catalog::PackedDirectoryEntry(dirent));
     return result;
   }
 
   bool InsertNegative(const shash::Md5 &hash) {
-    const bool result = Insert(hash, dirent_negative_);
+    const bool result =
+      LruCache<shash::Md5, catalog::PackedDirectoryEntry>::Insert(
+        hash, dirent_negative_);
     if (result)
       perf::Inc(counters_.n_insert_negative);
     return result;
@@ -137,8 +146,12 @@ class Md5PathCache :
   bool Lookup(const shash::Md5 &hash, catalog::DirectoryEntry *dirent,
               bool update_lru = true)
   {
+    catalog::PackedDirectoryEntry packed;
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Lookup(hash, dirent);
+      LruCache<shash::Md5, catalog::PackedDirectoryEntry>::Lookup(hash,
+                                                                  &packed);
+    if (result)
+      packed.Unpack(dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup md5 --> dirent: %s (%s)",
              hash.ToString().c_str(), result ? "hit" : "miss");
     return result;
@@ -147,16 +160,16 @@ class Md5PathCache :
   bool Forget(const shash::Md5 &hash) {
     LogCvmfs(kLogLru, kLogDebug, "forget md5: %s",
              hash.ToString().c_str());
-    return LruCache<shash::Md5, catalog::DirectoryEntry>::Forget(hash);
+    return LruCache<shash::Md5, catalog::PackedDirectoryEntry>::Forget(hash);
   }
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping md5path cache");
-    LruCache<shash::Md5, catalog::DirectoryEntry>::Drop();
+    LruCache<shash::Md5, catalog::PackedDirectoryEntry>::Drop();
   }
 
  private:
-  catalog::DirectoryEntry dirent_negative_;
+  catalog::PackedDirectoryEntry dirent_negative_;
 };  // Md5PathCache
 
 }  // namespace lru
@@ -4,6 +4,8 @@
 
 #include "manifest_fetch.h"
 
+#include <pthread.h>
+
 #include <string>
 #include <vector>
 
@@ -19,9 +21,33 @@ using namespace std;  // NOLINT
 
 namespace manifest {
 
+namespace {
+
+/**
+ * The whitelist does not depend on the certificate.  It is loaded in a
+ * separate thread while the certificate is downloaded and verified.
+ */
+struct WhitelistJob {
+  whitelist::Whitelist *whitelist;
+  const string *base_url;
+  whitelist::Failures result;
+};
+
+void *MainLoadWhitelist(void *data) {
+  WhitelistJob *job = reinterpret_cast<WhitelistJob *>(data);
+  job->result = job->whitelist->Load(*job->base_url);
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
 /**
  * Downloads and verifies the manifest, the certificate, and the whitelist.
  * If base_url is empty, uses the probe_hosts feature from download manager.
+ *
+ * Once the manifest is parsed, the certificate, the whitelist, and the objects
+ * requested by the ensemble are fetched concurrently.
  */
 Failures Fetch(const std::string &base_url, const std::string &repository_name,
                const uint64_t minimum_timestamp, const shash::Any *base_catalog,
@@ -38,9 +64,18 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   whitelist::Whitelist whitelist(repository_name,
                                  download_manager,
                                  signature_manager);
+  WhitelistJob whitelist_job;
+  whitelist_job.whitelist = &whitelist;
+  whitelist_job.base_url = &base_url;
+  whitelist_job.result = whitelist::kFailLoad;
+  pthread_t thread_whitelist;
+  bool whitelist_pending = false;
+  int retval;
 
   const string manifest_url = base_url + string("/.cvmfspublished");
   download::JobInfo download_manifest(&manifest_url, false, probe_hosts, NULL);
+  download_manifest.etag = &ensemble->etag;
+  download_manifest.last_modified = &ensemble->last_modified;
   shash::Any certificate_hash;
   string certificate_url = base_url + "/";  // rest is in manifest
   download::JobInfo download_certificate(&certificate_url, true, probe_hosts,
@@ -53,6 +88,10 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
              retval_dl, download::Code2Ascii(retval_dl));
     return kFailLoad;
   }
+  if (download_manifest.not_modified) {
+    free(download_manifest.destination_mem.data);
+    return kFailNotModified;
+  }
 
   // Load Manifest
   ensemble->raw_manifest_buf =
@@ -86,6 +125,14 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   if (base_catalog && (ensemble->manifest->catalog_hash() == *base_catalog))
     return kFailOk;
 
+  // Objects are content-addressed, they can be fetched before the manifest
+  // is verified
+  ensemble->PrefetchObjects();
+  retval = pthread_create(&thread_whitelist, NULL, MainLoadWhitelist,
+                          &whitelist_job);
+  assert(retval == 0);
+  whitelist_pending = true;
+
   // Load certificate
   certificate_hash = ensemble->manifest->certificate();
   ensemble->FetchCertificate(certificate_hash);
@@ -94,7 +141,7 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
     retval_dl = download_manager->Fetch(&download_certificate);
     if (retval_dl != download::kFailOk) {
       result = kFailLoad;
-        goto cleanup;
+      goto cleanup;
     }
     ensemble->cert_buf = reinterpret_cast<unsigned char *>(
       download_certificate.destination_mem.data);
@@ -118,8 +165,10 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
     goto cleanup;
   }
 
-  // Load whitelist and verify
-  retval_wl = whitelist.Load(base_url);
+  // Wait for whitelist and verify
+  pthread_join(thread_whitelist, NULL);
+  whitelist_pending = false;
+  retval_wl = whitelist_job.result;
   if (retval_wl != whitelist::kFailOk) {
     LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
              "whitelist verification failed (%d): %s",
@@ -137,6 +186,9 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
     goto cleanup;
   }
 
+  ensemble->whitelist_expires = whitelist.expires();
+  ensemble->certificate_fingerprint =
+    signature_manager->HashCertificate(shash::kSha1);
   whitelist.CopyBuffers(&ensemble->whitelist_size,
                         &ensemble->whitelist_buf,
                         &ensemble->whitelist_pkcs7_size,
@@ -145,6 +197,8 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   return kFailOk;
 
  cleanup:
+  if (whitelist_pending)
+    pthread_join(thread_whitelist, NULL);
   delete ensemble->manifest;
   ensemble->manifest = NULL;
   if (ensemble->raw_manifest_buf) free(ensemble->raw_manifest_buf);
@@ -6,6 +6,7 @@
 #define CVMFS_MANIFEST_FETCH_H_
 
 #include <cstdlib>
+#include <ctime>
 #include <string>
 
 #include "manifest.h"
@@ -36,6 +37,7 @@ enum Failures {
   kFailBadWhitelist,
   kFailInvalidCertificate,
   kFailUnknown,
+  kFailNotModified,
 
   kFailNumEntries
 };
@@ -53,7 +55,8 @@ inline const char *Code2Ascii(const Failures error) {
   texts[8] = "bad whitelist";
   texts[9] = "invalid certificate";
   texts[10] = "unknown error";
-  texts[11] = "no text";
+  texts[11] = "manifest not modified";
+  texts[12] = "no text";
   return texts[error];
 }
 
@@ -67,6 +70,7 @@ struct ManifestEnsemble {
     manifest = NULL;
     raw_manifest_buf = cert_buf = whitelist_buf = whitelist_pkcs7_buf = NULL;
     raw_manifest_size = cert_size = whitelist_size = whitelist_pkcs7_size = 0;
+    whitelist_expires = 0;
   }
   virtual ~ManifestEnsemble() {
     delete manifest;
@@ -77,6 +81,24 @@ struct ManifestEnsemble {
   }
   // Can be overwritte to fetch certificate from cache
   virtual void FetchCertificate(const shash::Any &hash) { }
+  // Can be overwritten to start downloading objects referenced by the
+  // manifest, such as the root catalog, while the manifest is verified
+  virtual void PrefetchObjects() { }
+
+  /**
+   * HTTP validators of a previously verified manifest.  If set, the manifest
+   * is only downloaded if it changed; otherwise Fetch() returns
+   * kFailNotModified.  Replaced by the validators of the downloaded manifest.
+   */
+  std::string etag;
+  std::string last_modified;
+  /**
+   * Set if Fetch() verified the whitelist: its expiry date and the SHA-1
+   * fingerprint of the certificate that signed the manifest.  Not set if the
+   * manifest announces the base catalog and the verification is skipped.
+   */
+  time_t whitelist_expires;
+  shash::Any certificate_fingerprint;
 
   Manifest *manifest;
   unsigned char *raw_manifest_buf;
@@ -40,6 +40,7 @@
 #include "clientctx.h"
 #include "download.h"
 #include "duplex_sqlite3.h"
+#include "external_stream.h"
 #include "fetch.h"
 #include "file_chunk.h"
 #include "globals.h"
@@ -897,6 +898,16 @@ void FileSystem::SetupSqlite() {
   assert(retval == SQLITE_OK);
   retval = sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
   assert(retval == SQLITE_OK);
+  retval = sqlite3_config(SQLITE_CONFIG_MMAP_SIZE,
+                          static_cast<sqlite3_int64>(kSqliteMmapSize),
+                          static_cast<sqlite3_int64>(kSqliteMmapSize));
+  assert(retval == SQLITE_OK);
+  // In MB, page cache shared by all catalogs
+  string optarg;
+  if (options_mgr_->GetValue("CVMFS_SQLITE_CACHE_SIZE", &optarg)) {
+    SqliteMemoryManager::GetInstance()->SetPageCacheSize(
+      String2Uint64(optarg) * 1024 * 1024);
+  }
   SqliteMemoryManager::GetInstance()->AssignGlobalArenas();
 
   // Disable SQlite3 file locking
@@ -1107,9 +1118,30 @@ bool MountPoint::CreateCatalogManager() {
   catalog_mgr_ = new catalog::ClientCatalogManager(
     fqrn_, fetcher_, signature_mgr_, statistics_);
 
+  if (options_mgr_->GetValue("CVMFS_CATALOG_PREFETCH_DEPTH", &optarg) &&
+      (String2Uint64(optarg) > 0))
+  {
+    unsigned max_depth = String2Uint64(optarg);
+    uint64_t budget = kDefaultCatalogPrefetchBudget;
+    if (options_mgr_->GetValue("CVMFS_CATALOG_PREFETCH_BUDGET", &optarg))
+      budget = String2Uint64(optarg) * 1024 * 1024;
+    string hints_path;
+    options_mgr_->GetValue("CVMFS_CATALOG_PREFETCH_HINTS", &hints_path);
+    if (!catalog_mgr_->EnablePrefetch(max_depth, budget, hints_path)) {
+      boot_error_ = "failed to load catalog prefetch hints from " + hints_path;
+      boot_status_ = loader::kFailOptions;
+      return false;
+    }
+  }
+
   SetupInodeAnnotation();
   if (!SetupOwnerMaps())
     return false;
+  // The SQlite page cache is shared among the attached catalogs
+  if (SqliteMemoryManager::HasInstance()) {
+    catalog_mgr_->SetSqliteCacheBudget(
+      SqliteMemoryManager::GetInstance()->page_cache_no_slots());
+  }
   shash::Any root_hash;
   if (!DetermineRootHash(&root_hash))
     return false;
@@ -1136,6 +1168,17 @@ bool MountPoint::CreateCatalogManager() {
     fixed_catalog_ = true;
   }
 
+  // The NFS maps rely on a fixed root inode
+  if (options_mgr_->GetValue("CVMFS_DIFF_REMOUNT", &optarg) &&
+      options_mgr_->IsOn(optarg) && !file_system_->IsNfsSource())
+  {
+    catalog_mgr_->SetDiffRemount(true);
+  }
+
+  // In MB, cold nested catalogs are detached beyond the limit
+  if (options_mgr_->GetValue("CVMFS_CATALOG_MEMORY_LIMIT", &optarg))
+    catalog_mgr_->SetMemoryLimit(String2Uint64(optarg) * 1024 * 1024);
+
   if (catalog_mgr_->volatile_flag()) {
     LogCvmfs(kLogCvmfs, kLogDebug, "content of repository flagged as VOLATILE");
   }
@@ -1207,6 +1250,24 @@ void MountPoint::CreateFetchers() {
     backoff_throttle_,
     perf::StatisticsTemplate("fetch-external", statistics_),
     is_external_data);
+
+  string optarg;
+  if (options_mgr_->GetValue("CVMFS_EXTERNAL_STREAMING", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    unsigned block_size = cvmfs::ExternalStreamer::kDefaultBlockSize;
+    if (options_mgr_->GetValue("CVMFS_EXTERNAL_BLOCK_SIZE", &optarg) &&
+        (String2Uint64(optarg) > 0))
+    {
+      block_size = String2Uint64(optarg);
+    }
+    external_streamer_ = new cvmfs::ExternalStreamer(
+      file_system_->cache_mgr(),
+      external_download_mgr_,
+      backoff_throttle_,
+      perf::StatisticsTemplate("stream-external", statistics_),
+      block_size);
+  }
 }
 
 
@@ -1459,6 +1520,7 @@ MountPoint::MountPoint(
   , external_download_mgr_(NULL)
   , fetcher_(NULL)
   , external_fetcher_(NULL)
+  , external_streamer_(NULL)
   , inode_annotation_(NULL)
   , catalog_mgr_(NULL)
   , chunk_tables_(NULL)
@@ -1492,6 +1554,7 @@ MountPoint::~MountPoint() {
 
   delete catalog_mgr_;
   delete inode_annotation_;
+  delete external_streamer_;
   delete external_fetcher_;
   delete fetcher_;
   if (external_download_mgr_ != NULL) {
@@ -1591,6 +1654,11 @@ void MountPoint::SetupDnsTuning(download::DownloadManager *manager) {
   }
   if (options_mgr_->GetValue("CVMFS_MAX_IPADDR_PER_PROXY", &optarg))
     manager->SetMaxIpaddrPerProxy(String2Uint64(optarg));
+  if (options_mgr_->GetValue("CVMFS_DNS_REFRESH", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    manager->EnableDnsRefresh();
+  }
 }
 
 
@@ -1679,6 +1747,28 @@ void MountPoint::SetupHttpTuning() {
   {
     download_mgr_->EnableInfoHeader();
   }
+  if (options_mgr_->GetValue("CVMFS_HEDGED_REQUESTS", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    unsigned hedge_max_size = download::DownloadManager::kHedgeDefaultMaxSize;
+    if (options_mgr_->GetValue("CVMFS_HEDGE_MAX_SIZE", &optarg))
+      hedge_max_size = String2Uint64(optarg);
+    download_mgr_->EnableHedging(hedge_max_size);
+  }
+
+  const char *priority_names[] = {"INTERACTIVE", "CATALOG", "PREFETCH", "BULK"};
+  for (unsigned i = 0; i < download::kPriorityNumEntries; ++i) {
+    const download::Priority priority = static_cast<download::Priority>(i);
+    const string suffix = priority_names[i];
+    unsigned max_transfers = (priority >= download::kPriorityPrefetch) ?
+      download::DownloadManager::kDefaultMaxBackgroundTransfers : 0;
+    if (options_mgr_->GetValue("CVMFS_MAX_TRANSFERS_" + suffix, &optarg))
+      max_transfers = String2Uint64(optarg);
+    uint64_t max_rate = 0;
+    if (options_mgr_->GetValue("CVMFS_MAX_RATE_" + suffix, &optarg))
+      max_rate = String2Uint64(optarg) * 1024;
+    download_mgr_->SetPriorityLimits(priority, max_transfers, max_rate);
+  }
 }
 
 
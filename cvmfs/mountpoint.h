@@ -31,6 +31,7 @@ class InodeGenerationAnnotation;
 }
 struct ChunkTables;
 namespace cvmfs {
+class ExternalStreamer;
 class Fetcher;
 class Uuid;
 }
@@ -195,6 +196,11 @@ class FileSystem : SingleCopy, public BootFactory {
   static const unsigned kDefaultQuotaLimit = 1024 * 1024 * 1024;  // 1GB
   static const unsigned kDefaultNfiles = 8192;  // if CVMFS_NFILES is unset
   static const char *kDefaultCacheMgrInstance;  // "default"
+  /**
+   * Catalogs in the posix cache are memory mapped by the SQlite VFS up to this
+   * size.  Larger catalogs are read through the file descriptor beyond it.
+   */
+  static const unsigned kSqliteMmapSize = 1024 * 1024 * 1024;  // 1GB
 
   struct PosixCacheSettings {
     PosixCacheSettings() :
@@ -383,6 +389,10 @@ class MountPoint : SingleCopy, public BootFactory {
   bool fixed_catalog() { return fixed_catalog_; }
   std::string fqrn() { return fqrn_; }
   cvmfs::Fetcher *external_fetcher() { return external_fetcher_; }
+  /**
+   * NULL unless external data files are streamed
+   */
+  cvmfs::ExternalStreamer *external_streamer() { return external_streamer_; }
   FileSystem *file_system() { return file_system_; }
   bool has_membership_req() { return has_membership_req_; }
   bool hide_magic_xattrs() { return hide_magic_xattrs_; }
@@ -430,6 +440,10 @@ class MountPoint : SingleCopy, public BootFactory {
    * Default to 16M RAM for meta-data caches; does not include the inode tracker
    */
   static const unsigned kDefaultMemcacheSize = 16 * 1024 * 1024;
+  /**
+   * If nested catalogs are prefetched, download at most 64M per revision.
+   */
+  static const unsigned kDefaultCatalogPrefetchBudget = 64 * 1024 * 1024;
   /**
    * Where to look for external authz helpers.
    */
@@ -497,6 +511,7 @@ class MountPoint : SingleCopy, public BootFactory {
   download::DownloadManager *external_download_mgr_;
   cvmfs::Fetcher *fetcher_;
   cvmfs::Fetcher *external_fetcher_;
+  cvmfs::ExternalStreamer *external_streamer_;
   catalog::InodeGenerationAnnotation *inode_annotation_;
   catalog::ClientCatalogManager *catalog_mgr_;
   ChunkTables *chunk_tables_;
@@ -7,6 +7,7 @@
 #ifndef CVMFS_PLATFORM_LINUX_H_
 #define CVMFS_PLATFORM_LINUX_H_
 
+#include <alloca.h>
 #include <sys/types.h>  // contains ssize_t needed inside <attr/xattr.h>
 #include <sys/xattr.h>
 #include <attr/xattr.h>  // NOLINT(build/include_alpha)
@@ -16,12 +17,16 @@
 #include <limits.h>
 #include <mntent.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -310,6 +315,170 @@ inline int platform_invalidate_kcache(const int    fd,
   return posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
 }
 
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS    (1024 + 9)
+#define F_GET_SEALS    (1024 + 10)
+#define F_SEAL_SHRINK  0x0002
+#define F_SEAL_GROW    0x0004
+#endif
+
+/**
+ * Creates an anonymous, memory-backed file of the given size that can be
+ * mmapped and passed to another process.  Uses memfd_create() if the kernel
+ * supports it and an unlinked file in /dev/shm otherwise.  A memfd is sealed
+ * against resizing so that the receiving process can safely map it.  Returns
+ * -1 on failure.
+ */
+inline int platform_memfd(const char *name, const uint64_t size) {
+  int fd = -1;
+  bool sealable = false;
+#ifdef __NR_memfd_create
+  fd = syscall(__NR_memfd_create, name,
+               1 /* MFD_CLOEXEC */ | 2 /* MFD_ALLOW_SEALING */);
+  sealable = (fd >= 0);
+#endif
+  if (fd < 0) {
+    char path[] = "/dev/shm/cvmfs.XXXXXX";
+    fd = mkstemp(path);
+    if (fd < 0)
+      return -1;
+    unlink(path);
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (sealable && (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Checks that a shared memory region received from another process cannot be
+ * resized underneath its mapping.  If the kernel supports memfd_create(), the
+ * region has to be a memfd sealed against shrinking and growing.
+ */
+inline bool platform_memfd_sealed(int fd) {
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals >= 0) {
+    return (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) ==
+           (F_SEAL_SHRINK | F_SEAL_GROW);
+  }
+#ifdef __NR_memfd_create
+  int fd_probe = syscall(__NR_memfd_create, "cvmfs-probe", 1 /* CLOEXEC */);
+  if (fd_probe >= 0) {
+    close(fd_probe);
+    return false;
+  }
+#endif
+  return true;
+}
+
+/**
+ * Reserves disk blocks for the first size bytes of the file so that later
+ * writes into the region cannot fail with ENOSPC.  Returns 0 on success and
+ * an errno value otherwise.
+ */
+inline int platform_fallocate(int fd, const uint64_t size) {
+  return posix_fallocate(fd, 0, size);
+}
+
+/**
+ * Event queue for readable file descriptors, backed by epoll.  File
+ * descriptors added as oneshot are disabled after they reported an event until
+ * they are rearmed, which allows for handing them over to another thread.  All
+ * functions return -1 on failure.
+ */
+inline int platform_eventqueue_create() {
+  return epoll_create(64);
+}
+
+inline int platform_eventqueue_add(int fd_queue, int fd, bool oneshot) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLPRI | (oneshot ? EPOLLONESHOT : 0);
+  event.data.fd = fd;
+  return epoll_ctl(fd_queue, EPOLL_CTL_ADD, fd, &event);
+}
+
+inline int platform_eventqueue_rearm(int fd_queue, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
+  event.data.fd = fd;
+  return epoll_ctl(fd_queue, EPOLL_CTL_MOD, fd, &event);
+}
+
+inline int platform_eventqueue_del(int fd_queue, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  return epoll_ctl(fd_queue, EPOLL_CTL_DEL, fd, &event);
+}
+
+/**
+ * Blocks until at least one of the file descriptors is readable.  Returns the
+ * number of ready file descriptors stored in ready_fds.
+ */
+inline int platform_eventqueue_wait(int fd_queue, int *ready_fds, int max) {
+  struct epoll_event *events = reinterpret_cast<struct epoll_event *>(
+    alloca(max * sizeof(struct epoll_event)));
+  int num_events = epoll_wait(fd_queue, events, max, -1);
+  for (int i = 0; i < num_events; ++i)
+    ready_fds[i] = events[i].data.fd;
+  return num_events;
+}
+
+/**
+ * Opens another /dev/fuse file descriptor for the fuse connection of fd
+ * (FUSE_DEV_IOC_CLONE, Linux >= 4.2).  Requests can be read from and answered
+ * on the clone independently of the original descriptor.  Returns -1 if the
+ * kernel does not support cloning.
+ */
+inline int platform_clone_fuse_fd(int fd) {
+  int fd_clone = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+  if (fd_clone < 0)
+    return -1;
+  uint32_t fd_master = fd;
+  // FUSE_DEV_IOC_CLONE from linux/fuse.h
+  if (ioctl(fd_clone, _IOR(229, 0, uint32_t), &fd_master) != 0) {
+    close(fd_clone);
+    return -1;
+  }
+  return fd_clone;
+}
+
+/**
+ * The CPUs the process may run on, which can be fewer than the online CPUs,
+ * e.g. in a cpuset or after taskset.
+ */
+inline std::vector<unsigned> platform_allowed_cpus() {
+  std::vector<unsigned> result;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+    for (unsigned i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &cpu_set))
+        result.push_back(i);
+    }
+  }
+  if (result.empty())
+    result.push_back(0);
+  return result;
+}
+
+/**
+ * Restricts the calling thread to the given CPU.
+ */
+inline bool platform_pin_thread(const unsigned cpu) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)
+         == 0;
+}
+
 inline std::string platform_libname(const std::string &base_name) {
   return "lib" + base_name + ".so";
 }
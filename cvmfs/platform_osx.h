@@ -9,12 +9,15 @@
 
 #include <alloca.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <libkern/OSAtomic.h>
 #include <mach/mach.h>
 #include <mach/mach_time.h>
 #include <mach-o/dyld.h>
 #include <signal.h>
+#include <sys/event.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -22,8 +25,10 @@
 #include <sys/types.h>
 #include <sys/ucred.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -201,9 +206,19 @@ inline void platform_invalidate_kcache(const int    fd,
   // TODO(rmeusel): implement
 }
 
+/**
+ * F_RDADVISE is the closest equivalent to readahead(2).  Fails with EBADF for
+ * invalid file descriptors, like readahead.
+ */
 inline int platform_readahead(int filedes) {
-  // TODO(jblomer): is there a readahead equivalent?
-  return 0;
+  platform_stat64 info;
+  if (platform_fstat(filedes, &info) != 0)
+    return -1;
+  struct radvisory advice;
+  advice.ra_offset = 0;
+  advice.ra_count = (info.st_size > INT_MAX) ?
+                    INT_MAX : static_cast<int>(info.st_size);
+  return fcntl(filedes, F_RDADVISE, &advice);
 }
 
 inline bool read_line(FILE *f, std::string *line) {
@@ -239,6 +254,119 @@ inline uint64_t platform_monotonic_time() {
   reinterpret_cast<char *>(alloca(strlen((s)) + 1)), (s))
 
 
+/**
+ * Anonymous shared memory through a POSIX shared memory object that is unlinked
+ * right after creation.
+ */
+inline int platform_memfd(const char *name, const uint64_t size) {
+  char shm_name[32];
+  snprintf(shm_name, sizeof(shm_name), "/cvmfs.%d.%u",
+           getpid(), static_cast<unsigned>(mach_absolute_time()));
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return -1;
+  shm_unlink(shm_name);
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * There are no file seals on OS X.
+ */
+inline bool platform_memfd_sealed(int fd __attribute__((unused))) {
+  return true;
+}
+
+/**
+ * Reserves disk blocks for the first size bytes of the file.  Falls back to
+ * a sparse file if the file system does not support preallocation.  Returns 0
+ * on success and an errno value otherwise.
+ */
+inline int platform_fallocate(int fd, const uint64_t size) {
+  fstore_t store;
+  memset(&store, 0, sizeof(store));
+  store.fst_flags = F_ALLOCATEALL;
+  store.fst_posmode = F_PEOFPOSMODE;
+  store.fst_offset = 0;
+  store.fst_length = size;
+  (void)fcntl(fd, F_PREALLOCATE, &store);
+  if (ftruncate(fd, size) != 0)
+    return errno;
+  return 0;
+}
+
+/**
+ * Event queue for readable file descriptors, backed by kqueue.  File
+ * descriptors added as oneshot are disabled after they reported an event until
+ * they are rearmed, which allows for handing them over to another thread.  All
+ * functions return -1 on failure.
+ */
+inline int platform_eventqueue_create() {
+  return kqueue();
+}
+
+inline int platform_eventqueue_add(int fd_queue, int fd, bool oneshot) {
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_ADD | (oneshot ? EV_DISPATCH : 0),
+         0, 0, NULL);
+  return kevent(fd_queue, &event, 1, NULL, 0, NULL);
+}
+
+inline int platform_eventqueue_rearm(int fd_queue, int fd) {
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_ENABLE | EV_DISPATCH, 0, 0, NULL);
+  return kevent(fd_queue, &event, 1, NULL, 0, NULL);
+}
+
+inline int platform_eventqueue_del(int fd_queue, int fd) {
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  return kevent(fd_queue, &event, 1, NULL, 0, NULL);
+}
+
+/**
+ * Blocks until at least one of the file descriptors is readable.  Returns the
+ * number of ready file descriptors stored in ready_fds.
+ */
+inline int platform_eventqueue_wait(int fd_queue, int *ready_fds, int max) {
+  struct kevent *events = reinterpret_cast<struct kevent *>(
+    alloca(max * sizeof(struct kevent)));
+  int num_events = kevent(fd_queue, NULL, 0, events, max, NULL);
+  for (int i = 0; i < num_events; ++i)
+    ready_fds[i] = events[i].ident;
+  return num_events;
+}
+
+/**
+ * OSXFuse cannot clone its device file descriptor.
+ */
+inline int platform_clone_fuse_fd(int fd) {
+  return -1;
+}
+
+/**
+ * There is no process affinity on OS X, all online CPUs can be used.
+ */
+inline std::vector<unsigned> platform_allowed_cpus() {
+  std::vector<unsigned> result;
+  const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);  // NOLINT(runtime/int)
+  for (long i = 0; i < num_cpus; ++i)  // NOLINT(runtime/int)
+    result.push_back(i);
+  if (result.empty())
+    result.push_back(0);
+  return result;
+}
+
+/**
+ * Thread affinity is only a hint on OS X, threads are not pinned.
+ */
+inline bool platform_pin_thread(const unsigned cpu) {
+  return false;
+}
+
 inline std::string platform_libname(const std::string &base_name) {
   return "lib" + base_name + ".dylib";
 }
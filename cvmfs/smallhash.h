@@ -355,14 +355,18 @@ class SmallHashDynamic :
     num_migrates_++;
   }
 
+  /**
+   * Grows to the capacity of other first, so that the copy needs at most one
+   * migration.  A table that is at least as large as other does not suffer
+   * from clustering when the elements are inserted in their bucket order.
+   */
   void CopyFrom(const SmallHashDynamic<Key, Value> &other) {
-    uint32_t *shuffled_indices = ShuffleIndices(other.capacity_);
+    if (other.capacity_ > capacity())
+      Migrate(other.capacity_);
     for (uint32_t i = 0; i < other.capacity_; ++i) {
-      if (other.keys_[shuffled_indices[i]] != other.empty_key_)
-        this->Insert(other.keys_[shuffled_indices[i]],
-                     other.values_[shuffled_indices[i]]);
+      if (other.keys_[i] != other.empty_key_)
+        this->Insert(other.keys_[i], other.values_[i]);
     }
-    smunmap(shuffled_indices);
   }
 
   uint32_t num_migrates_;
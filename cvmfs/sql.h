@@ -166,6 +166,15 @@ class Database : SingleCopy {
    */
   double GetFreePageRatio() const;
 
+  /**
+   * Number of pages in the database file.
+   */
+  uint64_t GetPageCount() const;
+  /**
+   * Limits the number of pages the connection keeps in the page cache.
+   */
+  bool SetCacheSize(const unsigned num_pages) const;
+
   /**
    * Retrieves the per-connection memory statistics from SQlite
    */
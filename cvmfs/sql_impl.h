@@ -14,6 +14,7 @@
 #include "logging.h"
 #include "platform.h"
 #include "sqlitemem.h"
+#include "util/string.h"
 
 namespace sqlite {
 
@@ -413,6 +414,22 @@ double Database<DerivedT>::GetFreePageRatio() const {
 }
 
 
+template <class DerivedT>
+uint64_t Database<DerivedT>::GetPageCount() const {
+  Sql page_count_query(this->sqlite_db(), "PRAGMA page_count;");
+  const bool retval = page_count_query.FetchRow();
+  assert(retval);
+  return page_count_query.RetrieveInt64(0);
+}
+
+
+template <class DerivedT>
+bool Database<DerivedT>::SetCacheSize(const unsigned num_pages) const {
+  return Sql(this->sqlite_db(),
+             "PRAGMA cache_size=" + StringifyInt(num_pages) + ";").Execute();
+}
+
+
 template <class DerivedT>
 bool Database<DerivedT>::Vacuum() const {
   assert(read_write_);
@@ -133,6 +133,26 @@ void SqliteMemoryManager::xShutdown(void *app_data __attribute__((unused))) {
 }
 
 
+/**
+ * Replaces the page cache by one of the given size in bytes, rounded down to
+ * full slots.  The page cache holds at least one slot.  Must be called before
+ * AssignGlobalArenas.
+ */
+void SqliteMemoryManager::SetPageCacheSize(const uint64_t size) {
+  assert(!assigned_);
+  uint64_t no_slots = size / kPageCacheSlotSize;
+  if (no_slots == 0)
+    no_slots = 1;
+  if (no_slots == page_cache_no_slots_)
+    return;
+
+  sxunmap(page_cache_memory_,
+          static_cast<uint64_t>(page_cache_no_slots_) * kPageCacheSlotSize);
+  page_cache_no_slots_ = static_cast<unsigned>(no_slots);
+  page_cache_memory_ = sxmmap(no_slots * kPageCacheSlotSize);
+}
+
+
 void SqliteMemoryManager::AssignGlobalArenas() {
   if (assigned_) return;
   int retval;
@@ -142,7 +162,7 @@ void SqliteMemoryManager::AssignGlobalArenas() {
   assert(retval == SQLITE_OK);
 
   retval = sqlite3_config(SQLITE_CONFIG_PAGECACHE, page_cache_memory_,
-                          kPageCacheSlotSize, kPageCacheNoSlots);
+                          kPageCacheSlotSize, page_cache_no_slots_);
   assert(retval == SQLITE_OK);
 
   retval = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sqlite3_mem_vanilla_);
@@ -230,6 +250,7 @@ SqliteMemoryManager::SqliteMemoryManager()
   : assigned_(false)
   , scratch_memory_(sxmmap(kScratchSize))
   , page_cache_memory_(sxmmap(kPageCacheSize))
+  , page_cache_no_slots_(kPageCacheNoSlots)
   , idx_last_arena_(0)
 {
   memset(&sqlite3_mem_vanilla_, 0, sizeof(sqlite3_mem_vanilla_));
@@ -267,7 +288,8 @@ SqliteMemoryManager::~SqliteMemoryManager() {
   }
 
   sxunmap(scratch_memory_, kScratchSize);
-  sxunmap(page_cache_memory_, kPageCacheSize);
+  sxunmap(page_cache_memory_,
+          static_cast<uint64_t>(page_cache_no_slots_) * kPageCacheSlotSize);
   for (unsigned i = 0; i < lookaside_buffer_arenas_.size(); ++i)
     delete lookaside_buffer_arenas_[i];
   for (unsigned i = 0; i < malloc_arenas_.size(); ++i)
@@ -29,10 +29,11 @@ class MallocArena;
  * It is implemented as a singleton.  GetInstance() will reserve memory blocks,
  * AssignGlobalArenas will set the global sqlite configuration and
  * CleanupInstance frees the memory blocks.  These three routines are not
- * thread-safe.  AssignGlobalArenas has to be called as first sqlite operation,
- * CleanupInstance has to be called after sqlite3_shutdown.  If the singleton
- * is alive, read-only sqlite databases will automatically use it for their
- * lookaside buffers (see sql.h).  Assignment of lookaside buffers is
+ * thread-safe.  The page cache can be resized with SetPageCacheSize before the
+ * arenas are assigned.  AssignGlobalArenas has to be called as first sqlite
+ * operation, CleanupInstance has to be called after sqlite3_shutdown.  If the
+ * singleton is alive, read-only sqlite databases will automatically use it for
+ * their lookaside buffers (see sql.h).  Assignment of lookaside buffers is
  * thread-safe.
  */
 class SqliteMemoryManager {
@@ -40,6 +41,7 @@ class SqliteMemoryManager {
   FRIEND_TEST(T_Sqlitemem, Malloc);
   FRIEND_TEST(T_Sqlitemem, Realloc);
   FRIEND_TEST(T_Sqlitemem, ReallocStress);
+  FRIEND_TEST(T_Sqlitemem, PageCacheSize);
 
  public:
   /**
@@ -62,7 +64,8 @@ class SqliteMemoryManager {
    */
   static const unsigned kPageCacheSlotSize = 1300;
   /**
-   * Number of pages that can be cached.
+   * Default number of pages that can be cached.  Can be changed by
+   * SetPageCacheSize() before AssignGlobalArenas() is called.
    */
   static const unsigned kPageCacheNoSlots = 4000;
   /**
@@ -141,10 +144,13 @@ class SqliteMemoryManager {
   static bool HasInstance() { return instance_ != NULL; }
   ~SqliteMemoryManager();
 
+  void SetPageCacheSize(const uint64_t size);
   void AssignGlobalArenas();
   void *AssignLookasideBuffer(sqlite3 *db);
   void ReleaseLookasideBuffer(void *buffer);
 
+  unsigned page_cache_no_slots() const { return page_cache_no_slots_; }
+
  private:
   /**
    * Should be larger than 10 times the largest allocation, which for reading
@@ -194,6 +200,10 @@ class SqliteMemoryManager {
   struct sqlite3_mem_methods mem_methods_;
   void *scratch_memory_;
   void *page_cache_memory_;
+  /**
+   * Number of kPageCacheSlotSize slots in page_cache_memory_.
+   */
+  unsigned page_cache_no_slots_;
   std::vector<LookasideBufferArena *> lookaside_buffer_arenas_;
   std::vector<MallocArena *> malloc_arenas_;
   /**
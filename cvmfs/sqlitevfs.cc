@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -59,6 +60,7 @@ struct VfsRdOnly {
     , n_sleep(NULL)
     , sz_sleep(NULL)
     , n_time(NULL)
+    , n_fetch(NULL)
   { }
   CacheManager *cache_mgr;
   perf::Counter *n_access;
@@ -70,6 +72,7 @@ struct VfsRdOnly {
   perf::Counter *n_sleep;
   perf::Counter *sz_sleep;
   perf::Counter *n_time;
+  perf::Counter *n_fetch;
 };
 
 /**
@@ -80,13 +83,33 @@ struct VfsRdOnlyFile {
   VfsRdOnly *vfs_rdonly;
   int fd;
   uint64_t size;
+  /**
+   * Only file descriptors of the posix cache manager can be memory mapped.
+   * The mapping is created on the first xFetch and covers the file up to
+   * the mmap_limit set by SQlite.
+   */
+  bool mappable;
+  void *mmap_base;
+  uint64_t mmap_size;
+  int64_t mmap_limit;
+  unsigned n_fetch_out;  ///< Pages handed out by xFetch and not yet released
 };
 
 }  // anonymous namespace
 
 
+static void VfsRdOnlyUnmap(VfsRdOnlyFile *p) {
+  if (p->mmap_base != NULL) {
+    munmap(p->mmap_base, p->mmap_size);
+    p->mmap_base = NULL;
+    p->mmap_size = 0;
+  }
+}
+
+
 static int VfsRdOnlyClose(sqlite3_file *pFile) {
   VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
+  VfsRdOnlyUnmap(p);
   int retval = p->vfs_rdonly->cache_mgr->Close(p->fd);
   if (retval == 0) {
     perf::Dec(p->vfs_rdonly->no_open);
@@ -181,14 +204,27 @@ static int VfsRdOnlyCheckReservedLock(
 
 
 /**
- *  No xFileControl() verbs are implemented by this VFS.
+ * Only SQLITE_FCNTL_MMAP_SIZE is implemented by this VFS.  It reports the
+ * previous mmap limit and sets the new one, unless pages are still mapped out.
  */
 static int VfsRdOnlyFileControl(
-  sqlite3_file *p __attribute__((unused)),
-  int op __attribute__((unused)),
-  void *pArg __attribute__((unused))
+  sqlite3_file *pFile,
+  int op,
+  void *pArg
 ) {
-  return SQLITE_NOTFOUND;
+  if (op != SQLITE_FCNTL_MMAP_SIZE)
+    return SQLITE_NOTFOUND;
+
+  VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
+  const int64_t new_limit = *reinterpret_cast<int64_t *>(pArg);
+  *reinterpret_cast<int64_t *>(pArg) = p->mmap_limit;
+  if ((new_limit >= 0) && (new_limit != p->mmap_limit) &&
+      (p->n_fetch_out == 0))
+  {
+    VfsRdOnlyUnmap(p);
+    p->mmap_limit = new_limit;
+  }
+  return SQLITE_OK;
 }
 
 
@@ -210,6 +246,68 @@ static int VfsRdOnlyDeviceCharacteristics(
 }
 
 
+/**
+ * Hands out a pointer into the memory mapped file, so that SQlite reads the
+ * page directly from the page cache instead of copying it.  Sets *pp to NULL
+ * if the region cannot be mapped, in which case SQlite falls back to xRead.
+ */
+static int VfsRdOnlyFetch(
+  sqlite3_file *pFile,
+  sqlite3_int64 iOfst,
+  int iAmt,
+  void **pp)
+{
+  VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
+  *pp = NULL;
+  if (!p->mappable || (p->mmap_limit <= 0))
+    return SQLITE_OK;
+
+  if (p->mmap_base == NULL) {
+    uint64_t map_size = p->size;
+    if (map_size > static_cast<uint64_t>(p->mmap_limit))
+      map_size = p->mmap_limit;
+    if (map_size == 0)
+      return SQLITE_OK;
+    void *base = mmap(NULL, map_size, PROT_READ, MAP_SHARED, p->fd, 0);
+    if (base == MAP_FAILED) {
+      LogCvmfs(kLogSql, kLogDebug, "failed to mmap sqlite file on fd %d (%d)",
+               p->fd, errno);
+      p->mappable = false;
+      return SQLITE_OK;
+    }
+    p->mmap_base = base;
+    p->mmap_size = map_size;
+  }
+
+  if (static_cast<uint64_t>(iOfst + iAmt) > p->mmap_size)
+    return SQLITE_OK;
+  *pp = reinterpret_cast<char *>(p->mmap_base) + iOfst;
+  p->n_fetch_out++;
+  perf::Inc(p->vfs_rdonly->n_fetch);
+  return SQLITE_OK;
+}
+
+
+/**
+ * Releases a page obtained by xFetch.  If pPage is NULL, SQlite asks for the
+ * mapping to be removed, which is done once no pages are mapped out anymore.
+ */
+static int VfsRdOnlyUnfetch(
+  sqlite3_file *pFile,
+  sqlite3_int64 iOfst __attribute__((unused)),
+  void *pPage)
+{
+  VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
+  if (pPage != NULL) {
+    assert(p->n_fetch_out > 0);
+    p->n_fetch_out--;
+  } else if (p->n_fetch_out == 0) {
+    VfsRdOnlyUnmap(p);
+  }
+  return SQLITE_OK;
+}
+
+
 /**
  * Supports only read-only opens.  The "file name" has to be in the form of
  * '@<file descriptor>', where file descriptor is usable by the cache manager.
@@ -222,7 +320,7 @@ static int VfsRdOnlyOpen(
   int *pOutFlags)
 {
   static const sqlite3_io_methods io_methods = {
-    1,  // iVersion
+    3,  // iVersion
     VfsRdOnlyClose,
     VfsRdOnlyRead,
     VfsRdOnlyWrite,
@@ -234,7 +332,13 @@ static int VfsRdOnlyOpen(
     VfsRdOnlyCheckReservedLock,
     VfsRdOnlyFileControl,
     VfsRdOnlySectorSize,
-    VfsRdOnlyDeviceCharacteristics
+    VfsRdOnlyDeviceCharacteristics,
+    NULL,  // xShmMap, no write-ahead log
+    NULL,  // xShmLock
+    NULL,  // xShmBarrier
+    NULL,  // xShmUnmap
+    VfsRdOnlyFetch,
+    VfsRdOnlyUnfetch
   };
 
   VfsRdOnlyFile *p = reinterpret_cast<VfsRdOnlyFile *>(pFile);
@@ -266,6 +370,11 @@ static int VfsRdOnlyOpen(
     return SQLITE_IOERR;
   }
   p->size = static_cast<uint64_t>(size);
+  p->mappable = (cache_mgr->id() == kPosixCacheManager);
+  p->mmap_base = NULL;
+  p->mmap_size = 0;
+  p->mmap_limit = 0;
+  p->n_fetch_out = 0;
   if (pOutFlags)
     *pOutFlags = flags;
   p->vfs_rdonly = reinterpret_cast<VfsRdOnly *>(vfs->pAppData);
@@ -494,6 +603,9 @@ bool RegisterVfsRdOnly(
     statistics->Register("sqlite.sz_sleep", "overall microseconds slept");
   vfs_rdonly->n_time =
     statistics->Register("sqlite.n_time", "overall number of time() calls");
+  vfs_rdonly->n_fetch =
+    statistics->Register("sqlite.n_fetch",
+                         "overall number of memory mapped page reads");
 
   return true;
 }
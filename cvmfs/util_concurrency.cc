@@ -50,6 +50,15 @@ void Signal::Wait() {
 }
 
 
+/**
+ * Returns true as long as the signal did not fire.
+ */
+bool Signal::IsSleeping() {
+  MutexLockGuard guard(lock_);
+  return !fired_;
+}
+
+
 void Signal::Wakeup() {
   MutexLockGuard guard(lock_);
   fired_ = true;
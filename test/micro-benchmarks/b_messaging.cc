@@ -3,16 +3,24 @@
  */
 #include <benchmark/benchmark.h>
 
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <string>
+#include <vector>
 
 #include "bm_util.h"
+#include "cache_extern.h"
+#include "cache_plugin/channel.h"
 #include "cache_transport.h"
+#include "hash.h"
+#include "smalloc.h"
 #include "util/posix.h"
 
 using namespace std;  // NOLINT
@@ -107,3 +115,209 @@ BENCHMARK_DEFINE_F(BM_Messaging, CacheHandshake)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Messaging, CacheHandshake)->Repetitions(3)->
   Arg(1024)->Arg(128*1024)->UseRealTime();
+
+
+/**
+ * Serves a single object from memory.  Used to measure the throughput of the
+ * client-plugin protocol.
+ */
+class BenchmarkCachePlugin : public CachePlugin {
+ public:
+  BenchmarkCachePlugin(const string &socket_path, unsigned object_size,
+                       unsigned num_workers = 0)
+    : CachePlugin(cvmfs::CAP_ALL_V1)
+    , object_size_(object_size)
+  {
+    object_ = reinterpret_cast<unsigned char *>(smalloc(object_size_));
+    memset(object_, 42, object_size_);
+    object_id_.algorithm = shash::kSha1;
+    shash::HashMem(object_, object_size_, &object_id_);
+    bool retval = Listen("unix=" + socket_path);
+    assert(retval);
+    ProcessRequests(num_workers);
+  }
+  virtual ~BenchmarkCachePlugin() { free(object_); }
+
+  shash::Any object_id() const { return object_id_; }
+
+ protected:
+  virtual cvmfs::EnumStatus ChangeRefcount(const shash::Any &id,
+                                           int32_t change_by)
+  {
+    return (id == object_id_) ? cvmfs::STATUS_OK : cvmfs::STATUS_NOENTRY;
+  }
+  virtual cvmfs::EnumStatus GetObjectInfo(const shash::Any &id,
+                                          ObjectInfo *info)
+  {
+    if (id != object_id_)
+      return cvmfs::STATUS_NOENTRY;
+    info->size = object_size_;
+    return cvmfs::STATUS_OK;
+  }
+  virtual cvmfs::EnumStatus Pread(const shash::Any &id,
+                                  uint64_t offset,
+                                  uint32_t *size,
+                                  unsigned char *buffer)
+  {
+    if (id != object_id_)
+      return cvmfs::STATUS_NOENTRY;
+    if (offset > object_size_)
+      return cvmfs::STATUS_OUTOFBOUNDS;
+    *size = std::min(static_cast<uint64_t>(*size), object_size_ - offset);
+    memcpy(buffer, object_ + offset, *size);
+    return cvmfs::STATUS_OK;
+  }
+  virtual cvmfs::EnumStatus StartTxn(const shash::Any &id,
+                                     const uint64_t txn_id,
+                                     const ObjectInfo &info)
+  { return cvmfs::STATUS_OK; }
+  virtual cvmfs::EnumStatus WriteTxn(const uint64_t txn_id,
+                                     unsigned char *buffer,
+                                     uint32_t size)
+  { return cvmfs::STATUS_OK; }
+  virtual cvmfs::EnumStatus AbortTxn(const uint64_t txn_id) {
+    return cvmfs::STATUS_OK;
+  }
+  virtual cvmfs::EnumStatus CommitTxn(const uint64_t txn_id) {
+    return cvmfs::STATUS_OK;
+  }
+  virtual cvmfs::EnumStatus GetInfo(Info *info) { return cvmfs::STATUS_OK; }
+  virtual cvmfs::EnumStatus Shrink(uint64_t shrink_to, uint64_t *used_bytes) {
+    return cvmfs::STATUS_OK;
+  }
+  virtual cvmfs::EnumStatus ListingBegin(uint64_t lst_id,
+                                         cvmfs::EnumObjectType type)
+  { return cvmfs::STATUS_NOSUPPORT; }
+  virtual cvmfs::EnumStatus ListingNext(int64_t lst_id, ObjectInfo *item) {
+    return cvmfs::STATUS_OUTOFBOUNDS;
+  }
+  virtual cvmfs::EnumStatus ListingEnd(int64_t lst_id) {
+    return cvmfs::STATUS_OK;
+  }
+
+ private:
+  uint64_t object_size_;
+  unsigned char *object_;
+  shash::Any object_id_;
+};
+
+
+/**
+ * Sequentially reads a 64MB object through the external cache manager in
+ * blocks of range_x bytes.  Requests are pipelined and read ahead.
+ */
+BENCHMARK_DEFINE_F(BM_Messaging, CacheRead)(benchmark::State &st) {
+  const unsigned object_size = 64 * 1024 * 1024;
+  string socket_path = "/tmp/cvmfs_benchmark_read.socket";
+  BenchmarkCachePlugin *plugin =
+    new BenchmarkCachePlugin(socket_path, object_size);
+  int fd_client = ConnectSocket(socket_path);
+  assert(fd_client >= 0);
+  ExternalCacheManager *cache_mgr =
+    ExternalCacheManager::Create(fd_client, 16, "benchmark");
+  assert(cache_mgr != NULL);
+  cache_mgr->Spawn();
+  int fd = cache_mgr->Open(CacheManager::Bless(plugin->object_id()));
+  assert(fd >= 0);
+
+  unsigned char *buffer =
+    reinterpret_cast<unsigned char *>(smalloc(st.range_x()));
+  uint64_t offset = 0;
+  while (st.KeepRunning()) {
+    int64_t nbytes = cache_mgr->Pread(fd, buffer, st.range_x(), offset);
+    assert(nbytes >= 0);
+    Escape(buffer);
+    offset += nbytes;
+    if (offset >= object_size)
+      offset = 0;
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(st.range_x()));
+
+  free(buffer);
+  cache_mgr->Close(fd);
+  delete cache_mgr;
+  delete plugin;
+  unlink(socket_path.c_str());
+}
+BENCHMARK_REGISTER_F(BM_Messaging, CacheRead)->Repetitions(3)->
+  Arg(4096)->Arg(128*1024)->Arg(1024*1024)->UseRealTime();
+
+
+namespace {
+
+struct LoadSession {
+  ExternalCacheManager *cache_mgr;
+  int fd;
+  unsigned object_size;
+  unsigned num_reads;
+};
+
+void *MainLoadSession(void *data) {
+  LoadSession *session = reinterpret_cast<LoadSession *>(data);
+  const unsigned block_size = 4096;
+  unsigned char buffer[block_size];
+  for (unsigned i = 0; i < session->num_reads; ++i) {
+    // Scattered offsets so that read-ahead does not kick in
+    uint64_t offset =
+      (uint64_t(i) * 7919 * block_size) % (session->object_size - block_size);
+    int64_t nbytes =
+      session->cache_mgr->Pread(session->fd, buffer, block_size, offset);
+    assert(nbytes == block_size);
+    Escape(buffer);
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+/**
+ * Load generator: range_x client sessions issue small reads concurrently
+ * against a plugin with range_y worker threads.  One iteration is a batch of
+ * 256 reads per session.
+ */
+BENCHMARK_DEFINE_F(BM_Messaging, CacheSessions)(benchmark::State &st) {
+  const unsigned object_size = 16 * 1024 * 1024;
+  const unsigned num_reads = 256;
+  const unsigned num_sessions = st.range_x();
+  string socket_path = "/tmp/cvmfs_benchmark_sessions.socket";
+  BenchmarkCachePlugin *plugin =
+    new BenchmarkCachePlugin(socket_path, object_size, st.range_y());
+
+  vector<LoadSession> sessions(num_sessions);
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    int fd_client = ConnectSocket(socket_path);
+    assert(fd_client >= 0);
+    sessions[i].cache_mgr =
+      ExternalCacheManager::Create(fd_client, 16, "benchmark");
+    assert(sessions[i].cache_mgr != NULL);
+    sessions[i].cache_mgr->Spawn();
+    sessions[i].fd =
+      sessions[i].cache_mgr->Open(CacheManager::Bless(plugin->object_id()));
+    assert(sessions[i].fd >= 0);
+    sessions[i].object_size = object_size;
+    sessions[i].num_reads = num_reads;
+  }
+
+  vector<pthread_t> threads(num_sessions);
+  while (st.KeepRunning()) {
+    for (unsigned i = 0; i < num_sessions; ++i) {
+      int retval =
+        pthread_create(&threads[i], NULL, MainLoadSession, &sessions[i]);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_sessions; ++i)
+      pthread_join(threads[i], NULL);
+  }
+  st.SetItemsProcessed(int64_t(st.iterations()) * num_sessions * num_reads);
+
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    sessions[i].cache_mgr->Close(sessions[i].fd);
+    delete sessions[i].cache_mgr;
+  }
+  delete plugin;
+  unlink(socket_path.c_str());
+}
+BENCHMARK_REGISTER_F(BM_Messaging, CacheSessions)->Repetitions(3)->
+  ArgPair(1, 0)->ArgPair(16, 0)->ArgPair(16, 4)->ArgPair(64, 0)->
+  ArgPair(64, 8)->UseRealTime();
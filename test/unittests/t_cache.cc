@@ -683,6 +683,16 @@ TEST_F(T_CacheManager, Pread) {
 }
 
 
+TEST_F(T_CacheManager, Readahead) {
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_one_));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->Readahead(fd));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  EXPECT_EQ(-EBADF, cache_mgr_->Readahead(fd));
+}
+
+
 TEST_F(T_CacheManager, Rename) {
   string path_null = tmp_path_ + "/" + hash_null_.MakePath();
   string path_one = tmp_path_ + "/" + hash_one_.MakePath();
@@ -36,13 +36,14 @@ class MockCachePlugin : public CachePlugin {
   static const unsigned kMockCacheSize;
   static const unsigned kMockListingNitems;
 
-  MockCachePlugin(const string &socket_path, bool read_only)
+  MockCachePlugin(const string &socket_path, bool read_only,
+                  unsigned num_workers = 0)
     : CachePlugin(read_only ? (cvmfs::CAP_ALL_V1 & ~cvmfs::CAP_WRITE)
                             : cvmfs::CAP_ALL_V1)
   {
     bool retval = Listen("unix=" + socket_path);
     assert(retval);
-    ProcessRequests(0);
+    ProcessRequests(num_workers);
     known_object.algorithm = shash::kSha1;
     known_object_content = "Hello, World";
     shash::HashString(known_object_content, &known_object);
@@ -236,6 +237,33 @@ TEST_F(T_ExternalCacheManager, Connection) {
 }
 
 
+TEST_F(T_ExternalCacheManager, SharedMemory) {
+  // Unix domain socket connections negotiate the shared memory data path
+  EXPECT_TRUE(cache_mgr_->has_shm());
+
+  shash::Any id(shash::kSha1);
+  unsigned size = 3 * cache_mgr_->max_object_size() + 1;
+  unsigned char *content = reinterpret_cast<unsigned char *>(smalloc(size));
+  for (unsigned i = 0; i < size; ++i)
+    content[i] = i % 251;
+  shash::HashMem(content, size, &id);
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(id, content, size, "test"));
+  EXPECT_EQ(string(reinterpret_cast<char *>(content), size),
+            mock_plugin_->new_object_content);
+
+  int fd = cache_mgr_->Open(CacheManager::Bless(id));
+  EXPECT_GE(fd, 0);
+  unsigned char *buffer = reinterpret_cast<unsigned char *>(smalloc(size));
+  EXPECT_EQ(static_cast<int64_t>(size), cache_mgr_->Pread(fd, buffer, size, 0));
+  EXPECT_EQ(0, memcmp(content, buffer, size));
+  EXPECT_EQ(1, cache_mgr_->Pread(fd, buffer, 2, size - 1));
+  EXPECT_EQ(content[size - 1], buffer[0]);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  free(buffer);
+  free(content);
+}
+
+
 TEST_F(T_ExternalCacheManager, OpenClose) {
   EXPECT_EQ(-EBADF, cache_mgr_->Close(0));
   shash::Any rnd_id(shash::kSha1);
@@ -586,6 +614,167 @@ TEST_F(T_ExternalCacheManager, MultiThreaded) {
 }
 
 
+namespace {
+
+struct SessionData {
+  ExternalCacheManager *cache_mgr;
+  int fd;
+  string expected_content;
+  unsigned num_errors;
+};
+
+void *MainSession(void *data) {
+  SessionData *sd = reinterpret_cast<SessionData *>(data);
+  char buffer[64];
+  for (unsigned i = 0; i < 500; ++i) {
+    unsigned offset = i % sd->expected_content.length();
+    int64_t len = sd->cache_mgr->Pread(sd->fd, buffer, sizeof(buffer), offset);
+    if (string(buffer, std::max(len, int64_t(0))) !=
+        sd->expected_content.substr(offset))
+    {
+      sd->num_errors++;
+    }
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST_F(T_ExternalCacheManager, WorkerThreads) {
+  string socket_path = "cvmfs_cache_plugin_workers.socket";
+  MockCachePlugin *plugin = new MockCachePlugin(socket_path, false, 4);
+
+  const unsigned num_sessions = 8;
+  SessionData sd[num_sessions];
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    int fd_con = ConnectSocket(socket_path);
+    ASSERT_GE(fd_con, 0);
+    sd[i].cache_mgr = ExternalCacheManager::Create(fd_con, nfiles, "test");
+    ASSERT_TRUE(sd[i].cache_mgr != NULL);
+    sd[i].cache_mgr->Spawn();
+    sd[i].fd = sd[i].cache_mgr->Open(CacheManager::Bless(plugin->known_object));
+    ASSERT_GE(sd[i].fd, 0);
+    sd[i].expected_content = plugin->known_object_content;
+    sd[i].num_errors = 0;
+  }
+
+  // Requests of all the sessions are processed concurrently, interleaved
+  // with detach requests from the plugin
+  pthread_t threads[num_sessions];
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    int retval = pthread_create(&threads[i], NULL, MainSession, &sd[i]);
+    assert(retval == 0);
+  }
+  for (unsigned i = 0; i < 10; ++i)
+    plugin->AskToDetach();
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(0U, sd[i].num_errors);
+  }
+
+  for (unsigned i = 0; i < num_sessions; ++i) {
+    EXPECT_EQ(0, sd[i].cache_mgr->Close(sd[i].fd));
+    delete sd[i].cache_mgr;
+  }
+  unlink(socket_path.c_str());
+  delete plugin;
+}
+
+
+TEST_F(T_ExternalCacheManager, Pipelined) {
+  cache_mgr_->Spawn();
+
+  shash::Any id(shash::kSha1);
+  unsigned size = 20 * cache_mgr_->max_object_size() + 7;
+  unsigned char *content = reinterpret_cast<unsigned char *>(smalloc(size));
+  for (unsigned i = 0; i < size; ++i)
+    content[i] = (i / 3) % 253;
+  shash::HashMem(content, size, &id);
+  // Stored in parts that are sent without waiting for the replies
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(id, content, size, "test"));
+  EXPECT_EQ(string(reinterpret_cast<char *>(content), size),
+            mock_plugin_->new_object_content);
+
+  int fd = cache_mgr_->Open(CacheManager::Bless(id));
+  EXPECT_GE(fd, 0);
+  unsigned char *buffer = reinterpret_cast<unsigned char *>(smalloc(size));
+  // Many batches in flight
+  EXPECT_EQ(static_cast<int64_t>(size), cache_mgr_->Pread(fd, buffer, size, 0));
+  EXPECT_EQ(0, memcmp(content, buffer, size));
+
+  // Sequential reads served from read-ahead buffers
+  memset(buffer, 0, size);
+  EXPECT_EQ(0, cache_mgr_->Readahead(fd));
+  const unsigned block = cache_mgr_->max_object_size() / 2 + 1;
+  uint64_t pos = 0;
+  int64_t nbytes;
+  while ((nbytes = cache_mgr_->Pread(fd, buffer + pos, block, pos)) > 0)
+    pos += nbytes;
+  EXPECT_EQ(0, nbytes);
+  EXPECT_EQ(size, pos);
+  EXPECT_EQ(0, memcmp(content, buffer, size));
+
+  // Random access
+  EXPECT_EQ(3, cache_mgr_->Pread(fd, buffer, 3, size / 2));
+  EXPECT_EQ(0, memcmp(content + size / 2, buffer, 3));
+  EXPECT_EQ(-EINVAL, cache_mgr_->Pread(fd, buffer, 1, size + 1));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  free(buffer);
+  free(content);
+}
+
+
+TEST_F(T_ExternalCacheManager, ReadaheadRecycling) {
+  cache_mgr_->Spawn();
+
+  const unsigned block = cache_mgr_->max_object_size();
+  const unsigned size = 3 * block + 7;
+  unsigned char *content = reinterpret_cast<unsigned char *>(smalloc(size));
+  unsigned char *buffer = reinterpret_cast<unsigned char *>(smalloc(size));
+  const unsigned num_objects = 4 * ExternalCacheManager::kNumReadaheadBuffers /
+                               ExternalCacheManager::kReadaheadDepth;
+  for (unsigned i = 0; i < num_objects; ++i) {
+    memset(content, i, size);
+    shash::Any id(shash::kSha1);
+    shash::HashMem(content, size, &id);
+    EXPECT_TRUE(cache_mgr_->CommitFromMem(id, content, size, "test"));
+    int fd = cache_mgr_->Open(CacheManager::Bless(id));
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(static_cast<int64_t>(block),
+              cache_mgr_->Pread(fd, buffer, block, 0));
+
+    // Only read the header, which leaves the read-ahead buffers unused
+    if (i % 3 == 1) {
+      EXPECT_EQ(0, cache_mgr_->Close(fd));
+      continue;
+    }
+
+    // The following blocks were read ahead
+    for (unsigned d = 1; d <= ExternalCacheManager::kReadaheadDepth; ++d) {
+      EXPECT_EQ(static_cast<int64_t>(block),
+                cache_mgr_->ReadFromReadahead(id, buffer + d * block, block,
+                                              d * block))
+        << "object " << i << ", block " << d;
+    }
+    EXPECT_EQ(0, memcmp(content, buffer, 3 * block));
+
+    // Read to the end, which requests ranges beyond the end of the object
+    if (i % 3 == 2) {
+      uint64_t pos = 3 * block;
+      int64_t nbytes;
+      while ((nbytes = cache_mgr_->Pread(fd, buffer + pos, block, pos)) > 0)
+        pos += nbytes;
+      EXPECT_EQ(0, nbytes);
+      EXPECT_EQ(size, pos);
+      EXPECT_EQ(0, memcmp(content, buffer, size));
+    }
+    EXPECT_EQ(0, cache_mgr_->Close(fd));
+  }
+  free(buffer);
+  free(content);
+}
+
+
 TEST_F(T_ExternalCacheManager, SaveState) {
   // Should not crash
   void *data = cache_mgr_->SaveState(-1);
@@ -0,0 +1,254 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "catalog_diff.h"
+#include "catalog_rw.h"
+#include "catalog_sql.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+/**
+ * Opens catalogs from the database files of the test fixture
+ */
+class TestCatalogDiff : public CatalogDiff {
+ public:
+  TestCatalogDiff(const map<shash::Any, string> *db_paths,
+                  const unsigned max_paths)
+    : CatalogDiff(max_paths), num_opened_(0), num_closed_(0)
+    , db_paths_(db_paths) { }
+
+  unsigned num_opened_;
+  unsigned num_closed_;
+
+ protected:
+  virtual Catalog *OpenCatalog(const PathString &mountpoint,
+                               const shash::Any &hash)
+  {
+    map<shash::Any, string>::const_iterator iter = db_paths_->find(hash);
+    if (iter == db_paths_->end())
+      return NULL;
+    num_opened_++;
+    return Catalog::AttachFreely(mountpoint.ToString(), iter->second, hash,
+                                 NULL, !mountpoint.IsEmpty());
+  }
+
+  virtual void CloseCatalog(Catalog *catalog) {
+    num_closed_++;
+    delete catalog;
+  }
+
+ private:
+  const map<shash::Any, string> *db_paths_;
+};
+
+
+class T_CatalogDiff : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    sandbox_ = CreateTempDir(GetCurrentWorkingDirectory() +
+                             "/cvmfs_ut_catalog_diff");
+    ASSERT_FALSE(sandbox_.empty());
+  }
+
+  virtual void TearDown() {
+    if (sandbox_ != "")
+      RemoveTree(sandbox_);
+  }
+
+  WritableCatalog *CreateCatalog(const string &mountpoint) {
+    string db_file = CreateTempPath(sandbox_ + "/catalog", 0666);
+    EXPECT_FALSE(db_file.empty());
+    DirectoryEntry root_entry =
+      DirectoryEntryTestFactory::Directory(GetFileName(mountpoint));
+    root_entry.set_is_nested_catalog_root(!mountpoint.empty());
+    {
+      UniquePtr<CatalogDatabase> db(CatalogDatabase::Create(db_file));
+      EXPECT_TRUE(db.IsValid());
+      EXPECT_TRUE(db->InsertInitialValues(mountpoint, false, "", root_entry));
+    }
+    return WritableCatalog::AttachFreely(mountpoint, db_file,
+                                         shash::Any(shash::kSha1), NULL,
+                                         !mountpoint.empty());
+  }
+
+  /**
+   * Closes the catalog and returns the hash under which it can be opened
+   */
+  shash::Any CommitCatalog(WritableCatalog *catalog) {
+    string db_file = catalog->database_path();
+    catalog->Commit();
+    delete catalog;
+    shash::Any hash(shash::kSha1, shash::kSuffixCatalog);
+    EXPECT_TRUE(shash::HashFile(db_file, &hash));
+    db_paths_[hash] = db_file;
+    return hash;
+  }
+
+  void AddFile(WritableCatalog *catalog,
+               const string &parent_path,
+               const string &name,
+               const unsigned size = 4096)
+  {
+    DirectoryEntry dirent = DirectoryEntryTestFactory::RegularFile(name, size);
+    catalog->AddEntry(dirent, XattrList(), parent_path + "/" + name,
+                      parent_path);
+  }
+
+  void AddDirectory(WritableCatalog *catalog,
+                    const string &parent_path,
+                    const string &name,
+                    const bool is_nested_catalog_mountpoint = false)
+  {
+    DirectoryEntry dirent = DirectoryEntryTestFactory::Directory(
+      name, 4096, shash::Any(), is_nested_catalog_mountpoint);
+    catalog->AddEntry(dirent, XattrList(), parent_path + "/" + name,
+                      parent_path);
+  }
+
+  /**
+   * A root catalog with the given files in /dir and a nested catalog /nested
+   * with the file /nested/x of size size_x.  Revisions with the same size_x
+   * share the nested catalog.
+   */
+  shash::Any CreateRevision(const vector<string> &files,
+                            const unsigned size_x)
+  {
+    if (nested_hashes_.find(size_x) == nested_hashes_.end()) {
+      WritableCatalog *nested = CreateCatalog("/nested");
+      AddFile(nested, "/nested", "x", size_x);
+      nested_hashes_[size_x] = CommitCatalog(nested);
+    }
+    shash::Any nested_hash = nested_hashes_[size_x];
+
+    WritableCatalog *root = CreateCatalog("");
+    AddDirectory(root, "", "dir");
+    for (unsigned i = 0; i < files.size(); ++i)
+      AddFile(root, "/dir", files[i]);
+    AddDirectory(root, "", "nested", true);
+    root->InsertNestedCatalog("/nested", NULL, nested_hash,
+                              GetFileSize(db_paths_[nested_hash]));
+    return CommitCatalog(root);
+  }
+
+  string sandbox_;
+  map<shash::Any, string> db_paths_;
+  map<unsigned, shash::Any> nested_hashes_;
+};
+
+
+TEST_F(T_CatalogDiff, Identical) {
+  vector<string> files;
+  files.push_back("a");
+  files.push_back("b");
+  map<PathString, shash::Any> loaded;
+  loaded[PathString("")] = CreateRevision(files, 4096);
+
+  TestCatalogDiff catalog_diff(&db_paths_, 100);
+  EXPECT_TRUE(catalog_diff.Compare(loaded, loaded[PathString("")]));
+  EXPECT_TRUE(catalog_diff.dentries().empty());
+  EXPECT_TRUE(catalog_diff.directories().empty());
+  EXPECT_EQ(2U, catalog_diff.num_opened_);
+  EXPECT_EQ(catalog_diff.num_opened_, catalog_diff.num_closed_);
+}
+
+
+TEST_F(T_CatalogDiff, AddedAndRemoved) {
+  vector<string> files;
+  files.push_back("a");
+  files.push_back("b");
+  map<PathString, shash::Any> loaded;
+  loaded[PathString("")] = CreateRevision(files, 4096);
+  files[1] = "c";
+  shash::Any new_root_hash = CreateRevision(files, 4096);
+
+  TestCatalogDiff catalog_diff(&db_paths_, 100);
+  EXPECT_TRUE(catalog_diff.Compare(loaded, new_root_hash));
+  ASSERT_EQ(2U, catalog_diff.dentries().size());
+  EXPECT_EQ(PathString("/dir/b"), catalog_diff.dentries()[0]);
+  EXPECT_EQ(PathString("/dir/c"), catalog_diff.dentries()[1]);
+  EXPECT_TRUE(catalog_diff.directories().empty());
+  EXPECT_EQ(catalog_diff.num_opened_, catalog_diff.num_closed_);
+
+  // The other way round
+  loaded[PathString("")] = new_root_hash;
+  files[1] = "b";
+  files.push_back("d");
+  EXPECT_TRUE(catalog_diff.Compare(loaded, CreateRevision(files, 4096)));
+  ASSERT_EQ(3U, catalog_diff.dentries().size());
+  EXPECT_EQ(PathString("/dir/b"), catalog_diff.dentries()[0]);
+  EXPECT_EQ(PathString("/dir/c"), catalog_diff.dentries()[1]);
+  EXPECT_EQ(PathString("/dir/d"), catalog_diff.dentries()[2]);
+}
+
+
+TEST_F(T_CatalogDiff, ChangedNested) {
+  vector<string> files;
+  files.push_back("a");
+  map<PathString, shash::Any> loaded;
+  loaded[PathString("")] = CreateRevision(files, 4096);
+  shash::Any new_root_hash = CreateRevision(files, 0);
+  ASSERT_NE(nested_hashes_[4096], nested_hashes_[0]);
+
+  // The nested catalog is not loaded, its entire subtree changed
+  TestCatalogDiff catalog_diff(&db_paths_, 100);
+  EXPECT_TRUE(catalog_diff.Compare(loaded, new_root_hash));
+  ASSERT_EQ(1U, catalog_diff.dentries().size());
+  EXPECT_EQ(PathString("/nested"), catalog_diff.dentries()[0]);
+  EXPECT_EQ(2U, catalog_diff.num_opened_);
+
+  // The loaded nested catalog is compared entry by entry
+  loaded[PathString("/nested")] = nested_hashes_[4096];
+  EXPECT_TRUE(catalog_diff.Compare(loaded, new_root_hash));
+  ASSERT_EQ(1U, catalog_diff.dentries().size());
+  EXPECT_EQ(PathString("/nested/x"), catalog_diff.dentries()[0]);
+  EXPECT_TRUE(catalog_diff.directories().empty());
+  EXPECT_EQ(6U, catalog_diff.num_opened_);
+  EXPECT_EQ(catalog_diff.num_opened_, catalog_diff.num_closed_);
+
+  // A missing new nested catalog fails the comparison
+  db_paths_.erase(nested_hashes_[0]);
+  EXPECT_FALSE(catalog_diff.Compare(loaded, new_root_hash));
+  EXPECT_EQ(catalog_diff.num_opened_, catalog_diff.num_closed_);
+}
+
+
+TEST_F(T_CatalogDiff, MaxPaths) {
+  vector<string> files;
+  map<PathString, shash::Any> loaded;
+  loaded[PathString("")] = CreateRevision(files, 4096);
+  for (unsigned i = 0; i < 10; ++i)
+    files.push_back("file" + StringifyInt(i));
+  shash::Any new_root_hash = CreateRevision(files, 4096);
+
+  TestCatalogDiff catalog_diff_ok(&db_paths_, 10);
+  EXPECT_TRUE(catalog_diff_ok.Compare(loaded, new_root_hash));
+  EXPECT_EQ(10U, catalog_diff_ok.dentries().size());
+
+  TestCatalogDiff catalog_diff(&db_paths_, 9);
+  EXPECT_FALSE(catalog_diff.Compare(loaded, new_root_hash));
+  EXPECT_EQ(catalog_diff.num_opened_, catalog_diff.num_closed_);
+
+  // Without the root catalog in the loaded catalogs
+  loaded.clear();
+  EXPECT_FALSE(catalog_diff_ok.Compare(loaded, new_root_hash));
+}
+
+}  // namespace catalog
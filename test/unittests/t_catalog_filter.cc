@@ -0,0 +1,118 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "catalog_filter.h"
+#include "catalog_rw.h"
+#include "catalog_sql.h"
+#include "hash.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+static shash::Md5 MkPathHash(const string &path) {
+  return shash::Md5(path.data(), path.length());
+}
+
+
+TEST(T_CatalogFilter, Empty) {
+  PathHashFilter filter(0);
+  EXPECT_FALSE(filter.MayContain(MkPathHash("")));
+  EXPECT_FALSE(filter.MayContain(MkPathHash("/foo")));
+  filter.Add(MkPathHash("/foo"));
+  EXPECT_TRUE(filter.MayContain(MkPathHash("/foo")));
+}
+
+
+TEST(T_CatalogFilter, FalsePositives) {
+  const unsigned num_entries = 100000;
+  PathHashFilter filter(num_entries);
+  EXPECT_EQ((num_entries * PathHashFilter::kBitsPerEntry + 63) / 64 * 8,
+            filter.GetMemoryUsage());
+
+  for (unsigned i = 0; i < num_entries; ++i)
+    filter.Add(MkPathHash("/dir/file" + StringifyInt(i)));
+  for (unsigned i = 0; i < num_entries; ++i)
+    EXPECT_TRUE(filter.MayContain(MkPathHash("/dir/file" + StringifyInt(i))));
+
+  unsigned false_positives = 0;
+  for (unsigned i = 0; i < num_entries; ++i) {
+    if (filter.MayContain(MkPathHash("/other/file" + StringifyInt(i))))
+      false_positives++;
+  }
+  EXPECT_LT(false_positives, num_entries / 50);
+}
+
+
+
+/**
+ * The filter is built in the background after kPathFilterThreshold misses
+ */
+TEST(T_CatalogFilter, Catalog) {
+  const string sandbox = CreateTempDir(GetCurrentWorkingDirectory() +
+                                       "/cvmfs_ut_catalog_filter");
+  ASSERT_FALSE(sandbox.empty());
+  const string db_file = sandbox + "/catalog";
+  {
+    UniquePtr<CatalogDatabase> db(CatalogDatabase::Create(db_file));
+    ASSERT_TRUE(db.IsValid());
+    ASSERT_TRUE(db->InsertInitialValues("", false, "",
+                DirectoryEntryTestFactory::Directory("")));
+  }
+  WritableCatalog *writable = WritableCatalog::AttachFreely(
+    "", db_file, shash::Any(shash::kSha1), NULL, false);
+  ASSERT_TRUE(writable != NULL);
+  for (unsigned i = 0; i < 100; ++i) {
+    const string name = "file" + StringifyInt(i);
+    writable->AddEntry(DirectoryEntryTestFactory::RegularFile(name, 4096),
+                       XattrList(), "/" + name, "");
+  }
+  writable->Commit();
+  delete writable;
+
+  // Deleting the catalog stops a running filter thread
+  for (unsigned n = 0; n < 2; ++n) {
+    Catalog *catalog = Catalog::AttachFreely(
+      "", db_file, shash::Any(shash::kSha1), NULL, false);
+    ASSERT_TRUE(catalog != NULL);
+    DirectoryEntry dirent;
+    for (unsigned i = 0; i < Catalog::kPathFilterThreshold; ++i) {
+      EXPECT_FALSE(catalog->LookupPath(
+        PathString("/none" + StringifyInt(i)), &dirent));
+    }
+    if (n == 0) {
+      delete catalog;
+      continue;
+    }
+
+    bool has_filter = false;
+    for (unsigned i = 0; (i < 100) && !has_filter; ++i) {
+      pthread_mutex_lock(catalog->lock_);
+      has_filter = catalog->path_filter_ != NULL;
+      pthread_mutex_unlock(catalog->lock_);
+      if (!has_filter)
+        SafeSleepMs(50);
+    }
+    EXPECT_TRUE(has_filter);
+    for (unsigned i = 0; i < 100; ++i) {
+      EXPECT_TRUE(catalog->LookupPath(
+        PathString("/file" + StringifyInt(i)), &dirent));
+    }
+    EXPECT_FALSE(catalog->LookupPath(PathString("/none"), &dirent));
+    delete catalog;
+  }
+  RemoveTree(sandbox);
+}
+
+}  // namespace catalog
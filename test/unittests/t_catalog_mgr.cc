@@ -13,6 +13,7 @@
 #include "hash.h"
 #include "shortstring.h"
 #include "testutil.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -118,6 +119,20 @@ class T_CatalogManager : public ::testing::Test {
     catalog_mgr_.RegisterNewCatalog(new_catalog_2);
   }
 
+  /**
+   * Creates the next revision of the root catalog of the tree from AddTree()
+   * without nested catalogs.  It is served by the next remount.
+   */
+  MockCatalog *CreateNewRoot() {
+    MockCatalog *new_root = new MockCatalog("", shash::Any(), 4096, 2, 0, true);
+    new_root->AddFile(shash::Any(), 4096, "", "");
+    new_root->AddFile(shash::Any(), 4096, "", "dir");
+    new_root->AddFile(shash::Any(), 4096, "/dir", "dir");
+    new_root->AddFile(shash::Any(), 4096, "/dir/dir", "dir");
+    catalog_mgr_.RegisterNewCatalog(new_root);
+    return new_root;
+  }
+
  protected:
   static const char *hashes[];
   perf::Statistics statistics_;
@@ -291,6 +306,108 @@ TEST_F(T_CatalogManager, Balance) {
                                       kLookupSole, &dirent));
 }
 
+TEST_F(T_CatalogManager, EvictColdCatalogs) {
+  catalog::DirectoryEntry dirent;
+  ASSERT_TRUE(catalog_mgr_.Init());
+  AddTree();
+  // Two more nested catalogs next to /dir: /other and /third
+  MockCatalog *root_catalog = catalog_mgr_.RetrieveRootCatalog();
+  const char *siblings[] = {"other", "third"};
+  for (unsigned i = 0; i < 2; ++i) {
+    string mountpoint = string("/") + siblings[i];
+    root_catalog->AddFile(shash::Any(), 4096, "", siblings[i]);
+    MockCatalog *nested = new MockCatalog(mountpoint, shash::Any(),
+                                          4096, 1, 0, false,
+                                          root_catalog, NULL);
+    nested->AddFile(shash::Any(shash::kSha1,
+                      reinterpret_cast<const unsigned char*>(hashes[i]),
+                      shash::kSha1),
+                    4096, mountpoint, "file");
+    catalog_mgr_.RegisterNewCatalog(nested);
+  }
+
+  // Room for the root catalog and one nested catalog, 4kB each
+  catalog_mgr_.SetMemoryLimit(2 * 4096);
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/dir/dir/dir/dir/dir/file5",
+                                      kLookupSole, &dirent));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(0, catalog_mgr_.statistics().n_evicted->Get());
+  MockCatalog *nested = root_catalog->FindSubtree(PathString("/dir/dir/dir"));
+  ASSERT_TRUE(nested != NULL);
+  MockCatalog *nested_2 =
+    nested->FindSubtree(PathString("/dir/dir/dir/dir/dir"));
+  ASSERT_TRUE(nested_2 != NULL);
+  const InodeRange range = nested->inode_range();
+  const InodeRange range_2 = nested_2->inode_range();
+
+  // Only the leaf /dir/dir/dir/dir/dir can be detached
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/other/file", kLookupSole, &dirent));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(1, catalog_mgr_.statistics().n_evicted->Get());
+  string hierarchy = catalog_mgr_.PrintHierarchy();
+  EXPECT_EQ(string::npos, hierarchy.find("/dir/dir/dir/dir/dir"));
+  EXPECT_NE(string::npos, hierarchy.find("/other"));
+
+  // /dir/dir/dir was used less recently than /other
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/other/file", kLookupSole, &dirent));
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/third/file", kLookupSole, &dirent));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(2, catalog_mgr_.statistics().n_evicted->Get());
+  hierarchy = catalog_mgr_.PrintHierarchy();
+  EXPECT_EQ(string::npos, hierarchy.find("/dir/dir/dir"));
+  EXPECT_NE(string::npos, hierarchy.find("/other"));
+  EXPECT_NE(string::npos, hierarchy.find("/third"));
+
+  // Re-mounted catalogs get their previous inodes back
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/dir/dir/dir/dir/dir/file5",
+                                      kLookupSole, &dirent));
+  nested = root_catalog->FindSubtree(PathString("/dir/dir/dir"));
+  ASSERT_TRUE(nested != NULL);
+  nested_2 = nested->FindSubtree(PathString("/dir/dir/dir/dir/dir"));
+  ASSERT_TRUE(nested_2 != NULL);
+  EXPECT_EQ(range.offset, nested->inode_range().offset);
+  EXPECT_EQ(range.size, nested->inode_range().size);
+  EXPECT_EQ(range_2.offset, nested_2->inode_range().offset);
+  EXPECT_EQ(range_2.size, nested_2->inode_range().size);
+}
+
+TEST_F(T_CatalogManager, SqliteCacheBudget) {
+  catalog::DirectoryEntry dirent;
+  catalog_mgr_.SetSqliteCacheBudget(100);
+  ASSERT_TRUE(catalog_mgr_.Init());
+  MockCatalog *root_catalog = catalog_mgr_.RetrieveRootCatalog();
+  // The root catalog has 5 pages
+  EXPECT_EQ(5U, root_catalog->cache_pages());
+
+  // Three nested catalogs with 1025 pages each
+  MockCatalog *nested[3];
+  for (unsigned i = 0; i < 3; ++i) {
+    string name = "big" + StringifyInt(i);
+    root_catalog->AddFile(shash::Any(), 4096, "", name);
+    nested[i] = new MockCatalog("/" + name, shash::Any(),
+                                1024 * 1024, 1, 0, false,
+                                root_catalog, NULL);
+    nested[i]->AddFile(shash::Any(shash::kSha1,
+                         reinterpret_cast<const unsigned char*>(hashes[i]),
+                         shash::kSha1),
+                       4096, "/" + name, "file");
+    catalog_mgr_.RegisterNewCatalog(nested[i]);
+  }
+
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/big0/file", kLookupSole, &dirent));
+  EXPECT_EQ(100U * 1025 / 1030, nested[0]->cache_pages());
+  EXPECT_EQ(5U, root_catalog->cache_pages());
+  // Attached size did not double, the share is calculated from the old size
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/big1/file", kLookupSole, &dirent));
+  EXPECT_EQ(100U * 1025 / 1030, nested[1]->cache_pages());
+  // Rebalanced, shares drop to the minimum
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/big2/file", kLookupSole, &dirent));
+  EXPECT_EQ(kMinSqliteCachePages, nested[0]->cache_pages());
+  EXPECT_EQ(kMinSqliteCachePages, nested[1]->cache_pages());
+  EXPECT_EQ(kMinSqliteCachePages, nested[2]->cache_pages());
+  EXPECT_EQ(5U, root_catalog->cache_pages());
+}
+
 TEST_F(T_CatalogManager, Remount) {
   EXPECT_TRUE(catalog_mgr_.Init());
   LoadError le;
@@ -298,4 +415,87 @@ TEST_F(T_CatalogManager, Remount) {
   EXPECT_EQ(kLoadNew, catalog_mgr_.Remount(false));
 }
 
+TEST_F(T_CatalogManager, RemountDiffUnchanged) {
+  catalog::DirectoryEntry dirent;
+  catalog_mgr_.SetDiffRemount(true);
+  ASSERT_TRUE(catalog_mgr_.Init());
+  AddTree();
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/dir/dir/dir/dir/dir/file5",
+                                      kLookupSole, &dirent));
+  ASSERT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  MockCatalog *nested = catalog_mgr_.RetrieveRootCatalog()->FindSubtree(
+    PathString("/dir/dir/dir"));
+  ASSERT_TRUE(nested != NULL);
+  MockCatalog *nested_2 = nested->FindSubtree(
+    PathString("/dir/dir/dir/dir/dir"));
+  ASSERT_TRUE(nested_2 != NULL);
+  InodeRange range = nested->inode_range();
+  InodeRange range_2 = nested_2->inode_range();
+  const inode_t old_root_inode = catalog_mgr_.GetRootInode();
+
+  // The new root catalog references the same nested catalog
+  MockCatalog *new_root = CreateNewRoot();
+  new_root->RegisterNestedCatalog(nested);
+  EXPECT_EQ(kLoadNew, catalog_mgr_.Remount(false));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(new_root, catalog_mgr_.RetrieveRootCatalog());
+  EXPECT_EQ(nested, new_root->FindSubtree(PathString("/dir/dir/dir")));
+  EXPECT_EQ(new_root, nested->parent());
+  EXPECT_EQ(nested_2, nested->FindSubtree(PathString("/dir/dir/dir/dir/dir")));
+  EXPECT_EQ(range.offset, nested->inode_range().offset);
+  EXPECT_EQ(range_2.offset, nested_2->inode_range().offset);
+
+  // The new root catalog gets fresh inodes, it is not the old root catalog
+  EXPECT_NE(old_root_inode, catalog_mgr_.GetRootInode());
+  EXPECT_EQ(new_root->inode_range().offset + 1, catalog_mgr_.GetRootInode());
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/dir/dir/dir/dir/dir/file5",
+                                      kLookupSole, &dirent));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+}
+
+TEST_F(T_CatalogManager, RemountDiffChanged) {
+  catalog::DirectoryEntry dirent;
+  catalog_mgr_.SetDiffRemount(true);
+  ASSERT_TRUE(catalog_mgr_.Init());
+  AddTree();
+  EXPECT_TRUE(catalog_mgr_.LookupPath("/dir/dir/dir/dir/dir/file5",
+                                      kLookupSole, &dirent));
+  ASSERT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  MockCatalog *nested = catalog_mgr_.RetrieveRootCatalog()->FindSubtree(
+    PathString("/dir/dir/dir"));
+  ASSERT_TRUE(nested != NULL);
+  MockCatalog *nested_2 = nested->FindSubtree(
+    PathString("/dir/dir/dir/dir/dir"));
+  ASSERT_TRUE(nested_2 != NULL);
+  InodeRange range = nested->inode_range();
+  InodeRange range_2 = nested_2->inode_range();
+
+  // /dir/dir/dir changed, its nested catalog did not
+  MockCatalog *new_root = CreateNewRoot();
+  MockCatalog *new_nested = new MockCatalog("/dir/dir/dir", shash::Any(),
+                                            4096, 2, 0, false,
+                                            new_root, NULL);
+  new_nested->AddFile(shash::Any(), 4096, "/dir/dir/dir", "dir");
+  new_nested->AddFile(shash::Any(), 4096, "/dir/dir/dir/dir", "dir");
+  new_nested->RegisterNestedCatalog(nested_2);
+  catalog_mgr_.RegisterNewCatalog(new_nested);
+  EXPECT_EQ(kLoadNew, catalog_mgr_.Remount(false));
+  EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(new_nested, new_root->FindSubtree(PathString("/dir/dir/dir")));
+  EXPECT_NE(range.offset, new_nested->inode_range().offset);
+  EXPECT_EQ(nested_2,
+            new_nested->FindSubtree(PathString("/dir/dir/dir/dir/dir")));
+  EXPECT_EQ(new_nested, nested_2->parent());
+  EXPECT_EQ(range_2.offset, nested_2->inode_range().offset);
+  EXPECT_EQ(new_root->inode_range().offset + 1, catalog_mgr_.GetRootInode());
+
+  // Without the nested catalog in the new root catalog, the subtree is gone
+  MockCatalog *newer_root = CreateNewRoot();
+  EXPECT_EQ(kLoadNew, catalog_mgr_.Remount(false));
+  EXPECT_EQ(1, catalog_mgr_.GetNumCatalogs());
+  EXPECT_EQ(newer_root, catalog_mgr_.RetrieveRootCatalog());
+  EXPECT_EQ(newer_root->inode_range().offset + 1,
+            catalog_mgr_.GetRootInode());
+}
+
 }  // namespace catalog
@@ -0,0 +1,81 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "catalog_mgr_client.h"
+#include "hash.h"
+#include "signature.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+class T_ManifestValidators : public ::testing::Test {
+ protected:
+  static const char *kFingerprint;
+
+  virtual void SetUp() {
+    now_ = time(NULL);
+    validators_.etag = "\"v1\"";
+    validators_.timestamp_verified = now_;
+    validators_.whitelist_expires = now_ + 30 * 24 * 3600;
+    validators_.certificate_fingerprint =
+      signature::SignatureManager::MkFromFingerprint(kFingerprint);
+    ASSERT_FALSE(validators_.certificate_fingerprint.IsNull());
+  }
+
+  time_t now_;
+  ManifestValidators validators_;
+  vector<string> blacklist_;
+};
+
+const char *T_ManifestValidators::kFingerprint =
+  "01:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:45:67";
+
+
+TEST_F(T_ManifestValidators, Verified) {
+  EXPECT_TRUE(validators_.IsVerified(now_, blacklist_));
+  blacklist_.push_back("AA:23:45:67:89:AB:CD:EF:01:23:45:67:89:AB:CD:EF:01:23:"
+                       "45:67");
+  EXPECT_TRUE(validators_.IsVerified(now_ + 60, blacklist_));
+}
+
+
+TEST_F(T_ManifestValidators, NotVerified) {
+  validators_.timestamp_verified = 0;
+  EXPECT_FALSE(validators_.IsVerified(now_, blacklist_));
+}
+
+
+TEST_F(T_ManifestValidators, ExpiredWhitelist) {
+  // An expired whitelist forces a full fetch despite the validators
+  validators_.whitelist_expires = now_ - 1;
+  EXPECT_FALSE(validators_.IsVerified(now_, blacklist_));
+  validators_.whitelist_expires = now_ + 60;
+  EXPECT_TRUE(validators_.IsVerified(now_, blacklist_));
+  EXPECT_FALSE(validators_.IsVerified(now_ + 60, blacklist_));
+}
+
+
+TEST_F(T_ManifestValidators, ReverifyInterval) {
+  EXPECT_TRUE(validators_.IsVerified(
+    now_ + ManifestValidators::kReverifyIntervalS - 1, blacklist_));
+  EXPECT_FALSE(validators_.IsVerified(
+    now_ + ManifestValidators::kReverifyIntervalS, blacklist_));
+  // Clock jumps backwards
+  EXPECT_FALSE(validators_.IsVerified(now_ - 1, blacklist_));
+}
+
+
+TEST_F(T_ManifestValidators, Blacklisted) {
+  blacklist_.push_back(kFingerprint);
+  EXPECT_FALSE(validators_.IsVerified(now_, blacklist_));
+}
+
+}  // namespace catalog
@@ -0,0 +1,306 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "backoff.h"
+#include "cache_posix.h"
+#include "catalog.h"
+#include "catalog_prefetch.h"
+#include "catalog_rw.h"
+#include "catalog_sql.h"
+#include "compression.h"
+#include "download.h"
+#include "fetch.h"
+#include "hash.h"
+#include "quota.h"
+#include "sqlitevfs.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+/**
+ * Keeps track of the pinned objects
+ */
+class RecordingQuotaManager : public NoopQuotaManager {
+ public:
+  RecordingQuotaManager() : num_catalog_pins(0) { }
+  virtual bool Pin(const shash::Any &hash, const uint64_t size,
+                   const std::string &description, const bool is_catalog)
+  {
+    if (is_catalog)
+      num_catalog_pins++;
+    pinned.insert(hash);
+    return true;
+  }
+  virtual void Unpin(const shash::Any &hash) { pinned.erase(hash); }
+
+  unsigned num_catalog_pins;
+  set<shash::Any> pinned;
+};
+
+
+class T_CatalogPrefetcher : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+    tmp_path_ = CreateTempDir(GetCurrentWorkingDirectory() +
+                              "/cvmfs_ut_catalog_prefetch");
+    ASSERT_NE("", tmp_path_);
+
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_ + "/cache", false);
+    ASSERT_TRUE(cache_mgr_ != NULL);
+    quota_mgr_ = new RecordingQuotaManager();
+    ASSERT_TRUE(cache_mgr_->AcquireQuotaManager(quota_mgr_));
+    download_mgr_ = new download::DownloadManager();
+    download_mgr_->Init(8, false, /* use_system_proxy */
+      perf::StatisticsTemplate("test", &statistics_));
+    download_mgr_->SetHostChain("file://" + tmp_path_);
+    fetcher_ = new cvmfs::Fetcher(
+      cache_mgr_, download_mgr_, &backoff_throttle_,
+      perf::StatisticsTemplate("fetch", &statistics_));
+
+    // Nested catalogs /a --> /a/b --> /a/b/c and /x
+    hash_c_ = CommitCatalog(CreateCatalog("/a/b/c"));
+    WritableCatalog *catalog = CreateCatalog("/a/b");
+    AddNested(catalog, "/a/b/c", hash_c_);
+    hash_b_ = CommitCatalog(catalog);
+    catalog = CreateCatalog("/a");
+    AddNested(catalog, "/a/b", hash_b_);
+    hash_a_ = CommitCatalog(catalog);
+    hash_x_ = CommitCatalog(CreateCatalog("/x"));
+    catalog = CreateCatalog("");
+    AddNested(catalog, "/a", hash_a_);
+    AddNested(catalog, "/x", hash_x_);
+    hash_root_ = CommitCatalog(catalog);
+    root_ = Catalog::AttachFreely("", db_paths_[hash_root_], hash_root_, NULL,
+                                  false);
+    ASSERT_TRUE(root_ != NULL);
+
+    // The prefetcher opens catalogs as @<FILE DESCRIPTOR>
+    ASSERT_TRUE(sqlite::RegisterVfsRdOnly(cache_mgr_, &statistics_,
+                                          sqlite::kVfsOptDefault));
+    prefetcher_ = new CatalogPrefetcher(fetcher_, "test", 2, 1024 * 1024);
+  }
+
+  virtual void TearDown() {
+    delete prefetcher_;
+    EXPECT_TRUE(sqlite::UnregisterVfsRdOnly());
+    delete root_;
+    delete fetcher_;
+    download_mgr_->Fini();
+    delete download_mgr_;
+    delete cache_mgr_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  WritableCatalog *CreateCatalog(const string &mountpoint) {
+    string db_file = CreateTempPath(tmp_path_ + "/catalog", 0666);
+    EXPECT_FALSE(db_file.empty());
+    DirectoryEntry root_entry =
+      DirectoryEntryTestFactory::Directory(GetFileName(mountpoint));
+    root_entry.set_is_nested_catalog_root(!mountpoint.empty());
+    {
+      UniquePtr<CatalogDatabase> db(CatalogDatabase::Create(db_file));
+      EXPECT_TRUE(db.IsValid());
+      EXPECT_TRUE(db->InsertInitialValues(mountpoint, false, "", root_entry));
+    }
+    return WritableCatalog::AttachFreely(mountpoint, db_file,
+                                         shash::Any(shash::kSha1), NULL,
+                                         !mountpoint.empty());
+  }
+
+  /**
+   * Stores the compressed catalog in the data directory of the repository
+   */
+  shash::Any CommitCatalog(WritableCatalog *catalog) {
+    string db_file = catalog->database_path();
+    if (catalog->IsDirty())
+      catalog->Commit();
+    delete catalog;
+    shash::Any hash(shash::kSha1, shash::kSuffixCatalog);
+    EXPECT_TRUE(zlib::CompressPath2Null(db_file, &hash));
+    string object_path = tmp_path_ + "/data/" + hash.MakePath();
+    EXPECT_TRUE(MkdirDeep(GetParentPath(object_path), 0700));
+    EXPECT_TRUE(zlib::CompressPath2Path(db_file, object_path));
+    db_paths_[hash] = db_file;
+    sizes_[hash] = GetFileSize(db_file);
+    return hash;
+  }
+
+  void AddNested(WritableCatalog *catalog,
+                 const string &mountpoint,
+                 const shash::Any &hash)
+  {
+    DirectoryEntry dirent = DirectoryEntryTestFactory::Directory(
+      GetFileName(mountpoint), 4096, shash::Any(), true);
+    catalog->AddEntry(dirent, XattrList(), mountpoint,
+                      GetParentPath(mountpoint));
+    catalog->InsertNestedCatalog(mountpoint, NULL, hash, sizes_[hash]);
+  }
+
+  bool IsCached(const shash::Any &hash) {
+    int fd = cache_mgr_->Open(CacheManager::Bless(hash));
+    if (fd < 0)
+      return false;
+    cache_mgr_->Close(fd);
+    return true;
+  }
+
+  /**
+   * The job type is private to the prefetcher and named by the tests
+   */
+  template <class JobT>
+  JobT MakeJob(const string &mountpoint, const shash::Any &hash) {
+    JobT job;
+    job.mountpoint = PathString(mountpoint);
+    job.hash = hash;
+    job.size = sizes_[hash];
+    return job;
+  }
+
+ protected:
+  unsigned used_fds_;
+  string tmp_path_;
+  PosixCacheManager *cache_mgr_;
+  RecordingQuotaManager *quota_mgr_;
+  perf::Statistics statistics_;
+  download::DownloadManager *download_mgr_;
+  BackoffThrottle backoff_throttle_;
+  cvmfs::Fetcher *fetcher_;
+  CatalogPrefetcher *prefetcher_;
+  Catalog *root_;
+  map<shash::Any, string> db_paths_;
+  map<shash::Any, uint64_t> sizes_;
+  shash::Any hash_root_;
+  shash::Any hash_a_;
+  shash::Any hash_b_;
+  shash::Any hash_c_;
+  shash::Any hash_x_;
+};
+
+
+TEST_F(T_CatalogPrefetcher, Hints) {
+  EXPECT_TRUE(prefetcher_->IsHinted(PathString("/any/path")));
+  EXPECT_FALSE(prefetcher_->LoadHints(tmp_path_ + "/no_such_file"));
+
+  string hints_path = tmp_path_ + "/hints";
+  string hints = "# comment\n\n  /sw/lib/  \n/data\n";
+  ASSERT_TRUE(SafeWriteToFile(hints, hints_path, 0600));
+  EXPECT_TRUE(prefetcher_->LoadHints(hints_path));
+  EXPECT_EQ(2U, prefetcher_->hints_.size());
+
+  // On the way to a hinted path
+  EXPECT_TRUE(prefetcher_->IsHinted(PathString("/sw")));
+  EXPECT_TRUE(prefetcher_->IsHinted(PathString("/sw/lib")));
+  // Below a hinted path
+  EXPECT_TRUE(prefetcher_->IsHinted(PathString("/sw/lib/x86_64")));
+  EXPECT_TRUE(prefetcher_->IsHinted(PathString("/data/run1")));
+  // Elsewhere
+  EXPECT_FALSE(prefetcher_->IsHinted(PathString("/sw/bin")));
+  EXPECT_FALSE(prefetcher_->IsHinted(PathString("/swap")));
+  EXPECT_FALSE(prefetcher_->IsHinted(PathString("/database")));
+}
+
+
+TEST_F(T_CatalogPrefetcher, Prefetch) {
+  // Stops at the maximum depth
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/a", hash_a_), 1);
+  EXPECT_TRUE(IsCached(hash_a_));
+  EXPECT_TRUE(IsCached(hash_b_));
+  EXPECT_FALSE(IsCached(hash_c_));
+  EXPECT_EQ(sizes_[hash_a_] + sizes_[hash_b_],
+            prefetcher_->bytes_prefetched());
+  // Stored as catalogs, the pins of the downloads are released
+  EXPECT_EQ(2U, quota_mgr_->num_catalog_pins);
+  EXPECT_TRUE(quota_mgr_->pinned.empty());
+
+  // Cached catalogs are traversed but not downloaded again, a pinned one, such
+  // as a mounted catalog, remains pinned
+  delete prefetcher_;
+  prefetcher_ = new CatalogPrefetcher(fetcher_, "test", 3, 1024 * 1024);
+  quota_mgr_->pinned.insert(hash_a_);
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/a", hash_a_), 1);
+  EXPECT_TRUE(IsCached(hash_c_));
+  EXPECT_EQ(sizes_[hash_c_], prefetcher_->bytes_prefetched());
+  EXPECT_EQ(3U, quota_mgr_->num_catalog_pins);
+  EXPECT_EQ(1U, quota_mgr_->pinned.size());
+  EXPECT_EQ(1U, quota_mgr_->pinned.count(hash_a_));
+
+  // Missing catalogs are skipped
+  shash::Any hash_missing(shash::kSha1, shash::kSuffixCatalog);
+  hash_missing.Randomize();
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/y", hash_missing), 1);
+  EXPECT_FALSE(IsCached(hash_missing));
+  EXPECT_EQ(sizes_[hash_c_], prefetcher_->bytes_prefetched());
+}
+
+
+TEST_F(T_CatalogPrefetcher, Budget) {
+  delete prefetcher_;
+  prefetcher_ = new CatalogPrefetcher(fetcher_, "test", 3,
+                                      sizes_[hash_a_] - 1);
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/a", hash_a_), 1);
+  EXPECT_FALSE(IsCached(hash_a_));
+  EXPECT_EQ(0U, prefetcher_->bytes_prefetched());
+
+  delete prefetcher_;
+  prefetcher_ = new CatalogPrefetcher(fetcher_, "test", 3, sizes_[hash_a_]);
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/a", hash_a_), 1);
+  EXPECT_TRUE(IsCached(hash_a_));
+  EXPECT_FALSE(IsCached(hash_b_));
+  EXPECT_EQ(sizes_[hash_a_], prefetcher_->bytes_prefetched());
+
+  // Attaching a root catalog resets the budget
+  prefetcher_->Schedule(root_);
+  EXPECT_EQ(0U, prefetcher_->bytes_prefetched());
+  prefetcher_->Prefetch(MakeJob<CatalogPrefetcher::Job>("/a", hash_a_), 1);
+  EXPECT_TRUE(IsCached(hash_b_));
+  EXPECT_EQ(sizes_[hash_b_], prefetcher_->bytes_prefetched());
+}
+
+
+TEST_F(T_CatalogPrefetcher, Schedule) {
+  prefetcher_->Schedule(root_);
+  EXPECT_EQ(2U, prefetcher_->jobs_.GetItemCount());
+  while (!prefetcher_->jobs_.IsEmpty())
+    delete prefetcher_->jobs_.Dequeue();
+
+  // Only the nested catalogs on the way to the hinted path
+  string hints_path = tmp_path_ + "/hints";
+  ASSERT_TRUE(SafeWriteToFile("/a/b\n", hints_path, 0600));
+  EXPECT_TRUE(prefetcher_->LoadHints(hints_path));
+  prefetcher_->Schedule(root_);
+  EXPECT_EQ(1U, prefetcher_->jobs_.GetItemCount());
+
+  prefetcher_->Spawn();
+  const uint64_t expected = sizes_[hash_a_] + sizes_[hash_b_];
+  for (unsigned i = 0; i < 100; ++i) {
+    if (prefetcher_->bytes_prefetched() == expected)
+      break;
+    SafeSleepMs(50);
+  }
+  EXPECT_EQ(expected, prefetcher_->bytes_prefetched());
+  delete prefetcher_;
+  prefetcher_ = NULL;
+  EXPECT_TRUE(IsCached(hash_a_));
+  EXPECT_TRUE(IsCached(hash_b_));
+  EXPECT_FALSE(IsCached(hash_c_));
+  EXPECT_FALSE(IsCached(hash_x_));
+}
+
+}  // namespace catalog
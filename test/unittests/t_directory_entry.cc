@@ -0,0 +1,66 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "directory_entry.h"
+#include "hash.h"
+#include "testutil.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+static void ExpectPackedEqual(const DirectoryEntry &dirent) {
+  PackedDirectoryEntry packed(dirent);
+  DirectoryEntry unpacked;
+  packed.Unpack(&unpacked);
+  EXPECT_TRUE(dirent == unpacked);
+  EXPECT_EQ(dirent.inode(), unpacked.inode());
+  EXPECT_EQ(dirent.checksum(), unpacked.checksum());
+  EXPECT_EQ(dirent.IsExternalFile(), unpacked.IsExternalFile());
+  EXPECT_EQ(dirent.IsNegative(), unpacked.IsNegative());
+  EXPECT_EQ(dirent.IsNegative(), packed.IsNegative());
+
+  PackedDirectoryEntry copy(packed);
+  PackedDirectoryEntry assigned;
+  assigned = copy;
+  copy = PackedDirectoryEntry();
+  DirectoryEntry unpacked_assigned;
+  assigned.Unpack(&unpacked_assigned);
+  EXPECT_TRUE(dirent == unpacked_assigned);
+}
+
+
+TEST(T_DirectoryEntry, Packed) {
+  EXPECT_LT(sizeof(PackedDirectoryEntry), sizeof(DirectoryEntry));
+
+  shash::Any hash(shash::kRmd160, shash::kSuffixCatalog);
+  hash.Randomize();
+  DirectoryEntry regular = DirectoryEntryTestFactory::RegularFile("file", 42,
+                                                                  hash);
+  regular.set_inode(1000);
+  regular.set_hardlink_group(3);
+  regular.set_linkcount(2);
+  regular.set_has_xattrs(true);
+  ExpectPackedEqual(regular);
+
+  ExpectPackedEqual(DirectoryEntryTestFactory::Directory("dir", 4096,
+                                                         shash::Any(), true));
+  ExpectPackedEqual(DirectoryEntryTestFactory::Symlink("link", 0, "target"));
+  ExpectPackedEqual(DirectoryEntryTestFactory::ChunkedFile(hash));
+  ExpectPackedEqual(DirectoryEntryTestFactory::ExternalFile());
+  ExpectPackedEqual(DirectoryEntry(kDirentNegative));
+  ExpectPackedEqual(DirectoryEntry());
+
+  // Name and symlink exceed the inline buffer
+  ExpectPackedEqual(DirectoryEntryTestFactory::Symlink(
+    string(PackedDirectoryEntry::kInlineNamesSize, 'n'), 0,
+    string(1000, 't')));
+  ExpectPackedEqual(DirectoryEntryTestFactory::RegularFile(string(255, 'x')));
+}
+
+}  // namespace catalog
@@ -0,0 +1,179 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "cache_plugin/disk_cache.h"
+#include "cache_plugin/libcvmfs_cache.h"
+#include "testutil.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+class T_DiskCache : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+    tmp_path_ = CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_disk");
+    cache_dir_ = tmp_path_ + "/cache";
+    plugin_ = PluginDiskCache::Create(cache_dir_, "64");
+    ASSERT_TRUE(plugin_ != NULL);
+    memset(&id_, 0, sizeof(id_));
+    id_.digest[0] = 1;
+    id_.algorithm = 1;
+    content_ = string(10000, 'x');
+    next_txn_id_ = 0;
+  }
+
+  virtual void TearDown() {
+    delete plugin_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  void Restart() {
+    delete plugin_;
+    plugin_ = PluginDiskCache::Create(cache_dir_, "64");
+    ASSERT_TRUE(plugin_ != NULL);
+  }
+
+  void StoreUnpinned(struct cvmcache_hash *id, const string &content) {
+    struct cvmcache_object_info info;
+    memset(&info, 0, sizeof(info));
+    info.size = content.length();
+    info.type = CVMCACHE_OBJECT_REGULAR;
+    uint64_t txn_id = next_txn_id_++;
+    ASSERT_EQ(CVMCACHE_STATUS_OK,
+              PluginDiskCache::disk_start_txn(id, txn_id, &info));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_write_txn(txn_id,
+      reinterpret_cast<unsigned char *>(const_cast<char *>(content.data())),
+      content.length()));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_commit_txn(txn_id));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_chrefcnt(id, -1));
+  }
+
+  string Read(struct cvmcache_hash *id) {
+    string buf(content_.length(), '\0');
+    uint32_t size = buf.length();
+    int retval = PluginDiskCache::disk_pread(id, 0, &size,
+      reinterpret_cast<unsigned char *>(&buf[0]));
+    if (retval != CVMCACHE_STATUS_OK)
+      return "";
+    buf.resize(size);
+    return buf;
+  }
+
+  uint64_t GetUsedBytes() {
+    struct cvmcache_info info;
+    EXPECT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_info(&info));
+    return info.used_bytes;
+  }
+
+  void WriteIndex(off_t offset, const void *buf, size_t size) {
+    int fd = open((cache_dir_ + "/index").c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(static_cast<ssize_t>(size), pwrite(fd, buf, size, offset));
+    close(fd);
+  }
+
+  PluginDiskCache *plugin_;
+  struct cvmcache_hash id_;
+  string content_;
+  uint64_t next_txn_id_;
+  unsigned used_fds_;
+  string tmp_path_;
+  string cache_dir_;
+};
+
+
+TEST_F(T_DiskCache, Persistence) {
+  StoreUnpinned(&id_, content_);
+  EXPECT_EQ(content_, Read(&id_));
+  EXPECT_EQ(content_.length(), GetUsedBytes());
+
+  Restart();
+  EXPECT_EQ(content_, Read(&id_));
+  EXPECT_EQ(content_.length(), GetUsedBytes());
+  struct cvmcache_object_info info;
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_obj_info(&id_, &info));
+  EXPECT_EQ(0, info.pinned);
+
+  // The space of the loaded object is claimed in the allocator
+  struct cvmcache_hash id2 = id_;
+  id2.digest[0] = 2;
+  StoreUnpinned(&id2, string(content_.length(), 'y'));
+  EXPECT_EQ(content_, Read(&id_));
+  EXPECT_EQ(string(content_.length(), 'y'), Read(&id2));
+}
+
+
+TEST_F(T_DiskCache, UncleanShutdown) {
+  StoreUnpinned(&id_, content_);
+  delete plugin_;
+  plugin_ = NULL;
+
+  uint32_t clean = 0;
+  WriteIndex(offsetof(IndexHeader, clean), &clean, sizeof(clean));
+  Restart();
+  EXPECT_EQ(CVMCACHE_STATUS_NOENTRY,
+            PluginDiskCache::disk_chrefcnt(&id_, 1));
+  EXPECT_EQ(0U, GetUsedBytes());
+
+  // The index is rebuilt from scratch and usable
+  StoreUnpinned(&id_, content_);
+  Restart();
+  EXPECT_EQ(content_, Read(&id_));
+}
+
+
+TEST_F(T_DiskCache, ChangedGeometry) {
+  StoreUnpinned(&id_, content_);
+  delete plugin_;
+  plugin_ = PluginDiskCache::Create(cache_dir_, "128");
+  ASSERT_TRUE(plugin_ != NULL);
+  EXPECT_EQ(CVMCACHE_STATUS_NOENTRY,
+            PluginDiskCache::disk_chrefcnt(&id_, 1));
+  EXPECT_EQ(0U, GetUsedBytes());
+}
+
+
+TEST_F(T_DiskCache, CorruptedIndex) {
+  StoreUnpinned(&id_, content_);
+  delete plugin_;
+  plugin_ = NULL;
+
+  // The first object takes the first index slot
+  off_t pos_entry = sizeof(IndexHeader);
+  uint8_t size_class = 9;
+  WriteIndex(pos_entry + offsetof(IndexEntry, size_class),
+             &size_class, sizeof(size_class));
+
+  Restart();
+  EXPECT_EQ(CVMCACHE_STATUS_NOENTRY,
+            PluginDiskCache::disk_chrefcnt(&id_, 1));
+  EXPECT_EQ(0U, GetUsedBytes());
+  StoreUnpinned(&id_, content_);
+  EXPECT_EQ(content_, Read(&id_));
+}
+
+
+TEST_F(T_DiskCache, PinnedObjectsNotPersistent) {
+  StoreUnpinned(&id_, content_);
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_chrefcnt(&id_, 1));
+  Restart();
+  struct cvmcache_object_info info;
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginDiskCache::disk_obj_info(&id_, &info));
+  EXPECT_EQ(0, info.pinned);
+  EXPECT_EQ(CVMCACHE_STATUS_BADCOUNT,
+            PluginDiskCache::disk_chrefcnt(&id_, -1));
+}
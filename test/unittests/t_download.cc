@@ -4,18 +4,30 @@
 
 #include "gtest/gtest.h"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "compression.h"
 #include "download.h"
 #include "hash.h"
+#include "manifest_fetch.h"
 #include "prng.h"
 #include "sink.h"
 #include "statistics.h"
 #include "util/file_guard.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -80,6 +92,73 @@ class TestSink : public cvmfs::Sink {
 };
 
 
+/**
+ * Answers the HTTP requests on a local port with the given replies, one
+ * connection per reply, and records the request headers.
+ */
+class MockHttpServer {
+ public:
+  explicit MockHttpServer(const vector<string> &replies)
+    : replies_(replies), port_(0)
+  {
+    fd_listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd_listen_ >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int retval = bind(fd_listen_, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr));
+    assert(retval == 0);
+    socklen_t addr_len = sizeof(addr);
+    retval = getsockname(fd_listen_, reinterpret_cast<struct sockaddr *>(&addr),
+                         &addr_len);
+    assert(retval == 0);
+    port_ = ntohs(addr.sin_port);
+    retval = listen(fd_listen_, 5);
+    assert(retval == 0);
+    retval = pthread_create(&thread_, NULL, MainServer, this);
+    assert(retval == 0);
+  }
+
+  ~MockHttpServer() {
+    pthread_join(thread_, NULL);
+    close(fd_listen_);
+  }
+
+  string url() const { return "http://127.0.0.1:" + StringifyInt(port_); }
+
+  vector<string> requests;
+
+ private:
+  static void *MainServer(void *data) {
+    MockHttpServer *server = reinterpret_cast<MockHttpServer *>(data);
+    for (unsigned i = 0; i < server->replies_.size(); ++i) {
+      int fd_con = accept(server->fd_listen_, NULL, NULL);
+      assert(fd_con >= 0);
+      string request;
+      char c;
+      while ((request.find("\r\n\r\n") == string::npos) &&
+             (read(fd_con, &c, 1) == 1))
+      {
+        request.push_back(c);
+      }
+      server->requests.push_back(request);
+      SafeWrite(fd_con, server->replies_[i].data(),
+                server->replies_[i].length());
+      close(fd_con);
+    }
+    return NULL;
+  }
+
+  vector<string> replies_;
+  int fd_listen_;
+  int port_;
+  pthread_t thread_;
+};
+
+
 //------------------------------------------------------------------------------
 
 
@@ -291,6 +370,522 @@ TEST_F(T_Download, ValidateGeoReply) {
 }
 
 
+TEST_F(T_Download, ProxyScores) {
+  const time_t now = time(NULL);
+  DownloadManager::ProxyInfo fast("http://fast:3128");
+  DownloadManager::ProxyInfo slow("http://slow:3128");
+  DownloadManager::ProxyInfo unknown("http://unknown:3128");
+  EXPECT_FALSE(fast.HasScore(now));
+  fast.AddSample(10.0, -1.0, now);
+  EXPECT_TRUE(fast.HasScore(now));
+  EXPECT_FALSE(fast.HasScore(now + DownloadManager::kProxyScoreTtl));
+  EXPECT_FLOAT_EQ(10.0, fast.GetScore());
+  fast.AddSample(10.0, 1024.0 * 1024.0, now);
+  EXPECT_FLOAT_EQ(10.0 + 250.0, fast.GetScore());
+  for (unsigned i = 0; i < 10; ++i)
+    slow.AddSample(500.0, 1024.0 * 1024.0, now);
+  EXPECT_GT(slow.GetScore(), fast.GetScore());
+
+  vector<DownloadManager::ProxyInfo> group;
+  group.push_back(slow);
+  group.push_back(fast);
+  for (unsigned i = 0; i < 100; ++i)
+    EXPECT_EQ(1U, download_mgr.SelectProxyUnlocked(group, 2));
+  EXPECT_EQ(0U, download_mgr.SelectProxyUnlocked(group, 1));
+
+  // The slowest proxy loses every comparison, unmeasured proxies are probed
+  group.push_back(unknown);
+  unsigned num_selected[3] = {0, 0, 0};
+  for (unsigned i = 0; i < 300; ++i)
+    num_selected[download_mgr.SelectProxyUnlocked(group, 3)]++;
+  EXPECT_EQ(0U, num_selected[0]);
+  EXPECT_GT(num_selected[1], 0U);
+  EXPECT_GT(num_selected[2], num_selected[1]);
+}
+
+
+TEST_F(T_Download, ProxyPenalty) {
+  download_mgr.SetTimeout(7, 7);
+  download_mgr.SetProxyChain("http://127.0.0.1:3128|http://127.0.0.2:3128",
+                             "", DownloadManager::kSetProxyRegular);
+  const vector<DownloadManager::ProxyInfo> &group =
+    (*download_mgr.opt_proxy_groups_)[0];
+  ASSERT_EQ(2U, group.size());
+  const time_t now = time(NULL);
+  CURL *handle = curl_easy_init();
+  ASSERT_TRUE(handle != NULL);
+
+  JobInfo info(&foo_url, false, false, NULL);
+  info.proxy = group[1].url;
+  download_mgr.UpdateStatistics(handle, CURLE_COULDNT_CONNECT, &info);
+  EXPECT_TRUE(group[1].HasScore(now));
+  EXPECT_FLOAT_EQ(7000.0, group[1].GetScore());
+  EXPECT_FALSE(group[0].HasScore(now));
+
+  // Errors of the host do not count against the proxy
+  info.proxy = group[0].url;
+  info.error_code = kFailHostHttp;
+  download_mgr.UpdateStatistics(handle, CURLE_WRITE_ERROR, &info);
+  EXPECT_FALSE(group[0].HasScore(now));
+  info.error_code = kFailProxyHttp;
+  download_mgr.UpdateStatistics(handle, CURLE_WRITE_ERROR, &info);
+  EXPECT_TRUE(group[0].HasScore(now));
+  EXPECT_FLOAT_EQ(7000.0, group[0].GetScore());
+
+  info.proxy = "DIRECT";
+  download_mgr.UpdateStatistics(handle, CURLE_COULDNT_CONNECT, &info);
+  EXPECT_EQ(1U, group[0].num_samples);
+  EXPECT_EQ(1U, group[1].num_samples);
+  curl_easy_cleanup(handle);
+}
+
+
+TEST_F(T_Download, HedgeDelay) {
+  const unsigned default_delay = DownloadManager::kHedgeDefaultDelayMs;
+  const unsigned min_delay = DownloadManager::kHedgeMinDelayMs;
+  const unsigned num_samples = DownloadManager::kHedgeNumSamples;
+  EXPECT_EQ(default_delay, download_mgr.hedge_delay_ms_);
+
+  // Too few samples keep the default
+  for (unsigned i = 0; i < num_samples / 4 - 1; ++i)
+    download_mgr.AddHedgeSampleUnlocked(1);
+  EXPECT_EQ(default_delay, download_mgr.hedge_delay_ms_);
+  download_mgr.AddHedgeSampleUnlocked(1);
+  EXPECT_EQ(min_delay, download_mgr.hedge_delay_ms_);
+
+  // 1% of slow transfers does not move the delay, 10% does
+  for (unsigned i = 0; i < num_samples; ++i)
+    download_mgr.AddHedgeSampleUnlocked((i % 100 == 0) ? 5000 : 100);
+  EXPECT_EQ(100U, download_mgr.hedge_delay_ms_);
+  for (unsigned i = 0; i < num_samples; ++i)
+    download_mgr.AddHedgeSampleUnlocked((i % 10 == 0) ? 5000 : 100);
+  EXPECT_EQ(5000U, download_mgr.hedge_delay_ms_);
+}
+
+
+/**
+ * Runs the transfers of the multi handle until one of them completes.
+ */
+static int PerformUntilDone(CURLM *multi, CURL **done_handle) {
+  int still_running = 1;
+  while (still_running > 0) {
+    curl_multi_perform(multi, &still_running);
+    int msgs_in_queue;
+    CURLMsg *curl_msg = curl_multi_info_read(multi, &msgs_in_queue);
+    if ((curl_msg != NULL) && (curl_msg->msg == CURLMSG_DONE)) {
+      *done_handle = curl_msg->easy_handle;
+      curl_multi_remove_handle(multi, *done_handle);
+      return curl_msg->data.result;
+    }
+    curl_multi_wait(multi, NULL, 0, 100, NULL);
+  }
+  return -1;
+}
+
+
+/**
+ * Two file:// hosts; the hedged requests go to the second one.
+ */
+static void CreateHedgeHosts(const string &base_dir,
+                             DownloadManager *download_mgr)
+{
+  ASSERT_TRUE(MkdirDeep(base_dir + "/primary", 0700, true));
+  ASSERT_TRUE(MkdirDeep(base_dir + "/backup", 0700, true));
+  ASSERT_TRUE(SafeWriteToFile("backup data", base_dir + "/backup/data",
+                              0600));
+  download_mgr->SetHostChain("file://" + base_dir + "/primary;" +
+                             "file://" + base_dir + "/backup");
+}
+
+
+TEST_F(T_Download, IssueHedge) {
+  const string base_dir = CreateTempDir(GetCurrentWorkingDirectory() +
+                                        "/cvmfs_ut_hedge");
+  ASSERT_FALSE(base_dir.empty());
+  const string url = "/data";
+
+  // Without a second host, there is no alternative route
+  JobInfo info(&url, false, true, NULL);
+  download_mgr.SetHostChain("file://" + base_dir + "/primary");
+  EXPECT_FALSE(download_mgr.IssueHedge(&info));
+
+  CreateHedgeHosts(base_dir, &download_mgr);
+  JobInfo info_prefetch(&url, false, true, NULL);
+  info_prefetch.priority = kPriorityPrefetch;
+  EXPECT_FALSE(download_mgr.IssueHedge(&info_prefetch));
+  string etag = "\"v1\"";
+  JobInfo info_conditional(&url, false, true, NULL);
+  info_conditional.etag = &etag;
+  EXPECT_FALSE(download_mgr.IssueHedge(&info_conditional));
+  JobInfo info_fixed_host(&url, false, false, NULL);
+  EXPECT_FALSE(download_mgr.IssueHedge(&info_fixed_host));
+  EXPECT_EQ(0, statistics.Lookup("test.n_hedged_requests")->Get());
+
+  EXPECT_TRUE(download_mgr.IssueHedge(&info));
+  ASSERT_TRUE(info.hedge != NULL);
+  EXPECT_EQ(&info, info.hedge->hedge);
+  EXPECT_TRUE(info.hedge->is_hedge);
+  EXPECT_EQ(kDestinationMem, info.hedge->destination);
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedged_requests")->Get());
+  download_mgr.CancelHedge(&info);
+  EXPECT_TRUE(RemoveTree(base_dir));
+}
+
+
+TEST_F(T_Download, FinalizeHedge) {
+  const string base_dir = CreateTempDir(GetCurrentWorkingDirectory() +
+                                        "/cvmfs_ut_hedge");
+  ASSERT_FALSE(base_dir.empty());
+  CreateHedgeHosts(base_dir, &download_mgr);
+  const string url = "/data";
+
+  // The primary request stalls, the duplicate from the backup host wins.  The
+  // memory of the original job is replaced by a buffer of the replayed size.
+  JobInfo info(&url, false, true, NULL);
+  CURL *handle = download_mgr.AcquireCurlHandle();
+  download_mgr.InitializeRequest(&info, handle);
+  download_mgr.SetUrlOptions(&info);
+  info.destination_mem.data = static_cast<char *>(smalloc(1));
+  info.destination_mem.size = 1;
+  ASSERT_TRUE(download_mgr.IssueHedge(&info));
+  JobInfo *hedge = info.hedge;
+  CURL *done_handle = NULL;
+  int curl_error = PerformUntilDone(download_mgr.curl_multi_, &done_handle);
+  EXPECT_EQ(CURLE_OK, curl_error);
+  EXPECT_EQ(hedge->curl_handle, done_handle);
+  int primary_curl_error = -1;
+  EXPECT_EQ(&info, download_mgr.FinalizeHedge(hedge, curl_error,
+                                              &primary_curl_error));
+  EXPECT_EQ(CURLE_OK, primary_curl_error);
+  EXPECT_TRUE(info.hedge == NULL);
+  EXPECT_EQ(11U, info.destination_mem.size);
+  EXPECT_EQ(11U, info.destination_mem.pos);
+  EXPECT_EQ("backup data", string(info.destination_mem.data,
+                                  info.destination_mem.pos));
+  EXPECT_FALSE(download_mgr.VerifyAndFinalize(primary_curl_error, &info));
+  EXPECT_EQ(kFailOk, info.error_code);
+  download_mgr.ReleaseCurlHandle(handle);
+  free(info.destination_mem.data);
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedged_won")->Get());
+
+  // A failed duplicate leaves the original transfer alone
+  EXPECT_EQ(0, unlink((base_dir + "/backup/data").c_str()));
+  JobInfo info_lost(&url, false, true, NULL);
+  handle = download_mgr.AcquireCurlHandle();
+  download_mgr.InitializeRequest(&info_lost, handle);
+  download_mgr.SetUrlOptions(&info_lost);
+  ASSERT_TRUE(download_mgr.IssueHedge(&info_lost));
+  hedge = info_lost.hedge;
+  curl_error = PerformUntilDone(download_mgr.curl_multi_, &done_handle);
+  EXPECT_NE(CURLE_OK, curl_error);
+  EXPECT_EQ(hedge->curl_handle, done_handle);
+  primary_curl_error = -1;
+  EXPECT_EQ(NULL, download_mgr.FinalizeHedge(hedge, curl_error,
+                                             &primary_curl_error));
+  EXPECT_EQ(-1, primary_curl_error);
+  EXPECT_TRUE(info_lost.hedge == NULL);
+  EXPECT_EQ(0U, info_lost.destination_mem.pos);
+  EXPECT_EQ(1, statistics.Lookup("test.n_hedged_won")->Get());
+  download_mgr.header_lists_->PutList(info_lost.headers);
+  download_mgr.ReleaseCurlHandle(handle);
+  EXPECT_TRUE(RemoveTree(base_dir));
+}
+
+
+TEST_F(T_Download, CancelHedge) {
+  const string base_dir = CreateTempDir(GetCurrentWorkingDirectory() +
+                                        "/cvmfs_ut_hedge");
+  ASSERT_FALSE(base_dir.empty());
+  CreateHedgeHosts(base_dir, &download_mgr);
+  const string url = "/data";
+
+  JobInfo info(&url, false, true, NULL);
+  const size_t num_handles = download_mgr.pool_handles_inuse_->size();
+  ASSERT_TRUE(download_mgr.IssueHedge(&info));
+  EXPECT_EQ(num_handles + 1, download_mgr.pool_handles_inuse_->size());
+  download_mgr.CancelHedge(&info);
+  EXPECT_TRUE(info.hedge == NULL);
+  EXPECT_EQ(num_handles, download_mgr.pool_handles_inuse_->size());
+
+  // Nothing is left to complete on the multi handle
+  int still_running = -1;
+  curl_multi_perform(download_mgr.curl_multi_, &still_running);
+  EXPECT_EQ(0, still_running);
+  EXPECT_EQ(0, statistics.Lookup("test.n_hedged_won")->Get());
+  EXPECT_TRUE(RemoveTree(base_dir));
+}
+
+
+TEST_F(T_Download, PriorityLimits) {
+  const unsigned max_background =
+    DownloadManager::kDefaultMaxBackgroundTransfers;
+  EXPECT_EQ(0U, download_mgr.priority_classes_[kPriorityInteractive]
+                .max_transfers);
+  EXPECT_EQ(max_background,
+            download_mgr.priority_classes_[kPriorityBulk].max_transfers);
+
+  download_mgr.SetPriorityLimits(kPriorityBulk, 1, 1024 * 1024);
+  DownloadManager *download_mgr_cloned = download_mgr.Clone(
+    perf::StatisticsTemplate("x", &statistics));
+  EXPECT_EQ(1U, download_mgr_cloned->priority_classes_[kPriorityBulk]
+                .max_transfers);
+  EXPECT_EQ(1024U * 1024U,
+            download_mgr_cloned->priority_classes_[kPriorityBulk].bucket.rate);
+  download_mgr_cloned->Fini();
+  delete download_mgr_cloned;
+
+  // The first refill fills the burst, later refills add tokens at the rate
+  TokenBucket *bucket = &download_mgr.priority_classes_[kPriorityBulk].bucket;
+  bucket->Refill(1000);
+  EXPECT_EQ(256 * 1024, bucket->tokens);
+  bucket->tokens = -1000;
+  bucket->Refill(1000);
+  EXPECT_EQ(-1000, bucket->tokens);
+  bucket->Refill(1001);
+  EXPECT_EQ(-1000 + 1048, bucket->tokens);
+  bucket->Refill(2001);
+  EXPECT_EQ(256 * 1024, bucket->tokens);
+
+  // Slow rates accumulate over several refills
+  bucket->rate = 100;
+  bucket->tokens = 0;
+  bucket->Refill(2005);
+  EXPECT_EQ(0, bucket->tokens);
+  bucket->Refill(2011);
+  EXPECT_EQ(1, bucket->tokens);
+  bucket->Refill(1000000);
+  EXPECT_EQ(CURL_MAX_WRITE_SIZE, bucket->tokens);
+}
+
+
+/**
+ * Records the order in which the I/O thread delivers data to the sinks of
+ * several transfers.
+ */
+class RecordingSink : public cvmfs::Sink {
+ public:
+  RecordingSink(const int id, vector<int> *log, pthread_mutex_t *lock)
+    : id_(id), num_bytes_(0), log_(log), lock_(lock) { }
+  virtual int64_t Write(const void *buf, uint64_t size) {
+    pthread_mutex_lock(lock_);
+    log_->push_back(id_);
+    num_bytes_ += size;
+    pthread_mutex_unlock(lock_);
+    return size;
+  }
+  virtual int Reset() {
+    num_bytes_ = 0;
+    return 0;
+  }
+  uint64_t num_bytes() const { return num_bytes_; }
+
+ private:
+  int id_;
+  uint64_t num_bytes_;
+  vector<int> *log_;
+  pthread_mutex_t *lock_;
+};
+
+
+struct PriorityFetch {
+  DownloadManager *download_mgr;
+  string url;
+  Priority priority;
+  RecordingSink *sink;
+  int id;
+  vector<int> *finished;
+  pthread_mutex_t *lock;
+  Failures result;
+};
+
+
+static void *MainPriorityFetch(void *data) {
+  PriorityFetch *fetch = reinterpret_cast<PriorityFetch *>(data);
+  JobInfo info(&fetch->url, false, false, fetch->sink, NULL);
+  info.priority = fetch->priority;
+  fetch->result = fetch->download_mgr->Fetch(&info);
+  pthread_mutex_lock(fetch->lock);
+  fetch->finished->push_back(fetch->id);
+  pthread_mutex_unlock(fetch->lock);
+  return NULL;
+}
+
+
+static uint64_t NowMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+
+TEST_F(T_Download, PriorityScheduling) {
+  const unsigned kNumBulk = 3;
+  const unsigned kBulkSize = 128 * 1024;
+  const unsigned kRate = 512 * 1024;
+  const int kIdInteractive = 100;
+  download_mgr.SetPriorityLimits(kPriorityBulk, 1, kRate);
+  download_mgr.Spawn();
+
+  // curl cannot pause local files, so the throttled transfers use HTTP
+  vector<string> replies;
+  for (unsigned i = 0; i < kNumBulk; ++i) {
+    replies.push_back("HTTP/1.1 200 OK\r\n"
+                      "Content-Length: " + StringifyInt(kBulkSize) + "\r\n"
+                      "Connection: close\r\n\r\n" +
+                      string(kBulkSize, 'a' + i));
+  }
+  MockHttpServer server(replies);
+
+  vector<int> log;
+  vector<int> finished;
+  pthread_mutex_t lock;
+  pthread_mutex_init(&lock, NULL);
+
+  const uint64_t timestamp_start = NowMs();
+  PriorityFetch fetches[kNumBulk];
+  RecordingSink *sinks[kNumBulk];
+  pthread_t threads[kNumBulk];
+  for (unsigned i = 0; i < kNumBulk; ++i) {
+    sinks[i] = new RecordingSink(i, &log, &lock);
+    fetches[i].download_mgr = &download_mgr;
+    fetches[i].url = server.url() + "/bulk" + StringifyInt(i);
+    fetches[i].priority = kPriorityBulk;
+    fetches[i].sink = sinks[i];
+    fetches[i].id = i;
+    fetches[i].finished = &finished;
+    fetches[i].lock = &lock;
+    fetches[i].result = kFailOther;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainPriorityFetch,
+                                &fetches[i]));
+  }
+
+  // An interactive request is neither queued nor throttled behind bulk ones
+  bool bulk_started = false;
+  while (!bulk_started) {
+    SafeSleepMs(1);
+    pthread_mutex_lock(&lock);
+    bulk_started = !log.empty();
+    pthread_mutex_unlock(&lock);
+  }
+  const string content_interactive(1024, 'i');
+  EXPECT_EQ(static_cast<int64_t>(content_interactive.length()),
+            fwrite(content_interactive.data(), 1, content_interactive.length(),
+                   ffoo));
+  fflush(ffoo);
+  RecordingSink sink_interactive(kIdInteractive, &log, &lock);
+  PriorityFetch fetch_interactive;
+  fetch_interactive.download_mgr = &download_mgr;
+  fetch_interactive.url = foo_url;
+  fetch_interactive.priority = kPriorityInteractive;
+  fetch_interactive.sink = &sink_interactive;
+  fetch_interactive.id = kIdInteractive;
+  fetch_interactive.finished = &finished;
+  fetch_interactive.lock = &lock;
+  MainPriorityFetch(&fetch_interactive);
+  EXPECT_EQ(kFailOk, fetch_interactive.result);
+  EXPECT_EQ(content_interactive.length(), sink_interactive.num_bytes());
+
+  for (unsigned i = 0; i < kNumBulk; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(kFailOk, fetches[i].result);
+    EXPECT_EQ(kBulkSize, sinks[i]->num_bytes());
+    delete sinks[i];
+  }
+  const uint64_t duration_ms = NowMs() - timestamp_start;
+
+  // The bulk transfers were paused and resumed according to the rate, apart
+  // from the initial burst of tokens
+  const uint64_t min_duration_ms =
+    (kNumBulk * kBulkSize - kRate / 4) * 1000 / kRate;
+  EXPECT_GE(duration_ms, min_duration_ms * 3 / 4);
+
+  ASSERT_EQ(kNumBulk + 1, finished.size());
+  EXPECT_NE(kIdInteractive, finished[kNumBulk]);
+
+  // At most one bulk transfer at a time: the data of a bulk transfer arrives
+  // in a single run
+  set<int> done;
+  int current = -1;
+  for (unsigned i = 0; i < log.size(); ++i) {
+    if ((log[i] == kIdInteractive) || (log[i] == current))
+      continue;
+    EXPECT_EQ(0U, done.count(log[i])) << "interleaved transfer " << log[i];
+    if (current >= 0)
+      done.insert(current);
+    current = log[i];
+  }
+  EXPECT_EQ(kNumBulk - 1, done.size());
+
+  // Local files bypass the token bucket
+  RecordingSink sink_local(0, &log, &lock);
+  PriorityFetch fetch_local;
+  fetch_local.download_mgr = &download_mgr;
+  fetch_local.url = foo_url;
+  fetch_local.priority = kPriorityBulk;
+  fetch_local.sink = &sink_local;
+  fetch_local.id = 0;
+  fetch_local.finished = &finished;
+  fetch_local.lock = &lock;
+  MainPriorityFetch(&fetch_local);
+  EXPECT_EQ(kFailOk, fetch_local.result);
+  EXPECT_EQ(content_interactive.length(), sink_local.num_bytes());
+  pthread_mutex_destroy(&lock);
+}
+
+
+TEST_F(T_Download, RefreshProxyIps) {
+  download_mgr.SetProxyChain("http://127.0.0.1:3128;http://127.0.0.2:3128", "",
+                             DownloadManager::kSetProxyRegular);
+  vector<DownloadManager::ProxyInfo> *group0 =
+    &((*download_mgr.opt_proxy_groups_)[0]);
+  vector<DownloadManager::ProxyInfo> *group1 =
+    &((*download_mgr.opt_proxy_groups_)[1]);
+  ASSERT_EQ(1U, group0->size());
+  ASSERT_EQ(1U, group1->size());
+  const int64_t id_fresh = (*group0)[0].host.id();
+
+  // Nothing is due yet
+  map<string, time_t> refresh_due;
+  download_mgr.RefreshProxyIps(&refresh_due);
+  EXPECT_TRUE(refresh_due.empty());
+  EXPECT_EQ(id_fresh, (*group0)[0].host.id());
+
+  // Entries close to expiry are refreshed, the others remain
+  (*group1)[0].host = dns::Host::ExtendDeadline((*group1)[0].host, 10);
+  const int64_t id_expiring = (*group1)[0].host.id();
+  download_mgr.RefreshProxyIps(&refresh_due);
+  EXPECT_EQ(1U, refresh_due.size());
+  EXPECT_EQ(1U, refresh_due.count("127.0.0.2"));
+  EXPECT_EQ(id_fresh, (*group0)[0].host.id());
+  EXPECT_NE(id_expiring, (*group1)[0].host.id());
+  EXPECT_GT((*group1)[0].host.deadline(), time(NULL) + 3600);
+  EXPECT_EQ("http://127.0.0.2:3128", (*group1)[0].url);
+
+  // Refresh time from a previous resolution takes precedence
+  const int64_t id_refreshed = (*group1)[0].host.id();
+  refresh_due["127.0.0.2"] = time(NULL);
+  download_mgr.RefreshProxyIps(&refresh_due);
+  EXPECT_NE(id_refreshed, (*group1)[0].host.id());
+  EXPECT_GT(refresh_due["127.0.0.2"], time(NULL) + 3600);
+
+  // The refresh thread picks up expiring entries in the background
+  (*group1)[0].host = dns::Host::ExtendDeadline((*group1)[0].host, 10);
+  const int64_t id_background = (*group1)[0].host.id();
+  download_mgr.EnableDnsRefresh();
+  download_mgr.Spawn();
+  bool refreshed = false;
+  const unsigned kMaxWaitMs = 3 * DownloadManager::kDnsRefreshCheckIntervalMs;
+  for (unsigned i = 0; (i < kMaxWaitMs / 100) && !refreshed; ++i) {
+    SafeSleepMs(100);
+    pthread_mutex_lock(download_mgr.lock_options_);
+    refreshed = (*group1)[0].host.id() != id_background;
+    pthread_mutex_unlock(download_mgr.lock_options_);
+  }
+  EXPECT_TRUE(refreshed);
+  EXPECT_GT((*group1)[0].host.deadline(), time(NULL) + 3600);
+}
+
+
 TEST_F(T_Download, ParseHttpCode) {
   char digits[3];
   digits[0] = '0';  digits[1] = '0';  digits[2] = 'a';
@@ -305,4 +900,155 @@ TEST_F(T_Download, ParseHttpCode) {
   EXPECT_EQ(999, DownloadManager::ParseHttpCode(digits));
 }
 
+TEST_F(T_Download, GetHeaderValue) {
+  EXPECT_EQ("\"abc\"",
+            DownloadManager::GetHeaderValue("ETag: \"abc\"\r\n", 5));
+  EXPECT_EQ("Tue, 01 Nov 2016 10:00:00 GMT", DownloadManager::GetHeaderValue(
+    "Last-Modified:  Tue, 01 Nov 2016 10:00:00 GMT \n", 14));
+  EXPECT_EQ("x", DownloadManager::GetHeaderValue("ETag:x", 5));
+  EXPECT_EQ("", DownloadManager::GetHeaderValue("ETag: \r\n", 5));
+  EXPECT_EQ("", DownloadManager::GetHeaderValue("ETag:", 5));
+  EXPECT_EQ("", DownloadManager::GetHeaderValue("", 5));
+}
+
+
+typedef size_t (*CurlHeaderCallback)(void *ptr, size_t size, size_t nmemb,
+                                     void *info_link);
+
+static size_t FeedHeader(CurlHeaderCallback callback, JobInfo *info,
+                         const string &header_line)
+{
+  return callback(const_cast<char *>(header_line.data()), 1,
+                  header_line.length(), info);
+}
+
+
+TEST_F(T_Download, HeaderValidators) {
+  CurlHeaderCallback callback = &DownloadManager::CallbackCurlHeader;
+  string etag = "\"old\"";
+  string last_modified = "old";
+  JobInfo info(&foo_url, false, false, NULL);
+  info.etag = &etag;
+  info.last_modified = &last_modified;
+  info.follow_redirects = true;
+
+  // Only the validators of the final successful response are taken
+  string line = "HTTP/1.1 302 Found\r\n";
+  EXPECT_EQ(line.length(), FeedHeader(callback, &info, line));
+  FeedHeader(callback, &info, "ETag: \"redirect\"\r\n");
+  EXPECT_EQ("\"old\"", etag);
+  FeedHeader(callback, &info, "HTTP/1.1 200 OK\r\n");
+  EXPECT_EQ("", etag);
+  EXPECT_EQ("", last_modified);
+  FeedHeader(callback, &info, "ETag: \"new\"\r\n");
+  FeedHeader(callback, &info,
+             "Last-Modified: Tue, 01 Nov 2016 10:00:00 GMT\r\n");
+  EXPECT_EQ("\"new\"", etag);
+  EXPECT_EQ("Tue, 01 Nov 2016 10:00:00 GMT", last_modified);
+  EXPECT_FALSE(info.not_modified);
+
+  // A 304 reply is accepted for conditional requests only
+  JobInfo info_304(&foo_url, false, false, NULL);
+  info_304.etag = &etag;
+  info_304.header_if_none_match = "If-None-Match: " + etag;
+  line = "HTTP/1.1 304 Not Modified\r\n";
+  EXPECT_EQ(line.length(), FeedHeader(callback, &info_304, line));
+  EXPECT_TRUE(info_304.not_modified);
+  FeedHeader(callback, &info_304, "ETag: \"other\"\r\n");
+  EXPECT_EQ("\"new\"", etag);
+
+  JobInfo info_plain(&foo_url, false, false, NULL);
+  info_plain.proxy = "DIRECT";
+  EXPECT_EQ(0U, FeedHeader(callback, &info_plain, line));
+  EXPECT_FALSE(info_plain.not_modified);
+  EXPECT_EQ(kFailHostHttp, info_plain.error_code);
+}
+
+
+TEST_F(T_Download, NotModified) {
+  vector<string> replies;
+  replies.push_back("HTTP/1.1 200 OK\r\n"
+                    "ETag: \"v1\"\r\n"
+                    "Last-Modified: Tue, 01 Nov 2016 10:00:00 GMT\r\n"
+                    "Content-Length: 5\r\n"
+                    "Connection: close\r\n\r\n"
+                    "hello");
+  replies.push_back("HTTP/1.1 304 Not Modified\r\n"
+                    "ETag: \"v1\"\r\n"
+                    "Connection: close\r\n\r\n");
+  replies.push_back("HTTP/1.1 200 OK\r\n"
+                    "Content-Length: 5\r\n"
+                    "Connection: close\r\n\r\n"
+                    "world");
+  MockHttpServer server(replies);
+  const string url = server.url() + "/file";
+  string etag;
+  string last_modified;
+
+  JobInfo info(&url, false, false, NULL);
+  info.etag = &etag;
+  info.last_modified = &last_modified;
+  EXPECT_EQ(kFailOk, download_mgr.Fetch(&info));
+  EXPECT_FALSE(info.not_modified);
+  EXPECT_EQ(5U, info.destination_mem.pos);
+  free(info.destination_mem.data);
+  EXPECT_EQ("\"v1\"", etag);
+  EXPECT_EQ("Tue, 01 Nov 2016 10:00:00 GMT", last_modified);
+
+  // The validators are sent along and cleared by the 304 reply
+  JobInfo info_304(&url, false, false, NULL);
+  info_304.etag = &etag;
+  info_304.last_modified = &last_modified;
+  EXPECT_EQ(kFailOk, download_mgr.Fetch(&info_304));
+  EXPECT_TRUE(info_304.not_modified);
+  EXPECT_EQ(0U, info_304.destination_mem.pos);
+  free(info_304.destination_mem.data);
+  EXPECT_EQ("", etag);
+  EXPECT_EQ("", last_modified);
+
+  // A reply without validators clears them
+  etag = "\"v1\"";
+  JobInfo info_new(&url, false, false, NULL);
+  info_new.etag = &etag;
+  EXPECT_EQ(kFailOk, download_mgr.Fetch(&info_new));
+  EXPECT_FALSE(info_new.not_modified);
+  EXPECT_EQ(5U, info_new.destination_mem.pos);
+  free(info_new.destination_mem.data);
+  EXPECT_EQ("", etag);
+
+  ASSERT_EQ(3U, server.requests.size());
+  EXPECT_EQ(string::npos, server.requests[0].find("If-None-Match"));
+  EXPECT_NE(string::npos,
+            server.requests[1].find("If-None-Match: \"v1\"\r\n"));
+  EXPECT_NE(string::npos, server.requests[1].find(
+    "If-Modified-Since: Tue, 01 Nov 2016 10:00:00 GMT\r\n"));
+  EXPECT_EQ(string::npos, server.requests[2].find("If-Modified-Since"));
+}
+
+
+TEST_F(T_Download, ManifestNotModified) {
+  vector<string> replies;
+  replies.push_back("HTTP/1.1 304 Not Modified\r\n"
+                    "Connection: close\r\n\r\n");
+  replies.push_back("HTTP/1.1 304 Not Modified\r\n"
+                    "Connection: close\r\n\r\n");
+  MockHttpServer server(replies);
+
+  manifest::ManifestEnsemble ensemble;
+  ensemble.etag = "\"v1\"";
+  EXPECT_EQ(manifest::kFailNotModified,
+            manifest::Fetch(server.url(), "test", 0, NULL, NULL,
+                            &download_mgr, &ensemble));
+  EXPECT_TRUE(ensemble.manifest == NULL);
+
+  // Without validators, a 304 reply is an error
+  manifest::ManifestEnsemble ensemble_plain;
+  EXPECT_EQ(manifest::kFailLoad,
+            manifest::Fetch(server.url(), "test", 0, NULL, NULL,
+                            &download_mgr, &ensemble_plain));
+  ASSERT_EQ(2U, server.requests.size());
+  EXPECT_NE(string::npos,
+            server.requests[0].find("GET /.cvmfspublished HTTP/1.1\r\n"));
+}
+
 }  // namespace download
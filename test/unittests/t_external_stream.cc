@@ -0,0 +1,196 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "backoff.h"
+#include "cache_posix.h"
+#include "download.h"
+#include "external_stream.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+namespace cvmfs {
+
+class T_ExternalStreamer : public ::testing::Test {
+ protected:
+  static const unsigned kBlockSize = 4096;
+
+  virtual void SetUp() {
+    used_fds_ = GetNoUsedFds();
+    tmp_path_ =
+      CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_stream");
+
+    // 10 full blocks and a partial one
+    for (unsigned i = 0; i < 10 * kBlockSize + 123; ++i)
+      content_.push_back(static_cast<char>(i % 251));
+    EXPECT_TRUE(CopyMem2Path(
+      reinterpret_cast<const unsigned char *>(content_.data()),
+      content_.length(), tmp_path_ + "/external"));
+    hash_ = shash::Any(shash::kSha1);
+    shash::HashString(content_, &hash_);
+
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_ + "/cache", false);
+    ASSERT_TRUE(cache_mgr_ != NULL);
+    download_mgr_ = new download::DownloadManager();
+    download_mgr_->Init(8, false, /* use_system_proxy */
+      perf::StatisticsTemplate("test", &statistics_));
+    download_mgr_->SetHostChain("file://" + tmp_path_);
+    streamer_ = new ExternalStreamer(
+      cache_mgr_, download_mgr_, &backoff_throttle_,
+      perf::StatisticsTemplate("stream", &statistics_), kBlockSize);
+    n_range_requests_ = statistics_.Lookup("stream.n_range_requests");
+    n_blocks_ = statistics_.Lookup("stream.n_blocks");
+  }
+
+  virtual void TearDown() {
+    delete streamer_;
+    download_mgr_->Fini();
+    delete download_mgr_;
+    delete cache_mgr_;
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+    EXPECT_EQ(used_fds_, GetNoUsedFds());
+  }
+
+  string Read(const FileChunk &chunk, const uint64_t offset,
+              const uint64_t size, const uint64_t handle = 0)
+  {
+    string buf(size, '\0');
+    const int64_t retval = streamer_->Read(chunk, "/external", offset, size,
+                                           CacheManager::kTypeRegular,
+                                           &buf[0], handle);
+    EXPECT_GE(retval, 0);
+    buf.resize((retval < 0) ? 0 : retval);
+    return buf;
+  }
+
+  ExternalStreamer *streamer_;
+  PosixCacheManager *cache_mgr_;
+  download::DownloadManager *download_mgr_;
+  perf::Statistics statistics_;
+  perf::Counter *n_range_requests_;
+  perf::Counter *n_blocks_;
+  BackoffThrottle backoff_throttle_;
+  unsigned used_fds_;
+  string tmp_path_;
+  string content_;
+  shash::Any hash_;
+};
+
+
+TEST_F(T_ExternalStreamer, RandomAccess) {
+  FileChunk chunk(hash_, 0, content_.length());
+
+  EXPECT_EQ(content_.substr(5000, 100), Read(chunk, 5000, 100));
+  EXPECT_EQ(1, n_range_requests_->Get());
+  EXPECT_EQ(1, n_blocks_->Get());
+
+  // Cached block, no new request
+  EXPECT_EQ(content_.substr(4096, 4096), Read(chunk, 4096, 4096));
+  EXPECT_EQ(1, n_range_requests_->Get());
+
+  // Spanning two blocks, one of them cached
+  EXPECT_EQ(content_.substr(3000, 2000), Read(chunk, 3000, 2000));
+  EXPECT_EQ(2, n_range_requests_->Get());
+  EXPECT_EQ(2, n_blocks_->Get());
+
+  // Partial last block and reads beyond the end
+  EXPECT_EQ(content_.substr(40900), Read(chunk, 40900, 1000));
+  EXPECT_EQ("", Read(chunk, content_.length(), 10));
+  EXPECT_EQ(3, n_range_requests_->Get());
+}
+
+
+TEST_F(T_ExternalStreamer, ReadAhead) {
+  FileChunk chunk(hash_, 0, content_.length());
+
+  string result;
+  for (uint64_t offset = 0; offset < content_.length(); offset += 1000)
+    result += Read(chunk, offset, 1000);
+  EXPECT_EQ(content_, result);
+  EXPECT_EQ(11, n_blocks_->Get());
+  EXPECT_LT(n_range_requests_->Get(), 5);
+  EXPECT_EQ(ExternalStreamer::kMaxReadAheadBlocks + 0,
+            streamer_->read_ahead_states_[0].read_ahead);
+
+  // Other handles have their own window
+  Read(chunk, 1000, 10, 1);
+  EXPECT_EQ(0U, streamer_->read_ahead_states_[1].read_ahead);
+  EXPECT_EQ(ExternalStreamer::kMaxReadAheadBlocks + 0,
+            streamer_->read_ahead_states_[0].read_ahead);
+
+  // A seek resets the window
+  Read(chunk, 0, 10);
+  EXPECT_EQ(0U, streamer_->read_ahead_states_[0].read_ahead);
+
+  streamer_->Release(0);
+  streamer_->Release(1);
+  EXPECT_TRUE(streamer_->read_ahead_states_.empty());
+}
+
+
+TEST_F(T_ExternalStreamer, ChunkOffset) {
+  // Second and third block of the file as a separate chunk
+  shash::Any chunk_hash(shash::kSha1);
+  shash::HashString(content_.substr(kBlockSize, 2 * kBlockSize), &chunk_hash);
+  FileChunk chunk(chunk_hash, kBlockSize, 2 * kBlockSize);
+  EXPECT_EQ(content_.substr(kBlockSize + 100, kBlockSize),
+            Read(chunk, 100, kBlockSize));
+  EXPECT_EQ(content_.substr(3 * kBlockSize - 10, 10),
+            Read(chunk, 2 * kBlockSize - 10, 100));
+}
+
+
+TEST_F(T_ExternalStreamer, EntireObjectCached) {
+  void *txn = alloca(cache_mgr_->SizeOfTxn());
+  ASSERT_GE(cache_mgr_->StartTxn(hash_, content_.length(), txn), 0);
+  EXPECT_EQ(static_cast<int64_t>(content_.length()),
+            cache_mgr_->Write(content_.data(), content_.length(), txn));
+  ASSERT_EQ(0, cache_mgr_->CommitTxn(txn));
+
+  FileChunk chunk(hash_, 0, content_.length());
+  EXPECT_EQ(content_.substr(3000, 20000), Read(chunk, 3000, 20000));
+  EXPECT_EQ(0, n_range_requests_->Get());
+}
+
+
+TEST_F(T_ExternalStreamer, Failure) {
+  FileChunk chunk(hash_, 0, content_.length());
+  char buf[10];
+  EXPECT_EQ(-EIO, streamer_->Read(chunk, "/missing", 0, 10,
+                                  CacheManager::kTypeRegular, buf, 0));
+}
+
+
+TEST_F(T_ExternalStreamer, BlockSinkReset) {
+  const uint64_t size = 2 * kBlockSize + 10;
+  BlockSink sink(cache_mgr_, hash_, kBlockSize, 3, size,
+                 CacheManager::ObjectInfo());
+  const char *data = content_.data() + 3 * kBlockSize;
+  EXPECT_EQ(static_cast<int64_t>(kBlockSize + 10),
+            sink.Write(data, kBlockSize + 10));
+  EXPECT_FALSE(sink.IsComplete());
+  EXPECT_EQ(0, sink.Reset());
+  EXPECT_EQ(static_cast<int64_t>(size), sink.Write(data, size));
+  EXPECT_TRUE(sink.IsComplete());
+  EXPECT_EQ(-EIO, sink.Write(data, 1));
+
+  for (unsigned i = 3; i < 6; ++i) {
+    int fd = cache_mgr_->Open(CacheManager::Bless(
+      ExternalStreamer::MakeBlockId(hash_, kBlockSize, i)));
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ((i < 5) ? kBlockSize : 10, cache_mgr_->GetSize(fd));
+    cache_mgr_->Close(fd);
+  }
+}
+
+}  // namespace cvmfs
@@ -4,14 +4,19 @@
 
 #include <gtest/gtest.h>
 
+#include <vector>
+
 #include "fuse_evict.h"
 #include "glue_buffer.h"
 #include "util/string.h"
 
 extern "C" {
 unsigned fuse_lowlevel_notify_inval_entry_cnt = 0;
+unsigned fuse_lowlevel_notify_inval_inode_cnt = 0;
 }
 
+using namespace std;  // NOLINT
+
 class T_FuseInvalidator : public ::testing::Test {
  protected:
   virtual void SetUp() {
@@ -93,3 +98,29 @@ TEST_F(T_FuseInvalidator, InvalidateOps) {
   EXPECT_EQ((2 * FuseInvalidator::kCheckTimeoutFreqOps) + 1024,
             fuse_lowlevel_notify_inval_entry_cnt);
 }
+
+
+TEST_F(T_FuseInvalidator, InvalidatePaths) {
+  invalidator_->fuse_channel_ = reinterpret_cast<struct fuse_chan **>(this);
+  inode_tracker_.VfsGet(1, PathString(""));
+  inode_tracker_.VfsGet(2, PathString("/a"));
+  inode_tracker_.VfsGet(3, PathString("/a/b"));
+
+  vector<PathString> dentries;
+  dentries.push_back(PathString("/a/b"));
+  dentries.push_back(PathString("/c"));
+  dentries.push_back(PathString("/x/y"));
+  vector<PathString> directories;
+  directories.push_back(PathString(""));
+  directories.push_back(PathString("/a"));
+  directories.push_back(PathString("/z"));
+
+  unsigned entry_cnt = fuse_lowlevel_notify_inval_entry_cnt;
+  unsigned inode_cnt = fuse_lowlevel_notify_inval_inode_cnt;
+  FuseInvalidator::Handle handle(1000000);
+  invalidator_->InvalidatePaths(&handle, dentries, directories);
+  handle.WaitFor();
+  EXPECT_TRUE(handle.IsDone());
+  EXPECT_EQ(entry_cnt + 2, fuse_lowlevel_notify_inval_entry_cnt);
+  EXPECT_EQ(inode_cnt + 2, fuse_lowlevel_notify_inval_inode_cnt);
+}
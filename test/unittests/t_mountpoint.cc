@@ -9,17 +9,23 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <map>
 #include <string>
+#include <vector>
 
 #include "cache_posix.h"
 #include "cache_tiered.h"
 #include "catalog_mgr_client.h"
 #include "catalog_mgr_rw.h"
+#include "catalog_rw.h"
+#include "catalog_sql.h"
 #include "compression.h"
 #include "history_sqlite.h"
 #include "manifest.h"
+#include "manifest_fetch.h"
 #include "mountpoint.h"
 #include "options.h"
+#include "quota.h"
 #include "signature.h"
 #include "testutil.h"
 #include "upload.h"
@@ -273,11 +279,133 @@ class T_MountPoint : public ::testing::Test {
                           repo_path_ + string("/testrepo.pub"));
   }
 
+
+  /**
+   * Stores content as a compressed catalog object in the repository.  The
+   * object does not need to be a valid catalog to be prefetched.
+   */
+  shash::Any CreateCatalogObject(const string &content) {
+    string path = repo_path_ + "/catalog_object";
+    EXPECT_TRUE(SafeWriteToFile(content, path, 0600));
+    shash::Any hash(shash::kSha1, shash::kSuffixCatalog);
+    EXPECT_TRUE(zlib::CompressPath2Null(path, &hash));
+    EXPECT_TRUE(
+      zlib::CompressPath2Path(path, repo_path_ + "/data/" + hash.MakePath()));
+    unlink(path.c_str());
+    return hash;
+  }
+
+
+  catalog::WritableCatalog *CreateCatalog(const string &mountpoint) {
+    string db_file = CreateTempPath(repo_path_ + "/catalog", 0600);
+    EXPECT_FALSE(db_file.empty());
+    catalog::DirectoryEntry root_entry =
+      catalog::DirectoryEntryTestFactory::Directory(GetFileName(mountpoint));
+    root_entry.set_is_nested_catalog_root(!mountpoint.empty());
+    {
+      UniquePtr<catalog::CatalogDatabase> db(
+        catalog::CatalogDatabase::Create(db_file));
+      EXPECT_TRUE(db.IsValid());
+      EXPECT_TRUE(db->InsertInitialValues(mountpoint, false, "", root_entry));
+    }
+    return catalog::WritableCatalog::AttachFreely(
+      mountpoint, db_file, shash::Any(shash::kSha1), NULL, !mountpoint.empty());
+  }
+
+
+  /**
+   * Stores the compressed catalog in the repository
+   */
+  shash::Any CommitCatalog(catalog::WritableCatalog *catalog) {
+    string db_file = catalog->database_path();
+    catalog->Commit();
+    delete catalog;
+    shash::Any hash(shash::kSha1, shash::kSuffixCatalog);
+    EXPECT_TRUE(zlib::CompressPath2Null(db_file, &hash));
+    EXPECT_TRUE(zlib::CompressPath2Path(
+      db_file, repo_path_ + "/data/" + hash.MakePath()));
+    catalog_sizes_[hash] = GetFileSize(db_file);
+    unlink(db_file.c_str());
+    return hash;
+  }
+
+
+  void AddFile(catalog::WritableCatalog *catalog, const string &path) {
+    catalog->AddEntry(
+      catalog::DirectoryEntryTestFactory::RegularFile(GetFileName(path)),
+      XattrList(), path, GetParentPath(path));
+  }
+
+
+  void AddNested(catalog::WritableCatalog *catalog,
+                 const string &mountpoint,
+                 const shash::Any &hash)
+  {
+    catalog->AddEntry(
+      catalog::DirectoryEntryTestFactory::Directory(
+        GetFileName(mountpoint), 4096, shash::Any(), true),
+      XattrList(), mountpoint, GetParentPath(mountpoint));
+    catalog->InsertNestedCatalog(mountpoint, NULL, hash, catalog_sizes_[hash]);
+  }
+
+
+  /**
+   * A root catalog with the nested catalogs /a, /b, and /c.  The files in the
+   * nested catalogs are named after the revision.
+   */
+  shash::Any CreateRevision(const string &revision,
+                            map<string, shash::Any> *nested)
+  {
+    (*nested)["/a"] = shash::Any();
+    (*nested)["/b"] = shash::Any();
+    (*nested)["/c"] = shash::Any();
+    for (map<string, shash::Any>::iterator i = nested->begin();
+         i != nested->end(); ++i)
+    {
+      catalog::WritableCatalog *catalog = CreateCatalog(i->first);
+      AddFile(catalog, i->first + "/" + revision);
+      i->second = CommitCatalog(catalog);
+    }
+    catalog::WritableCatalog *root = CreateCatalog("");
+    for (map<string, shash::Any>::const_iterator i = nested->begin();
+         i != nested->end(); ++i)
+    {
+      AddNested(root, i->first, i->second);
+    }
+    return CommitCatalog(root);
+  }
+
+
+  /**
+   * Signs a new manifest that points to the given root catalog
+   */
+  void PublishRevision(const shash::Any &root_hash) {
+    UniquePtr<manifest::Manifest> manifest(
+      manifest::Manifest::LoadFile(repo_path_ + "/.cvmfspublished"));
+    ASSERT_TRUE(manifest.IsValid());
+    manifest->set_catalog_hash(root_hash);
+    manifest->set_catalog_size(catalog_sizes_[root_hash]);
+    manifest->set_revision(manifest->revision() + 1);
+    manifest->set_publish_timestamp(time(NULL));
+    CreateManifest(manifest.weak_ref());
+  }
+
+
+  bool IsPinned(QuotaManager *quota_mgr, const shash::Any &hash) {
+    vector<string> pinned = quota_mgr->ListPinned();
+    for (unsigned i = 0; i < pinned.size(); ++i) {
+      if (pinned[i].find(hash.ToString()) != string::npos)
+        return true;
+    }
+    return false;
+  }
+
  protected:
   FileSystem::FileSystemInfo fs_info_;
   SimpleOptionsParser options_mgr_;
   string tmp_path_;
   string repo_path_;
+  map<shash::Any, uint64_t> catalog_sizes_;
   int fd_cwd_;
   unsigned used_fds_;
   /**
@@ -814,3 +942,180 @@ TEST_F(T_MountPoint, History) {
     EXPECT_EQ(loader::kFailOk, mp->boot_status());
   }
 }
+
+
+namespace {
+
+class CountingManifestEnsemble : public manifest::ManifestEnsemble {
+ public:
+  CountingManifestEnsemble() : num_prefetch(0) { }
+  virtual void PrefetchObjects() { num_prefetch++; }
+  unsigned num_prefetch;
+};
+
+}  // anonymous namespace
+
+
+TEST_F(T_MountPoint, FetchManifest) {
+  CreateMiniRepository();
+  UniquePtr<FileSystem> fs(FileSystem::Create(fs_info_));
+  ASSERT_EQ(loader::kFailOk, fs->boot_status());
+  UniquePtr<MountPoint> mp(MountPoint::Create("keys.cern.ch", fs.weak_ref()));
+  ASSERT_EQ(loader::kFailOk, mp->boot_status());
+
+  {
+    CountingManifestEnsemble ensemble;
+    EXPECT_EQ(manifest::kFailOk,
+              manifest::Fetch("", "keys.cern.ch", 0, NULL, mp->signature_mgr(),
+                              mp->download_mgr(), &ensemble));
+    EXPECT_EQ(1U, ensemble.num_prefetch);
+    ASSERT_TRUE(ensemble.manifest != NULL);
+    EXPECT_EQ(mp->catalog_mgr()->GetRootHash(),
+              ensemble.manifest->catalog_hash());
+    EXPECT_TRUE(ensemble.cert_buf != NULL);
+    EXPECT_TRUE(ensemble.whitelist_buf != NULL);
+  }
+
+  // Objects are prefetched before the whitelist, which is loaded concurrently,
+  // is verified
+  EXPECT_TRUE(SafeWriteToFile("garbage", repo_path_ + "/.cvmfswhitelist",
+                              0600));
+  {
+    CountingManifestEnsemble ensemble;
+    EXPECT_EQ(manifest::kFailBadWhitelist,
+              manifest::Fetch("", "keys.cern.ch", 0, NULL, mp->signature_mgr(),
+                              mp->download_mgr(), &ensemble));
+    EXPECT_EQ(1U, ensemble.num_prefetch);
+  }
+
+  // No prefetch without a valid manifest
+  EXPECT_TRUE(SafeWriteToFile("garbage", repo_path_ + "/.cvmfspublished",
+                              0600));
+  {
+    CountingManifestEnsemble ensemble;
+    EXPECT_NE(manifest::kFailOk,
+              manifest::Fetch("", "keys.cern.ch", 0, NULL, mp->signature_mgr(),
+                              mp->download_mgr(), &ensemble));
+    EXPECT_EQ(0U, ensemble.num_prefetch);
+  }
+}
+
+
+TEST_F(T_MountPoint, PrefetchRootCatalog) {
+  options_mgr_.SetValue("CVMFS_QUOTA_LIMIT", "10");
+  CreateMiniRepository();
+  UniquePtr<FileSystem> fs(FileSystem::Create(fs_info_));
+  ASSERT_EQ(loader::kFailOk, fs->boot_status());
+  UniquePtr<MountPoint> mp(MountPoint::Create("keys.cern.ch", fs.weak_ref()));
+  ASSERT_EQ(loader::kFailOk, mp->boot_status());
+  QuotaManager *quota_mgr = fs->cache_mgr()->quota_mgr();
+  quota_mgr->Spawn();
+
+  // The mounted root catalog keeps its pin if prefetching it is aborted
+  shash::Any root_hash = mp->catalog_mgr()->GetRootHash();
+  EXPECT_TRUE(IsPinned(quota_mgr, root_hash));
+  {
+    catalog::CachedManifestEnsemble ensemble(
+      fs->cache_mgr(), mp->catalog_mgr(), true);
+    ensemble.manifest = new manifest::Manifest(root_hash, 0, "");
+    ensemble.PrefetchObjects();
+    ensemble.AbortPrefetch();
+  }
+  EXPECT_TRUE(IsPinned(quota_mgr, root_hash));
+
+  // A catalog downloaded by the prefetch is unpinned on abort
+  shash::Any hash = CreateCatalogObject("aborted");
+  {
+    catalog::CachedManifestEnsemble ensemble(
+      fs->cache_mgr(), mp->catalog_mgr(), true);
+    ensemble.manifest = new manifest::Manifest(hash, 0, "");
+    ensemble.PrefetchObjects();
+    ensemble.AbortPrefetch();
+  }
+  int fd = fs->cache_mgr()->Open(
+    CacheManager::Bless(hash, CacheManager::kTypeCatalog));
+  EXPECT_GE(fd, 0);
+  fs->cache_mgr()->Close(fd);
+  EXPECT_FALSE(IsPinned(quota_mgr, hash));
+  EXPECT_TRUE(IsPinned(quota_mgr, root_hash));
+
+  // Otherwise the pin is left to the catalog manager
+  hash = CreateCatalogObject("prefetched");
+  {
+    catalog::CachedManifestEnsemble ensemble(
+      fs->cache_mgr(), mp->catalog_mgr(), true);
+    ensemble.manifest = new manifest::Manifest(hash, 0, "");
+    ensemble.PrefetchObjects();
+  }
+  EXPECT_TRUE(IsPinned(quota_mgr, hash));
+  quota_mgr->Unpin(hash);
+  EXPECT_FALSE(IsPinned(quota_mgr, hash));
+
+  // Without prefetching, nothing is downloaded
+  hash = CreateCatalogObject("not prefetched");
+  {
+    catalog::CachedManifestEnsemble ensemble(
+      fs->cache_mgr(), mp->catalog_mgr(), false);
+    ensemble.manifest = new manifest::Manifest(hash, 0, "");
+    ensemble.PrefetchObjects();
+    ensemble.AbortPrefetch();
+  }
+  EXPECT_LT(fs->cache_mgr()->Open(
+    CacheManager::Bless(hash, CacheManager::kTypeCatalog)), 0);
+}
+
+
+TEST_F(T_MountPoint, StageRemount) {
+  options_mgr_.SetValue("CVMFS_QUOTA_LIMIT", "10");
+  CreateMiniRepository();
+  options_mgr_.UnsetValue("CVMFS_ROOT_HASH");
+  // Catalogs cannot be created once the file system registered its sqlite VFS
+  map<string, shash::Any> nested;
+  shash::Any root_hash = CreateRevision("1", &nested);
+  shash::Any new_root_hash = CreateRevision("2", &nested);
+  PublishRevision(root_hash);
+  UniquePtr<FileSystem> fs(FileSystem::Create(fs_info_));
+  ASSERT_EQ(loader::kFailOk, fs->boot_status());
+  UniquePtr<MountPoint> mp(MountPoint::Create("keys.cern.ch", fs.weak_ref()));
+  ASSERT_EQ(loader::kFailOk, mp->boot_status());
+  QuotaManager *quota_mgr = fs->cache_mgr()->quota_mgr();
+  quota_mgr->Spawn();
+  catalog::ClientCatalogManager *catalog_mgr = mp->catalog_mgr();
+  EXPECT_EQ(root_hash, catalog_mgr->GetRootHash());
+  EXPECT_EQ(catalog::kLoadUp2Date, catalog_mgr->StageRemount());
+
+  // /a and /b are attached, /c is not
+  catalog::DirectoryEntry dirent;
+  EXPECT_TRUE(catalog_mgr->LookupPath("/a/1", catalog::kLookupSole, &dirent));
+  EXPECT_TRUE(catalog_mgr->LookupPath("/b/1", catalog::kLookupSole, &dirent));
+  EXPECT_EQ(3, catalog_mgr->GetNumCatalogs());
+
+  // The new root catalog and the changed attached nested catalogs are
+  // downloaded and stay pinned until the new revision is mounted
+  PublishRevision(new_root_hash);
+  EXPECT_EQ(catalog::kLoadNew, catalog_mgr->StageRemount());
+  EXPECT_EQ(catalog::kLoadNew, catalog_mgr->StageRemount());
+  EXPECT_EQ(root_hash, catalog_mgr->GetRootHash());
+  EXPECT_TRUE(IsPinned(quota_mgr, new_root_hash));
+  EXPECT_TRUE(IsPinned(quota_mgr, nested["/a"]));
+  EXPECT_TRUE(IsPinned(quota_mgr, nested["/b"]));
+  EXPECT_LT(fs->cache_mgr()->Open(
+    CacheManager::Bless(nested["/c"], CacheManager::kTypeCatalog)), 0);
+
+  EXPECT_EQ(catalog::kLoadNew, catalog_mgr->Remount(false));
+  EXPECT_EQ(new_root_hash, catalog_mgr->GetRootHash());
+  EXPECT_TRUE(IsPinned(quota_mgr, nested["/a"]));
+  EXPECT_TRUE(IsPinned(quota_mgr, nested["/b"]));
+  EXPECT_TRUE(catalog_mgr->LookupPath("/a/2", catalog::kLookupSole, &dirent));
+
+  // Staged catalogs that did not get mounted are unpinned but stay cached
+  catalog_mgr->UnpinStaged();
+  EXPECT_TRUE(IsPinned(quota_mgr, new_root_hash));
+  EXPECT_TRUE(IsPinned(quota_mgr, nested["/a"]));
+  EXPECT_FALSE(IsPinned(quota_mgr, nested["/b"]));
+  int fd = fs->cache_mgr()->Open(
+    CacheManager::Bless(nested["/b"], CacheManager::kTypeCatalog));
+  EXPECT_GE(fd, 0);
+  fs->cache_mgr()->Close(fd);
+  EXPECT_EQ(catalog::kLoadUp2Date, catalog_mgr->StageRemount());
+}
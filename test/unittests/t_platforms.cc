@@ -4,7 +4,67 @@
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
 #include "platform.h"
 
 // TODO(Radu): Could add some unit tests for all the functions in
 //             platform_{linux,osx}.h
+
+
+TEST(T_Platforms, AllowedCpus) {
+  const std::vector<unsigned> cpus = platform_allowed_cpus();
+  ASSERT_FALSE(cpus.empty());
+  for (unsigned i = 1; i < cpus.size(); ++i)
+    EXPECT_LT(cpus[i - 1], cpus[i]);
+#ifndef __APPLE__
+  EXPECT_TRUE(platform_pin_thread(cpus[cpus.size() - 1]));
+  EXPECT_EQ(cpus[cpus.size() - 1], static_cast<unsigned>(sched_getcpu()));
+  // Restore the affinity of the test process
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (unsigned i = 0; i < cpus.size(); ++i)
+    CPU_SET(cpus[i], &cpu_set);
+  EXPECT_EQ(0, pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                      &cpu_set));
+  EXPECT_EQ(cpus, platform_allowed_cpus());
+#endif
+}
+
+
+TEST(T_Platforms, CloneFuseFd) {
+  // Only /dev/fuse file descriptors of a mounted file system can be cloned
+  int fd = open("/dev/null", O_RDONLY);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(-1, platform_clone_fuse_fd(fd));
+  close(fd);
+  EXPECT_EQ(-1, platform_clone_fuse_fd(-1));
+}
+
+
+TEST(T_Platforms, MemfdSealed) {
+  int fd = platform_memfd("cvmfs-test", 4096);
+  ASSERT_GE(fd, 0);
+  platform_stat64 info;
+  ASSERT_EQ(0, platform_fstat(fd, &info));
+  EXPECT_EQ(4096, info.st_size);
+  EXPECT_TRUE(platform_memfd_sealed(fd));
+#if defined(__linux__) && defined(__NR_memfd_create)
+  if (fcntl(fd, F_GET_SEALS) >= 0) {
+    EXPECT_NE(0, ftruncate(fd, 0));
+    EXPECT_NE(0, ftruncate(fd, 8192));
+
+    // An unsealed file is rejected
+    char path[] = "/tmp/cvmfs_test_memfd.XXXXXX";
+    int fd_plain = mkstemp(path);
+    ASSERT_GE(fd_plain, 0);
+    unlink(path);
+    EXPECT_FALSE(platform_memfd_sealed(fd_plain));
+    close(fd_plain);
+  }
+#endif
+  close(fd);
+}
@@ -0,0 +1,459 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "cache_plugin/libcvmfs_cache.h"
+#include "cache_plugin/ram_cache.h"
+
+using namespace std;  // NOLINT
+
+namespace {
+
+/**
+ * Objects of this size occupy one slab each
+ */
+const unsigned kSlabObjectSize = 900 * 1024;
+
+/**
+ * The plugin hashes the first bytes of the digest and picks the index stripe
+ * from the last byte, so these need to be spread like real content hashes.
+ */
+struct cvmcache_hash MkId(unsigned char tag, unsigned n) {
+  struct cvmcache_hash id;
+  memset(&id, 0, sizeof(id));
+  uint32_t mixed = (n * 2654435761U) ^ (tag * 40503U);
+  memcpy(id.digest, &mixed, sizeof(mixed));
+  id.digest[sizeof(mixed)] = tag;
+  memcpy(id.digest + sizeof(mixed) + 1, &n, sizeof(n));
+  id.digest[sizeof(id.digest) - 1] = mixed >> 24;
+  id.algorithm = 1;
+  return id;
+}
+
+string MkContent(unsigned size, unsigned seed) {
+  string content(size, '\0');
+  for (unsigned i = 0; i < size; ++i)
+    content[i] = static_cast<char>((i * 7 + seed) % 251);
+  return content;
+}
+
+atomic_int64 next_txn_id;
+
+/**
+ * Commits an object and leaves it pinned by the commit.
+ */
+int StorePinned(
+  struct cvmcache_hash *id,
+  const string &content,
+  cvmcache_object_type type)
+{
+  struct cvmcache_object_info info;
+  memset(&info, 0, sizeof(info));
+  info.size = content.length();
+  info.type = type;
+  uint64_t txn_id = atomic_xadd64(&next_txn_id, 1);
+  int retval = PluginRamCache::ram_start_txn(id, txn_id, &info);
+  if (retval != CVMCACHE_STATUS_OK)
+    return retval;
+  retval = PluginRamCache::ram_write_txn(txn_id,
+    reinterpret_cast<unsigned char *>(const_cast<char *>(content.data())),
+    content.length());
+  if (retval != CVMCACHE_STATUS_OK) {
+    PluginRamCache::ram_abort_txn(txn_id);
+    return retval;
+  }
+  return PluginRamCache::ram_commit_txn(txn_id);
+}
+
+/**
+ * Returns the empty string if the object cannot be read.
+ */
+string Read(struct cvmcache_hash *id, uint64_t size) {
+  string buf(size, '\0');
+  uint64_t pos = 0;
+  while (pos < size) {
+    uint32_t nbytes = std::min(uint64_t(64 * 1024), size - pos);
+    int retval = PluginRamCache::ram_pread(id, pos, &nbytes,
+      reinterpret_cast<unsigned char *>(&buf[pos]));
+    if ((retval != CVMCACHE_STATUS_OK) || (nbytes == 0))
+      return "";
+    pos += nbytes;
+  }
+  return buf;
+}
+
+bool IsPresent(struct cvmcache_hash *id) {
+  struct cvmcache_object_info info;
+  memset(&info, 0, sizeof(info));
+  if (PluginRamCache::ram_obj_info(id, &info) != CVMCACHE_STATUS_OK)
+    return false;
+  free(info.description);
+  return true;
+}
+
+}  // anonymous namespace
+
+
+class T_RamCache : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    atomic_init64(&next_txn_id);
+    plugin_ = PluginRamCache::Create("100");
+    ASSERT_TRUE(plugin_ != NULL);
+  }
+
+  virtual void TearDown() {
+    delete plugin_;
+  }
+
+  void StoreUnpinned(struct cvmcache_hash *id, const string &content,
+                     cvmcache_object_type type = CVMCACHE_OBJECT_REGULAR)
+  {
+    ASSERT_EQ(CVMCACHE_STATUS_OK, StorePinned(id, content, type));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_chrefcnt(id, -1));
+  }
+
+  struct cvmcache_info GetInfo() {
+    struct cvmcache_info info;
+    EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_info(&info));
+    return info;
+  }
+
+  unsigned GetNumSlabs() {
+    return GetInfo().size_bytes / (1024 * 1024);
+  }
+
+  /**
+   * Empties the cache and fills it completely with pinned objects.  Fails if
+   * memory leaked from previous operations.
+   */
+  void ExpectFillable() {
+    uint64_t used;
+    EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_shrink(0, &used));
+    EXPECT_EQ(0U, used);
+    string content = MkContent(kSlabObjectSize, 0);
+    unsigned num_slabs = GetNumSlabs();
+    for (unsigned i = 0; i < num_slabs; ++i) {
+      struct cvmcache_hash id = MkId(0xFF, i);
+      EXPECT_EQ(CVMCACHE_STATUS_OK,
+                StorePinned(&id, content, CVMCACHE_OBJECT_REGULAR));
+    }
+  }
+
+  PluginRamCache *plugin_;
+};
+
+
+struct CommitData {
+  struct cvmcache_hash id;
+  string content;
+  atomic_int32 *num_ready;
+  unsigned num_threads;
+  int result;
+};
+
+static void *MainCommit(void *data) {
+  CommitData *cd = reinterpret_cast<CommitData *>(data);
+  struct cvmcache_object_info info;
+  memset(&info, 0, sizeof(info));
+  info.size = cd->content.length();
+  info.type = CVMCACHE_OBJECT_REGULAR;
+  uint64_t txn_id = atomic_xadd64(&next_txn_id, 1);
+  cd->result = PluginRamCache::ram_start_txn(&cd->id, txn_id, &info);
+  if (cd->result == CVMCACHE_STATUS_OK) {
+    cd->result = PluginRamCache::ram_write_txn(txn_id,
+      reinterpret_cast<unsigned char *>(const_cast<char *>(
+        cd->content.data())),
+      cd->content.length());
+  }
+  // Commit only once all the transactions are open
+  atomic_inc32(cd->num_ready);
+  while (static_cast<unsigned>(atomic_read32(cd->num_ready)) <
+         cd->num_threads)
+  { }
+  if (cd->result == CVMCACHE_STATUS_OK)
+    cd->result = PluginRamCache::ram_commit_txn(txn_id);
+  return NULL;
+}
+
+
+TEST_F(T_RamCache, ConcurrentCommit) {
+  const unsigned num_threads = 8;
+  struct cvmcache_hash id = MkId(1, 0);
+  string content = MkContent(100000, 1);
+  atomic_int32 num_ready;
+  atomic_init32(&num_ready);
+
+  pthread_t threads[num_threads];
+  CommitData cd[num_threads];
+  for (unsigned i = 0; i < num_threads; ++i) {
+    cd[i].id = id;
+    cd[i].content = content;
+    cd[i].num_ready = &num_ready;
+    cd[i].num_threads = num_threads;
+    cd[i].result = CVMCACHE_STATUS_UNKNOWN;
+    int retval = pthread_create(&threads[i], NULL, MainCommit, &cd[i]);
+    ASSERT_EQ(0, retval);
+  }
+  for (unsigned i = 0; i < num_threads; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(CVMCACHE_STATUS_OK, cd[i].result);
+  }
+
+  // A single copy, pinned once for every commit
+  struct cvmcache_info info = GetInfo();
+  EXPECT_EQ(content.length(), info.used_bytes);
+  EXPECT_EQ(content.length(), info.pinned_bytes);
+  EXPECT_EQ(content, Read(&id, content.length()));
+  for (unsigned i = 0; i < num_threads; ++i)
+    EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_chrefcnt(&id, -1));
+  EXPECT_EQ(CVMCACHE_STATUS_BADCOUNT, PluginRamCache::ram_chrefcnt(&id, -1));
+  EXPECT_EQ(0U, GetInfo().pinned_bytes);
+
+  // The dropped copies returned their memory
+  ExpectFillable();
+}
+
+
+TEST_F(T_RamCache, EvictSkipsPinned) {
+  string content = MkContent(kSlabObjectSize, 2);
+  unsigned num_slabs = GetNumSlabs();
+  struct cvmcache_hash id_pinned = MkId(2, 0);
+  ASSERT_EQ(CVMCACHE_STATUS_OK,
+            StorePinned(&id_pinned, content, CVMCACHE_OBJECT_REGULAR));
+  for (unsigned i = 1; i < num_slabs; ++i) {
+    struct cvmcache_hash id = MkId(2, i);
+    StoreUnpinned(&id, content);
+  }
+  EXPECT_EQ(uint64_t(num_slabs) * kSlabObjectSize, GetInfo().used_bytes);
+
+  // The pinned object is the least recently used one
+  struct cvmcache_hash id_new = MkId(3, 0);
+  StoreUnpinned(&id_new, content);
+  EXPECT_TRUE(IsPresent(&id_pinned));
+  EXPECT_EQ(content, Read(&id_pinned, content.length()));
+  struct cvmcache_hash id_oldest = MkId(2, 1);
+  EXPECT_FALSE(IsPresent(&id_oldest));
+  struct cvmcache_hash id_newest = MkId(2, num_slabs - 1);
+  EXPECT_TRUE(IsPresent(&id_newest));
+  EXPECT_TRUE(IsPresent(&id_new));
+
+  // Same for objects that recycle a chunk of their size class
+  string small_content = MkContent(60000, 3);
+  uint64_t used;
+  EXPECT_EQ(CVMCACHE_STATUS_PARTIAL, PluginRamCache::ram_shrink(0, &used));
+  EXPECT_EQ(content.length(), used);
+  struct cvmcache_hash id_small_pinned = MkId(4, 0);
+  ASSERT_EQ(CVMCACHE_STATUS_OK, StorePinned(&id_small_pinned, small_content,
+                                            CVMCACHE_OBJECT_REGULAR));
+  struct cvmcache_hash id_small_oldest = MkId(5, 0);
+  StoreUnpinned(&id_small_oldest, small_content);
+  unsigned num_small = 1;
+  while (IsPresent(&id_small_oldest)) {
+    ASSERT_LT(num_small, 1000000U);
+    struct cvmcache_hash id = MkId(5, num_small);
+    StoreUnpinned(&id, small_content);
+    num_small++;
+  }
+  EXPECT_TRUE(IsPresent(&id_small_pinned));
+  EXPECT_EQ(small_content, Read(&id_small_pinned, small_content.length()));
+  struct cvmcache_hash id_small_newest = MkId(5, num_small - 1);
+  EXPECT_TRUE(IsPresent(&id_small_newest));
+
+  // Only pinned objects left
+  bool nospace = false;
+  for (unsigned i = 0; i < num_slabs; ++i) {
+    struct cvmcache_hash id = MkId(6, i);
+    int retval = StorePinned(&id, content, CVMCACHE_OBJECT_REGULAR);
+    if (retval != CVMCACHE_STATUS_OK) {
+      EXPECT_EQ(CVMCACHE_STATUS_NOSPACE, retval);
+      nospace = true;
+      break;
+    }
+  }
+  EXPECT_TRUE(nospace);
+  EXPECT_FALSE(IsPresent(&id_small_newest));
+  EXPECT_TRUE(IsPresent(&id_pinned));
+  EXPECT_TRUE(IsPresent(&id_small_pinned));
+}
+
+
+TEST_F(T_RamCache, GrowTransaction) {
+  struct cvmcache_hash id = MkId(7, 0);
+  string content = MkContent(1536 * 1024 + 13, 4);
+  struct cvmcache_object_info info;
+  memset(&info, 0, sizeof(info));
+  info.size = CVMCACHE_SIZE_UNKNOWN;
+  info.type = CVMCACHE_OBJECT_CATALOG;
+  info.description = const_cast<char *>("growing");
+  ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_start_txn(&id, 0, &info));
+  // Starts in a small chunk and ends up in a slab run
+  const unsigned piece_size = 1000;
+  for (unsigned pos = 0; pos < content.length(); pos += piece_size) {
+    unsigned nbytes = std::min(piece_size,
+                               static_cast<unsigned>(content.length() - pos));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_write_txn(0,
+      reinterpret_cast<unsigned char *>(const_cast<char *>(
+        content.data() + pos)),
+      nbytes));
+  }
+  EXPECT_FALSE(IsPresent(&id));
+  ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_commit_txn(0));
+
+  memset(&info, 0, sizeof(info));
+  ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_obj_info(&id, &info));
+  EXPECT_EQ(content.length(), info.size);
+  EXPECT_EQ(CVMCACHE_OBJECT_CATALOG, info.type);
+  EXPECT_TRUE(info.pinned);
+  ASSERT_TRUE(info.description != NULL);
+  EXPECT_STREQ("growing", info.description);
+  free(info.description);
+  EXPECT_EQ(content, Read(&id, content.length()));
+  EXPECT_EQ(content.length(), GetInfo().used_bytes);
+
+  // Same with an aborted transaction
+  struct cvmcache_hash id_abort = MkId(7, 1);
+  info.size = CVMCACHE_SIZE_UNKNOWN;
+  info.description = NULL;
+  ASSERT_EQ(CVMCACHE_STATUS_OK,
+            PluginRamCache::ram_start_txn(&id_abort, 1, &info));
+  for (unsigned pos = 0; pos < content.length(); pos += piece_size) {
+    unsigned nbytes = std::min(piece_size,
+                               static_cast<unsigned>(content.length() - pos));
+    ASSERT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_write_txn(1,
+      reinterpret_cast<unsigned char *>(const_cast<char *>(
+        content.data() + pos)),
+      nbytes));
+  }
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_abort_txn(1));
+  EXPECT_FALSE(IsPresent(&id_abort));
+
+  // The intermediate chunks are returned to the allocator
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_chrefcnt(&id, -1));
+  ExpectFillable();
+}
+
+
+TEST_F(T_RamCache, ShrinkOrder) {
+  // Different sizes end up in different LRU lists
+  struct cvmcache_hash id_a = MkId(8, 0);
+  string content_a = MkContent(100, 5);
+  struct cvmcache_hash id_b = MkId(8, 1);
+  string content_b = MkContent(600 * 1024, 6);
+  struct cvmcache_hash id_c = MkId(8, 2);
+  string content_c = MkContent(20000, 7);
+  struct cvmcache_hash id_d = MkId(8, 3);
+  string content_d = MkContent(1000, 8);
+  struct cvmcache_hash id_v = MkId(8, 4);
+  string content_v = MkContent(5000, 9);
+
+  StoreUnpinned(&id_a, content_a);
+  StoreUnpinned(&id_b, content_b);
+  StoreUnpinned(&id_c, content_c);
+  StoreUnpinned(&id_d, content_d);
+  // Opening the object makes it the most recently used one
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_chrefcnt(&id_a, 1));
+  EXPECT_EQ(CVMCACHE_STATUS_OK, PluginRamCache::ram_chrefcnt(&id_a, -1));
+  // Volatile objects go first, no matter how recently they were used
+  StoreUnpinned(&id_v, content_v, CVMCACHE_OBJECT_VOLATILE);
+
+  struct cvmcache_hash *expected_order[] =
+    { &id_v, &id_b, &id_c, &id_d, &id_a };
+  const unsigned num_objects =
+    sizeof(expected_order) / sizeof(expected_order[0]);
+  for (unsigned i = 0; i < num_objects; ++i) {
+    uint64_t used = GetInfo().used_bytes;
+    ASSERT_GT(used, 0U);
+    EXPECT_EQ(CVMCACHE_STATUS_OK,
+              PluginRamCache::ram_shrink(used - 1, &used));
+    for (unsigned j = 0; j < num_objects; ++j)
+      EXPECT_EQ(j > i, IsPresent(expected_order[j])) << i << " " << j;
+  }
+  EXPECT_EQ(0U, GetInfo().used_bytes);
+}
+
+
+struct StressData {
+  unsigned seed;
+  unsigned num_iterations;
+  unsigned num_objects;
+  vector<string> *contents;
+  unsigned num_errors;
+};
+
+static void *MainStress(void *data) {
+  StressData *sd = reinterpret_cast<StressData *>(data);
+  for (unsigned i = 0; i < sd->num_iterations; ++i) {
+    unsigned idx = rand_r(&sd->seed) % sd->num_objects;
+    struct cvmcache_hash id = MkId(9, idx);
+    const string &content = (*sd->contents)[idx];
+    int retval = PluginRamCache::ram_chrefcnt(&id, 1);
+    if (retval == CVMCACHE_STATUS_NOENTRY)
+      retval = StorePinned(&id, content, CVMCACHE_OBJECT_REGULAR);
+    if (retval != CVMCACHE_STATUS_OK) {
+      sd->num_errors++;
+      continue;
+    }
+    if (Read(&id, content.length()) != content)
+      sd->num_errors++;
+    if (PluginRamCache::ram_chrefcnt(&id, -1) != CVMCACHE_STATUS_OK)
+      sd->num_errors++;
+  }
+  return NULL;
+}
+
+static void *MainShrink(void *data) {
+  atomic_int32 *stop = reinterpret_cast<atomic_int32 *>(data);
+  uint64_t used;
+  while (atomic_read32(stop) == 0)
+    PluginRamCache::ram_shrink(0, &used);
+  return NULL;
+}
+
+
+TEST_F(T_RamCache, Stress) {
+  const unsigned num_threads = 4;
+  const unsigned num_objects = 64;
+  vector<string> contents;
+  for (unsigned i = 0; i < num_objects; ++i)
+    contents.push_back(MkContent(1000 + i * 9000, i));
+
+  atomic_int32 stop;
+  atomic_init32(&stop);
+  pthread_t thread_shrink;
+  int retval = pthread_create(&thread_shrink, NULL, MainShrink, &stop);
+  ASSERT_EQ(0, retval);
+
+  pthread_t threads[num_threads];
+  StressData sd[num_threads];
+  for (unsigned i = 0; i < num_threads; ++i) {
+    sd[i].seed = i;
+    sd[i].num_iterations = 2000;
+    sd[i].num_objects = num_objects;
+    sd[i].contents = &contents;
+    sd[i].num_errors = 0;
+    retval = pthread_create(&threads[i], NULL, MainStress, &sd[i]);
+    ASSERT_EQ(0, retval);
+  }
+  for (unsigned i = 0; i < num_threads; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(0U, sd[i].num_errors);
+  }
+  atomic_inc32(&stop);
+  pthread_join(thread_shrink, NULL);
+
+  EXPECT_EQ(0U, GetInfo().pinned_bytes);
+  ExpectFillable();
+}
@@ -0,0 +1,135 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+#include <set>
+#include <vector>
+
+#include "cache_plugin/slab_allocator.h"
+
+using namespace std;  // NOLINT
+
+class T_SlabAllocator : public ::testing::Test {
+ protected:
+  static const uint64_t kNumSlabs = 16;
+  static const uint64_t kSlabSize = 64 * 1024;
+  static const uint64_t kMinChunkSize = 256;
+  static const uint8_t kNumSizeClasses = 5;
+
+  T_SlabAllocator()
+    : allocator_(kNumSlabs, kNumSlabs / 2, kSlabSize, kMinChunkSize,
+                 kNumSizeClasses)
+  { }
+
+  SlabAllocator allocator_;
+};
+
+const uint64_t T_SlabAllocator::kNumSlabs;
+const uint64_t T_SlabAllocator::kSlabSize;
+const uint64_t T_SlabAllocator::kMinChunkSize;
+const uint8_t T_SlabAllocator::kNumSizeClasses;
+
+
+TEST_F(T_SlabAllocator, SizeClass) {
+  EXPECT_EQ(0U, allocator_.GetSizeClass(0));
+  EXPECT_EQ(0U, allocator_.GetSizeClass(256));
+  EXPECT_EQ(1U, allocator_.GetSizeClass(257));
+  EXPECT_EQ(4U, allocator_.GetSizeClass(4096));
+  EXPECT_EQ(SlabAllocator::kClassRun, allocator_.GetSizeClass(4097));
+
+  EXPECT_EQ(512U, allocator_.GetCapacity(300, 1));
+  EXPECT_EQ(2 * kSlabSize,
+            allocator_.GetCapacity(kSlabSize + 1, SlabAllocator::kClassRun));
+}
+
+
+TEST_F(T_SlabAllocator, Chunks) {
+  uint64_t chunks_per_slab = kSlabSize / kMinChunkSize;
+  set<uint64_t> offsets;
+  for (unsigned i = 0; i < chunks_per_slab + 1; ++i) {
+    uint64_t offset;
+    ASSERT_TRUE(allocator_.Allocate(100, 0, &offset));
+    EXPECT_EQ(0U, offset % kMinChunkSize);
+    EXPECT_TRUE(offsets.insert(offset).second);
+  }
+  EXPECT_EQ(kNumSlabs - 2, allocator_.num_free_slabs());
+
+  for (set<uint64_t>::const_iterator i = offsets.begin(), iEnd = offsets.end();
+       i != iEnd; ++i)
+  {
+    allocator_.Free(*i, 100, 0);
+  }
+  EXPECT_EQ(kNumSlabs, allocator_.num_free_slabs());
+}
+
+
+TEST_F(T_SlabAllocator, Reuse) {
+  uint64_t offset1, offset2, offset3;
+  EXPECT_TRUE(allocator_.Allocate(1000, 2, &offset1));
+  EXPECT_TRUE(allocator_.Allocate(1000, 2, &offset2));
+  EXPECT_NE(offset1, offset2);
+  allocator_.Free(offset1, 1000, 2);
+  EXPECT_TRUE(allocator_.Allocate(1000, 2, &offset3));
+  EXPECT_EQ(offset1, offset3);
+}
+
+
+TEST_F(T_SlabAllocator, Runs) {
+  uint64_t offset1, offset2, offset3;
+  // Runs do not cross segment boundaries
+  EXPECT_FALSE(allocator_.Allocate(kNumSlabs / 2 * kSlabSize + 1,
+                                   SlabAllocator::kClassRun, &offset1));
+  EXPECT_TRUE(allocator_.Allocate(5 * kSlabSize, SlabAllocator::kClassRun,
+                                  &offset1));
+  EXPECT_EQ(0U, offset1);
+  EXPECT_TRUE(allocator_.Allocate(5 * kSlabSize, SlabAllocator::kClassRun,
+                                  &offset2));
+  EXPECT_EQ(kNumSlabs / 2 * kSlabSize, offset2);
+  EXPECT_EQ(kNumSlabs - 10, allocator_.num_free_slabs());
+  EXPECT_FALSE(allocator_.Allocate(4 * kSlabSize, SlabAllocator::kClassRun,
+                                   &offset3));
+  EXPECT_TRUE(allocator_.Allocate(3 * kSlabSize, SlabAllocator::kClassRun,
+                                  &offset3));
+
+  allocator_.Free(offset1, 5 * kSlabSize, SlabAllocator::kClassRun);
+  allocator_.Free(offset2, 5 * kSlabSize, SlabAllocator::kClassRun);
+  allocator_.Free(offset3, 3 * kSlabSize, SlabAllocator::kClassRun);
+  EXPECT_EQ(kNumSlabs, allocator_.num_free_slabs());
+}
+
+
+TEST_F(T_SlabAllocator, Full) {
+  vector<uint64_t> offsets;
+  uint64_t offset;
+  while (allocator_.Allocate(4096, 4, &offset))
+    offsets.push_back(offset);
+  EXPECT_EQ(kNumSlabs * kSlabSize / 4096, offsets.size());
+  EXPECT_EQ(0U, allocator_.num_free_slabs());
+  EXPECT_FALSE(allocator_.Allocate(100, 0, &offset));
+
+  allocator_.Free(offsets[0], 4096, 4);
+  EXPECT_FALSE(allocator_.Allocate(100, 0, &offset));
+  EXPECT_TRUE(allocator_.Allocate(4096, 4, &offset));
+  EXPECT_EQ(offsets[0], offset);
+}
+
+
+TEST_F(T_SlabAllocator, Claim) {
+  EXPECT_TRUE(allocator_.Claim(512, 300, 1));
+  EXPECT_FALSE(allocator_.Claim(512, 300, 1));
+  EXPECT_FALSE(allocator_.Claim(100, 300, 1));
+  EXPECT_FALSE(allocator_.Claim(1024, 1000, 2));
+  EXPECT_TRUE(allocator_.Claim(kSlabSize, 2 * kSlabSize,
+                               SlabAllocator::kClassRun));
+  EXPECT_FALSE(allocator_.Claim(2 * kSlabSize, kSlabSize,
+                                SlabAllocator::kClassRun));
+  EXPECT_EQ(kNumSlabs - 3, allocator_.num_free_slabs());
+
+  uint64_t offset;
+  EXPECT_TRUE(allocator_.Allocate(300, 1, &offset));
+  EXPECT_EQ(0U, offset);
+}
@@ -116,6 +116,14 @@ TEST_F(T_Smallhash, InsertAndCopyMd5Slow) {
   EXPECT_EQ(N, smallhash_md5_.size());
   EXPECT_EQ(N, new_smallhash_md5.size());
   EXPECT_GT(max_collisions, new_smallhash_md5.max_collisions_);
+  EXPECT_GE(1U, new_smallhash_md5.num_migrates());
+  for (unsigned i = 0; i < N; i += 1000) {
+    shash::Md5 random_hash;
+    random_hash.Randomize(i);
+    int value;
+    EXPECT_TRUE(new_smallhash_md5.Lookup(random_hash, &value));
+    EXPECT_EQ(static_cast<int>(i), value);
+  }
 }
 
 
@@ -180,3 +180,16 @@ TEST_F(T_Sqlitemem, ReallocStress) {
     ASSERT_TRUE(p != NULL);
   }
 }
+
+
+TEST_F(T_Sqlitemem, PageCacheSize) {
+  const unsigned default_no_slots = SqliteMemoryManager::kPageCacheNoSlots;
+  EXPECT_EQ(default_no_slots, mem_mgr_->page_cache_no_slots());
+  mem_mgr_->SetPageCacheSize(0);
+  EXPECT_EQ(1U, mem_mgr_->page_cache_no_slots());
+  mem_mgr_->SetPageCacheSize(
+    100 * SqliteMemoryManager::kPageCacheSlotSize + 1);
+  EXPECT_EQ(100U, mem_mgr_->page_cache_no_slots());
+  memset(mem_mgr_->page_cache_memory_, 0,
+         100 * SqliteMemoryManager::kPageCacheSlotSize);
+}
@@ -0,0 +1,108 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "cache_posix.h"
+#include "duplex_sqlite3.h"
+#include "sqlitevfs.h"
+#include "statistics.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+class T_SqliteVfs : public ::testing::Test {
+ protected:
+  static const unsigned kNumRows = 20000;
+
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_sqlitevfs");
+    ASSERT_NE("", tmp_path_);
+    db_path_ = tmp_path_ + "/test.db";
+    CreateDatabase();
+
+    ASSERT_TRUE(MkdirDeep(tmp_path_ + "/cache", 0700));
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_ + "/cache", false);
+    ASSERT_TRUE(cache_mgr_.IsValid());
+    ASSERT_TRUE(sqlite::RegisterVfsRdOnly(cache_mgr_.weak_ref(), &statistics_,
+                                          sqlite::kVfsOptNone));
+  }
+
+  virtual void TearDown() {
+    EXPECT_TRUE(sqlite::UnregisterVfsRdOnly());
+    if (tmp_path_ != "")
+      RemoveTree(tmp_path_);
+  }
+
+  void CreateDatabase() {
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(db_path_.c_str(), &db));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db,
+      "CREATE TABLE t (a INTEGER PRIMARY KEY, b TEXT); BEGIN;",
+      NULL, NULL, NULL));
+    for (unsigned i = 0; i < kNumRows; ++i) {
+      const string insert = "INSERT INTO t VALUES (" + StringifyInt(i) +
+                            ", 'row" + StringifyInt(i) + "');";
+      ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, insert.c_str(), NULL, NULL, NULL));
+    }
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL));
+    ASSERT_EQ(SQLITE_OK, sqlite3_close(db));
+  }
+
+  /**
+   * Opens the database through the read-only VFS and scans the table.
+   */
+  int64_t Scan(const string &mmap_pragma) {
+    int fd = open(db_path_.c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0);
+    sqlite3 *db;
+    EXPECT_EQ(SQLITE_OK, sqlite3_open_v2(("@" + StringifyInt(fd)).c_str(),
+                                         &db, SQLITE_OPEN_READONLY,
+                                         "cvmfs-readonly"));
+    EXPECT_EQ(SQLITE_OK,
+              sqlite3_exec(db, mmap_pragma.c_str(), NULL, NULL, NULL));
+    sqlite3_stmt *stmt;
+    EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db,
+      "SELECT sum(a) FROM t WHERE b LIKE 'row1%';", -1, &stmt, NULL));
+    EXPECT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    int64_t result = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    EXPECT_EQ(SQLITE_OK, sqlite3_close(db));
+    return result;
+  }
+
+  string tmp_path_;
+  string db_path_;
+  UniquePtr<PosixCacheManager> cache_mgr_;
+  perf::Statistics statistics_;
+};
+
+
+TEST_F(T_SqliteVfs, Mmap) {
+  perf::Counter *n_fetch = statistics_.Lookup("sqlite.n_fetch");
+  perf::Counter *no_open = statistics_.Lookup("sqlite.no_open");
+  ASSERT_TRUE(n_fetch != NULL);
+
+  const int64_t expected = Scan("PRAGMA mmap_size=0;");
+  EXPECT_GT(expected, 0);
+  EXPECT_EQ(0, n_fetch->Get());
+  EXPECT_EQ(0, no_open->Get());
+
+  EXPECT_EQ(expected, Scan("PRAGMA mmap_size=268435456;"));
+  EXPECT_GT(n_fetch->Get(), 0);
+  EXPECT_EQ(0, no_open->Get());
+
+  // Beyond the mmap limit, pages are read through the file descriptor
+  const int64_t n_fetch_full = n_fetch->Get();
+  n_fetch->Set(0);
+  EXPECT_EQ(expected, Scan("PRAGMA mmap_size=8192;"));
+  EXPECT_LT(n_fetch->Get(), n_fetch_full);
+}
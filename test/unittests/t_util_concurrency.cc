@@ -413,6 +413,12 @@ TEST(T_UtilConcurrency, Signal) {
     int retval = pthread_create(&thread_signal, NULL, MainSignal, &signal);
     assert(retval == 0);
     signal.Wait();
+    EXPECT_FALSE(signal.IsSleeping());
     pthread_join(thread_signal, NULL);
   }
+
+  Signal signal;
+  EXPECT_TRUE(signal.IsSleeping());
+  signal.Wakeup();
+  EXPECT_FALSE(signal.IsSleeping());
 }
@@ -320,8 +320,12 @@ void MockCatalog::RemoveChild(MockCatalog *child) {
 }
 
 MockCatalog* MockCatalog::FindSubtree(const PathString &path) {
+  PathString path_slash(path);
+  path_slash.Append("/", 1);
   for (unsigned i = 0; i < active_children_.size(); ++i) {
-    if (active_children_[i].mountpoint == path)
+    PathString mountpoint_slash(active_children_[i].mountpoint);
+    mountpoint_slash.Append("/", 1);
+    if (path_slash.StartsWith(mountpoint_slash))
       return active_children_[i].child;
   }
   return NULL;
@@ -394,6 +398,7 @@ void MockCatalog::AddChild(MockCatalog *child) {
   nested.child = child;
   nested.size = child->catalog_size();
   active_children_.push_back(nested);
+  child->set_parent(this);
 }
 
 void MockCatalog::AddFile(const shash::Any   &content_hash,
@@ -446,6 +451,8 @@ MockCatalog* catalog::MockCatalogManager::CreateCatalog(
 {
   map<PathString, MockCatalog*>::iterator it = catalog_map_.find(mountpoint);
   if (it != catalog_map_.end()) {
+    if (unloaded_catalogs_.erase(it->second) > 0)
+      it->second->set_parent(parent_catalog);
     return it->second;
   }
   bool is_root = parent_catalog == NULL;
@@ -453,6 +460,29 @@ MockCatalog* catalog::MockCatalogManager::CreateCatalog(
                          0, is_root, parent_catalog, NULL);
 }
 
+/**
+ * The catalog manager deletes detached catalogs.  A copy replaces the
+ * registered catalog, so that it can be mounted again.
+ */
+void catalog::MockCatalogManager::UnloadCatalog(const MockCatalog *catalog) {
+  map<PathString, MockCatalog*>::iterator it =
+    catalog_map_.find(catalog->mountpoint());
+  if ((it == catalog_map_.end()) || (it->second != catalog))
+    return;
+  MockCatalog *copy = new MockCatalog(*catalog);
+  it->second = copy;
+  unloaded_catalogs_.insert(copy);
+}
+
+
+catalog::MockCatalogManager::~MockCatalogManager() {
+  set<MockCatalog*>::const_iterator i = unloaded_catalogs_.begin();
+  for (; i != unloaded_catalogs_.end(); ++i)
+    delete *i;
+  delete spooler_;
+}
+
+
 catalog::LoadError catalog::MockCatalogManager::LoadCatalog(
                                                   const PathString &mountpoint,
                                                   const shash::Any &hash,
@@ -393,7 +393,7 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
     root_path_(root_path), catalog_hash_(catalog_hash),
     catalog_size_(catalog_size), revision_(revision),
     last_modified_(last_modified), is_root_(is_root),
-    owns_database_file_(false)
+    owns_database_file_(false), last_access_(0), cache_pages_(0)
   {
     if (this->catalog_hash_.IsNull()) {
       this->catalog_hash_.Randomize();
@@ -414,7 +414,9 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
     root_path_(other.root_path_), catalog_hash_(other.catalog_hash_),
     catalog_size_(other.catalog_size_), revision_(other.revision_),
     last_modified_(other.last_modified_), is_root_(other.is_root_),
-    owns_database_file_(false), active_children_(other.active_children_),
+    owns_database_file_(false), last_access_(0), cache_pages_(0),
+    inode_range_(other.inode_range_),
+    active_children_(other.active_children_),
     children_(other.children_), files_(other.files_),
     chunks_(other.chunks_)
   {
@@ -438,20 +440,29 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
     return children_arr;
   }
   bool HasParent() const { return parent_ != NULL; }
+  bool HasHardlinkInodes() const { return false; }
+  uint64_t GetMemoryUsage() const { return catalog_size_; }
+  uint64_t GetNumPages() const { return catalog_size_ / 1024 + 1; }
+  void SetCachePages(const unsigned num_pages) { cache_pages_ = num_pages; }
+  unsigned cache_pages() const { return cache_pages_; }
+  uint64_t last_access() const { return last_access_; }
+  void set_last_access(const uint64_t value) const { last_access_ = value; }
   /**
    * Removes a catalog from the already mounted catalog list
    * @param child catalog to be removed form the active catalog list
    */
   void RemoveChild(MockCatalog *child);
-  catalog::InodeRange inode_range() const { return catalog::InodeRange(); }
+  catalog::InodeRange inode_range() const { return inode_range_; }
   bool OpenDatabase(const std::string &db_path) {
     initialized_ = true;
     if (parent_ != NULL)
       parent_->AddChild(this);
     return true;
   }
-  uint64_t max_row_id() const { return std::numeric_limits<uint64_t>::max(); }
-  void set_inode_range(const catalog::InodeRange value) { }
+  uint64_t max_row_id() const { return files_.size(); }
+  void set_inode_range(const catalog::InodeRange value) {
+    inode_range_ = value;
+  }
   void SetInodeAnnotation(catalog::InodeAnnotation *new_annotation) { }
   void SetOwnerMaps(const catalog::OwnerMap *uid_map,
                     const catalog::OwnerMap *gid_map) { }
@@ -547,6 +558,9 @@ class MockCatalog : public MockObjectStorage<MockCatalog> {
   const time_t        last_modified_;
   const bool          is_root_;
   bool                owns_database_file_;
+  mutable uint64_t    last_access_;
+  unsigned            cache_pages_;
+  catalog::InodeRange inode_range_;
   NestedCatalogList   active_children_;
   NestedCatalogList   children_;
   FileList            files_;
@@ -570,7 +584,7 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
     max_weight_(5), min_weight_(1), balance_weight_(3),
     autogenerated_catalogs_(0), num_added_files_(0) { }
 
-  virtual ~MockCatalogManager() { delete spooler_; }
+  virtual ~MockCatalogManager();
 
   virtual LoadError LoadCatalog(const PathString &mountpoint,
                                 const shash::Any &hash,
@@ -581,6 +595,7 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
                                  const shash::Any  &catalog_hash,
                                  MockCatalog *parent_catalog);
   MockCatalog* RetrieveRootCatalog() { return GetRootCatalog(); }
+  virtual void UnloadCatalog(const MockCatalog *catalog);
   void AddFile(const DirectoryEntryBase &entry,
                const XattrList &xattrs,
                const std::string &parent_directory)
@@ -633,6 +648,10 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
 
   Spooler *spooler_;
   map<PathString, MockCatalog*> catalog_map_;
+  /**
+   * Copies of detached catalogs that have not been mounted again
+   */
+  set<MockCatalog*> unloaded_catalogs_;
   unsigned max_weight_;
   unsigned min_weight_;
   unsigned balance_weight_;